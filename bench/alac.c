@@ -0,0 +1,111 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Times encoding PCM to ALAC through one converter, then with
+ * wat4ff_alac_encode() and wat4ff_alac_decode() at 1, 2, 4 ... threads,
+ * and reports whether each run matched. test/alac.c checks it.
+ * Set WAT4FF_MOCK_PACKET_US to give the stand-in codec some work to do.
+ *
+ * wat4ff_bench_alac [seconds] [max threads] [batch packets]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate     = 44100,
+    kChannels = 2,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAlac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatAppleLossless,
+    .mChannelsPerFrame = kChannels,
+};
+
+static Digest
+encode_serial(const SInt16* pcm, UInt64 frames) {
+    Digest d = digest_new();
+    PcmSource src = { pcm, kChannels, frames, 0 };
+    encode_plain(&kPcm, &kAlac, NULL, 0, pcm_source_proc, &src, &d);
+    return d;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 600;
+    UInt32 max_threads = argc > 2 ? (UInt32)atoi(argv[2]) : 8;
+    UInt32 batch = argc > 3 ? (UInt32)atoi(argv[3]) : 0;
+
+    UInt64 frames = (UInt64)(seconds * kRate);
+    SInt16* pcm = malloc(frames * kPcm.mBytesPerFrame);
+    SInt16* back = malloc((frames + 4096) * kPcm.mBytesPerFrame);
+    for (UInt64 i = 0; i < frames * kChannels; ++i) pcm[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    int64_t t0 = bench_now_ns();
+    Digest serial = encode_serial(pcm, frames);
+    double t_serial = (bench_now_ns() - t0) / 1e9;
+    printf("input:        %.1f s, %llu frames, %llu packets\n",
+           seconds, (unsigned long long)frames, (unsigned long long)serial.packets);
+    printf("serial:       encode %.1fx realtime\n", seconds / t_serial);
+
+    double enc_one = 0, dec_one = 0;
+    for (UInt32 threads = 1; threads <= max_threads; threads *= 2) {
+        Wat4ffAlacJob job = {
+            .input = kPcm,
+            .output = kAlac,
+            .threads = threads,
+            .batchPackets = batch,
+        };
+        Wat4ffEncodedStream s;
+        t0 = bench_now_ns();
+        OSStatus rc = wat4ff_alac_encode(&job, pcm, frames, &s);
+        double t_enc = (bench_now_ns() - t0) / 1e9;
+        if (rc) {
+            fprintf(stderr, "encode failed on %u threads: %d\n", threads, (int)rc);
+            return 1;
+        }
+        Digest d = digest_packets(digest_new(), s.data, s.packets, s.packetCount);
+
+        // Packets passed on in order as batches complete, none kept.
+        Digest streamed = digest_new();
+        job.emit = digest_emit;
+        job.emitUser = &streamed;
+        rc = wat4ff_alac_encode(&job, pcm, frames, NULL);
+
+        job.input = kAlac;
+        job.output = kPcm;
+        job.emit = NULL;
+        UInt64 decoded = 0;
+        t0 = bench_now_ns();
+        rc |= wat4ff_alac_decode(&job, &s, back, &decoded);
+        double t_dec = (bench_now_ns() - t0) / 1e9;
+
+        bool same = digest_same(&d, &serial) && digest_same(&streamed, &serial);
+        bool lossless = !rc && decoded == frames && !memcmp(back, pcm, frames * kPcm.mBytesPerFrame);
+        if (threads == 1) {
+            enc_one = t_enc;
+            dec_one = t_dec;
+        }
+        printf("%2u threads:   encode %.1fx realtime %.2fx, decode %.1fx realtime %.2fx, %u batches, %s, %s\n",
+               threads, seconds / t_enc, enc_one / t_enc, seconds / t_dec, dec_one / t_dec, s.segments,
+               same ? "identical" : "DIFFERS", lossless ? "lossless" : "LOSSY");
+        wat4ff_free_encoded(&s);
+    }
+
+    free(back);
+    free(pcm);
+    return 0;
+}
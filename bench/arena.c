@@ -0,0 +1,162 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Runs many AAC encodes side by side, one packet per FillComplexBuffer
+ * call, round robin, the way a process serving many streams does. First
+ * each call mallocs and frees its output and descriptions, then each takes
+ * them from its converter's arena. Reports the time, the heap allocations
+ * and the arenas' peak and steady memory. Both must encode the same.
+ *
+ * wat4ff_bench_arena [streams] [seconds per stream]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate     = 22050,
+    kChannels = 1,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Stream {
+    AudioConverterRef conv;
+    UInt32 maxPacket;
+    UInt64 frames;
+    UInt64 pos;
+    UInt32 seed;
+    SInt16 buf[4096];
+    UInt64 hash;
+    bool done;
+}Stream;
+
+static OSStatus
+input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Stream* s = user;
+    UInt64 left = s->frames - s->pos;
+    UInt32 n = *packets < 4096 ? *packets : 4096;
+    if (n > left) n = (UInt32)left;
+    for (UInt32 i = 0; i < n; ++i) s->buf[i] = (SInt16)(((s->pos + i) * s->seed) >> 16);
+    s->pos += n;
+    *packets = n;
+    data->mBuffers[0].mData = s->buf;
+    data->mBuffers[0].mDataByteSize = n * kPcm.mBytesPerFrame;
+    data->mBuffers[0].mNumberChannels = kChannels;
+    return noErr;
+}
+
+static bool
+open_streams(Stream* s, UInt32 count, UInt64 frames) {
+    for (UInt32 i = 0; i < count; ++i) {
+        memset(&s[i], 0, sizeof(s[i]));
+        s[i].frames = frames;
+        s[i].seed = 2654435761u + i * 40503u;
+        s[i].hash = digest_new().hash;
+        if (AudioConverterNew(&kPcm, &kAac, &s[i].conv)) return false;
+        UInt32 size = sizeof(s[i].maxPacket);
+        AudioConverterGetProperty(s[i].conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &s[i].maxPacket);
+    }
+    return true;
+}
+
+static UInt64
+close_streams(Stream* s, UInt32 count) {
+    UInt64 h = 0;
+    for (UInt32 i = 0; i < count; ++i) {
+        h = h * 31 + s[i].hash;
+        AudioConverterDispose(s[i].conv);
+    }
+    return h;
+}
+
+// One packet per stream per round until all are done.
+static UInt64
+run(Stream* s, UInt32 count, bool arena, UInt64* mallocs) {
+    UInt32 live = count;
+    while (live) {
+        for (UInt32 i = 0; i < count; ++i) {
+            if (s[i].done) continue;
+            UInt32 n = 1;
+            Wat4ffPacketBuffer buf;
+            if (arena) {
+                wat4ff_arena_recycle(s[i].conv);
+                if (wat4ff_arena_acquire(s[i].conv, 1, &buf)) return 0;
+            }
+            else {
+                buf.dataSize = s[i].maxPacket;
+                buf.data = malloc(buf.dataSize);
+                buf.packets = malloc(sizeof(*buf.packets));
+                *mallocs += 2;
+            }
+            AudioBufferList list = { 1, { { kChannels, buf.dataSize, buf.data } } };
+            OSStatus rc = AudioConverterFillComplexBuffer(s[i].conv, input_proc, &s[i], &n, &list, buf.packets);
+            if (!rc && n) {
+                s[i].hash = fnv1a(s[i].hash, buf.data + buf.packets[0].mStartOffset, buf.packets[0].mDataByteSize);
+            }
+            else {
+                s[i].done = true;
+                --live;
+            }
+            if (!arena) {
+                free(buf.packets);
+                free(buf.data);
+            }
+        }
+    }
+    return 1;
+}
+
+int
+main(int argc, char** argv) {
+    UInt32 count = argc > 1 ? (UInt32)atoi(argv[1]) : 200;
+    double seconds = argc > 2 ? atof(argv[2]) : 10;
+    UInt64 frames = (UInt64)(seconds * kRate);
+    Stream* s = malloc(sizeof(Stream) * count);
+
+    if (!open_streams(s, count, frames)) return 1;
+    UInt64 mallocs = 0;
+    int64_t t0 = bench_now_ns();
+    run(s, count, false, &mallocs);
+    double t_heap = (bench_now_ns() - t0) / 1e9;
+    UInt64 h_heap = close_streams(s, count);
+    printf("streams:      %u x %.1f s\n", count, seconds);
+    printf("malloc/free:  %.3f s, %llu allocations\n", t_heap, (unsigned long long)mallocs);
+
+    if (!open_streams(s, count, frames)) return 1;
+    Wat4ffArenaStats before, after;
+    wat4ff_get_arena_stats(&before);
+    t0 = bench_now_ns();
+    bool ok = run(s, count, true, NULL);
+    double t_arena = (bench_now_ns() - t0) / 1e9;
+    wat4ff_get_arena_stats(&after);
+    UInt64 h_arena = close_streams(s, count);
+    Wat4ffArenaStats closed;
+    wat4ff_get_arena_stats(&closed);
+
+    ok = ok && h_heap == h_arena;
+    printf("arena:        %.3f s %.2fx, %llu allocations for %llu acquires, %s\n", t_arena, t_heap / t_arena,
+           (unsigned long long)(after.allocations - before.allocations),
+           (unsigned long long)(after.acquires - before.acquires), ok ? "identical" : "DIFFERS");
+    printf("memory:       peak %llu bytes, steady %llu bytes, %llu after dispose\n",
+           (unsigned long long)after.peakBytes, (unsigned long long)after.bytes, (unsigned long long)closed.bytes);
+    free(s);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Decodes AAC, AMR, ulaw and alaw one FillComplexBuffer call per packet,
+ * the way FFmpeg does, then with wat4ff_decode_batch() at batch sizes of 1
+ * to 1024 packets, and reports packets per second. Every run must decode
+ * to the same PCM as the per packet one.
+ * Set WAT4FF_MOCK_CALL_US to give every FillComplexBuffer call a cost.
+ *
+ * wat4ff_bench_batch [seconds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+
+
+enum {
+    kFill     = 64,
+    kMaxBatch = 1024,
+};
+
+typedef struct Codec {
+    const char* name;
+    AudioFormatID format;
+    Float64 rate;
+    UInt32 channels;
+    bool cbr;
+}Codec;
+
+static const Codec kCodecs[] = {
+    { "aac",  kAudioFormatMPEG4AAC, 44100, 2, false },
+    { "amr",  kAudioFormatAMR,       8000, 1, false },
+    { "ulaw", kAudioFormatULaw,      8000, 1, true  },
+    { "alaw", kAudioFormatALaw,      8000, 1, true  },
+};
+
+typedef struct Stream {
+    UInt8* data;
+    AudioStreamPacketDescription* packets;
+    UInt32 count;
+    UInt32 fpp;
+}Stream;
+
+typedef struct Source {
+    const SInt16* pcm;
+    UInt64 frames;
+    UInt64 pos;
+    UInt32 channels;
+}Source;
+
+typedef struct Single {
+    const Stream* s;
+    UInt32 next;
+    AudioStreamPacketDescription desc;
+}Single;
+
+static AudioStreamBasicDescription
+pcm_format(const Codec* c) {
+    AudioStreamBasicDescription fmt = {
+        .mSampleRate       = c->rate,
+        .mFormatID         = kAudioFormatLinearPCM,
+        .mFormatFlags      = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked,
+        .mBytesPerPacket   = c->channels * 2,
+        .mFramesPerPacket  = 1,
+        .mBytesPerFrame    = c->channels * 2,
+        .mChannelsPerFrame = c->channels,
+        .mBitsPerChannel   = 16,
+    };
+    return fmt;
+}
+
+static AudioStreamBasicDescription
+coded_format(const Codec* c) {
+    AudioStreamBasicDescription fmt = {
+        .mSampleRate       = c->rate,
+        .mFormatID         = c->format,
+        .mChannelsPerFrame = c->channels,
+    };
+    if (c->cbr) {
+        fmt.mBytesPerPacket = c->channels;
+        fmt.mFramesPerPacket = 1;
+        fmt.mBytesPerFrame = c->channels;
+        fmt.mBitsPerChannel = 8;
+    }
+    return fmt;
+}
+
+static OSStatus
+pcm_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+         AudioStreamPacketDescription** descs, void* user) {
+    Source* s = user;
+    UInt64 left = s->frames - s->pos;
+    if (*packets > left) *packets = (UInt32)left;
+    data->mBuffers[0].mData = (void*)(s->pcm + s->pos * s->channels);
+    data->mBuffers[0].mDataByteSize = *packets * s->channels * 2;
+    data->mBuffers[0].mNumberChannels = s->channels;
+    s->pos += *packets;
+    return noErr;
+}
+
+static bool
+encode(const Codec* c, const SInt16* pcm, UInt64 frames, Stream* out) {
+    AudioStreamBasicDescription in = pcm_format(c);
+    AudioStreamBasicDescription fmt = coded_format(c);
+    AudioConverterRef conv;
+    if (AudioConverterNew(&in, &fmt, &conv)) return false;
+
+    UInt32 max_packet = 0;
+    UInt32 size = sizeof(max_packet);
+    AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &max_packet);
+    size = sizeof(fmt);
+    AudioConverterGetProperty(conv, kAudioConverterCurrentOutputStreamDescription, &size, &fmt);
+    out->fpp = fmt.mFramesPerPacket;
+
+    // Room for the priming and padding packets, and a whole last fill.
+    UInt64 cap = frames / out->fpp + 2 * kFill;
+    out->data = malloc(cap * max_packet);
+    out->packets = malloc(cap * sizeof(*out->packets));
+    out->count = 0;
+    Source src = { pcm, frames, 0, c->channels };
+    UInt32 used = 0;
+    for (;;) {
+        UInt32 n = kFill;
+        AudioStreamPacketDescription descs[kFill];
+        AudioBufferList list = { 1, { { c->channels, max_packet * kFill, out->data + used } } };
+        if (AudioConverterFillComplexBuffer(conv, pcm_proc, &src, &n, &list, descs) || !n) break;
+        for (UInt32 i = 0; i < n; ++i) {
+            AudioStreamPacketDescription d = c->cbr ? (AudioStreamPacketDescription){ i * c->channels, 0, c->channels } : descs[i];
+            d.mStartOffset += used;
+            out->packets[out->count++] = d;
+        }
+        used += list.mBuffers[0].mDataByteSize;
+    }
+    AudioConverterDispose(conv);
+    return out->count > 0;
+}
+
+static OSStatus
+single_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    Single* p = user;
+    if (p->next >= p->s->count) {
+        *packets = 0;
+        return noErr;
+    }
+    p->desc = p->s->packets[p->next++];
+    data->mBuffers[0].mData = p->s->data + p->desc.mStartOffset;
+    data->mBuffers[0].mDataByteSize = p->desc.mDataByteSize;
+    p->desc.mStartOffset = 0;
+    if (descs) *descs = &p->desc;
+    *packets = 1;
+    return noErr;
+}
+
+static AudioConverterRef
+new_decoder(const Codec* c) {
+    AudioStreamBasicDescription in = coded_format(c);
+    AudioStreamBasicDescription out = pcm_format(c);
+    AudioConverterRef conv;
+    return AudioConverterNew(&in, &out, &conv) ? NULL : conv;
+}
+
+// One packet's worth of output per call, as FFmpeg asks for it.
+static UInt64
+decode_single(const Codec* c, const Stream* s, SInt16* pcm) {
+    AudioConverterRef conv = new_decoder(c);
+    if (!conv) return 0;
+    Single p = { s, 0 };
+    UInt64 got = 0;
+    for (;;) {
+        UInt32 n = s->fpp;
+        AudioBufferList list = { 1, { { c->channels, n * c->channels * 2, pcm + got * c->channels } } };
+        if (AudioConverterFillComplexBuffer(conv, single_proc, &p, &n, &list, NULL) || !n) break;
+        got += n;
+    }
+    AudioConverterDispose(conv);
+    return got;
+}
+
+static UInt64
+decode_batched(const Codec* c, const Stream* s, UInt32 batch, SInt16* pcm) {
+    AudioConverterRef conv = new_decoder(c);
+    if (!conv) return 0;
+    UInt64 got = 0;
+    for (UInt32 first = 0; first < s->count; first += batch) {
+        UInt32 n = s->count - first < batch ? s->count - first : batch;
+        const AudioStreamPacketDescription* d = &s->packets[first];
+        Wat4ffPacketBatch b = {
+            c->cbr ? s->data + d->mStartOffset : s->data,
+            c->cbr ? NULL : d,
+            n, 0, first + n == s->count,
+        };
+        for (;;) {
+            UInt32 room = (n + 1) * s->fpp;
+            UInt32 frames = room;
+            AudioBufferList list = { 1, { { c->channels, room * c->channels * 2, pcm + got * c->channels } } };
+            if (wat4ff_decode_batch(conv, &b, &list, &frames)) {
+                AudioConverterDispose(conv);
+                return 0;
+            }
+            got += frames;
+            if (frames < room) break;
+        }
+    }
+    AudioConverterDispose(conv);
+    return got;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 60;
+    bool ok = true;
+
+    for (size_t k = 0; k < sizeof(kCodecs) / sizeof(kCodecs[0]) && ok; ++k) {
+        const Codec* c = &kCodecs[k];
+        UInt64 frames = (UInt64)(seconds * c->rate);
+        SInt16* pcm = malloc(frames * c->channels * 2);
+        for (UInt64 i = 0; i < frames * c->channels; ++i) pcm[i] = (SInt16)((i * 2654435761u) >> 16);
+
+        Stream s;
+        if (!encode(c, pcm, frames, &s)) {
+            fprintf(stderr, "%s: encode failed\n", c->name);
+            return 1;
+        }
+        UInt64 cap = ((UInt64)s.count + kMaxBatch + 1) * s.fpp;
+        SInt16* single = malloc(cap * c->channels * 2);
+        SInt16* batched = malloc(cap * c->channels * 2);
+
+        int64_t t0 = bench_now_ns();
+        UInt64 single_frames = decode_single(c, &s, single);
+        double t_single = (bench_now_ns() - t0) / 1e9;
+        printf("%-5s %u packets\n", c->name, s.count);
+        printf("  per packet:  %10.0f packets/s\n", s.count / t_single);
+
+        for (UInt32 batch = 1; batch <= kMaxBatch && ok; batch *= 4) {
+            t0 = bench_now_ns();
+            UInt64 got = decode_batched(c, &s, batch, batched);
+            double t = (bench_now_ns() - t0) / 1e9;
+            bool same = got == single_frames && !memcmp(batched, single, got * c->channels * 2);
+            printf("  batch %4u:  %10.0f packets/s %6.2fx, %s\n",
+                   batch, s.count / t, t_single / t, same ? "identical" : "DIFFERS");
+            ok = same;
+        }
+
+        free(batched);
+        free(single);
+        free(s.packets);
+        free(s.data);
+        free(pcm);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Tiny helpers shared by the benchmarks.
+*/
+
+#ifndef WAT4FF_BENCH_H
+#define WAT4FF_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+
+static inline int64_t
+bench_now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (int64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void
+bench_sleep_ms(unsigned ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+typedef void (* BenchThreadProc)(void*);
+
+typedef struct BenchThread {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    BenchThreadProc proc;
+    void* arg;
+}BenchThread;
+
+#ifdef _WIN32
+static DWORD WINAPI
+bench_thread_main(LPVOID p) {
+    BenchThread* t = p;
+    t->proc(t->arg);
+    return 0;
+}
+#else
+static void*
+bench_thread_main(void* p) {
+    BenchThread* t = p;
+    t->proc(t->arg);
+    return NULL;
+}
+#endif
+
+// t must stay alive until bench_thread_join().
+static inline bool
+bench_thread_start(BenchThread* t, BenchThreadProc proc, void* arg) {
+    t->proc = proc;
+    t->arg = arg;
+#ifdef _WIN32
+    t->handle = CreateThread(NULL, 0, bench_thread_main, t, 0, NULL);
+    return t->handle != NULL;
+#else
+    return pthread_create(&t->handle, NULL, bench_thread_main, t) == 0;
+#endif
+}
+
+static inline void
+bench_thread_join(BenchThread* t) {
+#ifdef _WIN32
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#else
+    pthread_join(t->handle, NULL);
+#endif
+}
+
+// User plus kernel time of the whole process.
+static inline int64_t
+bench_cpu_ns(void) {
+#ifdef _WIN32
+    FILETIME c, e, k, u;
+    GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u);
+    ULARGE_INTEGER kk = { .LowPart = k.dwLowDateTime, .HighPart = k.dwHighDateTime };
+    ULARGE_INTEGER uu = { .LowPart = u.dwLowDateTime, .HighPart = u.dwHighDateTime };
+    return (int64_t)(kk.QuadPart + uu.QuadPart) * 100;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Process start-to-exit time of a program that only loads CoreAudioToolbox,
+ * with the library path cache disabled and enabled. The cache is Windows
+ * only, elsewhere there is nothing to compare and just the time is given.
+ *
+ *   wat4ff_bench_coldstart [runs]   compare both, runs processes each
+ *   wat4ff_bench_coldstart --load   load once and print the probe timing
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wat4ff.h>
+
+#include "bench.h"
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+
+static const char* const kProbeNames[kWat4ffProbeCount] = {
+    "override", "portable", "cache", "itunes", "appmodel", "system", "host",
+};
+
+static int
+child_main(bool verbose) {
+    OSStatus rc = wat4ff_preload();
+    if (!verbose) return rc == noErr ? 0 : 1;
+
+    Wat4ffLoadTiming t;
+    if (!wat4ff_get_load_timing(&t)) return 1;
+    printf("loaded:       %s (%s)\n", t.loaded ? "yes" : "no", t.source >= 0 ? kProbeNames[t.source] : "-");
+    for (int i = 0; i < kWat4ffProbeCount; ++i) {
+        printf("%-9s     probe %.3f ms, load %.3f ms\n", kProbeNames[i], t.probeNanos[i] / 1e6, t.loadLibraryNanos[i] / 1e6);
+    }
+    printf("resolve:      %.3f ms\n", t.resolveNanos / 1e6);
+    printf("total:        %.3f ms\n", t.totalNanos / 1e6);
+    return rc == noErr ? 0 : 1;
+}
+
+static bool
+run_child(const char* self) {
+#ifdef _WIN32
+    wchar_t path[MAX_PATH];
+    wchar_t cmd[MAX_PATH + 16];
+    if (!GetModuleFileNameW(NULL, path, MAX_PATH)) return false;
+    swprintf(cmd, MAX_PATH + 16, L"\"%ls\" --child", path);
+
+    STARTUPINFOW si = { .cb = sizeof(si) };
+    PROCESS_INFORMATION pi;
+    if (!CreateProcessW(path, cmd, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) return false;
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD code = 1;
+    GetExitCodeProcess(pi.hProcess, &code);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return code == 0;
+#else
+    char* argv[] = { (char*)self, "--child", NULL };
+    pid_t pid;
+    if (posix_spawn(&pid, self, NULL, NULL, argv, environ)) return false;
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+static void
+set_cache_enabled(bool enabled) {
+#ifdef _WIN32
+    SetEnvironmentVariableA("WAT4FF_LIB_CACHE", enabled ? NULL : "0");
+#else
+    if (enabled) unsetenv("WAT4FF_LIB_CACHE");
+    else setenv("WAT4FF_LIB_CACHE", "0", 1);
+#endif
+}
+
+static double
+measure(const char* self, int runs, bool cache, int* failed) {
+    set_cache_enabled(cache);
+    // One unmeasured run, so the cache is populated and the file cache warm.
+    run_child(self);
+
+    int64_t t0 = bench_now_ns();
+    for (int i = 0; i < runs; ++i) {
+        if (!run_child(self)) ++*failed;
+    }
+    return (bench_now_ns() - t0) / 1e6 / runs;
+}
+
+int
+main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "--child")) return child_main(false);
+    if (argc > 1 && !strcmp(argv[1], "--load")) return child_main(true);
+
+    int runs = argc > 1 ? atoi(argv[1]) : 50;
+    if (runs < 1) runs = 1;
+
+    int failed = 0;
+#ifdef _WIN32
+    double off = measure(argv[0], runs, false, &failed);
+    double on = measure(argv[0], runs, true, &failed);
+
+    printf("runs:         %d each (%d failed loads)\n", runs, failed);
+    printf("cache off:    %.3f ms/process\n", off);
+    printf("cache on:     %.3f ms/process\n", on);
+#else
+    double ms = measure(argv[0], runs, true, &failed);
+
+    printf("runs:         %d (%d failed loads)\n", runs, failed);
+    printf("process:      %.3f ms/process, no path cache off Windows\n", ms);
+#endif
+    return 0;
+}
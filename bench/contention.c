@@ -0,0 +1,102 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * N threads call AudioConverterNew at the same instant on a cold process,
+ * so all but one of them wait for the library load. Reports how long each
+ * waiter took and how much CPU the process burnt meanwhile; sleeping
+ * waiters should cost next to nothing.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "bench.h"
+
+
+enum {
+    kMaxThreads = 256,
+};
+
+typedef struct Worker {
+    BenchThread thread;
+    int64_t latency_ns;
+    OSStatus status;
+}Worker;
+
+static volatile int go_ = 0;
+
+static void
+worker_main(void* arg) {
+    Worker* w = arg;
+    AudioStreamBasicDescription in = {
+        .mSampleRate       = 44100,
+        .mFormatID         = kAudioFormatLinearPCM,
+        .mFormatFlags      = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked,
+        .mBytesPerPacket   = 4,
+        .mFramesPerPacket  = 1,
+        .mBytesPerFrame    = 4,
+        .mChannelsPerFrame = 2,
+        .mBitsPerChannel   = 16,
+    };
+    AudioStreamBasicDescription out = {
+        .mSampleRate       = 44100,
+        .mFormatID         = kAudioFormatMPEG4AAC,
+        .mFramesPerPacket  = 1024,
+        .mChannelsPerFrame = 2,
+    };
+    AudioConverterRef conv = NULL;
+
+    while (!go_) {}
+    int64_t t0 = bench_now_ns();
+    w->status = AudioConverterNew(&in, &out, &conv);
+    w->latency_ns = bench_now_ns() - t0;
+    if (w->status == noErr) AudioConverterDispose(conv);
+}
+
+static int
+cmp_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int
+main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 16;
+    if (n < 1) n = 1;
+    if (n > kMaxThreads) n = kMaxThreads;
+
+    static Worker workers[kMaxThreads];
+    for (int i = 0; i < n; ++i) {
+        if (!bench_thread_start(&workers[i].thread, worker_main, &workers[i])) {
+            fprintf(stderr, "cannot start thread %d\n", i);
+            return 1;
+        }
+    }
+
+    int64_t cpu0 = bench_cpu_ns();
+    int64_t t0 = bench_now_ns();
+    go_ = 1;
+    for (int i = 0; i < n; ++i) bench_thread_join(&workers[i].thread);
+    int64_t wall = bench_now_ns() - t0;
+    int64_t cpu = bench_cpu_ns() - cpu0;
+
+    int64_t lat[kMaxThreads];
+    int failed = 0;
+    for (int i = 0; i < n; ++i) {
+        lat[i] = workers[i].latency_ns;
+        if (workers[i].status != noErr) ++failed;
+    }
+    qsort(lat, n, sizeof(*lat), cmp_i64);
+
+    printf("threads:      %d (%d failed, status %d)\n", n, failed, (int)workers[0].status);
+    printf("wall:         %.3f ms\n", wall / 1e6);
+    printf("cpu:          %.3f ms\n", cpu / 1e6);
+    printf("latency min:  %.3f ms\n", lat[0] / 1e6);
+    printf("latency p50:  %.3f ms\n", lat[n / 2] / 1e6);
+    printf("latency max:  %.3f ms\n", lat[n - 1] / 1e6);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes PCM to AAC, then times decoding it through one converter and
+ * with wat4ff_decode_parallel() at 1, 2, 4 ... threads, and reports
+ * whether each run matched. test/decode.c checks it.
+ * Set WAT4FF_MOCK_PACKET_US to give the stand-in codec some work to do.
+ *
+ * wat4ff_bench_decode [seconds] [max threads] [preroll packets]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate     = 44100,
+    kChannels = 2,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Packets {
+    const Wat4ffEncodedStream* s;
+    UInt64 next;
+    AudioStreamPacketDescription desc;
+}Packets;
+
+static OSStatus
+packet_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    Packets* p = user;
+    if (p->next >= p->s->packetCount) {
+        *packets = 0;
+        return noErr;
+    }
+    p->desc = p->s->packets[p->next++];
+    data->mBuffers[0].mData = p->s->data + p->desc.mStartOffset;
+    data->mBuffers[0].mDataByteSize = p->desc.mDataByteSize;
+    p->desc.mStartOffset = 0;
+    if (descs) *descs = &p->desc;
+    *packets = 1;
+    return noErr;
+}
+
+// Decodes s the way a single ffmpeg process would, into pcm.
+static UInt64
+decode_serial(const Wat4ffEncodedStream* s, SInt16* pcm) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kAac, &kPcm, &conv)) return 0;
+    if (s->magicCookieSize) {
+        AudioConverterSetProperty(conv, kAudioConverterDecompressionMagicCookie, s->magicCookieSize, s->magicCookie);
+    }
+
+    UInt64 cap = s->packetCount * s->framesPerPacket;
+    UInt64 got = 0;
+    Packets p = { s, 0 };
+    while (got < cap) {
+        UInt32 n = cap - got < 4096 ? (UInt32)(cap - got) : 4096;
+        AudioBufferList list = { 1, { { kChannels, n * kPcm.mBytesPerFrame, pcm + got * kChannels } } };
+        if (AudioConverterFillComplexBuffer(conv, packet_proc, &p, &n, &list, NULL) || !n) break;
+        got += n;
+    }
+    AudioConverterDispose(conv);
+    return got;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 600;
+    UInt32 max_threads = argc > 2 ? (UInt32)atoi(argv[2]) : 8;
+    UInt32 preroll = argc > 3 ? (UInt32)atoi(argv[3]) : 0;
+
+    UInt64 frames = (UInt64)(seconds * kRate);
+    SInt16* pcm = malloc(frames * kPcm.mBytesPerFrame);
+    for (UInt64 i = 0; i < frames * kChannels; ++i) pcm[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    Wat4ffParallelEncode enc = { .input = kPcm, .output = kAac };
+    Wat4ffEncodedStream s;
+    if (wat4ff_encode_parallel(&enc, pcm, frames, &s)) {
+        fprintf(stderr, "encode failed\n");
+        return 1;
+    }
+    free(pcm);
+
+    UInt64 cap = s.packetCount * s.framesPerPacket;
+    SInt16* serial = malloc(cap * kPcm.mBytesPerFrame);
+    SInt16* parallel = malloc(cap * kPcm.mBytesPerFrame);
+    int64_t t0 = bench_now_ns();
+    UInt64 serial_frames = decode_serial(&s, serial);
+    double t_serial = (bench_now_ns() - t0) / 1e9;
+    printf("input:        %.1f s, %llu packets\n", seconds, (unsigned long long)s.packetCount);
+    printf("serial:       %.1fx realtime, %llu frames\n", seconds / t_serial, (unsigned long long)serial_frames);
+
+    for (UInt32 threads = 1; threads <= max_threads; threads *= 2) {
+        Wat4ffParallelDecode job = {
+            .input = kAac,
+            .output = kPcm,
+            .threads = threads,
+            .prerollPackets = preroll,
+        };
+        memset(parallel, 0, cap * kPcm.mBytesPerFrame);
+        UInt64 got = 0;
+        t0 = bench_now_ns();
+        OSStatus rc = wat4ff_decode_parallel(&job, &s, parallel, &got);
+        double t = (bench_now_ns() - t0) / 1e9;
+
+        bool same = !rc && got == serial_frames && !memcmp(parallel, serial, got * kPcm.mBytesPerFrame);
+        printf("%2u threads:   %.1fx realtime %.2fx, %s\n",
+               threads, seconds / t, t_serial / t, same ? "sample exact" : "DIFFERS");
+    }
+
+    free(parallel);
+    free(serial);
+    wat4ff_free_encoded(&s);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Per-call dispatch overhead of the exported trampolines.
+ *
+ * "flag" is the old scheme: every call tests a volatile loaded flag, then
+ * jumps through the function pointer.
+ * "resolve-once" is the current scheme: every call jumps through a pointer
+ * that was swapped from a resolver stub to the real entry on first use.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+
+typedef int (* TargetProc)(void* p1, int p2);
+
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE
+#endif
+
+static NOINLINE int
+target(void* p1, int p2) {
+    return p2 + (p1 != NULL);
+}
+
+static volatile long flag_loaded_ = 0;
+static TargetProc volatile flag_proc_ = NULL;
+
+static NOINLINE void
+flag_load(void) {
+    flag_proc_ = target;
+    flag_loaded_ = 1;
+}
+
+static NOINLINE int
+flag_trampoline(void* p1, int p2) {
+    if (!flag_loaded_) {
+        flag_load();
+        if (!flag_loaded_) return -1;
+    }
+    return flag_proc_(p1, p2);
+}
+
+static int resolver(void* p1, int p2);
+static TargetProc volatile once_proc_ = resolver;
+
+static NOINLINE int
+resolver(void* p1, int p2) {
+    once_proc_ = target;
+    return once_proc_(p1, p2);
+}
+
+static NOINLINE int
+once_trampoline(void* p1, int p2) {
+    return once_proc_(p1, p2);
+}
+
+static double
+run(TargetProc fn, long iters) {
+    int acc = 0;
+    int64_t t0 = bench_now_ns();
+    for (long i = 0; i < iters; ++i) acc = fn(&acc, acc);
+    int64_t t1 = bench_now_ns();
+    if (acc == -1) puts("");
+    return (double)(t1 - t0) / (double)iters;
+}
+
+int
+main(int argc, char** argv) {
+    long iters = argc > 1 ? atol(argv[1]) : 100000000L;
+    if (iters <= 0) iters = 1;
+
+    // Warm both up, the first call of each goes through its load path.
+    run(flag_trampoline, 1000);
+    run(once_trampoline, 1000);
+
+    double best_flag = 1e30, best_once = 1e30;
+    for (int round = 0; round < 5; ++round) {
+        double f = run(flag_trampoline, iters);
+        double o = run(once_trampoline, iters);
+        if (f < best_flag) best_flag = f;
+        if (o < best_once) best_once = o;
+    }
+
+    printf("iterations:   %ld x 5 rounds, best round\n", iters);
+    printf("flag:         %.3f ns/call\n", best_flag);
+    printf("resolve-once: %.3f ns/call\n", best_once);
+    printf("saved:        %.3f ns/call\n", best_flag - best_once);
+    return 0;
+}
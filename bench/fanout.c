@@ -0,0 +1,178 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes the same PCM to a ladder of AAC renditions one after another,
+ * each through its own converter, then all at once with
+ * wat4ff_encode_fanout(). Every rendition must come out the same both ways.
+ * The read proc costs read_us per 1024 frames, standing in for the decode
+ * and resampling the ladder would otherwise repeat per rendition.
+ * Set WAT4FF_MOCK_PACKET_US to give the stand-in codec some work to do.
+ *
+ * wat4ff_bench_fanout [seconds] [read_us] [ring frames]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate       = 44100,
+    kChannels   = 2,
+    kRenditions = 5,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const struct {
+    AudioFormatID format;
+    UInt32 bitRate;
+} kLadder[kRenditions] = {
+    { kAudioFormatMPEG4AAC,       256000 },
+    { kAudioFormatMPEG4AAC,       128000 },
+    { kAudioFormatMPEG4AAC,        96000 },
+    { kAudioFormatMPEG4AAC_HE,     64000 },
+    { kAudioFormatMPEG4AAC_HE_V2,  32000 },
+};
+
+typedef struct Source {
+    const SInt16* pcm;
+    UInt64 frames;
+    UInt64 pos;
+    long readUs;
+}Source;
+
+static void
+spin_us(long us) {
+    int64_t until = bench_now_ns() + (int64_t)us * 1000;
+    while (bench_now_ns() < until) {}
+}
+
+// Copies out the next frames, paying for them as a decoder would.
+static UInt32
+read_source(Source* s, void* buf, UInt32 frames) {
+    UInt64 left = s->frames - s->pos;
+    if (frames > left) frames = (UInt32)left;
+    memcpy(buf, s->pcm + s->pos * kChannels, (size_t)frames * kPcm.mBytesPerFrame);
+    s->pos += frames;
+    spin_us((long)((SInt64)s->readUs * frames / 1024));
+    return frames;
+}
+
+static OSStatus
+read_proc(void* user, void* buf, UInt32* frames) {
+    *frames = read_source(user, buf, *frames);
+    return noErr;
+}
+
+typedef struct Serial {
+    Source* src;
+    SInt16 buf[1024 * kChannels];
+}Serial;
+
+static OSStatus
+input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Serial* s = user;
+    if (*packets > 1024) *packets = 1024;
+    *packets = read_source(s->src, s->buf, *packets);
+    data->mBuffers[0].mData = s->buf;
+    data->mBuffers[0].mDataByteSize = *packets * kPcm.mBytesPerFrame;
+    data->mBuffers[0].mNumberChannels = kChannels;
+    return noErr;
+}
+
+static AudioStreamBasicDescription
+rendition_format(int i) {
+    AudioStreamBasicDescription fmt = {
+        .mSampleRate       = kRate,
+        .mFormatID         = kLadder[i].format,
+        .mChannelsPerFrame = kChannels,
+    };
+    return fmt;
+}
+
+// One rendition the way a single ffmpeg process would do it, reading and
+// paying for the input again.
+static Digest
+encode_serial(int i, Source* src) {
+    Digest d = digest_new();
+    AudioStreamBasicDescription fmt = rendition_format(i);
+    Wat4ffConverterProperty prop = { kAudioConverterEncodeBitRate, sizeof(UInt32), &kLadder[i].bitRate };
+    Serial* s = malloc(sizeof(*s));
+    s->src = src;
+    encode_plain(&kPcm, &fmt, &prop, 1, input_proc, s, &d);
+    free(s);
+    return d;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 300;
+    long read_us = argc > 2 ? atol(argv[2]) : 20;
+    UInt32 ring = argc > 3 ? (UInt32)atoi(argv[3]) : 0;
+
+    UInt64 frames = (UInt64)(seconds * kRate);
+    SInt16* pcm = malloc(frames * kPcm.mBytesPerFrame);
+    for (UInt64 i = 0; i < frames * kChannels; ++i) pcm[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    Digest serial[kRenditions];
+    double t_sum = 0, t_max = 0;
+    for (int i = 0; i < kRenditions; ++i) {
+        Source src = { pcm, frames, 0, read_us };
+        int64_t t0 = bench_now_ns();
+        serial[i] = encode_serial(i, &src);
+        double t = (bench_now_ns() - t0) / 1e9;
+        t_sum += t;
+        if (t > t_max) t_max = t;
+    }
+    printf("input:        %.1f s, %llu frames, %d renditions\n",
+           seconds, (unsigned long long)frames, kRenditions);
+    printf("one by one:   %.2f s, slowest rendition %.2f s\n", t_sum, t_max);
+
+    Wat4ffConverterProperty props[kRenditions];
+    Wat4ffRendition renditions[kRenditions];
+    for (int i = 0; i < kRenditions; ++i) {
+        props[i] = (Wat4ffConverterProperty){ kAudioConverterEncodeBitRate, sizeof(UInt32), &kLadder[i].bitRate };
+        renditions[i] = (Wat4ffRendition){ .output = rendition_format(i), .properties = &props[i], .propertyCount = 1 };
+    }
+    Source src = { pcm, frames, 0, read_us };
+    Wat4ffFanOut job = {
+        .input = kPcm,
+        .renditions = renditions,
+        .renditionCount = kRenditions,
+        .ringFrames = ring,
+        .read = read_proc,
+        .readUser = &src,
+    };
+    Wat4ffEncodedStream outs[kRenditions];
+    int64_t t0 = bench_now_ns();
+    OSStatus rc = wat4ff_encode_fanout(&job, outs);
+    double t_fan = (bench_now_ns() - t0) / 1e9;
+    if (rc) {
+        fprintf(stderr, "fan-out failed: %d\n", (int)rc);
+        return 1;
+    }
+    printf("fan-out:      %.2f s, %.2fx one by one, %.2fx slowest\n", t_fan, t_sum / t_fan, t_max / t_fan);
+
+    bool ok = true;
+    for (int i = 0; i < kRenditions; ++i) {
+        Digest d = digest_packets(digest_new(), outs[i].data, outs[i].packets, outs[i].packetCount);
+        bool same = digest_same(&d, &serial[i]) && d.packets > 0;
+        printf("rendition %d:  %6u bps, %llu packets, %s\n", i, (unsigned)kLadder[i].bitRate,
+               (unsigned long long)d.packets, same ? "identical" : "DIFFERS");
+        ok = ok && same;
+        wat4ff_free_encoded(&outs[i]);
+    }
+
+    free(pcm);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,320 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Many encoder processes at once, as many ffmpeg instances would be, first
+ * each loading CoreAudioToolbox itself, then all sharing one wat4ff host.
+ * Every client thread encodes, reads back the magic cookie and decodes what
+ * it encoded. Reports throughput, time from process start to first packet
+ * and resident memory, and checks that hosted output matches. Unless set in
+ * the environment, the mock loads and stays resident roughly as the real
+ * library does.
+ *
+ * wat4ff_bench_host [clients] [streams] [threads]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate       = 44100,
+    kChannels   = 2,
+    kFrames     = kRate * 10,
+    kMaxPackets = kFrames / 1024 + 8,
+    kMaxClients = 64,
+    kMaxThreads = 8,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+typedef struct Result {
+    bool ok;
+    SInt32 source;
+    int64_t firstPacketNs;      // Since the fork
+    long residentKb;
+    UInt64 hash;
+}Result;
+
+typedef struct Source {
+    const SInt16* pcm;
+    UInt32 pos;
+}Source;
+
+typedef struct Packets {
+    UInt8 data[kMaxPackets * 4096];
+    UInt32 size;
+    AudioStreamPacketDescription descs[kMaxPackets];
+    UInt32 count;
+    UInt32 next;
+    AudioStreamPacketDescription current;
+}Packets;
+
+typedef struct Worker {
+    BenchThread thread;
+    UInt32 streams;
+    int64_t firstPacket;
+    UInt64 hash;
+    bool ok;
+    Packets packets;
+}Worker;
+
+static SInt16 pcm_[kFrames * kChannels];
+
+static OSStatus
+pcm_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+         AudioStreamPacketDescription** descs, void* user) {
+    Source* s = user;
+    UInt32 left = kFrames - s->pos;
+    if (*packets > left) *packets = left;
+    data->mBuffers[0].mData = (void*)(s->pcm + s->pos * kChannels);
+    data->mBuffers[0].mDataByteSize = *packets * kPcm.mBytesPerFrame;
+    data->mBuffers[0].mNumberChannels = kChannels;
+    s->pos += *packets;
+    return noErr;
+}
+
+// One packet per call, as a demuxer would hand them over.
+static OSStatus
+packet_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    Packets* p = user;
+    if (p->next == p->count) {
+        *packets = 0;
+        return noErr;
+    }
+    const AudioStreamPacketDescription* d = &p->descs[p->next++];
+    *packets = 1;
+    data->mBuffers[0].mData = p->data + d->mStartOffset;
+    data->mBuffers[0].mDataByteSize = d->mDataByteSize;
+    data->mBuffers[0].mNumberChannels = kChannels;
+    p->current = (AudioStreamPacketDescription){ 0, d->mVariableFramesInPacket, d->mDataByteSize };
+    if (descs) *descs = &p->current;
+    return noErr;
+}
+
+static bool
+encode(Worker* w, AudioStreamBasicDescription* aac, UInt64* h) {
+    AudioConverterRef conv;
+    *aac = (AudioStreamBasicDescription){ .mSampleRate = kRate, .mFormatID = kAudioFormatMPEG4AAC, .mChannelsPerFrame = kChannels };
+    UInt32 size = sizeof(*aac);
+    if (AudioFormatGetProperty(kAudioFormatProperty_FormatInfo, 0, NULL, &size, aac)) return false;
+    if (AudioConverterNew(&kPcm, aac, &conv)) return false;
+    UInt32 rate = 128000;
+    bool ok = !AudioConverterSetProperty(conv, kAudioConverterEncodeBitRate, sizeof(rate), &rate);
+
+    Source src = { pcm_, 0 };
+    Packets* p = &w->packets;
+    p->size = p->count = p->next = 0;
+    while (ok) {
+        UInt8 buf[16384];
+        AudioStreamPacketDescription descs[16];
+        UInt32 n = 16;
+        AudioBufferList list = { 1, { { kChannels, sizeof(buf), buf } } };
+        if (AudioConverterFillComplexBuffer(conv, pcm_proc, &src, &n, &list, descs)) ok = false;
+        if (!ok || !n) break;
+        if (!w->firstPacket) w->firstPacket = bench_now_ns();
+        for (UInt32 i = 0; i < n && p->count < kMaxPackets; ++i) {
+            if (p->size + descs[i].mDataByteSize > sizeof(p->data)) break;
+            memcpy(p->data + p->size, buf + descs[i].mStartOffset, descs[i].mDataByteSize);
+            p->descs[p->count] = descs[i];
+            p->descs[p->count++].mStartOffset = p->size;
+            p->size += descs[i].mDataByteSize;
+            *h = fnv1a(*h, buf + descs[i].mStartOffset, descs[i].mDataByteSize);
+        }
+    }
+
+    Boolean writable;
+    if (ok && !AudioConverterGetPropertyInfo(conv, kAudioConverterCompressionMagicCookie, &size, &writable)) {
+        UInt8 cookie[256];
+        if (size > sizeof(cookie)) size = sizeof(cookie);
+        ok = !AudioConverterGetProperty(conv, kAudioConverterCompressionMagicCookie, &size, cookie);
+        *h = fnv1a(*h, cookie, size);
+    }
+    AudioConverterDispose(conv);
+    return ok;
+}
+
+static bool
+decode(Worker* w, const AudioStreamBasicDescription* aac, UInt64* h) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(aac, &kPcm, &conv)) return false;
+    bool ok = true;
+    Packets* p = &w->packets;
+    for (;;) {
+        SInt16 buf[4096 * kChannels];
+        UInt32 n = 4096;
+        AudioBufferList list = { 1, { { kChannels, sizeof(buf), buf } } };
+        if (AudioConverterFillComplexBuffer(conv, packet_proc, p, &n, &list, NULL)) ok = false;
+        if (!ok || !n) break;
+        *h = fnv1a(*h, buf, n * kPcm.mBytesPerFrame);
+    }
+    AudioConverterDispose(conv);
+    return ok;
+}
+
+static void
+worker_main(void* param) {
+    Worker* w = param;
+    w->hash = digest_new().hash;
+    w->ok = true;
+    for (UInt32 i = 0; i < w->streams && w->ok; ++i) {
+        AudioStreamBasicDescription aac;
+        w->ok = encode(w, &aac, &w->hash) && decode(w, &aac, &w->hash);
+    }
+}
+
+static long
+resident_kb(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/status", (long)pid);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+static Result
+client_main(const char* host, UInt32 streams, UInt32 threads, int64_t forked) {
+    Result r = { .source = -1 };
+    if (host && wat4ff_host_configure(host)) return r;
+
+    static Worker w[kMaxThreads];
+    for (UInt32 i = 0; i < threads; ++i) {
+        w[i].streams = streams;
+        bench_thread_start(&w[i].thread, worker_main, &w[i]);
+    }
+    r.ok = true;
+    for (UInt32 i = 0; i < threads; ++i) {
+        bench_thread_join(&w[i].thread);
+        r.ok = r.ok && w[i].ok && w[i].hash == w[0].hash;
+    }
+    r.firstPacketNs = w[0].firstPacket - forked;
+    r.residentKb = resident_kb(getpid());
+    r.hash = w[0].hash;
+
+    Wat4ffLoadTiming timing;
+    if (wat4ff_get_load_timing(&timing)) r.source = timing.source;
+    return r;
+}
+
+typedef struct Round {
+    double wallSeconds;
+    double firstPacketMs;
+    double residentMb;
+    UInt32 failed;
+    UInt32 sourced;             // Clients whose calls went where expected
+    UInt64 hash;
+    bool mixed;
+}Round;
+
+static Round
+run_round(const char* host, UInt32 clients, UInt32 streams, UInt32 threads) {
+    Round round = { 0 };
+    pid_t pids[kMaxClients];
+    int fds[kMaxClients];
+    int64_t forked[kMaxClients];
+
+    // The parent never loads the library, so each child starts cold.
+    fflush(stdout);
+    int64_t t0 = bench_now_ns();
+    for (UInt32 i = 0; i < clients; ++i) {
+        int fd[2];
+        if (pipe(fd)) exit(1);
+        forked[i] = bench_now_ns();
+        pids[i] = fork();
+        if (!pids[i]) {
+            close(fd[0]);
+            Result r = client_main(host, streams, threads, forked[i]);
+            _exit(write(fd[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+        }
+        close(fd[1]);
+        fds[i] = fd[0];
+    }
+    for (UInt32 i = 0; i < clients; ++i) {
+        Result r = { 0 };
+        if (read(fds[i], &r, sizeof(r)) != sizeof(r)) r.ok = false;
+        close(fds[i]);
+        waitpid(pids[i], NULL, 0);
+        if (!r.ok) {
+            ++round.failed;
+            continue;
+        }
+        if (host ? r.source == kWat4ffProbeHost : r.source >= 0 && r.source != kWat4ffProbeHost) ++round.sourced;
+        if (!round.hash) round.hash = r.hash;
+        round.mixed = round.mixed || r.hash != round.hash;
+        round.firstPacketMs += r.firstPacketNs / 1e6 / clients;
+        round.residentMb += r.residentKb / 1024.0;
+    }
+    round.wallSeconds = (bench_now_ns() - t0) / 1e9;
+    return round;
+}
+
+static void
+print_round(const char* label, const Round* r, UInt32 clients, UInt32 streams, UInt32 threads) {
+    double audio = (double)clients * threads * streams * kFrames * 2 / kRate;
+    printf("%-12s  %6.1f s audio/s, first packet %7.2f ms, clients %7.1f MB, %u failed, %u misrouted\n",
+           label, audio / r->wallSeconds, r->firstPacketMs, r->residentMb, r->failed, clients - r->failed - r->sourced);
+}
+
+int
+main(int argc, char** argv) {
+    UInt32 clients = argc > 1 ? (UInt32)atoi(argv[1]) : 8;
+    UInt32 streams = argc > 2 ? (UInt32)atoi(argv[2]) : 2;
+    UInt32 threads = argc > 3 ? (UInt32)atoi(argv[3]) : 2;
+    if (clients < 1) clients = 1;
+    if (clients > kMaxClients) clients = kMaxClients;
+    if (threads < 1) threads = 1;
+    if (threads > kMaxThreads) threads = kMaxThreads;
+    setenv("WAT4FF_MOCK_LOAD_MS", "150", 0);
+    setenv("WAT4FF_MOCK_RESIDENT_MB", "40", 0);
+    setenv("WAT4FF_MOCK_PACKET_US", "20", 0);
+    for (UInt32 i = 0; i < kFrames * kChannels; ++i) pcm_[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    char host[64];
+    snprintf(host, sizeof(host), "/tmp/wat4ff-bench-%ld.sock", (long)getpid());
+    fflush(stdout);
+    pid_t hostpid = fork();
+    if (!hostpid) {
+        wat4ff_host_run(host);
+        _exit(1);
+    }
+    while (access(host, F_OK) && !waitpid(hostpid, NULL, WNOHANG)) bench_sleep_ms(1);
+
+    // One unmeasured round each, so the page cache is warm and the host loaded.
+    run_round(NULL, 1, 1, 1);
+    run_round(host, 1, 1, 1);
+    Round local = run_round(NULL, clients, streams, threads);
+    Round hosted = run_round(host, clients, streams, threads);
+    long host_kb = resident_kb(hostpid);
+    kill(hostpid, SIGTERM);
+    waitpid(hostpid, NULL, 0);
+    unlink(host);
+
+    printf("clients:      %u, %u threads each, %u streams of %u s per thread\n", clients, threads, streams, kFrames / kRate);
+    printf("mock:         load %s ms, resident %s MB, %s us/packet\n",
+           getenv("WAT4FF_MOCK_LOAD_MS"), getenv("WAT4FF_MOCK_RESIDENT_MB"), getenv("WAT4FF_MOCK_PACKET_US"));
+    print_round("in process:", &local, clients, streams, threads);
+    print_round("hosted:", &hosted, clients, streams, threads);
+    printf("host:         %.1f MB\n", host_kb / 1024.0);
+    bool same = !local.mixed && !hosted.mixed && local.hash == hosted.hash;
+    printf("output:       %s\n", same ? "identical" : "DIFFERS");
+    return same && !local.failed && !hosted.failed && local.sourced == clients && hosted.sourced == clients ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Times encoding the same PCM as one segment and as many segments in
+ * parallel, then decodes both and reports the deviation around the seams.
+ * test/parallel.c checks it.
+ * Set WAT4FF_MOCK_PACKET_US to give the stand-in codec some work to do.
+ *
+ * wat4ff_bench_parallel [seconds] [threads]
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate     = 44100,
+    kChannels = 2,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Packets {
+    const Wat4ffEncodedStream* s;
+    UInt64 next;
+    AudioStreamPacketDescription desc;
+}Packets;
+
+static OSStatus
+packet_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    Packets* p = user;
+    if (p->next >= p->s->packetCount) {
+        *packets = 0;
+        return noErr;
+    }
+    p->desc = p->s->packets[p->next++];
+    data->mBuffers[0].mData = p->s->data + p->desc.mStartOffset;
+    data->mBuffers[0].mDataByteSize = p->desc.mDataByteSize;
+    p->desc.mStartOffset = 0;
+    if (descs) *descs = &p->desc;
+    *packets = 1;
+    return noErr;
+}
+
+// Decodes s into a new buffer of *frames frames, priming and padding removed.
+static SInt16*
+decode(const Wat4ffEncodedStream* s, UInt64* frames) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kAac, &kPcm, &conv)) return NULL;
+    if (s->magicCookieSize) {
+        AudioConverterSetProperty(conv, kAudioConverterDecompressionMagicCookie, s->magicCookieSize, s->magicCookie);
+    }
+
+    UInt64 cap = (s->packetCount + 1) * s->framesPerPacket;
+    SInt16* pcm = malloc(cap * kPcm.mBytesPerFrame);
+    Packets p = { s, 0 };
+    UInt64 got = 0;
+    for (;;) {
+        UInt32 n = s->framesPerPacket;
+        if (got + n > cap) break;
+        AudioBufferList list = { 1, { { kChannels, n * kPcm.mBytesPerFrame, pcm + got * kChannels } } };
+        if (AudioConverterFillComplexBuffer(conv, packet_proc, &p, &n, &list, NULL) || !n) break;
+        got += n;
+    }
+    AudioConverterDispose(conv);
+
+    UInt64 lead = s->prime.leadingFrames < got ? s->prime.leadingFrames : got;
+    got -= lead;
+    memmove(pcm, pcm + lead * kChannels, got * kPcm.mBytesPerFrame);
+    *frames = s->prime.trailingFrames < got ? got - s->prime.trailingFrames : 0;
+    return pcm;
+}
+
+static double
+dbfs(int diff) {
+    return diff ? 20 * log10(diff / 32768.0) : -INFINITY;
+}
+
+static int
+max_diff(const SInt16* a, const SInt16* b, UInt64 from, UInt64 to) {
+    int worst = 0;
+    for (UInt64 i = from * kChannels; i < to * kChannels; ++i) {
+        int d = abs(a[i] - b[i]);
+        if (d > worst) worst = d;
+    }
+    return worst;
+}
+
+// Worst deviation of b from a around the seams of s, b decoded from s.
+static int
+worst_seam(const SInt16* a, const SInt16* b, UInt64 n, const Wat4ffEncodedStream* s) {
+    // Segments are 10 s rounded up to whole packets. Seam i is where packet
+    // i * segment_packets starts, in frames of the decoded output.
+    UInt32 fpp = s->framesPerPacket;
+    UInt64 segment_packets = ((UInt64)kRate * 10 + fpp - 1) / fpp;
+    int worst = 0;
+    for (UInt32 i = 1; i < s->segments; ++i) {
+        UInt64 seam = i * segment_packets * fpp;
+        seam = seam > s->prime.leadingFrames ? seam - s->prime.leadingFrames : 0;
+        UInt64 from = seam > 4096 ? seam - 4096 : 0;
+        UInt64 to = seam + 4096 < n ? seam + 4096 : n;
+        int d = max_diff(a, b, from, to);
+        if (d > worst) worst = d;
+    }
+    return worst;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 120;
+    UInt32 threads = argc > 2 ? (UInt32)atoi(argv[2]) : 0;
+
+    UInt64 frames = (UInt64)(seconds * kRate);
+    SInt16* pcm = malloc(frames * kPcm.mBytesPerFrame);
+    double phase = 0;
+    for (UInt64 i = 0; i < frames; ++i) {
+        // A sweep plus a little noise, nothing repeats at a segment boundary.
+        phase += 2 * M_PI * (100 + 4000.0 * i / frames) / kRate;
+        SInt16 v = (SInt16)(12000 * sin(phase) + (rand() % 2001 - 1000));
+        pcm[i * 2] = v;
+        pcm[i * 2 + 1] = (SInt16)(v / 2);
+    }
+
+    UInt32 bitRate = 128000;
+    Wat4ffConverterProperty props[] = {
+        { kAudioConverterEncodeBitRate, sizeof(bitRate), &bitRate },
+    };
+    Wat4ffParallelEncode job = {
+        .input = kPcm,
+        .output = kAac,
+        .properties = props,
+        .propertyCount = 1,
+        .threads = 1,
+        .segmentFrames = (UInt32)(frames < 0x7fffffff ? frames * 2 : 0xffffffff),   // Room for the priming
+    };
+
+    Wat4ffEncodedStream serial, parallel;
+    int64_t t0 = bench_now_ns();
+    OSStatus rc = wat4ff_encode_parallel(&job, pcm, frames, &serial);
+    int64_t t_serial = bench_now_ns() - t0;
+    if (rc) {
+        fprintf(stderr, "serial encode failed: %d\n", (int)rc);
+        return 1;
+    }
+
+    job.threads = threads;
+    job.segmentFrames = 0;
+    t0 = bench_now_ns();
+    rc = wat4ff_encode_parallel(&job, pcm, frames, &parallel);
+    int64_t t_parallel = bench_now_ns() - t0;
+    if (rc) {
+        fprintf(stderr, "parallel encode failed: %d\n", (int)rc);
+        return 1;
+    }
+
+    bool same = serial.packetCount == parallel.packetCount && serial.dataSize == parallel.dataSize
+             && !memcmp(serial.data, parallel.data, serial.dataSize);
+
+    UInt64 n1, n2;
+    SInt16* a = decode(&serial, &n1);
+    SInt16* b = decode(&parallel, &n2);
+    if (!a || !b) {
+        fprintf(stderr, "decode failed\n");
+        return 1;
+    }
+    UInt64 n = n1 < n2 ? n1 : n2;
+
+    int seam = worst_seam(a, b, n, &parallel);
+    int worst = max_diff(a, b, 0, n);
+
+    printf("input:        %.1f s, %llu frames\n", seconds, (unsigned long long)frames);
+    printf("segments:     %u\n", parallel.segments);
+    printf("packets:      %llu serial, %llu parallel\n",
+           (unsigned long long)serial.packetCount, (unsigned long long)parallel.packetCount);
+    printf("serial:       %.1f ms, %.1fx realtime\n", t_serial / 1e6, seconds * 1e9 / t_serial);
+    printf("parallel:     %.1f ms, %.1fx realtime, %.2fx speedup\n",
+           t_parallel / 1e6, seconds * 1e9 / t_parallel, (double)t_serial / t_parallel);
+    printf("bitstream:    %s\n", same ? "identical" : "differs");
+    printf("decoded:      %llu frames serial, %llu parallel\n", (unsigned long long)n1, (unsigned long long)n2);
+    printf("worst seam:   %.1f dBFS\n", dbfs(seam));
+    printf("worst:        %.1f dBFS\n", dbfs(worst));
+    wat4ff_free_encoded(&serial);
+    wat4ff_free_encoded(&parallel);
+    free(a);
+    free(b);
+    free(pcm);
+    return 0;
+}
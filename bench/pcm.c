@@ -0,0 +1,156 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Reports samples per second for each conversion at every SIMD level the
+ * CPU has, and frames per second for (de)interleaving 1 to 8 channels.
+ * test/pcm.c checks the levels against plain C.
+ *
+ * wat4ff_bench_pcm [million samples]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+
+
+enum {
+    kMaxChannels = 8,
+};
+
+static const char* const kSimdNames[] = { "c", "sse2", "avx2", "neon" };
+static const char* const kFormatNames[] = { "s16", "s32", "f32" };
+
+static UInt32
+sample_size(UInt32 format) {
+    return format == kWat4ffSampleS16 ? 2 : 4;
+}
+
+static UInt32
+next_random(UInt32* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state;
+}
+
+// Fills n samples of each format, with the awkward values every so often.
+static void
+make_samples(void* s16, void* s32, void* f32, size_t n) {
+    static const float special[] = {
+        1.0f, -1.0f, 1.5f, -1.5f, 0.0f, -0.0f, 1e-40f, -1e-40f, 1e30f, -1e30f,
+        0.5f / 32768, 1.5f / 32768, 2.5f / 32768, -0.5f / 32768, -2.5f / 32768,
+        32767.5f / 32768, -32768.5f / 32768, 4194304.5f / 2147483648.0f, -8388607.5f / 2147483648.0f,
+    };
+    UInt32 state = 12345;
+    SInt16* a = s16;
+    SInt32* b = s32;
+    float* c = f32;
+    size_t nspecial = sizeof(special) / sizeof(special[0]);
+    for (size_t i = 0; i < n; ++i) {
+        UInt32 r = next_random(&state);
+        a[i] = (SInt16)(r >> 16);
+        b[i] = (SInt32)r;
+        if (i % 7 == 0) c[i] = special[(i / 7) % nspecial];
+        else c[i] = ((SInt32)r / 2147483648.0f) * 1.25f;
+    }
+    // inf, -inf and NaN, without libm.
+    UInt32 bits[] = { 0x7f800000u, 0xff800000u, 0x7fc00000u, 0xffc00001u };
+    for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]) && i * 11 + 3 < n; ++i) {
+        memcpy(&c[i * 11 + 3], &bits[i], 4);
+    }
+}
+
+typedef struct Set {
+    UInt8* src[kWat4ffSampleCount];
+    UInt8* out;
+}Set;
+
+static double
+rate(int64_t t0, size_t n, UInt32 rounds) {
+    double t = (bench_now_ns() - t0) / 1e9;
+    return t > 0 ? n * (double)rounds / t / 1e6 : 0;
+}
+
+int
+main(int argc, char** argv) {
+    double million = argc > 1 ? atof(argv[1]) : 64;
+    size_t big = 1 << 16;
+    UInt32 rounds = (UInt32)(million * 1e6 / big) + 1;
+
+    Set set;
+    for (UInt32 f = 0; f < kWat4ffSampleCount; ++f) set.src[f] = malloc(big * 4);
+    set.out = malloc(big * 4);
+    make_samples(set.src[0], set.src[1], set.src[2], big);
+
+    UInt32 levels[4];
+    UInt32 count = 0;
+    for (UInt32 simd = kWat4ffSimdNone; simd <= kWat4ffSimdNEON; ++simd) {
+        if (wat4ff_pcm_use_simd(simd) == simd) levels[count++] = simd;
+    }
+    UInt32 best = levels[count - 1];
+    printf("levels:");
+    for (UInt32 i = 0; i < count; ++i) printf(" %s", kSimdNames[levels[i]]);
+    printf("\n");
+
+    printf("\nconvert, million samples/s\n           ");
+    for (UInt32 i = 0; i < count; ++i) printf("%10s", kSimdNames[levels[i]]);
+    printf("\n");
+    for (UInt32 from = 0; from < kWat4ffSampleCount; ++from) {
+        for (UInt32 to = 0; to < kWat4ffSampleCount; ++to) {
+            if (from == to) continue;
+            printf("%s to %s ", kFormatNames[from], kFormatNames[to]);
+            for (UInt32 i = 0; i < count; ++i) {
+                wat4ff_pcm_use_simd(levels[i]);
+                int64_t t0 = bench_now_ns();
+                for (UInt32 r = 0; r < rounds; ++r) wat4ff_pcm_convert(set.out, to, set.src[from], from, big);
+                printf("%10.0f", rate(t0, big, rounds));
+            }
+            printf("\n");
+        }
+    }
+
+    // f32 planes to s16 is what ffmpeg hands an encoder, s16 back to f32
+    // planes is what comes out of a decoder.
+    static const UInt32 pairs[][2] = {
+        { kWat4ffSampleF32, kWat4ffSampleS16 },
+        { kWat4ffSampleF32, kWat4ffSampleF32 },
+        { kWat4ffSampleS16, kWat4ffSampleS16 },
+    };
+    for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); ++p) {
+        UInt32 a = pairs[p][0];
+        UInt32 b = pairs[p][1];
+        printf("\n(de)interleave %s planes and %s, million frames/s, c and %s\n", kFormatNames[a], kFormatNames[b],
+               kSimdNames[best]);
+        for (UInt32 ch = 1; ch <= kMaxChannels; ++ch) {
+            UInt32 frames = (UInt32)(big / ch);
+            const void* in[kMaxChannels];
+            void* outs[kMaxChannels];
+            for (UInt32 c = 0; c < ch; ++c) {
+                in[c] = set.src[a] + (size_t)c * frames * sample_size(a);
+                outs[c] = set.out + (size_t)c * frames * sample_size(a);
+            }
+            double speed[2][2];
+            for (int k = 0; k < 2; ++k) {
+                wat4ff_pcm_use_simd(k ? best : kWat4ffSimdNone);
+                int64_t t0 = bench_now_ns();
+                for (UInt32 r = 0; r < rounds; ++r) wat4ff_pcm_interleave(set.out, b, in, a, ch, frames);
+                speed[k][0] = rate(t0, frames, rounds);
+                t0 = bench_now_ns();
+                for (UInt32 r = 0; r < rounds; ++r) wat4ff_pcm_deinterleave(outs, a, set.src[b], b, ch, frames);
+                speed[k][1] = rate(t0, frames, rounds);
+            }
+            printf("  %u ch:  interleave %8.1f %8.1f %5.2fx   deinterleave %8.1f %8.1f %5.2fx\n", ch,
+                   speed[0][0], speed[1][0], speed[0][0] > 0 ? speed[1][0] / speed[0][0] : 0,
+                   speed[0][1], speed[1][1], speed[0][1] > 0 ? speed[1][1] / speed[0][1] : 0);
+        }
+    }
+
+    for (UInt32 f = 0; f < kWat4ffSampleCount; ++f) free(set.src[f]);
+    free(set.out);
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes 7.1 float planes to AAC the way FFmpeg does now, interleaving
+ * them into a scratch buffer in the input proc, then handing the planes over
+ * in place with wat4ff_pcm_source_proc(). Then decodes the result to
+ * interleaved frames and to planes through wat4ff_buffer_list_wrap().
+ * Both encodes must give the same packets, both decodes the same samples.
+ *
+ * wat4ff_bench_planar [seconds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+
+
+enum {
+    kRate     = 48000,
+    kChannels = 8,
+    kFill     = 64,
+};
+
+static const AudioStreamBasicDescription kInterleaved = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatLinearPCM,
+    .mFormatFlags      = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked,
+    .mBytesPerPacket   = kChannels * 4,
+    .mFramesPerPacket  = 1,
+    .mBytesPerFrame    = kChannels * 4,
+    .mChannelsPerFrame = kChannels,
+    .mBitsPerChannel   = 32,
+};
+
+static const AudioStreamBasicDescription kPlanar = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatLinearPCM,
+    .mFormatFlags      = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked | kAudioFormatFlagIsNonInterleaved,
+    .mBytesPerPacket   = 4,
+    .mFramesPerPacket  = 1,
+    .mBytesPerFrame    = 4,
+    .mChannelsPerFrame = kChannels,
+    .mBitsPerChannel   = 32,
+};
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Copying {
+    const void* const* planes;
+    UInt64 frames;
+    UInt64 pos;
+    float* scratch;
+    UInt32 scratchFrames;
+}Copying;
+
+typedef struct Encoded {
+    UInt8* data;
+    AudioStreamPacketDescription* packets;
+    UInt32 count;
+    UInt32 fpp;
+}Encoded;
+
+typedef struct Packets {
+    const Encoded* s;
+    UInt32 next;
+    AudioStreamPacketDescription desc;
+}Packets;
+
+// Interleaves the next frames into scratch, as FFmpeg's packed path does.
+static OSStatus
+copying_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+             AudioStreamPacketDescription** descs, void* user) {
+    Copying* c = user;
+    UInt64 left = c->frames - c->pos;
+    UInt32 n = *packets < c->scratchFrames ? *packets : c->scratchFrames;
+    if (n > left) n = (UInt32)left;
+    for (UInt32 ch = 0; ch < kChannels; ++ch) {
+        const float* p = (const float*)c->planes[ch] + c->pos;
+        for (UInt32 i = 0; i < n; ++i) c->scratch[(size_t)i * kChannels + ch] = p[i];
+    }
+    c->pos += n;
+    *packets = n;
+    data->mBuffers[0].mData = c->scratch;
+    data->mBuffers[0].mDataByteSize = n * kInterleaved.mBytesPerFrame;
+    data->mBuffers[0].mNumberChannels = kChannels;
+    return noErr;
+}
+
+static bool
+encode(const AudioStreamBasicDescription* in, AudioConverterComplexInputDataProc proc, void* user,
+       UInt64 frames, Encoded* out) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(in, &kAac, &conv)) return false;
+    UInt32 max_packet = 0;
+    UInt32 size = sizeof(max_packet);
+    AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &max_packet);
+    AudioStreamBasicDescription fmt;
+    size = sizeof(fmt);
+    AudioConverterGetProperty(conv, kAudioConverterCurrentOutputStreamDescription, &size, &fmt);
+    out->fpp = fmt.mFramesPerPacket;
+
+    UInt64 cap = frames / out->fpp + 2 * kFill;
+    out->data = malloc(cap * max_packet);
+    out->packets = malloc(cap * sizeof(*out->packets));
+    out->count = 0;
+    UInt32 used = 0;
+    for (;;) {
+        UInt32 n = kFill;
+        AudioBufferList list = { 1, { { kChannels, max_packet * kFill, out->data + used } } };
+        if (AudioConverterFillComplexBuffer(conv, proc, user, &n, &list, out->packets + out->count) || !n) break;
+        for (UInt32 i = 0; i < n; ++i) out->packets[out->count + i].mStartOffset += used;
+        out->count += n;
+        used += list.mBuffers[0].mDataByteSize;
+    }
+    AudioConverterDispose(conv);
+    return out->count > 0;
+}
+
+static OSStatus
+packet_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    Packets* p = user;
+    if (p->next >= p->s->count) {
+        *packets = 0;
+        return noErr;
+    }
+    p->desc = p->s->packets[p->next++];
+    data->mBuffers[0].mData = p->s->data + p->desc.mStartOffset;
+    data->mBuffers[0].mDataByteSize = p->desc.mDataByteSize;
+    p->desc.mStartOffset = 0;
+    if (descs) *descs = &p->desc;
+    *packets = 1;
+    return noErr;
+}
+
+// Decodes to interleaved frames, or with planes to one plane per channel.
+static UInt64
+decode(const Encoded* s, float* interleaved, void* const* planes) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kAac, planes ? &kPlanar : &kInterleaved, &conv)) return 0;
+    UInt64 cap = (UInt64)s->count * s->fpp;
+    UInt64 got = 0;
+    Packets p = { s, 0 };
+    while (got < cap) {
+        UInt32 n = cap - got < 4096 ? (UInt32)(cap - got) : 4096;
+        Wat4ffBufferList list;
+        if (planes) {
+            wat4ff_buffer_list_wrap(&list.abl, planes, kChannels, 1, (UInt32)(got * 4), n * 4);
+        }
+        else {
+            list.abl = (AudioBufferList){ 1, { { kChannels, n * kInterleaved.mBytesPerFrame, interleaved + got * kChannels } } };
+        }
+        if (AudioConverterFillComplexBuffer(conv, packet_proc, &p, &n, &list.abl, NULL) || !n) break;
+        got += n;
+    }
+    AudioConverterDispose(conv);
+    return got;
+}
+
+static bool
+same_packets(const Encoded* a, const Encoded* b) {
+    if (a->count != b->count) return false;
+    for (UInt32 i = 0; i < a->count; ++i) {
+        const AudioStreamPacketDescription* x = &a->packets[i];
+        const AudioStreamPacketDescription* y = &b->packets[i];
+        if (x->mDataByteSize != y->mDataByteSize
+            || memcmp(a->data + x->mStartOffset, b->data + y->mStartOffset, x->mDataByteSize)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 120;
+    UInt64 frames = (UInt64)(seconds * kRate);
+
+    float* storage = malloc(frames * kChannels * sizeof(float));
+    void* planes[kChannels];
+    for (UInt32 c = 0; c < kChannels; ++c) {
+        float* p = storage + c * frames;
+        for (UInt64 i = 0; i < frames; ++i) p[i] = (SInt16)(((i * kChannels + c) * 2654435761u) >> 16) / 32768.0f;
+        planes[c] = p;
+    }
+
+    Copying copying = { (const void* const*)planes, frames, 0, malloc(4096 * kInterleaved.mBytesPerFrame), 4096 };
+    Encoded a, b;
+    int64_t t0 = bench_now_ns();
+    bool ok = encode(&kInterleaved, copying_proc, &copying, frames, &a);
+    double t_copy = (bench_now_ns() - t0) / 1e9;
+
+    Wat4ffPcmSource src;
+    wat4ff_pcm_source_init(&src, &kPlanar, (const void* const*)planes, frames);
+    t0 = bench_now_ns();
+    ok = ok && encode(&kPlanar, wat4ff_pcm_source_proc, &src, frames, &b);
+    double t_wrap = (bench_now_ns() - t0) / 1e9;
+    bool same = ok && same_packets(&a, &b);
+    printf("input:        %.1f s of 7.1, %u packets\n", seconds, a.count);
+    printf("copying:      %.1fx realtime\n", seconds / t_copy);
+    printf("in place:     %.1fx realtime %.2fx, %s\n", seconds / t_wrap, t_copy / t_wrap, same ? "identical" : "DIFFERS");
+    ok = same;
+
+    UInt64 cap = (UInt64)a.count * a.fpp;
+    float* interleaved = malloc(cap * kInterleaved.mBytesPerFrame);
+    float* out = malloc(cap * kInterleaved.mBytesPerFrame);
+    void* outs[kChannels];
+    for (UInt32 c = 0; c < kChannels; ++c) outs[c] = out + c * cap;
+    UInt64 got_a = ok ? decode(&a, interleaved, NULL) : 0;
+    UInt64 got_b = ok ? decode(&a, NULL, outs) : 0;
+    same = got_a && got_a == got_b;
+    for (UInt64 i = 0; i < got_a && same; ++i) {
+        for (UInt32 c = 0; c < kChannels; ++c) same = same && interleaved[i * kChannels + c] == out[c * cap + i];
+    }
+    printf("decode:       %llu frames into planes, %s\n", (unsigned long long)got_b, same ? "identical" : "DIFFERS");
+    ok = same;
+
+    free(out);
+    free(interleaved);
+    free(a.data);
+    free(a.packets);
+    free(b.data);
+    free(b.packets);
+    free(copying.scratch);
+    free(storage);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes many short clips the way ffmpeg's aac_at does, with the converter
+ * pool off and then on, and checks every clip comes out byte for byte the
+ * same. "mixed" cycles through three encoder settings, one of which leaves
+ * the bit rate at its default, to exercise the stale converter path.
+ * Set WAT4FF_MOCK_NEW_US to give AudioConverterNew a realistic cost.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kChannels = 2,
+    kMaxPacketsPerCall = 1,
+};
+
+typedef struct Source {
+    const SInt16* pcm;
+    UInt32 frames;
+    UInt32 pos;
+}Source;
+
+typedef struct Setting {
+    UInt32 quality;
+    UInt32 mode;
+    UInt32 bitRate;     // 0 leaves it alone
+}Setting;
+
+static const Setting kSettings[] = {
+    { 96, kAudioCodecBitRateControlMode_Constant, 128000 },
+    { 96, kAudioCodecBitRateControlMode_Constant, 192000 },
+    { 96, kAudioCodecBitRateControlMode_Constant, 0 },
+};
+
+static OSStatus
+input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Source* s = user;
+    UInt32 left = s->frames - s->pos;
+    if (*packets > left) *packets = left;
+    data->mBuffers[0].mData = (void*)(s->pcm + s->pos * kChannels);
+    data->mBuffers[0].mDataByteSize = *packets * kChannels * sizeof(SInt16);
+    data->mBuffers[0].mNumberChannels = kChannels;
+    s->pos += *packets;
+    return noErr;
+}
+
+// Returns a hash of every packet, or 0 on error. *setup_ns gets the time
+// from AudioConverterNew to the first FillComplexBuffer.
+static UInt64
+encode_clip(const SInt16* pcm, UInt32 frames, const Setting* setting, int64_t* setup_ns) {
+    AudioStreamBasicDescription in = {
+        .mSampleRate       = 44100,
+        .mFormatID         = kAudioFormatLinearPCM,
+        .mFormatFlags      = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked,
+        .mBytesPerPacket   = kChannels * 2,
+        .mFramesPerPacket  = 1,
+        .mBytesPerFrame    = kChannels * 2,
+        .mChannelsPerFrame = kChannels,
+        .mBitsPerChannel   = 16,
+    };
+    AudioStreamBasicDescription out = {
+        .mSampleRate       = 44100,
+        .mFormatID         = kAudioFormatMPEG4AAC,
+        .mChannelsPerFrame = kChannels,
+    };
+    UInt64 hash = digest_new().hash;
+    AudioConverterRef conv = NULL;
+    UInt8* buf = NULL;
+
+    int64_t t0 = bench_now_ns();
+    if (AudioConverterNew(&in, &out, &conv)) return 0;
+
+    AudioConverterSetProperty(conv, kAudioConverterCodecQuality, sizeof(setting->quality), &setting->quality);
+    AudioConverterSetProperty(conv, kAudioCodecPropertyBitRateControlMode, sizeof(setting->mode), &setting->mode);
+    if (setting->bitRate) {
+        UInt32 size = 0;
+        AudioConverterGetPropertyInfo(conv, kAudioConverterApplicableEncodeBitRates, &size, NULL);
+        AudioConverterSetProperty(conv, kAudioConverterEncodeBitRate, sizeof(setting->bitRate), &setting->bitRate);
+    }
+
+    UInt32 max_packet = 0;
+    UInt32 size = sizeof(max_packet);
+    if (AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &max_packet)) {
+        hash = 0;
+        goto fin;
+    }
+    *setup_ns = bench_now_ns() - t0;
+
+    buf = malloc(max_packet);
+    Source src = { pcm, frames, 0 };
+    for (;;) {
+        UInt32 packets = kMaxPacketsPerCall;
+        AudioStreamPacketDescription desc;
+        AudioBufferList list = { 1, { { kChannels, max_packet, buf } } };
+        if (AudioConverterFillComplexBuffer(conv, input_proc, &src, &packets, &list, &desc)) {
+            hash = 0;
+            goto fin;
+        }
+        if (!packets) break;
+        hash = fnv1a(hash, buf, list.mBuffers[0].mDataByteSize);
+    }
+
+    AudioConverterPrimeInfo prime;
+    size = sizeof(prime);
+    AudioConverterGetProperty(conv, kAudioConverterPrimeInfo, &size, &prime);
+    hash = fnv1a(hash, &prime, sizeof(prime));
+
+fin:
+    free(buf);
+    AudioConverterDispose(conv);
+    return hash;
+}
+
+static double
+run(const SInt16* pcm, UInt32 frames, int clips, bool mixed, UInt64* hashes, bool check, int64_t* setup_total) {
+    int64_t t0 = bench_now_ns();
+    *setup_total = 0;
+    for (int i = 0; i < clips; ++i) {
+        int64_t setup = 0;
+        UInt64 h = encode_clip(pcm, frames, &kSettings[mixed ? i % 3 : 0], &setup);
+        *setup_total += setup;
+        if (!h) {
+            fprintf(stderr, "clip %d failed\n", i);
+            exit(1);
+        }
+        if (check && hashes[i] != h) {
+            fprintf(stderr, "clip %d differs with the pool on\n", i);
+            exit(1);
+        }
+        hashes[i] = h;
+    }
+    return (bench_now_ns() - t0) / 1e9;
+}
+
+int
+main(int argc, char** argv) {
+    int clips = argc > 1 ? atoi(argv[1]) : 1000;
+    UInt32 frames = argc > 2 ? (UInt32)atoi(argv[2]) : 4410;
+    bool mixed = argc > 3 && !strcmp(argv[3], "mixed");
+    if (clips < 1) clips = 1;
+
+    SInt16* pcm = malloc(sizeof(SInt16) * frames * kChannels);
+    UInt64* hashes = malloc(sizeof(UInt64) * clips);
+    for (UInt32 i = 0; i < frames * kChannels; ++i) pcm[i] = (SInt16)((i * 2654435761u) >> 20);
+
+    if (wat4ff_preload()) {
+        fprintf(stderr, "cannot load CoreAudioToolbox\n");
+        return 1;
+    }
+
+    int64_t setup_off, setup_on;
+    wat4ff_pool_configure(0, 0);
+    double off = run(pcm, frames, clips, mixed, hashes, false, &setup_off);
+    wat4ff_pool_configure(16, 0);
+    double on = run(pcm, frames, clips, mixed, hashes, true, &setup_on);
+
+    Wat4ffPoolStats stats;
+    wat4ff_get_pool_stats(&stats);
+
+    printf("clips:        %d x %u frames, %s settings\n", clips, frames, mixed ? "mixed" : "one");
+    printf("pool off:     %.1f clips/s, setup %.2f us/clip\n", clips / off, setup_off / 1e3 / clips);
+    printf("pool on:      %.1f clips/s, setup %.2f us/clip\n", clips / on, setup_on / 1e3 / clips);
+    printf("hits:         %llu\n", (unsigned long long)stats.hits);
+    printf("misses:       %llu\n", (unsigned long long)stats.misses);
+    printf("stale:        %llu\n", (unsigned long long)stats.stale);
+    printf("evictions:    %llu\n", (unsigned long long)stats.evictions);
+    printf("parked:       %u\n", stats.parked);
+    printf("output:       identical\n");
+    return 0;
+}
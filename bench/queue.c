@@ -0,0 +1,247 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * AudioQueue jitter on the null sink, which plays in real time. A producer
+ * thread keeps a few buffers enqueued, the way libavdevice does, and the
+ * output callback times each one coming back. Reports how far the gaps
+ * between callbacks stray from a buffer's duration, the worst time from
+ * enqueue to callback against the bound the buffers set, how often the
+ * queue ran dry, and, on Linux, allocations from start to dispose. Then
+ * again with the buffers refilled from the callback itself. Optional busy
+ * threads compete for the CPU.
+ *
+ * wat4ff_bench_queue [seconds] [buffer ms] [buffers] [busy threads]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate       = 48000,
+    kChannels   = 2,
+    kMaxBuffers = 32,
+    kMaxBusy    = 16,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+typedef struct Run {
+    AudioQueueRef queue;
+    AudioQueueBufferRef buffers[kMaxBuffers];
+    int64_t enqueuedAt[kMaxBuffers];
+    UInt32 count;
+    UInt32 bytes;
+    bool fromCallback;
+    int64_t until;
+    volatile int free;                  // Buffers back from the queue
+    int64_t* times;                     // Of each callback
+    UInt32 played;
+    UInt32 capacity;
+    int64_t maxLatency;
+}Run;
+
+typedef struct Busy {
+    BenchThread thread;
+    volatile int* stop;
+}Busy;
+
+#ifdef BENCH_COUNT_ALLOCS
+// Every malloc, calloc and realloc of the bench and of wat4ff, linked with
+// --wrap.
+static volatile long allocs_;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void*
+__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&allocs_, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void*
+__wrap_calloc(size_t n, size_t size) {
+    __atomic_add_fetch(&allocs_, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+void*
+__wrap_realloc(void* p, size_t size) {
+    __atomic_add_fetch(&allocs_, 1, __ATOMIC_RELAXED);
+    return __real_realloc(p, size);
+}
+
+static long
+allocs(void) {
+    return __atomic_load_n(&allocs_, __ATOMIC_RELAXED);
+}
+#else
+static long
+allocs(void) {
+    return -1;
+}
+#endif
+
+
+static int
+index_of(Run* r, AudioQueueBufferRef b) {
+    for (UInt32 i = 0; i < r->count; ++i) {
+        if (r->buffers[i] == b) return (int)i;
+    }
+    return -1;
+}
+
+static bool
+enqueue(Run* r, AudioQueueBufferRef b) {
+    b->mAudioDataByteSize = r->bytes;
+    r->enqueuedAt[index_of(r, b)] = bench_now_ns();
+    return AudioQueueEnqueueBuffer(r->queue, b, 0, NULL) == noErr;
+}
+
+static void
+output_proc(void* user, AudioQueueRef q, AudioQueueBufferRef b) {
+    Run* r = user;
+    int64_t now = bench_now_ns();
+    int64_t latency = now - r->enqueuedAt[index_of(r, b)];
+    if (latency > r->maxLatency) r->maxLatency = latency;
+    if (r->played < r->capacity) r->times[r->played] = now;
+    ++r->played;
+    if (r->fromCallback) {
+        if (now < r->until) enqueue(r, b);
+    }
+    else {
+        __atomic_add_fetch(&r->free, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void
+busy_main(void* param) {
+    Busy* b = param;
+    volatile UInt64 x = 0;
+    while (!__atomic_load_n(b->stop, __ATOMIC_RELAXED)) ++x;
+}
+
+static int
+compare_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static bool
+run(UInt32 count, double bufferMs, double seconds, bool fromCallback) {
+    Run r = { .count = count, .fromCallback = fromCallback };
+    UInt32 frames = (UInt32)(kRate * bufferMs / 1000);
+    r.bytes = frames * kPcm.mBytesPerFrame;
+    r.capacity = (UInt32)(seconds * 1000 / bufferMs) + count + 16;
+    r.times = calloc(r.capacity, sizeof(*r.times));
+
+    const char* uid = "null";
+    AudioObjectPropertyAddress prop = { kAudioHardwarePropertyDevices, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster };
+    UInt32 size = 0;
+    AudioObjectGetPropertyDataSize(kAudioObjectSystemObject, &prop, 0, NULL, &size);
+    AudioDeviceID devices[16];
+    if (size > sizeof(devices)) size = sizeof(devices);
+    CFStringRef device = NULL;
+    AudioObjectGetPropertyData(kAudioObjectSystemObject, &prop, 0, NULL, &size, devices);
+    prop.mSelector = kAudioDevicePropertyDeviceUID;
+    for (UInt32 i = 0; i < size / sizeof(*devices) && !device; ++i) {
+        CFStringRef s;
+        UInt32 n = sizeof(s);
+        if (!AudioObjectGetPropertyData(devices[i], &prop, 0, NULL, &n, &s)
+            && !strcmp(CFStringGetCStringPtr(s, kCFStringEncodingMacRoman), uid)) {
+            device = s;
+        }
+    }
+
+    if (!r.times || !device
+        || AudioQueueNewOutput(&kPcm, output_proc, &r, NULL, kCFRunLoopCommonModes, 0, &r.queue)
+        || AudioQueueSetProperty(r.queue, kAudioQueueProperty_CurrentDevice, &device, sizeof(device))) {
+        fprintf(stderr, "cannot open a queue on the %s sink\n", uid);
+        return false;
+    }
+    for (UInt32 i = 0; i < count; ++i) {
+        if (AudioQueueAllocateBuffer(r.queue, r.bytes, &r.buffers[i])) return false;
+        memset(r.buffers[i]->mAudioData, 0, r.bytes);
+    }
+
+    if (AudioQueueStart(r.queue, NULL)) return false;
+    long allocs1 = allocs();
+    int64_t t0 = bench_now_ns();
+    r.until = t0 + (int64_t)(seconds * 1e9);
+    bool ok = true;
+    for (UInt32 i = 0; i < count && ok; ++i) ok = enqueue(&r, r.buffers[i]);
+    UInt32 next = 0;
+    while (ok && !fromCallback && bench_now_ns() < r.until) {
+        if (!__atomic_load_n(&r.free, __ATOMIC_ACQUIRE)) {
+            bench_sleep_ms(1);
+            continue;
+        }
+        __atomic_sub_fetch(&r.free, 1, __ATOMIC_ACQ_REL);
+        ok = enqueue(&r, r.buffers[next]);
+        next = (next + 1) % count;
+    }
+    while (ok && fromCallback && bench_now_ns() < r.until) bench_sleep_ms(10);
+    ok = ok && AudioQueueFlush(r.queue) == noErr;
+    long allocs2 = allocs();
+    AudioQueueDispose(r.queue, true);
+
+    UInt32 n = r.played < r.capacity ? r.played : r.capacity;
+    int64_t duration = (int64_t)frames * 1000000000 / kRate;
+    UInt32 dry = 0;
+    int64_t* dev = calloc(n, sizeof(*dev));
+    for (UInt32 i = 1; i < n; ++i) {
+        int64_t gap = r.times[i] - r.times[i - 1];
+        dev[i - 1] = gap > duration ? gap - duration : duration - gap;
+        if (gap > duration * 3 / 2) ++dry;
+    }
+    if (n > 1) qsort(dev, n - 1, sizeof(*dev), compare_i64);
+    printf("%-9s %6u %8.1f %8.1f %8.1f %10.2f %8.2f %6u ",
+           fromCallback ? "callback" : "producer", r.played,
+           n > 1 ? dev[(n - 1) / 2] / 1e3 : 0, n > 1 ? dev[(size_t)((n - 2) * 0.99)] / 1e3 : 0,
+           n > 1 ? dev[n - 2] / 1e3 : 0, r.maxLatency / 1e6, count * duration / 1e6, dry);
+    if (allocs1 < 0) printf("%8s\n", "n/a");
+    else printf("%8ld\n", allocs2 - allocs1);
+    free(dev);
+    free(r.times);
+    return ok;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 5;
+    double bufferMs = argc > 2 ? atof(argv[2]) : 10;
+    UInt32 count = argc > 3 ? (UInt32)atoi(argv[3]) : 3;
+    UInt32 busy = argc > 4 ? (UInt32)atoi(argv[4]) : 0;
+    if (seconds <= 0) seconds = 5;
+    if (bufferMs < 1) bufferMs = 1;
+    if (count < 1) count = 1;
+    if (count > kMaxBuffers) count = kMaxBuffers;
+    if (busy > kMaxBusy) busy = kMaxBusy;
+
+    volatile int stop = 0;
+    Busy threads[kMaxBusy];
+    for (UInt32 i = 0; i < busy; ++i) {
+        threads[i].stop = &stop;
+        bench_thread_start(&threads[i].thread, busy_main, &threads[i]);
+    }
+
+    printf("%u buffers of %.1f ms on the null sink, %u busy threads, %.0f s\n", count, bufferMs, busy, seconds);
+    printf("%-9s %6s %8s %8s %8s %10s %8s %6s %8s\n", "refill", "played", "p50 us", "p99 us", "max us",
+           "latency ms", "bound ms", "dry", "allocs");
+    bool ok = run(count, bufferMs, seconds, false) && run(count, bufferMs, seconds, true);
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (UInt32 i = 0; i < busy; ++i) bench_thread_join(&threads[i].thread);
+    return ok ? 0 : 1;
+}
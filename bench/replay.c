@@ -0,0 +1,388 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Plays back a capture, see wat4ff_capture_start(), as fast as the backend
+ * allows: the same converters, properties and output requests, fed the same
+ * input in the same pieces. Converters play on the thread that created them
+ * in the capture, or spread over a given number of threads. Reports audio
+ * throughput and call latency percentiles next to the captured ones, and
+ * counts calls that came out differently. The backend is whatever wat4ff
+ * loads, so WAT4FF_HOST, WAT4FF_POOL and the mock knobs all apply.
+ *
+ * wat4ff_bench_replay file [threads] [runs]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "capture.h"
+
+
+enum {
+    kMaxThreads = 64,
+    kMaxDescs   = 1024,                 // Handed over by one input proc call
+};
+
+typedef struct Conv {
+    AudioStreamBasicDescription from;
+    AudioStreamBasicDescription to;
+    UInt32 thread;                      // Replay thread that owns it
+    AudioConverterRef ref;
+    const CaptureRecord** inputs;       // In capture order
+    UInt32 inputCount;
+    UInt32 next;                        // Next input to hand over
+    UInt32 used;                        // Packets of it handed over already
+    UInt64 fed;                         // Packets handed over in all
+    AudioStreamPacketDescription descs[kMaxDescs];
+}Conv;
+
+typedef struct Samples {
+    SInt64* v;
+    size_t count;
+    size_t capacity;
+}Samples;
+
+typedef struct Worker {
+    BenchThread thread;
+    UInt32 index;
+    UInt64 calls;
+    UInt64 mismatches;
+    UInt64 failures;
+    double seconds;                     // Of audio converted
+    Samples fill;
+    Samples create;
+    UInt8* out;
+    size_t outSize;
+}Worker;
+
+static const CaptureRecord** records_;
+static size_t record_count_;
+static Conv* convs_;
+static UInt32 conv_count_;
+
+
+static void
+sample_add(Samples* s, SInt64 v) {
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 1024;
+        s->v = realloc(s->v, s->capacity * sizeof(*s->v));
+        if (!s->v) exit(1);
+    }
+    s->v[s->count++] = v;
+}
+
+static int
+compare_ns(const void* a, const void* b) {
+    SInt64 x = *(const SInt64*)a, y = *(const SInt64*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+print_percentiles(const char* label, Samples* s) {
+    if (!s->count) {
+        printf("%-16s  -\n", label);
+        return;
+    }
+    qsort(s->v, s->count, sizeof(*s->v), compare_ns);
+    static const double kAt[] = { 0.5, 0.9, 0.99, 0.999 };
+    printf("%-16s ", label);
+    for (int i = 0; i < 4; ++i) printf(" p%-5g %8.1f us", kAt[i] * 100, s->v[(size_t)(kAt[i] * (s->count - 1))] / 1e3);
+    printf("  max %8.1f us\n", s->v[s->count - 1] / 1e3);
+}
+
+static const void*
+payload(const CaptureRecord* r) {
+    return r + 1;
+}
+
+// Hands over the captured input in order, split when the converter asks
+// for fewer packets than were given to it in the capture.
+static OSStatus
+input_proc(AudioConverterRef ref, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Conv* c = user;
+    if (c->next == c->inputCount) {
+        *packets = 0;
+        return noErr;
+    }
+    const CaptureRecord* r = c->inputs[c->next];
+    if (!r->b || r->status != noErr) {
+        ++c->next;
+        *packets = 0;
+        return r->status;
+    }
+
+    UInt32 left = r->b - c->used;
+    UInt32 n = *packets && *packets < left ? *packets : left;
+    const CaptureBuffer* buffers = payload(r);
+    const UInt8* at = (const UInt8*)(buffers + r->c);
+    const AudioStreamPacketDescription* captured = NULL;
+    if (r->flags & kCaptureHasDescs) {
+        const UInt8* p = at;
+        for (UInt32 i = 0; i < r->c; ++i) p += (buffers[i].bytes + 7) & ~7u;
+        captured = (const AudioStreamPacketDescription*)p;
+        if (n > kMaxDescs) n = kMaxDescs;
+    }
+
+    UInt32 count = r->c < data->mNumberBuffers ? r->c : data->mNumberBuffers;
+    for (UInt32 i = 0; i < count; ++i) {
+        UInt32 begin, end;
+        if (captured) {
+            begin = (UInt32)captured[c->used].mStartOffset;
+            end = (UInt32)captured[c->used + n - 1].mStartOffset + captured[c->used + n - 1].mDataByteSize;
+        }
+        else {
+            UInt32 per = buffers[i].bytes / r->b;
+            begin = c->used * per;
+            end = (c->used + n) * per;
+        }
+        data->mBuffers[i].mNumberChannels = buffers[i].channels;
+        data->mBuffers[i].mData = (void*)(at + begin);
+        data->mBuffers[i].mDataByteSize = end - begin;
+        at += (buffers[i].bytes + 7) & ~7u;
+    }
+    data->mNumberBuffers = count;
+    if (descs) {
+        *descs = NULL;
+        if (captured) {
+            for (UInt32 i = 0; i < n; ++i) {
+                c->descs[i] = captured[c->used + i];
+                c->descs[i].mStartOffset -= captured[c->used].mStartOffset;
+            }
+            *descs = c->descs;
+        }
+    }
+
+    c->used += n;
+    c->fed += n;
+    if (c->used == r->b) {
+        c->used = 0;
+        ++c->next;
+    }
+    *packets = n;
+    return noErr;
+}
+
+static double
+frames_to_seconds(const AudioStreamBasicDescription* f, UInt64 packets) {
+    return f->mSampleRate > 0 && f->mFramesPerPacket ? (double)packets * f->mFramesPerPacket / f->mSampleRate : 0;
+}
+
+static void
+replay_fill(Worker* w, Conv* c, const CaptureRecord* r) {
+    const CaptureBuffer* buffers = payload(r);
+    size_t need = 0;
+    for (UInt32 i = 0; i < r->c; ++i) need += (buffers[i].bytes + 15) & ~15u;
+    need += (size_t)r->a * sizeof(AudioStreamPacketDescription);
+    if (need > w->outSize) {
+        free(w->out);
+        w->out = malloc(need);
+        w->outSize = w->out ? need : 0;
+        if (!w->out) exit(1);
+    }
+
+    Wat4ffBufferList list;
+    list.room.mNumberBuffers = r->c;
+    UInt8* p = w->out;
+    for (UInt32 i = 0; i < r->c; ++i) {
+        list.room.mBuffers[i] = (AudioBuffer){ buffers[i].channels, buffers[i].bytes, p };
+        p += (buffers[i].bytes + 15) & ~15u;
+    }
+    AudioStreamPacketDescription* descs = r->flags & kCaptureHasDescs ? (AudioStreamPacketDescription*)p : NULL;
+
+    UInt32 packets = r->a;
+    UInt64 fed = c->fed;
+    int64_t t0 = bench_now_ns();
+    OSStatus rc = AudioConverterFillComplexBuffer(c->ref, input_proc, c, &packets, &list.abl, descs);
+    sample_add(&w->fill, bench_now_ns() - t0);
+    if (rc != r->status || packets != r->b) ++w->mismatches;
+    if (rc && !r->status) ++w->failures;
+    w->seconds += c->to.mFormatID == kAudioFormatLinearPCM ? frames_to_seconds(&c->to, packets)
+                                                          : frames_to_seconds(&c->from, c->fed - fed);
+}
+
+static void
+replay(Worker* w, const CaptureRecord* r) {
+    Conv* c = &convs_[r->conv - 1];
+    ++w->calls;
+    switch (r->op) {
+    case kCaptureNew: {
+        int64_t t0 = bench_now_ns();
+        OSStatus rc = AudioConverterNew(&c->from, &c->to, &c->ref);
+        sample_add(&w->create, bench_now_ns() - t0);
+        if (rc) {
+            c->ref = NULL;
+            ++w->failures;
+        }
+        c->next = c->used = 0;
+        break;
+    }
+    case kCaptureSetProperty:
+        if (AudioConverterSetProperty(c->ref, r->a, r->b, payload(r)) != r->status) ++w->mismatches;
+        break;
+    case kCaptureReset:
+        if (AudioConverterReset(c->ref) != r->status) ++w->mismatches;
+        break;
+    case kCaptureDispose:
+        AudioConverterDispose(c->ref);
+        c->ref = NULL;
+        break;
+    case kCaptureFill:
+        replay_fill(w, c, r);
+        break;
+    }
+}
+
+static void
+worker_main(void* param) {
+    Worker* w = param;
+    for (size_t i = 0; i < record_count_; ++i) {
+        const CaptureRecord* r = records_[i];
+        if (r->op == kCaptureInput || !r->conv || r->conv > conv_count_) continue;
+        Conv* c = &convs_[r->conv - 1];
+        if (c->thread != w->index || (!c->ref && r->op != kCaptureNew)) continue;
+        replay(w, r);
+    }
+    for (UInt32 i = 0; i < conv_count_; ++i) {
+        if (convs_[i].thread == w->index && convs_[i].ref) {
+            AudioConverterDispose(convs_[i].ref);
+            convs_[i].ref = NULL;
+        }
+    }
+}
+
+// Indexes the records, a record cut short at the end is dropped.
+static bool
+load(const char* path, UInt8** file) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *file = size > 0 ? malloc((size_t)size) : NULL;
+    bool ok = *file && fread(*file, 1, (size_t)size, f) == (size_t)size;
+    fclose(f);
+    const CaptureHeader* h = (const CaptureHeader*)*file;
+    if (!ok || (size_t)size < sizeof(*h) || h->magic != kCaptureMagic || h->version != kCaptureVersion) return false;
+
+    size_t capacity = 0;
+    for (size_t at = sizeof(*h); at + sizeof(CaptureRecord) <= (size_t)size;) {
+        const CaptureRecord* r = (const CaptureRecord*)(*file + at);
+        if (r->size < sizeof(*r) || r->size % 8 || r->size > (size_t)size - at) break;
+        if (record_count_ == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            records_ = realloc(records_, capacity * sizeof(*records_));
+            if (!records_) return false;
+        }
+        records_[record_count_++] = r;
+        if (r->op == kCaptureNew && r->conv > conv_count_) conv_count_ = r->conv;
+        at += r->size;
+    }
+    return true;
+}
+
+// Gives each converter its formats, its input records and a thread, the
+// one it was created on, or round robin.
+static UInt32
+assign(UInt32 threads) {
+    convs_ = calloc(conv_count_ ? conv_count_ : 1, sizeof(*convs_));
+    UInt32 tids[kMaxThreads];
+    UInt32 tid_count = 0;
+    UInt32 created = 0;
+    for (size_t i = 0; i < record_count_; ++i) {
+        const CaptureRecord* r = records_[i];
+        if (!r->conv || r->conv > conv_count_) continue;
+        Conv* c = &convs_[r->conv - 1];
+        if (r->op == kCaptureNew) {
+            const AudioStreamBasicDescription* f = payload(r);
+            c->from = f[0];
+            c->to = f[1];
+            if (threads) {
+                c->thread = created++ % threads;
+                continue;
+            }
+            UInt32 t = 0;
+            while (t < tid_count && tids[t] != r->thread) ++t;
+            if (t == tid_count && tid_count < kMaxThreads) tids[tid_count++] = r->thread;
+            c->thread = t < kMaxThreads ? t : t % kMaxThreads;
+        }
+        else if (r->op == kCaptureInput) {
+            if (!(c->inputCount & (c->inputCount + 1)) || !c->inputs) {
+                c->inputs = realloc(c->inputs, (c->inputCount + 1) * 2 * sizeof(*c->inputs));
+                if (!c->inputs) exit(1);
+            }
+            c->inputs[c->inputCount++] = r;
+        }
+    }
+    return threads ? threads : tid_count ? tid_count : 1;
+}
+
+static void
+captured_latency(Samples* fill, Samples* create) {
+    for (size_t i = 0; i < record_count_; ++i) {
+        const CaptureRecord* r = records_[i];
+        if (r->op == kCaptureFill) sample_add(fill, r->nanos);
+        else if (r->op == kCaptureNew && r->conv) sample_add(create, r->nanos);
+    }
+}
+
+int
+main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file [threads] [runs]\n", argv[0]);
+        return 2;
+    }
+    UInt32 threads = argc > 2 ? (UInt32)atoi(argv[2]) : 0;
+    int runs = argc > 3 ? atoi(argv[3]) : 1;
+    if (threads > kMaxThreads) threads = kMaxThreads;
+    if (runs < 1) runs = 1;
+
+    UInt8* file = NULL;
+    if (!load(argv[1], &file)) {
+        fprintf(stderr, "cannot read capture %s\n", argv[1]);
+        return 1;
+    }
+    threads = assign(threads);
+    wat4ff_preload();
+
+    static Worker w[kMaxThreads];
+    int64_t t0 = bench_now_ns();
+    for (int run = 0; run < runs; ++run) {
+        for (UInt32 i = 0; i < threads; ++i) {
+            w[i].index = i;
+            bench_thread_start(&w[i].thread, worker_main, &w[i]);
+        }
+        for (UInt32 i = 0; i < threads; ++i) bench_thread_join(&w[i].thread);
+    }
+    double wall = (bench_now_ns() - t0) / 1e9;
+
+    Worker total = { 0 };
+    for (UInt32 i = 0; i < threads; ++i) {
+        total.calls += w[i].calls;
+        total.mismatches += w[i].mismatches;
+        total.failures += w[i].failures;
+        total.seconds += w[i].seconds;
+        for (size_t k = 0; k < w[i].fill.count; ++k) sample_add(&total.fill, w[i].fill.v[k]);
+        for (size_t k = 0; k < w[i].create.count; ++k) sample_add(&total.create, w[i].create.v[k]);
+    }
+    Samples fill = { 0 }, create = { 0 };
+    captured_latency(&fill, &create);
+
+    printf("capture:          %zu records, %u converters\n", record_count_, conv_count_);
+    printf("replay:           %d run(s) on %u threads in %.3f s\n", runs, threads, wall);
+    printf("throughput:       %.1f s of audio/s, %.0f calls/s\n", total.seconds / wall, total.calls / wall);
+    print_percentiles("fill, captured", &fill);
+    print_percentiles("fill, replayed", &total.fill);
+    print_percentiles("new, captured", &create);
+    print_percentiles("new, replayed", &total.create);
+    printf("differences:      %llu calls, %llu failed\n",
+           (unsigned long long)total.mismatches, (unsigned long long)total.failures);
+    return total.failures ? 1 : 0;
+}
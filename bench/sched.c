@@ -0,0 +1,408 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Many live, low bitrate AAC streams, 24 kHz mono fed 20 ms at a time in
+ * real time, alongside a few bulk encodes fed as fast as they go. First
+ * with a thread per stream, each sleeping until its next chunk and then
+ * encoding it, then with the stream scheduler on a worker per CPU, or on
+ * threads workers. Latency is from the time a packet's last chunk was due
+ * to the packet's emit, late is over the 50 ms deadline. Also reports bulk
+ * throughput, CPU time, and the scheduler's worker utilization and steals.
+ * Set WAT4FF_MOCK_PACKET_US to give the stand-in codec some work to do.
+ *
+ * wat4ff_bench_sched [live streams] [seconds] [bulk streams] [threads]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate        = 24000,
+    kChunk       = 480,                 // 20 ms
+    kBulkChunk   = 4096,
+    kMaxOut      = 4,
+    kBulkOut     = 64,
+    kDeadlineMs  = 50,
+    kNoInput     = -1,
+    kMaxStreams  = 4096,
+};
+
+static const int64_t kChunkNs = (int64_t)kChunk * 1000000000 / kRate;
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, 1);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = 1,
+};
+
+static SInt16 pcm_[kBulkChunk];
+
+typedef struct Live {
+    int64_t start;                      // Chunk c is due at start + (c + 1) * kChunkNs
+    int64_t until;
+    UInt32 fpp;
+    UInt32 leading;
+    UInt64 packets;
+    int64_t* latency;
+    UInt32 count;
+    UInt32 capacity;
+    UInt32 late;
+
+    AudioConverterRef conv;             // Thread per stream
+    BenchThread thread;
+    bool fed;
+    UInt8* out;
+    UInt32 outSize;
+    AudioStreamPacketDescription descs[kMaxOut];
+    Wat4ffSchedStream* stream;          // Scheduled
+}Live;
+
+typedef struct Bulk {
+    int64_t until;
+    UInt64 packets;
+    AudioConverterRef conv;
+    BenchThread thread;
+    UInt8* out;
+    UInt32 outSize;
+    AudioStreamPacketDescription descs[kBulkOut];
+    Wat4ffSchedStream* stream;
+}Bulk;
+
+typedef struct Feeder {
+    Bulk* bulk;
+    UInt32 count;
+    int64_t until;
+    BenchThread thread;
+}Feeder;
+
+
+static void
+sleep_until(int64_t t) {
+#ifdef _WIN32
+    int64_t left = t - bench_now_ns();
+    if (left > 0) Sleep((DWORD)((left + 999999) / 1000000));
+#else
+    struct timespec ts = { t / 1000000000, t % 1000000000 };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+#endif
+}
+
+static int
+compare_i64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+live_emit(void* user, const UInt8* data, const AudioStreamPacketDescription* packets, UInt32 count) {
+    Live* l = user;
+    int64_t now = bench_now_ns();
+    for (UInt32 i = 0; i < count; ++i) {
+        UInt64 covered = ++l->packets * l->fpp;
+        covered = covered > l->leading ? covered - l->leading : 1;
+        int64_t latency = now - (l->start + (int64_t)((covered - 1) / kChunk + 1) * kChunkNs);
+        if (latency > (int64_t)kDeadlineMs * 1000000) ++l->late;
+        if (l->count < l->capacity) l->latency[l->count++] = latency;
+    }
+}
+
+static void
+bulk_emit(void* user, const UInt8* data, const AudioStreamPacketDescription* packets, UInt32 count) {
+    ((Bulk*)user)->packets += count;
+}
+
+
+// Thread per stream +++
+
+static OSStatus
+chunk_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Live* l = user;
+    if (l->fed) {
+        *packets = 0;
+        return kNoInput;
+    }
+    l->fed = true;
+    *packets = kChunk;
+    data->mBuffers[0].mData = pcm_;
+    data->mBuffers[0].mDataByteSize = kChunk * 2;
+    data->mBuffers[0].mNumberChannels = 1;
+    return noErr;
+}
+
+static void
+live_main(void* param) {
+    Live* l = param;
+    for (int64_t c = 0;; ++c) {
+        int64_t due = l->start + (c + 1) * kChunkNs;
+        if (due > l->until) break;
+        sleep_until(due);
+        l->fed = false;
+        UInt32 n = kMaxOut;
+        AudioBufferList list = { 1, { { 1, l->outSize, l->out } } };
+        OSStatus rc = AudioConverterFillComplexBuffer(l->conv, chunk_proc, l, &n, &list, l->descs);
+        if (rc && rc != kNoInput) break;
+        if (n) live_emit(l, l->out, l->descs, n);
+    }
+}
+
+static OSStatus
+endless_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+             AudioStreamPacketDescription** descs, void* user) {
+    if (*packets > kBulkChunk) *packets = kBulkChunk;
+    data->mBuffers[0].mData = pcm_;
+    data->mBuffers[0].mDataByteSize = *packets * 2;
+    data->mBuffers[0].mNumberChannels = 1;
+    return noErr;
+}
+
+static void
+bulk_main(void* param) {
+    Bulk* b = param;
+    while (bench_now_ns() < b->until) {
+        UInt32 n = kBulkOut;
+        AudioBufferList list = { 1, { { 1, b->outSize, b->out } } };
+        if (AudioConverterFillComplexBuffer(b->conv, endless_proc, b, &n, &list, b->descs) || !n) break;
+        b->packets += n;
+    }
+}
+
+static bool
+new_converter(AudioConverterRef* conv, UInt8** out, UInt32* outSize, UInt32 packets, UInt32* fpp, UInt32* leading) {
+    if (AudioConverterNew(&kPcm, &kAac, conv)) return false;
+    UInt32 maxPacket = 0;
+    UInt32 size = sizeof(maxPacket);
+    AudioConverterGetProperty(*conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &maxPacket);
+    AudioStreamBasicDescription fmt;
+    size = sizeof(fmt);
+    AudioConverterGetProperty(*conv, kAudioConverterCurrentOutputStreamDescription, &size, &fmt);
+    AudioConverterPrimeInfo prime = { 0, 0 };
+    size = sizeof(prime);
+    AudioConverterGetProperty(*conv, kAudioConverterPrimeInfo, &size, &prime);
+    if (fpp) *fpp = fmt.mFramesPerPacket;
+    if (leading) *leading = prime.leadingFrames;
+    *outSize = maxPacket * packets;
+    *out = malloc(*outSize);
+    return *out != NULL;
+}
+
+static bool
+run_threads(Live* live, UInt32 liveCount, Bulk* bulk, UInt32 bulkCount) {
+    bool ok = true;
+    for (UInt32 i = 0; i < liveCount && ok; ++i) {
+        ok = new_converter(&live[i].conv, &live[i].out, &live[i].outSize, kMaxOut, &live[i].fpp, &live[i].leading);
+    }
+    for (UInt32 i = 0; i < bulkCount && ok; ++i) {
+        ok = new_converter(&bulk[i].conv, &bulk[i].out, &bulk[i].outSize, kBulkOut, NULL, NULL);
+    }
+    UInt32 liveStarted = 0, bulkStarted = 0;
+    for (; ok && liveStarted < liveCount; ++liveStarted) {
+        ok = bench_thread_start(&live[liveStarted].thread, live_main, &live[liveStarted]);
+        if (!ok) break;
+    }
+    for (; ok && bulkStarted < bulkCount; ++bulkStarted) {
+        ok = bench_thread_start(&bulk[bulkStarted].thread, bulk_main, &bulk[bulkStarted]);
+        if (!ok) break;
+    }
+    for (UInt32 i = 0; i < liveStarted; ++i) bench_thread_join(&live[i].thread);
+    for (UInt32 i = 0; i < bulkStarted; ++i) bench_thread_join(&bulk[i].thread);
+    for (UInt32 i = 0; i < liveCount; ++i) {
+        if (live[i].conv) AudioConverterDispose(live[i].conv);
+        free(live[i].out);
+    }
+    for (UInt32 i = 0; i < bulkCount; ++i) {
+        if (bulk[i].conv) AudioConverterDispose(bulk[i].conv);
+        free(bulk[i].out);
+    }
+    if (!ok) fprintf(stderr, "cannot start %u threads\n", liveCount + bulkCount);
+    return ok;
+}
+
+// Thread per stream ---
+
+
+// Scheduled +++
+
+// Keeps every bulk stream's queue topped up, napping when all are full.
+static void
+feeder_main(void* param) {
+    Feeder* f = param;
+    while (bench_now_ns() < f->until) {
+        bool pushed = false;
+        for (UInt32 i = 0; i < f->count; ++i) {
+            if (!wat4ff_sched_push(f->bulk[i].stream, false, pcm_, kBulkChunk)) pushed = true;
+        }
+        if (!pushed) bench_sleep_ms(1);
+    }
+}
+
+static void
+print_sched_stats(const Wat4ffSchedStats* st) {
+    UInt64 quanta = 0, steals = 0;
+    printf("%-9s", "workers");
+    for (UInt32 i = 0; i < st->workerCount; ++i) {
+        const Wat4ffSchedWorkerStats* w = &st->workers[i];
+        quanta += w->quanta;
+        steals += w->steals;
+        printf(" %5.1f%%", w->elapsedNanos ? 100.0 * w->busyNanos / w->elapsedNanos : 0);
+    }
+    printf(" busy, %llu turns, %llu steals\n", (unsigned long long)quanta, (unsigned long long)steals);
+}
+
+static bool
+run_sched(Live* live, UInt32 liveCount, Bulk* bulk, UInt32 bulkCount, UInt32 threads, int64_t until,
+          Wat4ffSchedStats* stats) {
+    Wat4ffScheduler* sched;
+    if (wat4ff_sched_open(threads, &sched)) {
+        fprintf(stderr, "cannot open the scheduler\n");
+        return false;
+    }
+    bool ok = true;
+    for (UInt32 i = 0; i < liveCount && ok; ++i) {
+        Wat4ffSchedStreamConfig cfg = {
+            .input = kPcm, .output = kAac, .deadlineMillis = kDeadlineMs, .emit = live_emit, .emitUser = &live[i],
+        };
+        ok = !wat4ff_sched_add(sched, &cfg, &live[i].stream);
+        if (!ok) break;
+        Wat4ffStreamInfo info;
+        wat4ff_sched_get_info(live[i].stream, &info);
+        live[i].fpp = info.framesPerPacket;
+        live[i].leading = info.prime.leadingFrames;
+    }
+    for (UInt32 i = 0; i < bulkCount && ok; ++i) {
+        Wat4ffSchedStreamConfig cfg = { .input = kPcm, .output = kAac, .emit = bulk_emit, .emitUser = &bulk[i] };
+        ok = !wat4ff_sched_add(sched, &cfg, &bulk[i].stream);
+    }
+    Feeder feeder = { bulk, bulkCount, until };
+    bool feeding = ok && bulkCount && bench_thread_start(&feeder.thread, feeder_main, &feeder);
+
+    // One thread paces every live stream, in the order their chunks fall due.
+    for (int64_t c = 0; ok; ++c) {
+        if (live[0].start + (c + 1) * kChunkNs > until) break;
+        for (UInt32 i = 0; i < liveCount && ok; ++i) {
+            int64_t due = live[i].start + (c + 1) * kChunkNs;
+            if (due > until) break;
+            sleep_until(due);
+            ok = !wat4ff_sched_push(live[i].stream, false, pcm_, kChunk);
+        }
+    }
+    if (feeding) bench_thread_join(&feeder.thread);
+    for (UInt32 i = 0; i < liveCount; ++i) {
+        if (live[i].stream) wat4ff_sched_wait(live[i].stream);
+    }
+    wat4ff_sched_get_stats(sched, stats);
+
+    for (UInt32 i = 0; i < liveCount; ++i) wat4ff_sched_remove(live[i].stream);
+    for (UInt32 i = 0; i < bulkCount; ++i) wat4ff_sched_remove(bulk[i].stream);
+    wat4ff_sched_close(sched);
+    if (!ok) fprintf(stderr, "scheduled run failed\n");
+    return ok;
+}
+
+// Scheduled ---
+
+
+static void
+reset(Live* live, UInt32 liveCount, Bulk* bulk, UInt32 bulkCount, double seconds, int64_t* until) {
+    int64_t start = bench_now_ns() + 100000000;
+    *until = start + (int64_t)(seconds * 1e9);
+    for (UInt32 i = 0; i < liveCount; ++i) {
+        int64_t* latency = live[i].latency;
+        UInt32 capacity = live[i].capacity;
+        memset(&live[i], 0, sizeof(live[i]));
+        live[i].latency = latency;
+        live[i].capacity = capacity;
+        live[i].start = start + kChunkNs * i / liveCount;
+        live[i].until = *until;
+    }
+    for (UInt32 i = 0; i < bulkCount; ++i) {
+        memset(&bulk[i], 0, sizeof(bulk[i]));
+        bulk[i].until = *until;
+    }
+}
+
+static void
+report(const char* mode, UInt32 threads, Live* live, UInt32 liveCount, Bulk* bulk, UInt32 bulkCount,
+       double seconds, int64_t cpu) {
+    UInt64 n = 0, late = 0, bulkPackets = 0;
+    for (UInt32 i = 0; i < liveCount; ++i) {
+        n += live[i].count;
+        late += live[i].late;
+    }
+    for (UInt32 i = 0; i < bulkCount; ++i) bulkPackets += bulk[i].packets;
+    int64_t* all = malloc(sizeof(*all) * (n ? n : 1));
+    UInt64 k = 0;
+    for (UInt32 i = 0; i < liveCount; ++i) {
+        memcpy(all + k, live[i].latency, sizeof(*all) * live[i].count);
+        k += live[i].count;
+    }
+    if (n) qsort(all, n, sizeof(*all), compare_i64);
+    printf("%-9s %7u %8llu %8.2f %8.2f %8.2f %7llu %10.0f %7.2f\n", mode, threads, (unsigned long long)n,
+           n ? all[n / 2] / 1e6 : 0, n ? all[(size_t)((n - 1) * 0.99)] / 1e6 : 0, n ? all[n - 1] / 1e6 : 0,
+           (unsigned long long)late, bulkPackets / seconds, cpu / 1e9);
+    free(all);
+}
+
+int
+main(int argc, char** argv) {
+    UInt32 liveCount = argc > 1 ? (UInt32)atoi(argv[1]) : 200;
+    double seconds = argc > 2 ? atof(argv[2]) : 10;
+    UInt32 bulkCount = argc > 3 ? (UInt32)atoi(argv[3]) : 2;
+    UInt32 threads = argc > 4 ? (UInt32)atoi(argv[4]) : 0;
+    if (liveCount < 1) liveCount = 1;
+    if (liveCount > kMaxStreams) liveCount = kMaxStreams;
+    if (bulkCount > kMaxStreams) bulkCount = kMaxStreams;
+    if (seconds <= 0) seconds = 10;
+
+    UInt32 seed = 1;
+    for (UInt32 i = 0; i < kBulkChunk; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        pcm_[i] = (SInt16)(seed >> 16);
+    }
+    Live* live = calloc(liveCount, sizeof(*live));
+    Bulk* bulk = calloc(bulkCount ? bulkCount : 1, sizeof(*bulk));
+    if (!live || !bulk) return 1;
+    UInt32 capacity = (UInt32)(seconds * kRate / 1024) + 16;
+    for (UInt32 i = 0; i < liveCount; ++i) {
+        live[i].latency = malloc(sizeof(*live[i].latency) * capacity);
+        live[i].capacity = capacity;
+        if (!live[i].latency) return 1;
+    }
+
+    printf("%u live streams of 24 kHz mono AAC in 20 ms chunks, %u bulk, %.0f s, %u ms deadline\n",
+           liveCount, bulkCount, seconds, kDeadlineMs);
+    printf("%-9s %7s %8s %8s %8s %8s %7s %10s %7s\n", "mode", "threads", "packets", "p50 ms", "p99 ms",
+           "max ms", "late", "bulk pkt/s", "cpu s");
+
+    int64_t until;
+    reset(live, liveCount, bulk, bulkCount, seconds, &until);
+    int64_t cpu = bench_cpu_ns();
+    bool ok = run_threads(live, liveCount, bulk, bulkCount);
+    if (ok) report("thread", liveCount + bulkCount, live, liveCount, bulk, bulkCount, seconds, bench_cpu_ns() - cpu);
+
+    reset(live, liveCount, bulk, bulkCount, seconds, &until);
+    cpu = bench_cpu_ns();
+    Wat4ffSchedStats st;
+    ok = ok && run_sched(live, liveCount, bulk, bulkCount, threads, until, &st);
+    if (ok) {
+        report("sched", st.workerCount, live, liveCount, bulk, bulkCount, seconds, bench_cpu_ns() - cpu);
+        print_sched_stats(&st);
+    }
+
+    for (UInt32 i = 0; i < liveCount; ++i) free(live[i].latency);
+    free(live);
+    free(bulk);
+    return ok ? 0 : 1;
+}
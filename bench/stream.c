@@ -0,0 +1,174 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes PCM the usual way, producing it inside the input proc, then with
+ * the streaming encoder at several queue depths, producing it on this
+ * thread while the worker encodes. Producing costs produce_us per 1024
+ * frames, standing in for ffmpeg's decoding and filtering. Latency is from
+ * pushing the last frame a packet needs to pulling the packet. Every run
+ * must match the usual one.
+ * Set WAT4FF_MOCK_PACKET_US to give the stand-in codec some work to do.
+ *
+ * wat4ff_bench_stream [seconds] [produce_us] [queue frames]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate     = 44100,
+    kChannels = 2,
+    kBlock    = 1024,
+    kFill     = 64,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Source {
+    UInt64 frames;
+    UInt64 pos;
+    long produceUs;
+    SInt16 buf[kBlock * kChannels];
+}Source;
+
+// Makes the next block, busy for as long as a decoder would be.
+static UInt32
+produce(Source* s) {
+    int64_t until = bench_now_ns() + (int64_t)s->produceUs * 1000;
+    UInt64 left = s->frames - s->pos;
+    UInt32 n = left < kBlock ? (UInt32)left : kBlock;
+    for (UInt32 i = 0; i < n * kChannels; ++i) {
+        s->buf[i] = (SInt16)(((s->pos * kChannels + i) * 2654435761u) >> 16);
+    }
+    s->pos += n;
+    while (bench_now_ns() < until) {}
+    return n;
+}
+
+static OSStatus
+input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Source* s = user;
+    *packets = produce(s);
+    data->mBuffers[0].mData = s->buf;
+    data->mBuffers[0].mDataByteSize = *packets * kPcm.mBytesPerFrame;
+    data->mBuffers[0].mNumberChannels = kChannels;
+    return noErr;
+}
+
+static Digest
+encode_serial(Source* src) {
+    Digest d = digest_new();
+    encode_plain(&kPcm, &kAac, NULL, 0, input_proc, src, &d);
+    return d;
+}
+
+typedef struct Pulled {
+    Digest digest;
+    int64_t* at;                      // When each packet was pulled
+    UInt8* data;
+    UInt32 dataSize;
+}Pulled;
+
+static OSStatus
+pull_ready(Wat4ffStreamEncoder* enc, bool wait, Pulled* p) {
+    AudioStreamPacketDescription packets[kFill];
+    UInt32 n = kFill;
+    OSStatus rc = wat4ff_enc_pull(enc, wait, p->data, p->dataSize, packets, &n);
+    int64_t now = bench_now_ns();
+    for (UInt32 i = 0; i < n; ++i) p->at[p->digest.packets + i] = now;
+    p->digest = digest_packets(p->digest, p->data, packets, n);
+    return rc;
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 120;
+    long produce_us = argc > 2 ? atol(argv[2]) : 200;
+    UInt32 queue = argc > 3 ? (UInt32)atoi(argv[3]) : 0;
+
+    UInt64 frames = (UInt64)(seconds * kRate);
+    UInt64 blocks = (frames + kBlock - 1) / kBlock;
+    Source* src = calloc(1, sizeof(*src));
+    *src = (Source){ frames, 0, produce_us };
+    int64_t t0 = bench_now_ns();
+    Digest serial = encode_serial(src);
+    double t_serial = (bench_now_ns() - t0) / 1e9;
+    printf("input:        %.1f s, %llu frames, %llu packets\n",
+           seconds, (unsigned long long)frames, (unsigned long long)serial.packets);
+    printf("serial:       %.1fx realtime\n", seconds / t_serial);
+
+    int64_t* pushed_at = malloc(sizeof(int64_t) * blocks);
+    bool ok = serial.packets > 0;
+    for (UInt32 depth = 1; depth <= 16 && ok; depth *= 2) {
+        Wat4ffStreamConfig cfg = { .input = kPcm, .output = kAac, .queueFrames = queue, .depth = depth };
+        Wat4ffStreamEncoder* enc;
+        OSStatus rc = wat4ff_enc_open(&cfg, &enc);
+        if (rc) {
+            fprintf(stderr, "open failed: %d\n", (int)rc);
+            return 1;
+        }
+        Wat4ffStreamInfo info;
+        wat4ff_enc_get_info(enc, &info);
+        Pulled p = { digest_new(), malloc(sizeof(int64_t) * (serial.packets + 16)) };
+        p.dataSize = info.maxPacketSize * kFill;
+        p.data = malloc(p.dataSize);
+
+        *src = (Source){ frames, 0, produce_us };
+        t0 = bench_now_ns();
+        for (UInt64 b = 0; b < blocks && !rc; ++b) {
+            UInt32 n = produce(src);
+            while ((rc = wat4ff_enc_push(enc, false, src->buf, n)) == kWat4ffQueueFull) {
+                rc = pull_ready(enc, true, &p);
+                if (rc) break;
+            }
+            pushed_at[b] = bench_now_ns();
+            if (!rc) rc = pull_ready(enc, false, &p);
+        }
+        if (!rc) rc = wat4ff_enc_push(enc, false, NULL, 0);
+        while (!rc) rc = pull_ready(enc, true, &p);
+        double t = (bench_now_ns() - t0) / 1e9;
+        wat4ff_enc_get_info(enc, &info);
+        wat4ff_enc_close(enc);
+
+        // Packet k needs input up to (k + 1) * fpp - leading, the last
+        // packet needs the end of the input.
+        double lat_sum = 0, lat_max = 0;
+        for (UInt64 k = 0; k < p.digest.packets; ++k) {
+            UInt64 need = (k + 1) * info.framesPerPacket;
+            need = need > info.prime.leadingFrames ? need - info.prime.leadingFrames : 1;
+            UInt64 b = (need - 1) / kBlock;
+            double ms = (p.at[k] - pushed_at[b < blocks ? b : blocks - 1]) / 1e6;
+            lat_sum += ms;
+            if (ms > lat_max) lat_max = ms;
+        }
+
+        bool same = rc == kWat4ffEndOfStream && digest_same(&p.digest, &serial);
+        printf("depth %2u:     %.1fx realtime %.2fx, latency mean %.2f ms max %.2f ms, %s\n",
+               depth, seconds / t, t_serial / t, p.digest.packets ? lat_sum / p.digest.packets : 0, lat_max,
+               same ? "identical" : "DIFFERS");
+        ok = same;
+        free(p.data);
+        free(p.at);
+    }
+
+    free(pushed_at);
+    free(src);
+    return ok ? 0 : 1;
+}
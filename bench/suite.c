@@ -0,0 +1,671 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The whole benchmark suite in one run, for gating changes: encode and
+ * decode throughput of AAC-LC, HE-AAC, ALAC, ulaw and alaw, each at its
+ * default of stereo, 1024 frame buffers and one thread, then with the
+ * channel count, buffer size and thread count varied one at a time. Also
+ * process cold start and the cost of a call through wat4ff. Each case is
+ * the best of five tries.
+ *
+ * Results go out as JSON, one metric per line. Each run also times a
+ * reference loop that never calls wat4ff, and metrics are compared with a
+ * baseline relative to it, so a baseline taken on another machine still
+ * gates. Every metric worse than the baseline by more than the threshold
+ * is reported and the exit status is 1.
+ *
+ *   wat4ff_bench [--seconds s] [--out file] [--baseline file]
+ *                [--threshold percent] [--filter text]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+
+enum {
+    kRate        = 44100,
+    kClipFrames  = kRate * 2,
+    kMaxChannels = 6,
+    kMaxThreads  = 8,
+    kMaxMetrics  = 256,
+    kTries       = 5,
+    kColdRuns    = 20,
+    kCalls       = 200000,
+};
+
+typedef struct Format {
+    const char* name;
+    AudioFormatID id;
+}Format;
+
+static const Format kFormats[] = {
+    { "aac",   kAudioFormatMPEG4AAC },
+    { "heaac", kAudioFormatMPEG4AAC_HE },
+    { "alac",  kAudioFormatAppleLossless },
+    { "ulaw",  kAudioFormatULaw },
+    { "alaw",  kAudioFormatALaw },
+};
+
+typedef struct Case {
+    const Format* format;
+    bool decode;
+    UInt32 channels;
+    UInt32 buffer;                      // Frames per input and output call
+    UInt32 threads;
+}Case;
+
+// A clip encoded once, with packets back to back, for the decode cases.
+typedef struct Clip {
+    AudioStreamBasicDescription format;
+    UInt8* data;
+    AudioStreamPacketDescription* descs;
+    UInt32 packets;
+    UInt8 cookie[1024];
+    UInt32 cookieSize;
+}Clip;
+
+typedef struct Worker {
+    BenchThread thread;
+    const Case* c;
+    const Clip* clip;
+    int64_t until;
+    UInt64 frames;
+    UInt64 packets;
+    bool ok;
+}Worker;
+
+typedef struct Metric {
+    char name[96];
+    char unit[24];
+    double value;
+    bool higherIsBetter;
+}Metric;
+
+typedef struct Source {
+    const SInt16* pcm;
+    UInt32 channels;
+    UInt32 pos;
+    UInt32 chunk;
+}Source;
+
+typedef struct PacketSource {
+    const Clip* clip;
+    UInt32 next;
+    UInt32 chunk;
+    AudioStreamPacketDescription* descs;
+}PacketSource;
+
+static SInt16 pcm_[kClipFrames * kMaxChannels];
+static Metric metrics_[kMaxMetrics];
+static int metric_count_ = 0;
+static double seconds_ = 0.2;
+static const char* filter_ = NULL;
+static const char* self_;
+
+
+static AudioStreamBasicDescription
+pcm_format(UInt32 channels) {
+    return (AudioStreamBasicDescription){
+        .mSampleRate       = kRate,
+        .mFormatID         = kAudioFormatLinearPCM,
+        .mFormatFlags      = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked,
+        .mBytesPerPacket   = channels * 2,
+        .mFramesPerPacket  = 1,
+        .mBytesPerFrame    = channels * 2,
+        .mChannelsPerFrame = channels,
+        .mBitsPerChannel   = 16,
+    };
+}
+
+static bool
+coded_format(AudioFormatID id, UInt32 channels, AudioStreamBasicDescription* f) {
+    *f = (AudioStreamBasicDescription){ .mSampleRate = kRate, .mFormatID = id, .mChannelsPerFrame = channels };
+    UInt32 size = sizeof(*f);
+    return AudioFormatGetProperty(kAudioFormatProperty_FormatInfo, 0, NULL, &size, f) == noErr;
+}
+
+// Packets per call for about buffer frames, never fewer than one.
+static UInt32
+packets_for(const AudioStreamBasicDescription* f, UInt32 buffer) {
+    UInt32 n = f->mFramesPerPacket ? buffer / f->mFramesPerPacket : buffer;
+    return n ? n : 1;
+}
+
+static bool
+add_metric(const char* name, const char* unit, double value, bool higherIsBetter) {
+    if (metric_count_ == kMaxMetrics) return false;
+    Metric* m = &metrics_[metric_count_++];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    snprintf(m->unit, sizeof(m->unit), "%s", unit);
+    m->value = value;
+    m->higherIsBetter = higherIsBetter;
+    return true;
+}
+
+static bool
+wanted(const char* name) {
+    return !filter_ || strstr(name, filter_);
+}
+
+
+// Codec +++
+
+static OSStatus
+pcm_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+         AudioStreamPacketDescription** descs, void* user) {
+    Source* s = user;
+    UInt32 n = kClipFrames - s->pos;
+    if (n > s->chunk) n = s->chunk;
+    if (n > *packets) n = *packets;
+    data->mBuffers[0].mData = (void*)(s->pcm + s->pos * s->channels);
+    data->mBuffers[0].mDataByteSize = n * s->channels * 2;
+    data->mBuffers[0].mNumberChannels = s->channels;
+    s->pos += n;
+    *packets = n;
+    return noErr;
+}
+
+static OSStatus
+packet_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    PacketSource* s = user;
+    const Clip* clip = s->clip;
+    UInt32 n = clip->packets - s->next;
+    if (n > s->chunk) n = s->chunk;
+    if (n > *packets) n = *packets;
+    *packets = n;
+    if (!n) return noErr;
+
+    const AudioStreamPacketDescription* first = &clip->descs[s->next];
+    const AudioStreamPacketDescription* last = first + n - 1;
+    data->mBuffers[0].mData = clip->data + first->mStartOffset;
+    data->mBuffers[0].mDataByteSize = (UInt32)(last->mStartOffset - first->mStartOffset) + last->mDataByteSize;
+    data->mBuffers[0].mNumberChannels = clip->format.mChannelsPerFrame;
+    if (descs) {
+        for (UInt32 i = 0; i < n; ++i) {
+            s->descs[i] = first[i];
+            s->descs[i].mStartOffset -= first->mStartOffset;
+        }
+        *descs = s->descs;
+    }
+    s->next += n;
+    return noErr;
+}
+
+// One pass over the clip through an encoder, appending packets to clip if
+// one is given.
+static bool
+encode_pass(AudioConverterRef conv, UInt32 channels, UInt32 buffer, const AudioStreamBasicDescription* out,
+            Clip* clip, UInt64* frames, UInt64* packets) {
+    UInt32 max_packet = 0;
+    UInt32 size = sizeof(max_packet);
+    if (AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &max_packet)) return false;
+    UInt32 ask = packets_for(out, buffer);
+    UInt32 bytes = ask * max_packet;
+    UInt8* buf = malloc(bytes);
+    AudioStreamPacketDescription* descs = malloc(ask * sizeof(*descs));
+    Source src = { pcm_, channels, 0, buffer };
+    bool ok = buf && descs;
+    while (ok) {
+        UInt32 n = ask;
+        AudioBufferList list = { 1, { { channels, bytes, buf } } };
+        if (AudioConverterFillComplexBuffer(conv, pcm_proc, &src, &n, &list, out->mBytesPerPacket ? NULL : descs)) ok = false;
+        if (!ok || !n) break;
+        *packets += n;
+        for (UInt32 i = 0; clip && i < n; ++i) {
+            SInt64 from = out->mBytesPerPacket ? (SInt64)i * out->mBytesPerPacket : descs[i].mStartOffset;
+            UInt32 len = out->mBytesPerPacket ? out->mBytesPerPacket : descs[i].mDataByteSize;
+            SInt64 at = clip->packets ? clip->descs[clip->packets - 1].mStartOffset + clip->descs[clip->packets - 1].mDataByteSize : 0;
+            memcpy(clip->data + at, buf + from, len);
+            clip->descs[clip->packets++] = (AudioStreamPacketDescription){ at, 0, len };
+        }
+    }
+    *frames += src.pos;
+    free(buf);
+    free(descs);
+    return ok;
+}
+
+static bool
+decode_pass(AudioConverterRef conv, UInt32 buffer, const Clip* clip, UInt64* frames, UInt64* packets) {
+    UInt32 channels = clip->format.mChannelsPerFrame;
+    SInt16* buf = malloc((size_t)buffer * channels * 2);
+    PacketSource src = { clip, 0, packets_for(&clip->format, buffer), NULL };
+    src.descs = malloc(src.chunk * sizeof(*src.descs));
+    bool ok = buf && src.descs;
+    while (ok) {
+        UInt32 n = buffer;
+        AudioBufferList list = { 1, { { channels, buffer * channels * 2, buf } } };
+        if (AudioConverterFillComplexBuffer(conv, packet_proc, &src, &n, &list, NULL)) ok = false;
+        if (!ok || !n) break;
+        *frames += n;
+    }
+    *packets += src.next;
+    free(buf);
+    free(src.descs);
+    return ok;
+}
+
+static bool
+make_clip(const Format* format, UInt32 channels, Clip* clip) {
+    memset(clip, 0, sizeof(*clip));
+    AudioStreamBasicDescription in = pcm_format(channels);
+    AudioConverterRef conv;
+    if (!coded_format(format->id, channels, &clip->format) || AudioConverterNew(&in, &clip->format, &conv)) return false;
+
+    UInt32 max_packet = 0;
+    UInt32 size = sizeof(max_packet);
+    AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &max_packet);
+    UInt32 count = kClipFrames / (clip->format.mFramesPerPacket ? clip->format.mFramesPerPacket : 1) + 16;
+    clip->data = malloc((size_t)count * max_packet);
+    clip->descs = malloc(count * sizeof(*clip->descs));
+    UInt64 frames = 0, packets = 0;
+    bool ok = clip->data && clip->descs && encode_pass(conv, channels, 1024, &clip->format, clip, &frames, &packets);
+
+    Boolean writable;
+    if (ok && !AudioConverterGetPropertyInfo(conv, kAudioConverterCompressionMagicCookie, &size, &writable)
+        && size && size <= sizeof(clip->cookie)) {
+        ok = !AudioConverterGetProperty(conv, kAudioConverterCompressionMagicCookie, &size, clip->cookie);
+        clip->cookieSize = size;
+    }
+    AudioConverterDispose(conv);
+    return ok;
+}
+
+static void
+free_clip(Clip* clip) {
+    free(clip->data);
+    free(clip->descs);
+}
+
+// Codec ---
+
+
+// Throughput +++
+
+static void
+worker_main(void* param) {
+    Worker* w = param;
+    const Case* c = w->c;
+    AudioStreamBasicDescription pcm = pcm_format(c->channels);
+    AudioStreamBasicDescription coded;
+    AudioConverterRef conv;
+    w->ok = c->decode ? (coded = w->clip->format, true) : coded_format(c->format->id, c->channels, &coded);
+    if (!w->ok || AudioConverterNew(c->decode ? &coded : &pcm, c->decode ? &pcm : &coded, &conv)) {
+        w->ok = false;
+        return;
+    }
+    if (c->decode && w->clip->cookieSize) {
+        AudioConverterSetProperty(conv, kAudioConverterDecompressionMagicCookie, w->clip->cookieSize, w->clip->cookie);
+    }
+    while (w->ok && bench_now_ns() < w->until) {
+        w->ok = c->decode ? decode_pass(conv, c->buffer, w->clip, &w->frames, &w->packets)
+                          : encode_pass(conv, c->channels, c->buffer, &coded, NULL, &w->frames, &w->packets);
+        AudioConverterReset(conv);
+    }
+    AudioConverterDispose(conv);
+}
+
+static void
+run_case(const Case* c, const Clip* clip) {
+    char name[96];
+    snprintf(name, sizeof(name), "%s/%s/%uch/%uf/%ut", c->decode ? "decode" : "encode", c->format->name,
+             c->channels, c->buffer, c->threads);
+    if (!wanted(name)) return;
+
+    double best_frames = 0, best_packets = 0;
+    bool ok = true;
+    for (int t = 0; t < kTries && ok; ++t) {
+        Worker w[kMaxThreads];
+        int64_t t0 = bench_now_ns();
+        for (UInt32 i = 0; i < c->threads; ++i) {
+            w[i] = (Worker){ .c = c, .clip = clip, .until = t0 + (int64_t)(seconds_ * 1e9) };
+            bench_thread_start(&w[i].thread, worker_main, &w[i]);
+        }
+        UInt64 frames = 0, packets = 0;
+        for (UInt32 i = 0; i < c->threads; ++i) {
+            bench_thread_join(&w[i].thread);
+            ok = ok && w[i].ok;
+            frames += w[i].frames;
+            packets += w[i].packets;
+        }
+        double s = (bench_now_ns() - t0) / 1e9;
+        if (frames / s > best_frames) best_frames = frames / s;
+        if (packets / s > best_packets) best_packets = packets / s;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: failed\n", name);
+        return;
+    }
+    char metric[128];
+    snprintf(metric, sizeof(metric), "%s/frames", name);
+    add_metric(metric, "frames/s", best_frames, true);
+    snprintf(metric, sizeof(metric), "%s/packets", name);
+    add_metric(metric, "packets/s", best_packets, true);
+    fprintf(stderr, "%-32s %12.0f frames/s %10.0f packets/s\n", name, best_frames, best_packets);
+}
+
+static void
+run_format(const Format* f) {
+    static const UInt32 kChannels[] = { 1, 6 };
+    static const UInt32 kBuffers[] = { 256, 4096 };
+    static const UInt32 kThreads[] = { 2, 4 };
+    Clip clips[kMaxChannels + 1];
+    bool have[kMaxChannels + 1] = { false };
+
+    for (int decode = 0; decode < 2; ++decode) {
+        Case cases[7];
+        int n = 0;
+        cases[n++] = (Case){ f, decode, 2, 1024, 1 };
+        for (int i = 0; i < 2; ++i) cases[n++] = (Case){ f, decode, kChannels[i], 1024, 1 };
+        for (int i = 0; i < 2; ++i) cases[n++] = (Case){ f, decode, 2, kBuffers[i], 1 };
+        for (int i = 0; i < 2; ++i) cases[n++] = (Case){ f, decode, 2, 1024, kThreads[i] };
+
+        for (int i = 0; i < n; ++i) {
+            UInt32 ch = cases[i].channels;
+            if (decode && !have[ch]) {
+                have[ch] = make_clip(f, ch, &clips[ch]);
+                if (!have[ch]) {
+                    fprintf(stderr, "%s/%uch: cannot encode the clip\n", f->name, ch);
+                    continue;
+                }
+            }
+            run_case(&cases[i], decode ? &clips[ch] : NULL);
+        }
+    }
+    for (int i = 0; i <= kMaxChannels; ++i) {
+        if (have[i]) free_clip(&clips[i]);
+    }
+}
+
+// Throughput ---
+
+
+// Overhead +++
+
+static bool
+run_child(void) {
+#ifdef _WIN32
+    wchar_t path[MAX_PATH];
+    wchar_t cmd[MAX_PATH + 16];
+    if (!GetModuleFileNameW(NULL, path, MAX_PATH)) return false;
+    swprintf(cmd, MAX_PATH + 16, L"\"%ls\" --child", path);
+
+    STARTUPINFOW si = { .cb = sizeof(si) };
+    PROCESS_INFORMATION pi;
+    if (!CreateProcessW(path, cmd, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) return false;
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD code = 1;
+    GetExitCodeProcess(pi.hProcess, &code);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return code == 0;
+#else
+    char* argv[] = { (char*)self_, "--child", NULL };
+    pid_t pid;
+    if (posix_spawn(&pid, self_, NULL, NULL, argv, environ)) return false;
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+// Start to exit of a process that only loads the library, the best
+// average over kColdRuns.
+static void
+run_coldstart(void) {
+    if (!wanted("coldstart")) return;
+    run_child();
+    double best = 0;
+    for (int t = 0; t < kTries; ++t) {
+        int64_t t0 = bench_now_ns();
+        for (int i = 0; i < kColdRuns; ++i) {
+            if (!run_child()) {
+                fprintf(stderr, "coldstart: child failed\n");
+                return;
+            }
+        }
+        double ms = (bench_now_ns() - t0) / 1e6 / kColdRuns;
+        if (!t || ms < best) best = ms;
+    }
+    add_metric("coldstart", "ms", best, false);
+    fprintf(stderr, "%-32s %12.3f ms\n", "coldstart", best);
+}
+
+static OSStatus
+one_frame_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+               AudioStreamPacketDescription** descs, void* user) {
+    data->mBuffers[0].mData = pcm_;
+    data->mBuffers[0].mDataByteSize = 2;
+    data->mBuffers[0].mNumberChannels = 1;
+    *packets = 1;
+    return noErr;
+}
+
+// A property read and a one packet ulaw encode, the cheapest calls that
+// go all the way through.
+static void
+run_dispatch(void) {
+    AudioStreamBasicDescription pcm = pcm_format(1);
+    AudioStreamBasicDescription ulaw;
+    AudioConverterRef conv;
+    if (!coded_format(kAudioFormatULaw, 1, &ulaw) || AudioConverterNew(&pcm, &ulaw, &conv)) {
+        fprintf(stderr, "dispatch: cannot create a converter\n");
+        return;
+    }
+
+    for (int kind = 0; kind < 2; ++kind) {
+        const char* name = kind ? "dispatch/fill" : "dispatch/get_property";
+        if (!wanted(name)) continue;
+        double best = 0;
+        for (int t = 0; t < kTries; ++t) {
+            int64_t t0 = bench_now_ns();
+            for (int i = 0; i < kCalls; ++i) {
+                if (kind) {
+                    UInt8 out[8];
+                    UInt32 n = 1;
+                    AudioBufferList list = { 1, { { 1, sizeof(out), out } } };
+                    AudioConverterFillComplexBuffer(conv, one_frame_proc, NULL, &n, &list, NULL);
+                }
+                else {
+                    AudioStreamBasicDescription f;
+                    UInt32 size = sizeof(f);
+                    AudioConverterGetProperty(conv, kAudioConverterCurrentOutputStreamDescription, &size, &f);
+                }
+            }
+            double ns = (double)(bench_now_ns() - t0) / kCalls;
+            if (!t || ns < best) best = ns;
+        }
+        add_metric(name, "ns/call", best, false);
+        fprintf(stderr, "%-32s %12.1f ns/call\n", name, best);
+    }
+    AudioConverterDispose(conv);
+}
+
+// Overhead ---
+
+
+// Reference +++
+
+// Companding and summing of the clip in plain C, work of the same kind as
+// the codecs' but none of it in wat4ff or CoreAudioToolbox, so no change
+// under test moves it. It only tracks the machine.
+static UInt32
+reference_pass(void) {
+    UInt32 sum = 0;
+    for (UInt32 i = 0; i < kClipFrames * 2; ++i) {
+        SInt32 v = pcm_[i];
+        UInt32 mag = (UInt32)(v < 0 ? -v : v) + 0x84;
+        UInt32 exp = 7;
+        while (exp && !(mag & (0x4000u >> (7 - exp)))) --exp;
+        sum = sum * 31 + ((exp << 4) | ((mag >> (exp + 3)) & 0xF));
+    }
+    return sum;
+}
+
+// Best of kTries, each as long as a case. Taken before and after the
+// cases, as "reference", so compare() can scale by it.
+static double
+time_reference(void) {
+    volatile UInt32 sink = 0;
+    double best = 0;
+    for (int t = 0; t < kTries; ++t) {
+        int64_t t0 = bench_now_ns();
+        int64_t until = t0 + (int64_t)(seconds_ * 1e9);
+        UInt32 n = 0;
+        for (; !n || bench_now_ns() < until; ++n) sink += reference_pass();
+        double passes = n / ((bench_now_ns() - t0) / 1e9);
+        if (passes > best) best = passes;
+    }
+    (void)sink;
+    return best;
+}
+
+static void
+run_reference(double before) {
+    double after = time_reference();
+    double best = before > after ? before : after;
+    add_metric("reference", "passes/s", best, true);
+    fprintf(stderr, "%-32s %12.1f passes/s\n", "reference", best);
+}
+
+// Reference ---
+
+
+// Results +++
+
+static bool
+write_results(const char* path) {
+    FILE* f = path ? fopen(path, "w") : stdout;
+    if (!f) return false;
+    fprintf(f, "{\"suite\": \"wat4ff\", \"version\": 1, \"seconds\": %g, \"metrics\": [\n", seconds_);
+    for (int i = 0; i < metric_count_; ++i) {
+        const Metric* m = &metrics_[i];
+        fprintf(f, "{\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.6g, \"better\": \"%s\"}%s\n",
+                m->name, m->unit, m->value, m->higherIsBetter ? "higher" : "lower", i + 1 < metric_count_ ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    return path ? fclose(f) == 0 : true;
+}
+
+static const Metric*
+find_metric(const char* name) {
+    for (int i = 0; i < metric_count_; ++i) {
+        if (!strcmp(metrics_[i].name, name)) return &metrics_[i];
+    }
+    return NULL;
+}
+
+static bool
+parse_metric(const char* line, char* name, double* value, char* better) {
+    return sscanf(line, " {\"name\": \"%95[^\"]\", \"unit\": \"%*[^\"]\", \"value\": %lf, \"better\": \"%7[^\"]\"",
+                  name, value, better) == 3;
+}
+
+// Reads back what write_results() wrote, a line per metric. Both runs are
+// scaled by their own reference, a faster machine has higher throughput
+// and shorter times in proportion. Returns how many metrics regressed, -1
+// if the baseline cannot be read.
+static int
+compare(const char* path, double threshold) {
+    const Metric* ref = find_metric("reference");
+    if (!ref || ref->value <= 0) return -1;
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    char line[512], name[96], better[8];
+    double base, base_ref = 0;
+    while (!base_ref && fgets(line, sizeof(line), f)) {
+        if (parse_metric(line, name, &base, better) && !strcmp(name, "reference")) base_ref = base;
+    }
+    if (base_ref <= 0) {
+        fclose(f);
+        return -1;
+    }
+    double speedup = ref->value / base_ref;
+    printf("reference:  %.1f -> %.1f passes/s, this machine is %.2fx the baseline's\n", base_ref, ref->value, speedup);
+
+    rewind(f);
+    int compared = 0, regressed = 0, improved = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (!parse_metric(line, name, &base, better) || !strcmp(name, "reference")) continue;
+        const Metric* m = find_metric(name);
+        if (!m || base <= 0 || m->value <= 0) continue;
+        ++compared;
+        double ratio = strcmp(better, "higher") ? base / (m->value * speedup) : m->value / (base * speedup);
+        if (ratio < 1 - threshold / 100) {
+            ++regressed;
+            printf("REGRESSION  %-36s %12.6g -> %12.6g %s (%+.1f%%)\n", name, base, m->value, m->unit, (ratio - 1) * 100);
+        }
+        else if (ratio > 1 + threshold / 100) {
+            ++improved;
+            printf("improved    %-36s %12.6g -> %12.6g %s (%+.1f%%)\n", name, base, m->value, m->unit, (ratio - 1) * 100);
+        }
+    }
+    fclose(f);
+    printf("baseline:   %d metrics compared, %d regressed and %d improved by more than %g%%\n",
+           compared, regressed, improved, threshold);
+    return compared ? regressed : -1;
+}
+
+// Results ---
+
+
+int
+main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "--child")) return wat4ff_preload() == noErr ? 0 : 1;
+
+    self_ = argv[0];
+    const char* out = NULL;
+    const char* baseline = NULL;
+    double threshold = 15;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--seconds")) seconds_ = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--out")) out = argv[i + 1];
+        else if (!strcmp(argv[i], "--baseline")) baseline = argv[i + 1];
+        else if (!strcmp(argv[i], "--threshold")) threshold = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "--filter")) filter_ = argv[i + 1];
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (seconds_ <= 0) seconds_ = 0.2;
+    for (UInt32 i = 0; i < kClipFrames * kMaxChannels; ++i) pcm_[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    double reference = time_reference();
+    // Cold start first, while this process has not touched the library.
+    run_coldstart();
+    if (wat4ff_preload()) {
+        fprintf(stderr, "cannot load CoreAudioToolbox\n");
+        return 1;
+    }
+    run_dispatch();
+    for (size_t i = 0; i < sizeof(kFormats) / sizeof(*kFormats); ++i) run_format(&kFormats[i]);
+    run_reference(reference);
+
+    if (!write_results(out)) {
+        fprintf(stderr, "cannot write %s\n", out);
+        return 1;
+    }
+    if (!baseline) return 0;
+    int regressed = compare(baseline, threshold);
+    if (regressed < 0) {
+        fprintf(stderr, "cannot compare with %s\n", baseline);
+        return 1;
+    }
+    return regressed ? 1 : 0;
+}
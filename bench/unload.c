@@ -0,0 +1,239 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Stress for idle unload. Threads encode in short bursts, some holding a
+ * converter across a pause longer than the idle period. Every other half
+ * cycle goes quiet but for the odd call at a random time, so unloads and
+ * reloads keep racing the calls, with the converter pool on. Every burst
+ * must encode exactly as the first did, and the library must stay loaded
+ * while a converter that has converted is alive. Then reports how much
+ * smaller the process is once the library has gone idle, against the
+ * same process with it loaded after the threads are done. The stand-in
+ * is small, set WAT4FF_MOCK_RESIDENT_MB for the real library's weight.
+ *
+ * wat4ff_bench_unload [seconds] [threads] [idle ms]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate      = 8000,
+    kChannels  = 1,
+    kFrames    = 4096,
+    kMaxThreads = 64,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Source {
+    const SInt16* pcm;
+    UInt32 pos;
+}Source;
+
+typedef struct Worker {
+    BenchThread thread;
+    UInt32 seed;
+    double seconds;
+    UInt32 idleMs;
+    UInt64 expect;
+    UInt64 bursts;
+    UInt64 failures;
+}Worker;
+
+static SInt16 pcm_[kFrames];
+
+static OSStatus
+input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Source* s = user;
+    UInt32 left = kFrames - s->pos;
+    if (*packets > left) *packets = left;
+    data->mBuffers[0].mData = (void*)(s->pcm + s->pos);
+    data->mBuffers[0].mDataByteSize = *packets * kPcm.mBytesPerFrame;
+    data->mBuffers[0].mNumberChannels = kChannels;
+    s->pos += *packets;
+    return noErr;
+}
+
+// Hash of the whole stream, 0 on failure.
+static UInt64
+encode(AudioConverterRef conv) {
+    UInt8 buf[8192];
+    AudioStreamPacketDescription descs[16];
+    Source src = { pcm_, 0 };
+    Digest d = digest_new();
+    for (;;) {
+        UInt32 n = 16;
+        AudioBufferList list = { 1, { { kChannels, sizeof(buf), buf } } };
+        if (AudioConverterFillComplexBuffer(conv, input_proc, &src, &n, &list, descs)) return 0;
+        if (!n) break;
+        d = digest_packets(d, buf, descs, n);
+    }
+    return d.hash;
+}
+
+static UInt64
+burst(void) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kPcm, &kAac, &conv)) return 0;
+    UInt64 h = encode(conv);
+    AudioConverterDispose(conv);
+    return h;
+}
+
+static UInt32
+next_random(UInt32* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static bool
+loaded(void) {
+    Wat4ffLifetimeStats stats;
+    wat4ff_get_lifetime_stats(&stats);
+    return stats.loaded;
+}
+
+static void
+worker_main(void* param) {
+    Worker* w = param;
+    int64_t until = bench_now_ns() + (int64_t)(w->seconds * 1e9);
+    int64_t cycle = (int64_t)w->idleMs * 8 * 1000000;
+    while (bench_now_ns() < until) {
+        UInt32 r = next_random(&w->seed);
+        int64_t at = bench_now_ns() % cycle;
+        if (at >= cycle / 2) {
+            // Quiet half, the odd call lands wherever the reaper happens to be.
+            int64_t end = cycle - at;
+            int64_t wake = r & 3 ? end : (int64_t)(r % (UInt32)(cycle / 2000000 + 1)) * 1000000;
+            bench_sleep_ms((unsigned)((wake < end ? wake : end) / 1000000));
+            if (wake >= end) continue;
+        }
+        else {
+            bench_sleep_ms(r % (w->idleMs + 1));
+        }
+
+        if (r & 16) {
+            if (burst() != w->expect) ++w->failures;
+        }
+        else {
+            // Holds a converter across a pause longer than the idle period.
+            // One from the pool is only real once it has converted.
+            AudioConverterRef conv;
+            if (AudioConverterNew(&kPcm, &kAac, &conv)) {
+                ++w->failures;
+                continue;
+            }
+            if (encode(conv) != w->expect) ++w->failures;
+            bench_sleep_ms(w->idleMs * 2);
+            if (!loaded()) ++w->failures;
+            if (AudioConverterReset(conv) || encode(conv) != w->expect) ++w->failures;
+            AudioConverterDispose(conv);
+        }
+        ++w->bursts;
+    }
+}
+
+// Resident kilobytes of the process, and of the library in *lib.
+static long
+resident_kb(long* lib) {
+    *lib = 0;
+#ifdef __linux__
+    long kb = 0;
+    FILE* f = fopen("/proc/self/smaps", "r");
+    if (!f) return -1;
+    char line[512];
+    bool in_lib = false;
+    while (fgets(line, sizeof(line), f)) {
+        long n;
+        if (sscanf(line, "Rss: %ld", &n) == 1) {
+            kb += n;
+            if (in_lib) *lib += n;
+        }
+        else if (strchr(line, '-') && strchr(line, '-') < strchr(line, ' ')) {
+            in_lib = strstr(line, "CoreAudioToolbox") != NULL;
+        }
+    }
+    fclose(f);
+    return kb;
+#else
+    return -1;
+#endif
+}
+
+int
+main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 10;
+    UInt32 threads = argc > 2 ? (UInt32)atoi(argv[2]) : 8;
+    UInt32 idle_ms = argc > 3 ? (UInt32)atoi(argv[3]) : 5;
+    if (threads > kMaxThreads) threads = kMaxThreads;
+    for (UInt32 i = 0; i < kFrames; ++i) pcm_[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    long lib0, lib2;
+    long rss0 = resident_kb(&lib0);
+    if (wat4ff_unload_configure(idle_ms)) {
+        fprintf(stderr, "unload_configure failed\n");
+        return 1;
+    }
+    wat4ff_pool_configure(16, 0);
+    UInt64 expect = burst();
+    if (!expect) {
+        fprintf(stderr, "encode failed\n");
+        return 1;
+    }
+
+    Worker w[kMaxThreads];
+    for (UInt32 i = 0; i < threads; ++i) {
+        w[i] = (Worker){ .seed = 7919 * (i + 1), .seconds = seconds, .idleMs = idle_ms, .expect = expect };
+        bench_thread_start(&w[i].thread, worker_main, &w[i]);
+    }
+    UInt64 bursts = 0, failures = 0;
+    for (UInt32 i = 0; i < threads; ++i) {
+        bench_thread_join(&w[i].thread);
+        bursts += w[i].bursts;
+        failures += w[i].failures;
+    }
+
+    // Measured with everything the threads left behind, stacks and heaps,
+    // so the library is all that differs from the idle measurement. A
+    // converter that has converted keeps it loaded meanwhile.
+    AudioConverterRef conv;
+    bool held = !AudioConverterNew(&kPcm, &kAac, &conv) && encode(conv) == expect;
+    long lib1;
+    long rss1 = resident_kb(&lib1);
+    if (held) AudioConverterDispose(conv);
+    else ++failures;
+
+    // Parked converters go first, then the library, a few ticks later.
+    int64_t t0 = bench_now_ns();
+    while (loaded() && bench_now_ns() - t0 < (int64_t)idle_ms * 20 * 1000000) bench_sleep_ms(1);
+    bool gone = !loaded();
+    long rss2 = resident_kb(&lib2);
+    Wat4ffLifetimeStats stats;
+    wat4ff_get_lifetime_stats(&stats);
+
+    printf("threads:      %u for %.1f s, idle %u ms\n", threads, seconds, idle_ms);
+    printf("bursts:       %llu, %llu failed\n", (unsigned long long)bursts, (unsigned long long)failures);
+    printf("lifetime:     %llu loads, %llu unloads, %s when idle\n",
+           (unsigned long long)stats.loads, (unsigned long long)stats.unloads, gone ? "unloaded" : "STILL LOADED");
+    printf("resident:     %ld KB before load, %ld KB loaded after the threads, %ld KB idle\n", rss0, rss1, rss2);
+    printf("of which lib: %ld KB before load, %ld KB loaded after the threads, %ld KB idle\n", lib0, lib1, lib2);
+    return !failures && gone && stats.unloads > 0 ? 0 : 1;
+}
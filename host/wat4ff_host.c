@@ -0,0 +1,33 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Keeps CoreAudioToolbox loaded for every process on the machine that runs
+ * with WAT4FF_HOST set, see wat4ff_host_run(). Pools up to 64 disposed
+ * converters unless WAT4FF_POOL says otherwise.
+ *
+ * wat4ff_host [name]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+
+enum {
+    kPool = 64,
+};
+
+int
+main(int argc, char** argv) {
+    const char* name = argc > 1 ? argv[1] : NULL;
+    if (!getenv("WAT4FF_POOL")) wat4ff_pool_configure(kPool, 0);
+
+    OSStatus rc = wat4ff_host_run(name);
+    if (rc == NSExecutableLoadError) fprintf(stderr, "wat4ff_host: cannot load CoreAudioToolbox\n");
+    else fprintf(stderr, "wat4ff_host: cannot listen as %s, is another host running?\n", name ? name : "wat4ff");
+    return 1;
+}
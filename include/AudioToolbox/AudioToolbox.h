@@ -26,6 +26,8 @@
 
 
 typedef uint8_t                      Boolean;
+typedef int8_t                       SInt8;
+typedef uint8_t                      UInt8;
 typedef int16_t                      SInt16;
 typedef int32_t                      SInt32;
 typedef uint32_t                     UInt32;
@@ -65,7 +67,20 @@ enum
 {
     noErr                     = 0,
     kAudio_UnimplementedError = -4,   // Not used by ffmpeg, but we may return this.
+    kAudio_ParamError         = -50,  // Not used by ffmpeg, but we may return this.
+    kAudio_MemFullError       = -108, // Not used by ffmpeg, but we may return this.
     NSExecutableLoadError     = 3587, // Not used by ffmpeg, but we may return this if DLL failed to load.
+
+    // Not used by ffmpeg, but AudioQueue may return these.
+    kAudioQueueErr_InvalidBuffer       = -66687,
+    kAudioQueueErr_BufferEmpty         = -66686,
+    kAudioQueueErr_DisposalPending     = -66685,
+    kAudioQueueErr_InvalidProperty     = -66684,
+    kAudioQueueErr_InvalidPropertySize = -66683,
+    kAudioQueueErr_InvalidParameter    = -66682,
+    kAudioQueueErr_InvalidDevice       = -66680,
+    kAudioQueueErr_BufferInQueue       = -66679,
+    kAudioQueueErr_InvalidRunState     = -66678,
 };
 
 enum used_only_by_dev_
@@ -190,6 +205,25 @@ enum used_only_by_enc_
     kAudioCodecBitRateControlMode_Variable            = 3,
 };
 
+// Not used by ffmpeg, wat4ff builds channel layouts with them.
+enum used_only_by_wat4ff_
+{
+    kAudioChannelLabel_Left                 = 1,
+    kAudioChannelLabel_Right                = 2,
+    kAudioChannelLabel_Center               = 3,
+    kAudioChannelLabel_LeftSurround         = 5,
+    kAudioChannelLabel_LeftCenter           = 7,
+    kAudioChannelLabel_RightCenter          = 8,
+    kAudioChannelLabel_LeftSurroundDirect   = 10,
+    kAudioChannelLabel_TopCenterSurround    = 12,
+    kAudioChannelLabel_VerticalHeightLeft   = 13,
+    kAudioChannelLabel_VerticalHeightCenter = 14,
+    kAudioChannelLabel_VerticalHeightRight  = 15,
+    kAudioChannelLabel_TopBackLeft          = 16,
+    kAudioChannelLabel_TopBackCenter        = 17,
+    kAudioChannelLabel_LeftWide             = 35,
+};
+
 
 // Shared by dev, dec, enc +++
 
@@ -276,55 +310,35 @@ typedef void (*AudioQueueOutputCallback)(void*, AudioQueueRef, AudioQueueBufferR
 
 static const CFRunLoopMode kCFRunLoopCommonModes = 0;
 
-static inline const char*
-CFStringGetCStringPtr(CFStringRef p1, CFStringEncoding p2) {
-    return (const char*)0;
-}
-
-static inline OSStatus
-AudioObjectGetPropertyDataSize(AudioObjectID p1, const AudioObjectPropertyAddress* p2, UInt32 p3, const void* p4, UInt32* p5) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioObjectGetPropertyData(AudioObjectID p1, const AudioObjectPropertyAddress* p2, UInt32 p3, const void* p4, UInt32* p5, void* p6) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioQueueSetProperty(AudioQueueRef p1, AudioQueuePropertyID p2, const void* p3, UInt32 p4) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioQueueNewOutput(const AudioStreamBasicDescription* p1, AudioQueueOutputCallback p2, void* p3, CFRunLoopRef p4, CFStringRef p5, UInt32 p6, AudioQueueRef* p7) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioQueueAllocateBuffer(AudioQueueRef p1, UInt32 p2, AudioQueueBufferRef* p3) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioQueueEnqueueBuffer(AudioQueueRef p1, AudioQueueBufferRef p2, UInt32 p3, const AudioStreamPacketDescription* p4) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioQueueStart(AudioQueueRef p1, const AudioTimeStamp* p2) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioQueueDispose(AudioQueueRef p1, Boolean p2) {
-    return kAudio_UnimplementedError;
-}
-
-static inline OSStatus
-AudioQueueFlush(AudioQueueRef p1) {
-    return kAudio_UnimplementedError;
-}
+const char*
+CFStringGetCStringPtr(CFStringRef p1, CFStringEncoding p2);
+
+OSStatus
+AudioObjectGetPropertyDataSize(AudioObjectID p1, const AudioObjectPropertyAddress* p2, UInt32 p3, const void* p4, UInt32* p5);
+
+OSStatus
+AudioObjectGetPropertyData(AudioObjectID p1, const AudioObjectPropertyAddress* p2, UInt32 p3, const void* p4, UInt32* p5, void* p6);
+
+OSStatus
+AudioQueueSetProperty(AudioQueueRef p1, AudioQueuePropertyID p2, const void* p3, UInt32 p4);
+
+OSStatus
+AudioQueueNewOutput(const AudioStreamBasicDescription* p1, AudioQueueOutputCallback p2, void* p3, CFRunLoopRef p4, CFStringRef p5, UInt32 p6, AudioQueueRef* p7);
+
+OSStatus
+AudioQueueAllocateBuffer(AudioQueueRef p1, UInt32 p2, AudioQueueBufferRef* p3);
+
+OSStatus
+AudioQueueEnqueueBuffer(AudioQueueRef p1, AudioQueueBufferRef p2, UInt32 p3, const AudioStreamPacketDescription* p4);
+
+OSStatus
+AudioQueueStart(AudioQueueRef p1, const AudioTimeStamp* p2);
+
+OSStatus
+AudioQueueDispose(AudioQueueRef p1, Boolean p2);
+
+OSStatus
+AudioQueueFlush(AudioQueueRef p1);
 
 // Used only by dev ---
 
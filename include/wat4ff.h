@@ -0,0 +1,749 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * wat4ff specific extensions. FFmpeg never includes this header, these are
+ * for applications that link wat4ff directly and want more control.
+*/
+
+#ifndef WAT4FF_H
+#define WAT4FF_H
+
+#include <AudioToolbox/AudioToolbox.h>
+
+
+// Load +++
+
+enum
+{
+    kWat4ffProbeOverride = 0, // WAT4FF_LIB_PATH, nothing else is tried if set
+    kWat4ffProbePortable = 1, // QTfiles next to the executable, or the library itself on POSIX
+    kWat4ffProbeCache    = 2, // Path a previous process found by a slow probe, Windows only
+    kWat4ffProbeITunes   = 3, // iTunes installed by the official installer, Windows only
+    kWat4ffProbeAppModel = 4, // iTunes from the Store, WAT4FF_USE_APPMODEL only
+    kWat4ffProbeSystem   = 5, // Dynamic loader search path, POSIX only
+    kWat4ffProbeHost     = 6, // Calls forwarded to wat4ff_host, WAT4FF_HOST only
+    kWat4ffProbeCount    = 7,
+};
+
+typedef struct Wat4ffLoadTiming
+{
+    SInt64  probeNanos[kWat4ffProbeCount];       // Building the candidate path, 0 if not reached
+    SInt64  loadLibraryNanos[kWat4ffProbeCount]; // Loading the candidate, 0 if not tried
+    SInt64  resolveNanos;                        // Looking up every entry point
+    SInt64  totalNanos;                          // All of the above
+    SInt32  source;                              // kWat4ffProbe* that succeeded, -1 if none
+    Boolean loaded;
+}Wat4ffLoadTiming;
+
+// Loads CoreAudioToolbox now rather than on the first AudioToolbox call.
+// Returns noErr, or NSExecutableLoadError if it cannot be loaded.
+// Also set WAT4FF_PRELOAD=1 in the environment to start an asynchronous
+// preload at process start, or WAT4FF_PRELOAD=sync for a synchronous one.
+OSStatus
+wat4ff_preload(void);
+
+// Starts loading CoreAudioToolbox on a background thread and returns at once.
+// AudioToolbox calls made meanwhile wait for it rather than load again.
+void
+wat4ff_preload_async(void);
+
+// Fills timing and returns true once a load attempt has finished.
+bool
+wat4ff_get_load_timing(Wat4ffLoadTiming* timing);
+
+typedef struct Wat4ffLifetimeStats
+{
+    UInt64  loads;          // With idle unload on, first load included
+    UInt64  unloads;
+    UInt32  references;     // Calls in progress and live converters
+    Boolean loaded;
+}Wat4ffLifetimeStats;
+
+// Unloads CoreAudioToolbox once no AudioToolbox call has finished for
+// idleMillis and no converter is alive, disposing parked ones first. The
+// next call loads it again. 0, the default, keeps it loaded for good.
+// Idle unload can only be turned on or off before the library is first
+// loaded, kAudio_ParamError otherwise, the period can change any time.
+// Also set WAT4FF_UNLOAD_IDLE_MS=ms in the environment.
+OSStatus
+wat4ff_unload_configure(UInt32 idleMillis);
+
+void
+wat4ff_get_lifetime_stats(Wat4ffLifetimeStats* stats);
+
+// Load ---
+
+
+// Stats +++
+
+enum
+{
+    kWat4ffStatsMaxProcs = 16,
+    kWat4ffStatsStatuses = 8,
+    kWat4ffStatsBuckets  = 40,
+};
+
+typedef struct Wat4ffStatusCount
+{
+    OSStatus status;
+    UInt64   count;
+}Wat4ffStatusCount;
+
+typedef struct Wat4ffProcStats
+{
+    const char*       name;
+    UInt64            calls;
+    UInt64            errors;                           // Calls that returned anything but noErr
+    UInt64            totalNanos;
+    UInt64            maxNanos;
+    UInt64            callbackCalls;                    // Input proc calls, FillComplexBuffer only
+    UInt64            callbackNanos;                    // Time spent in them, part of totalNanos
+    Wat4ffStatusCount statuses[kWat4ffStatsStatuses];   // Error statuses, first seen first
+    UInt64            otherErrors;                      // Errors whose status did not fit above
+    UInt64            latency[kWat4ffStatsBuckets];     // latency[i] counts calls of [2^i, 2^(i+1)) ns
+}Wat4ffProcStats;
+
+typedef struct Wat4ffStats
+{
+    UInt32          procCount;
+    Wat4ffProcStats procs[kWat4ffStatsMaxProcs];
+}Wat4ffStats;
+
+// Fills stats and returns true, or returns false if wat4ff was built without
+// WAT4FF_ENABLE_STATS. Set WAT4FF_STATS=1 in the environment to print them to
+// stderr at exit, or WAT4FF_STATS=path to write them to a file.
+bool
+wat4ff_get_stats(Wat4ffStats* stats);
+
+void
+wat4ff_reset_stats(void);
+
+// Stats ---
+
+
+// Trace +++
+
+// Starts recording a begin and end time for every AudioConverterNew,
+// FillComplexBuffer, Reset, SetProperty and Dispose call, with the thread,
+// converter and packet counts. Returns false if wat4ff was built without
+// WAT4FF_ENABLE_TRACE. Set WAT4FF_TRACE=path in the environment to trace the
+// whole process, flushed at exit, and WAT4FF_TRACE_EVENTS to change the
+// default cap of 1M events.
+bool
+wat4ff_trace_start(const char* path);
+
+// Writes every event so far to the path given to wat4ff_trace_start() as
+// Chrome trace-event JSON, replacing the file.
+bool
+wat4ff_trace_flush(void);
+
+// Trace ---
+
+
+// Capture +++
+
+// Starts writing every AudioConverterNew, SetProperty, FillComplexBuffer,
+// Reset and Dispose call to path, with formats, property values, output
+// buffer sizes and everything the input proc hands over, for
+// wat4ff_bench_replay to play back against any backend. Converters created
+// earlier are left out. A background thread does the writing. Returns false
+// if wat4ff was built without WAT4FF_ENABLE_CAPTURE, if path cannot be
+// created or a capture is running. Set WAT4FF_CAPTURE=path in the
+// environment to capture the whole process, stopped at exit.
+bool
+wat4ff_capture_start(const char* path);
+
+// Writes out what is buffered and closes the file. Returns false if nothing
+// was running or something could not be written.
+bool
+wat4ff_capture_stop(void);
+
+// Capture ---
+
+
+// Pool +++
+
+typedef struct Wat4ffPoolStats
+{
+    UInt64 hits;        // AudioConverterNew calls served by a parked converter
+    UInt64 misses;      // Those that created a converter
+    UInt64 stale;       // Hits swapped for a new converter at first use
+    UInt64 evictions;   // Parked converters disposed for the size or idle limit
+    UInt32 parked;
+}Wat4ffPoolStats;
+
+// Keeps up to maxConverters disposed converters, reset, for
+// AudioConverterNew calls with the same formats and properties to reuse.
+// Parked converters are disposed once idle for maxIdleMillis, by a thread
+// that checks a few times per period, 0 keeps them. 0 converters turns the
+// pool off, it starts off. Also set WAT4FF_POOL=n and WAT4FF_POOL_IDLE_MS=ms
+// in the environment.
+void
+wat4ff_pool_configure(UInt32 maxConverters, UInt32 maxIdleMillis);
+
+// Disposes every parked converter.
+void
+wat4ff_pool_trim(void);
+
+void
+wat4ff_get_pool_stats(Wat4ffPoolStats* stats);
+
+// Pool ---
+
+
+// Parallel encode +++
+
+typedef struct Wat4ffConverterProperty
+{
+    AudioConverterPropertyID id;
+    UInt32                   size;
+    const void*              data;
+}Wat4ffConverterProperty;
+
+typedef struct Wat4ffParallelEncode
+{
+    AudioStreamBasicDescription    input;            // Interleaved PCM
+    AudioStreamBasicDescription    output;
+    const Wat4ffConverterProperty* properties;       // Set on every converter, in order
+    UInt32                         propertyCount;
+    UInt32                         threads;          // 0 for one per CPU
+    UInt32                         segmentFrames;    // 0 for 10 seconds
+    UInt32                         overlapPackets;   // Encoded and dropped before each segment, 0 for 2
+    bool                           adts;             // Prefix every packet with an ADTS header, AAC LC only
+}Wat4ffParallelEncode;
+
+typedef struct Wat4ffEncodedStream
+{
+    UInt8*                        data;
+    UInt64                        dataSize;
+    AudioStreamPacketDescription* packets;
+    UInt64                        packetCount;
+    UInt32                        framesPerPacket;
+    AudioConverterPrimeInfo       prime;             // Priming and padding of the whole stream
+    UInt8*                        magicCookie;
+    UInt32                        magicCookieSize;
+    UInt32                        segments;
+}Wat4ffEncodedStream;
+
+// Encodes frames of pcm on several threads, each encoding segments of it on
+// its own converter, and joins the packets into one gapless stream.
+// Segments start on packet boundaries of the serial encode. Each one starts
+// encoding early enough to cover the priming frames plus overlapPackets,
+// then drops those packets. So every packet kept comes from an encoder that
+// has seen the same input as the serial one for at least that long. Only
+// encoder state built up over longer spans, such as the bit reservoir,
+// differs at a seam. bench/parallel.c measures the deviation.
+OSStatus
+wat4ff_encode_parallel(const Wat4ffParallelEncode* job, const void* pcm, UInt64 frames, Wat4ffEncodedStream* out);
+
+void
+wat4ff_free_encoded(Wat4ffEncodedStream* stream);
+
+typedef struct Wat4ffParallelDecode
+{
+    AudioStreamBasicDescription    input;            // As the stream was encoded
+    AudioStreamBasicDescription    output;           // Interleaved PCM at the same rate
+    UInt32                         threads;          // 0 for one per CPU
+    UInt32                         segmentPackets;   // 0 for 10 seconds
+    UInt32                         prerollPackets;   // Decoded and dropped before each segment, 0 for 2
+}Wat4ffParallelDecode;
+
+// Decodes the packets of in on several threads, each decoding segments of
+// them on its own decoder, into pcm, which must have room for
+// in->packetCount * in->framesPerPacket frames. *frames gets the number
+// decoded. Like a single decoder, priming and padding are left in,
+// in->prime says how much. Each segment starts prerollPackets early, enough
+// for the decoder to match a serial one from the segment's first packet on.
+// The cookie of in is set on every decoder.
+OSStatus
+wat4ff_decode_parallel(const Wat4ffParallelDecode* job, const Wat4ffEncodedStream* in, void* pcm, UInt64* frames);
+
+// Parallel encode ---
+
+
+// Parallel ALAC +++
+
+// Gets each batch of encoded packets, in stream order, from whichever thread
+// completed the run. Offsets in packets are relative to data.
+typedef void (* Wat4ffPacketProc)(void* user, const UInt8* data, const AudioStreamPacketDescription* packets, UInt32 count);
+
+typedef struct Wat4ffAlacJob
+{
+    AudioStreamBasicDescription    input;            // Interleaved PCM to encode, ALAC to decode
+    AudioStreamBasicDescription    output;           // ALAC to encode, interleaved PCM to decode
+    const Wat4ffConverterProperty* properties;       // Set on every converter, in order
+    UInt32                         propertyCount;
+    UInt32                         threads;          // 0 for one per CPU
+    UInt32                         batchPackets;     // Packets per unit of work, 0 for 16
+    Wat4ffPacketProc               emit;             // Optional, encode only
+    void*                          emitUser;
+}Wat4ffAlacJob;
+
+// Encodes frames of pcm to ALAC on several threads. ALAC packets carry no
+// state from one to the next, so the packets are exactly those of a single
+// converter. If out is NULL they only go to job->emit and are not kept.
+OSStatus
+wat4ff_alac_encode(const Wat4ffAlacJob* job, const void* pcm, UInt64 frames, Wat4ffEncodedStream* out);
+
+// Decodes the ALAC packets of in on several threads. pcm must have room for
+// in->packetCount * in->framesPerPacket frames, *frames gets the number
+// decoded. The cookie of in is set on every decoder.
+OSStatus
+wat4ff_alac_decode(const Wat4ffAlacJob* job, const Wat4ffEncodedStream* in, void* pcm, UInt64* frames);
+
+// Parallel ALAC ---
+
+
+// Fan-out +++
+
+// Fills buf with up to *frames frames of PCM and sets *frames to the number
+// filled, 0 at the end of the input.
+typedef OSStatus (* Wat4ffPcmProc)(void* user, void* buf, UInt32* frames);
+
+// A rendition's emit is called on its own worker thread. Calls for one
+// rendition come one at a time, in stream order, but different renditions'
+// calls run at the same time, so callbacks sharing state must lock it.
+typedef struct Wat4ffRendition
+{
+    AudioStreamBasicDescription    output;
+    const Wat4ffConverterProperty* properties;       // Such as kAudioConverterEncodeBitRate
+    UInt32                         propertyCount;
+    Wat4ffPacketProc               emit;             // Optional, gets packets as they are encoded
+    void*                          emitUser;
+}Wat4ffRendition;
+
+typedef struct Wat4ffFanOut
+{
+    AudioStreamBasicDescription    input;            // Interleaved PCM
+    const Wat4ffRendition*         renditions;
+    UInt32                         renditionCount;
+    UInt32                         ringFrames;       // Input read ahead of the slowest rendition, 0 for 2 seconds
+    Wat4ffPcmProc                  read;
+    void*                          readUser;
+}Wat4ffFanOut;
+
+// Encodes the input once per rendition, each on a thread and converter of
+// its own. job->read is called on this thread only, into a ring every
+// rendition reads from in place. Reading waits while the slowest rendition
+// is a whole ring behind, so a ladder takes about as long as its slowest
+// rendition. outs has renditionCount streams, or is NULL if the renditions
+// only emit their packets. A rendition that fails does not stop the others
+// emitting theirs, but the first error is returned and outs are left empty.
+OSStatus
+wat4ff_encode_fanout(const Wat4ffFanOut* job, Wat4ffEncodedStream* outs);
+
+// Fan-out ---
+
+
+// Batched decode +++
+
+typedef struct Wat4ffPacketBatch
+{
+    const UInt8*                        data;
+    const AudioStreamPacketDescription* packets;      // Offsets relative to data, NULL for CBR input
+    UInt32                              count;
+    UInt32                              used;         // Packets handed to the converter so far
+    bool                                end;          // Nothing follows, flush once all are used
+}Wat4ffPacketBatch;
+
+// Decodes the packets of batch left over from earlier calls with conv, any
+// converter from AudioConverterNew, in one FillComplexBuffer call rather
+// than one per packet. The converter is handed as many packets at a time as
+// it asks for, in place. out has room for *frames frames, *frames gets the
+// number decoded. Fewer than that means the batch is used up, and the next
+// call may take a new one. Until then data must stay valid, the converter
+// may still be reading the last packets handed to it.
+OSStatus
+wat4ff_decode_batch(AudioConverterRef conv, Wat4ffPacketBatch* batch, AudioBufferList* out, UInt32* frames);
+
+// Batched decode ---
+
+
+// Streaming encode +++
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmultichar"
+#endif
+enum
+{
+    kWat4ffEndOfStream = 'eos ', // Every packet has been pulled
+    kWat4ffQueueFull   = 'full', // Nothing pushed, pull some packets first
+};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+typedef struct Wat4ffStreamEncoder Wat4ffStreamEncoder;
+
+typedef struct Wat4ffStreamConfig
+{
+    AudioStreamBasicDescription    input;            // Interleaved PCM
+    AudioStreamBasicDescription    output;
+    const Wat4ffConverterProperty* properties;       // Set on the converter, in order
+    UInt32                         propertyCount;
+    UInt32                         queueFrames;      // PCM pushed ahead of the encoder, 0 for 1 second
+    UInt32                         depth;            // Encoded blocks waiting to be pulled, 0 for 2
+}Wat4ffStreamConfig;
+
+typedef struct Wat4ffStreamInfo
+{
+    UInt32                         framesPerPacket;
+    UInt32                         maxPacketSize;    // Enough room for pull to return a packet
+    AudioConverterPrimeInfo        prime;            // Final once pull returns kWat4ffEndOfStream
+    const UInt8*                   magicCookie;      // Valid until the encoder is closed
+    UInt32                         magicCookieSize;
+}Wat4ffStreamInfo;
+
+// Starts an encoder whose converter runs on a thread of its own, so the
+// caller can produce the next PCM while the last is encoded. One thread may
+// push while another pulls.
+OSStatus
+wat4ff_enc_open(const Wat4ffStreamConfig* config, Wat4ffStreamEncoder** enc);
+
+// Queues frames of pcm, at most queueFrames of them, all or none. With wait
+// it sleeps until they fit, which only ever happens if another thread pulls.
+// Otherwise it sleeps only while the encoder is making room, and returns
+// kWat4ffQueueFull when that waits on a pull. 0 frames ends the input.
+// Returns the encoder's error if it has failed.
+OSStatus
+wat4ff_enc_push(Wat4ffStreamEncoder* enc, bool wait, const void* pcm, UInt32 frames);
+
+// As wat4ff_enc_push(), for one plane of kWat4ffSample* format per channel
+// of the input, which must be 16 or 32-bit integers or floats. They are
+// converted and interleaved straight into the queue, see wat4ff_pcm_interleave().
+OSStatus
+wat4ff_enc_push_planes(Wat4ffStreamEncoder* enc, bool wait, const void* const* planes, UInt32 format,
+                       UInt32 frames);
+
+// Takes up to *count encoded packets, as many as fit in dataSize bytes, and
+// sets *count to the number taken. Offsets in packets are relative to data.
+// With wait it sleeps until there is one, otherwise *count may be 0.
+// Returns kWat4ffEndOfStream once the input has ended and all is pulled.
+OSStatus
+wat4ff_enc_pull(Wat4ffStreamEncoder* enc, bool wait, UInt8* data, UInt32 dataSize,
+                AudioStreamPacketDescription* packets, UInt32* count);
+
+void
+wat4ff_enc_get_info(Wat4ffStreamEncoder* enc, Wat4ffStreamInfo* info);
+
+// Stops the encoder, even mid-stream, and frees it.
+void
+wat4ff_enc_close(Wat4ffStreamEncoder* enc);
+
+// Streaming encode ---
+
+
+// Stream scheduler +++
+
+enum
+{
+    kWat4ffSchedMaxWorkers = 64,
+};
+
+typedef struct Wat4ffScheduler Wat4ffScheduler;
+typedef struct Wat4ffSchedStream Wat4ffSchedStream;
+
+typedef struct Wat4ffSchedStreamConfig
+{
+    AudioStreamBasicDescription    input;            // Interleaved PCM
+    AudioStreamBasicDescription    output;
+    const Wat4ffConverterProperty* properties;       // Set on the converter, in order
+    UInt32                         propertyCount;
+    UInt32                         queueFrames;      // PCM pushed ahead of the encoder, 0 for 1 second
+    UInt32                         quantumPackets;   // Packets encoded per turn on a worker, 0 for 1
+    UInt32                         deadlineMillis;   // Live: packets due this long after their PCM. 0 for bulk
+    Wat4ffPacketProc               emit;             // Gets each turn's packets, on a worker thread
+    void*                          emitUser;
+}Wat4ffSchedStreamConfig;
+
+typedef struct Wat4ffSchedStreamStats
+{
+    UInt64 quanta;                                   // Turns on a worker
+    UInt64 packets;
+    UInt64 late;                                     // Turns whose packets were past their deadline
+    UInt64 totalNanos;                               // Time spent in turns
+    UInt64 totalLatencyNanos;
+    UInt64 maxLatencyNanos;
+    UInt64 latency[kWat4ffStatsBuckets];             // Push to emit, per turn with packets, of its last packet
+}Wat4ffSchedStreamStats;
+
+typedef struct Wat4ffSchedWorkerStats
+{
+    UInt64 quanta;
+    UInt64 steals;                                   // Streams taken from another worker's queue
+    UInt64 busyNanos;                                // Time spent in turns
+    UInt64 elapsedNanos;                             // Since the scheduler opened
+}Wat4ffSchedWorkerStats;
+
+typedef struct Wat4ffSchedStats
+{
+    UInt32                 workerCount;
+    Wat4ffSchedWorkerStats workers[kWat4ffSchedMaxWorkers];
+}Wat4ffSchedStats;
+
+// Starts threads workers, 0 for one per CPU, that encode any number of
+// streams between them. A stream runs on one worker at a time, a turn of
+// quantumPackets packets, then goes back in line. Live streams go first,
+// earliest deadline first, bulk streams take turns in the time left over.
+// A worker with nothing to do takes streams from the others.
+OSStatus
+wat4ff_sched_open(UInt32 threads, Wat4ffScheduler** sched);
+
+// Adds a stream, with a converter of its own, that runs whenever it has
+// input.
+OSStatus
+wat4ff_sched_add(Wat4ffScheduler* sched, const Wat4ffSchedStreamConfig* config, Wat4ffSchedStream** stream);
+
+// Queues frames of pcm, at most queueFrames of them, all or none. With wait
+// it sleeps until they fit, otherwise it returns kWat4ffQueueFull. 0 frames
+// ends the input, and the last packets follow. Returns the stream's error
+// if it has failed.
+OSStatus
+wat4ff_sched_push(Wat4ffSchedStream* stream, bool wait, const void* pcm, UInt32 frames);
+
+// Sleeps until the stream has encoded all it can of what was pushed, and
+// once the input has ended, until the last packet is emitted. Returns the
+// stream's error, if any.
+OSStatus
+wat4ff_sched_wait(Wat4ffSchedStream* stream);
+
+// The prime info is final once wat4ff_sched_wait() returns after the input
+// has ended.
+void
+wat4ff_sched_get_info(Wat4ffSchedStream* stream, Wat4ffStreamInfo* info);
+
+void
+wat4ff_sched_get_stream_stats(Wat4ffSchedStream* stream, Wat4ffSchedStreamStats* stats);
+
+void
+wat4ff_sched_get_stats(Wat4ffScheduler* sched, Wat4ffSchedStats* stats);
+
+// Stops the stream, even mid-stream, waiting for a turn in progress, and
+// frees it.
+void
+wat4ff_sched_remove(Wat4ffSchedStream* stream);
+
+// Stops the workers and frees the scheduler. Remove every stream first.
+void
+wat4ff_sched_close(Wat4ffScheduler* sched);
+
+// Stream scheduler ---
+
+
+// PCM +++
+
+enum
+{
+    kWat4ffSampleS16   = 0,      // Native endian, full scale
+    kWat4ffSampleS32   = 1,
+    kWat4ffSampleF32   = 2,      // -1.0 to 1.0
+    kWat4ffSampleCount = 3,
+};
+
+enum
+{
+    kWat4ffSimdNone    = 0,
+    kWat4ffSimdSSE2    = 1,
+    kWat4ffSimdAVX2    = 2,
+    kWat4ffSimdNEON    = 3,
+};
+
+// Gets the kWat4ffSample* of packed, interleaved or not, native endian
+// linear PCM, or returns false for anything else.
+bool
+wat4ff_pcm_sample_format(const AudioStreamBasicDescription* fmt, UInt32* format);
+
+// Converts samples from one kWat4ffSample* to another. Floats to integers
+// are scaled, rounded to nearest even and saturated, NaN saturates high.
+// Integers to floats are exact for s16, rounded to nearest for s32.
+void
+wat4ff_pcm_convert(void* dst, UInt32 dstFormat, const void* src, UInt32 srcFormat, UInt64 samples);
+
+// Interleaves channels planes of frames samples into dst, converting them
+// on the way. Results match wat4ff_pcm_convert() bit for bit.
+void
+wat4ff_pcm_interleave(void* dst, UInt32 dstFormat, const void* const* planes, UInt32 srcFormat,
+                      UInt32 channels, UInt32 frames);
+
+void
+wat4ff_pcm_deinterleave(void* const* planes, UInt32 dstFormat, const void* src, UInt32 srcFormat,
+                        UInt32 channels, UInt32 frames);
+
+// Returns the kWat4ffSimd* the kernels above use, the best the CPU has.
+// wat4ff_pcm_use_simd() picks another, for comparing them, and returns the
+// one picked, which is kWat4ffSimdNone if the CPU does not have it.
+UInt32
+wat4ff_pcm_simd(void);
+
+UInt32
+wat4ff_pcm_use_simd(UInt32 simd);
+
+// PCM ---
+
+
+// Buffer lists +++
+
+enum
+{
+    kWat4ffMaxBuffers = 64,
+};
+
+// An AudioBufferList with room for kWat4ffMaxBuffers buffers, which the one
+// declared with mBuffers[1] lacks. Pass &list.abl wherever an
+// AudioBufferList* is wanted.
+typedef union Wat4ffBufferList
+{
+    AudioBufferList abl;
+    struct
+    {
+        UInt32 mNumberBuffers;
+        AudioBuffer mBuffers[kWat4ffMaxBuffers];
+    }room;
+}Wat4ffBufferList;
+
+// Bytes an AudioBufferList of count buffers takes, for allocating one.
+UInt32
+wat4ff_buffer_list_size(UInt32 count);
+
+// Points count buffers of list at planes, offset bytes into each and size
+// bytes long, channels apiece. Nothing is copied.
+void
+wat4ff_buffer_list_wrap(AudioBufferList* list, void* const* planes, UInt32 count, UInt32 channels,
+                        UInt32 offset, UInt32 size);
+
+// Caller owned PCM, one plane per channel for non-interleaved formats, else
+// a single plane. An input proc hands it to a converter in place, a frame
+// count at a time, picking up where the last call stopped.
+typedef struct Wat4ffPcmSource
+{
+    const void* const* planes;
+    UInt32 count;                     // Planes
+    UInt32 channels;                  // Per plane
+    UInt32 bytesPerFrame;             // Per plane
+    UInt64 frames;
+    UInt64 pos;                       // Frames handed over so far
+}Wat4ffPcmSource;
+
+// Sets s up for frames frames of planes in format fmt, linear PCM.
+OSStatus
+wat4ff_pcm_source_init(Wat4ffPcmSource* s, const AudioStreamBasicDescription* fmt,
+                       const void* const* planes, UInt64 frames);
+
+// Points list at up to frames frames from s->pos on, moves s->pos past them
+// and returns how many. 0 once all is handed over.
+UInt32
+wat4ff_pcm_source_take(Wat4ffPcmSource* s, AudioBufferList* list, UInt32 frames);
+
+// An AudioConverterComplexInputDataProc taking a Wat4ffPcmSource* as user
+// data. It ends the input when the source runs out.
+OSStatus
+wat4ff_pcm_source_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                       AudioStreamPacketDescription** descs, void* user);
+
+// Buffer lists ---
+
+
+// Arena +++
+
+// Output and packet description room lent by a converter's arena.
+typedef struct Wat4ffPacketBuffer
+{
+    UInt8* data;                              // 64-byte aligned
+    UInt32 dataSize;                          // packetCount maximum sized packets
+    AudioStreamPacketDescription* packets;
+    UInt32 packetCount;
+    UInt32 generation;                        // Valid while the arena's is this
+}Wat4ffPacketBuffer;
+
+typedef struct Wat4ffArenaStats
+{
+    UInt64 acquires;
+    UInt64 allocations;                       // Acquires that had to allocate
+    UInt64 bytes;                             // Held by all arenas now
+    UInt64 peakBytes;
+}Wat4ffArenaStats;
+
+// Lends room for packets packets of conv's output, sized from its maximum
+// output packet size, with as many descriptions, which also serve a
+// decoder's input. It stays valid until wat4ff_arena_recycle(). Recycled
+// room is lent again rather than freed, and all of it goes when conv is
+// disposed for good.
+OSStatus
+wat4ff_arena_acquire(AudioConverterRef conv, UInt32 packets, Wat4ffPacketBuffer* buf);
+
+// Takes back everything conv's arena has lent and starts a new generation.
+void
+wat4ff_arena_recycle(AudioConverterRef conv);
+
+void
+wat4ff_get_arena_stats(Wat4ffArenaStats* stats);
+
+// Arena ---
+
+
+// Host +++
+
+// Serves the AudioToolbox calls of other processes on this machine, which
+// then need not load CoreAudioToolbox themselves, and whose crashes, or
+// its crashes, take down nobody else. Clients find the host by name, NULL
+// for "wat4ff". Converters they dispose of are pooled for the next, see
+// wat4ff_pool_configure(). Only returns if another host has the name, or
+// CoreAudioToolbox cannot be loaded. On Windows, only built with
+// WAT4FF_WIN_HOST, otherwise it returns kAudio_ParamError at once.
+OSStatus
+wat4ff_host_run(const char* name);
+
+// Sends this process's AudioToolbox calls to the host called name, NULL
+// for the default, instead of loading CoreAudioToolbox. PCM and packets go
+// through shared memory. Without a host to answer, the library is loaded
+// here as usual. If the host goes away, calls fail with
+// NSExecutableLoadError. Only before the first AudioToolbox call,
+// kAudio_ParamError after it. Also set WAT4FF_HOST=name, or 1, in the
+// environment.
+OSStatus
+wat4ff_host_configure(const char* name);
+
+// Host ---
+
+
+// Audio output +++
+
+// Where an AudioQueue plays to. Every sink is listed as an audio device,
+// its uid the DeviceUID that kAudioQueueProperty_CurrentDevice selects it
+// by. Built in are "null", which discards PCM in real time, "file", which
+// writes it as fast as it comes to WAT4FF_SINK_FILE, wat4ff.pcm by
+// default, and on Windows builds with WAT4FF_WIN_WAVEOUT "waveout", the
+// system's default output.
+typedef struct Wat4ffSink
+{
+    const char* uid;
+    const char* name;
+    void*       user;
+    // Opens a stream of format once the queue starts, setting *stream.
+    OSStatus (* open)(void* user, const AudioStreamBasicDescription* format, void** stream);
+    // Called on the queue's render thread with each buffer in turn, returns
+    // once the next may be written. Must not allocate.
+    OSStatus (* write)(void* stream, const void* data, UInt32 bytes);
+    // With drain, returns once everything written has played.
+    void     (* close)(void* stream, bool drain);
+}Wat4ffSink;
+
+// Adds sink to the devices, which must stay valid. kAudio_ParamError if
+// the uid is taken or there are 16 sinks already.
+OSStatus
+wat4ff_sink_register(const Wat4ffSink* sink);
+
+// Picks the sink queues play to unless told otherwise, NULL for the
+// default of "waveout" where it is built and "null" elsewhere. Also set
+// WAT4FF_SINK=uid in the environment. kAudioQueueErr_InvalidDevice if no
+// sink has uid.
+OSStatus
+wat4ff_sink_set_default(const char* uid);
+
+// Audio output ---
+
+
+#endif
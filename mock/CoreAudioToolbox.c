@@ -0,0 +1,987 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * A stand-in for CoreAudioToolbox, so wat4ff can be built, tested and
+ * benchmarked without iTunes. It is not a codec, output is deterministic and
+ * shaped like the real thing:
+ *
+ * lpcm to lpcm     Sample format conversion, no resampling or remixing.
+ * AAC family, AMR  Samples quantized to 8 bits, fixed frames per packet,
+ *                  delayed by leadingFrames of priming, silent packets
+ *                  shrink to a single byte so packet sizes vary. The step
+ *                  follows the level of the packets before, two unless
+ *                  WAT4FF_MOCK_HISTORY says otherwise, as a bit reservoir
+ *                  would, so an encoder started cold differs from a running
+ *                  one for that long. Packets carry their step, decoding
+ *                  needs no history.
+ * ALAC             Lossless, 4096 frames per packet, no priming.
+ * ulaw, alaw       8 bit quantization, one frame per packet, CBR.
+ *
+ * Cost knobs, read once when the library loads:
+ * WAT4FF_MOCK_LOAD_MS      Sleep when the library loads.
+ * WAT4FF_MOCK_NEW_US       Sleep in every AudioConverterNew.
+ * WAT4FF_MOCK_CALL_US      Sleep in every AudioConverterFillComplexBuffer.
+ * WAT4FF_MOCK_PACKET_US    Busy CPU time per packet encoded or decoded.
+ * WAT4FF_MOCK_RESIDENT_MB  Memory kept resident while loaded, as the real
+ *                          library's frameworks and codec tables are.
+ * WAT4FF_MOCK_HISTORY      Packets the lossy step follows, 1 to 16.
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+
+
+#ifdef _WIN32
+#define MOCK_EXPORT __declspec(dllexport)
+#else
+#define MOCK_EXPORT __attribute__((visibility("default")))
+#endif
+
+enum {
+    kLossyHeaderSilent = 0,
+    kLossyHeaderFull   = 1,   // Followed by the step, 16 bits
+    kLossyHeaderSize   = 3,
+    kLossyHistory      = 2,   // Packets, by default
+    kLossyHistoryMax   = 16,
+    kLossyStepsPerRms  = 8,
+    kMaxChannels       = 64,
+};
+
+typedef enum CodecKind {
+    kCodecLossy,
+    kCodecLossless,
+    kCodecCBR,
+}CodecKind;
+
+typedef struct Codec {
+    AudioFormatID id;
+    CodecKind     kind;
+    UInt32        framesPerPacket;
+    UInt32        leadingFrames;
+}Codec;
+
+static const Codec kCodecs[] = {
+    { kAudioFormatMPEG4AAC,       kCodecLossy,    1024, 2112 },
+    { kAudioFormatMPEG4AAC_HE,    kCodecLossy,    2048, 4224 },
+    { kAudioFormatMPEG4AAC_HE_V2, kCodecLossy,    2048, 4224 },
+    { kAudioFormatMPEG4AAC_LD,    kCodecLossy,     512,  512 },
+    { kAudioFormatAMR,            kCodecLossy,     160,    0 },
+    { kAudioFormatAppleLossless,  kCodecLossless, 4096,    0 },
+    { kAudioFormatULaw,           kCodecCBR,         1,    0 },
+    { kAudioFormatALaw,           kCodecCBR,         1,    0 },
+};
+
+static struct {
+    long newUs;
+    long callUs;
+    long packetUs;
+} cost_;
+
+static void* resident_ = NULL;
+static UInt32 history_ = kLossyHistory;
+
+typedef enum ConvKind {
+    kConvPCM,
+    kConvEncode,
+    kConvDecode,
+}ConvKind;
+
+// Samples are kept as SInt32 full scale, whatever the PCM side uses.
+struct OpaqueAudioConverter {
+    AudioStreamBasicDescription in;
+    AudioStreamBasicDescription out;
+    ConvKind     kind;
+    const Codec* codec;
+    UInt32       channels;
+
+    UInt32       bitRate;
+    UInt32       codecQuality;
+    UInt32       controlMode;
+    UInt32       vbrQuality;
+    UInt32       bitDepthHint;
+    AudioConverterPrimeInfo prime;
+    void*        cookie;
+    UInt32       cookieSize;
+    void*        inLayout;
+    UInt32       inLayoutSize;
+    void*        outLayout;
+    UInt32       outLayoutSize;
+
+    SInt32*      fifo;
+    UInt32       fifoStart;  // Frames
+    UInt32       fifoFrames;
+    UInt32       fifoCap;
+    bool         eof;
+    UInt64       energy[kLossyHistoryMax];  // Of the history_ packets encoded last, oldest first
+
+    AudioBufferList* inList;
+};
+
+
+static void
+sleep_us(long us) {
+    if (us <= 0) return;
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+static void
+spin_us(long us) {
+    if (us <= 0) return;
+    struct timespec t0, t;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &t);
+    } while ((t.tv_sec - t0.tv_sec) * 1000000 + (t.tv_nsec - t0.tv_nsec) / 1000 < us);
+}
+
+static long
+env_long(const char* name) {
+    const char* val = getenv(name);
+    return val ? atol(val) : 0;
+}
+
+__attribute__((constructor)) static void
+mock_init(void) {
+    cost_.newUs = env_long("WAT4FF_MOCK_NEW_US");
+    cost_.callUs = env_long("WAT4FF_MOCK_CALL_US");
+    cost_.packetUs = env_long("WAT4FF_MOCK_PACKET_US");
+    sleep_us(env_long("WAT4FF_MOCK_LOAD_MS") * 1000);
+    long mb = env_long("WAT4FF_MOCK_RESIDENT_MB");
+    if (mb > 0 && (resident_ = malloc((size_t)mb << 20))) memset(resident_, 1, (size_t)mb << 20);
+    long history = env_long("WAT4FF_MOCK_HISTORY");
+    if (history > 0) history_ = history < kLossyHistoryMax ? (UInt32)history : kLossyHistoryMax;
+}
+
+__attribute__((destructor)) static void
+mock_fini(void) {
+    free(resident_);
+}
+
+static const Codec*
+find_codec(AudioFormatID id) {
+    for (size_t i = 0; i < sizeof(kCodecs) / sizeof(*kCodecs); ++i) {
+        if (kCodecs[i].id == id) return &kCodecs[i];
+    }
+    return NULL;
+}
+
+
+// PCM +++
+
+static bool
+pcm_supported(const AudioStreamBasicDescription* f) {
+    if (f->mFormatID != kAudioFormatLinearPCM) return false;
+    if (f->mFormatFlags & kAudioFormatFlagIsBigEndian) return false;
+    if (!f->mChannelsPerFrame || f->mChannelsPerFrame > kMaxChannels) return false;
+    if (f->mFormatFlags & kAudioFormatFlagIsFloat) return f->mBitsPerChannel == 32;
+    return f->mBitsPerChannel == 16 || f->mBitsPerChannel == 32;
+}
+
+static UInt32
+pcm_frame_bytes(const AudioStreamBasicDescription* f) {
+    return f->mBitsPerChannel / 8 * f->mChannelsPerFrame;
+}
+
+static SInt32
+float_to_s32(Float32 v) {
+    if (v >= 1.0f) return 0x7fffffff;
+    if (v <= -1.0f) return -0x7fffffff - 1;
+    return (SInt32)(v * 2147483648.0f);
+}
+
+// Reads frames starting at frame `at` of a buffer list in format f.
+static void
+pcm_read(const AudioStreamBasicDescription* f, const AudioBufferList* abl, UInt32 at, UInt32 frames, SInt32* dst) {
+    UInt32 ch = f->mChannelsPerFrame;
+    bool planar = f->mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+    bool fl = f->mFormatFlags & kAudioFormatFlagIsFloat;
+    UInt32 bits = f->mBitsPerChannel;
+
+    for (UInt32 c = 0; c < ch; ++c) {
+        const void* base = planar ? abl->mBuffers[c].mData : abl->mBuffers[0].mData;
+        size_t step = planar ? 1 : ch;
+        size_t first = planar ? at : (size_t)at * ch + c;
+        for (UInt32 i = 0; i < frames; ++i) {
+            size_t k = first + i * step;
+            SInt32 v;
+            if (fl) v = float_to_s32(((const Float32*)base)[k]);
+            else if (bits == 16) v = (SInt32)((UInt32)((const SInt16*)base)[k] << 16);
+            else v = ((const SInt32*)base)[k];
+            dst[(size_t)i * ch + c] = v;
+        }
+    }
+}
+
+static void
+pcm_write(const AudioStreamBasicDescription* f, AudioBufferList* abl, UInt32 at, UInt32 frames, const SInt32* src) {
+    UInt32 ch = f->mChannelsPerFrame;
+    bool planar = f->mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+    bool fl = f->mFormatFlags & kAudioFormatFlagIsFloat;
+    UInt32 bits = f->mBitsPerChannel;
+
+    for (UInt32 c = 0; c < ch; ++c) {
+        void* base = planar ? abl->mBuffers[c].mData : abl->mBuffers[0].mData;
+        size_t step = planar ? 1 : ch;
+        size_t first = planar ? at : (size_t)at * ch + c;
+        for (UInt32 i = 0; i < frames; ++i) {
+            size_t k = first + i * step;
+            SInt32 v = src[(size_t)i * ch + c];
+            if (fl) ((Float32*)base)[k] = (Float32)v / 2147483648.0f;
+            else if (bits == 16) ((SInt16*)base)[k] = (SInt16)(v >> 16);
+            else ((SInt32*)base)[k] = v;
+        }
+    }
+}
+
+// Frames available in every buffer of a list handed over by an input proc.
+static UInt32
+pcm_list_frames(const AudioStreamBasicDescription* f, const AudioBufferList* abl) {
+    bool planar = f->mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+    UInt32 bytes = planar ? f->mBitsPerChannel / 8 : pcm_frame_bytes(f);
+    UInt32 n = planar ? f->mChannelsPerFrame : 1;
+    if (abl->mNumberBuffers < n) return 0;
+
+    UInt32 frames = 0xffffffff;
+    for (UInt32 i = 0; i < n; ++i) {
+        if (!abl->mBuffers[i].mData) return 0;
+        UInt32 k = abl->mBuffers[i].mDataByteSize / bytes;
+        if (k < frames) frames = k;
+    }
+    return frames;
+}
+
+// PCM ---
+
+
+// FIFO +++
+
+static bool
+fifo_reserve(AudioConverterRef c, UInt32 frames) {
+    if (c->fifoStart && c->fifoStart + c->fifoFrames + frames > c->fifoCap) {
+        memmove(c->fifo, c->fifo + (size_t)c->fifoStart * c->channels, sizeof(SInt32) * c->fifoFrames * c->channels);
+        c->fifoStart = 0;
+    }
+    if (c->fifoFrames + frames <= c->fifoCap) return true;
+
+    UInt32 cap = c->fifoCap ? c->fifoCap : 4096;
+    while (cap < c->fifoFrames + frames) cap *= 2;
+    SInt32* p = realloc(c->fifo, sizeof(SInt32) * cap * c->channels);
+    if (!p) return false;
+    c->fifo = p;
+    c->fifoCap = cap;
+    return true;
+}
+
+static SInt32*
+fifo_head(AudioConverterRef c) {
+    return c->fifo + (size_t)c->fifoStart * c->channels;
+}
+
+static SInt32*
+fifo_tail(AudioConverterRef c) {
+    return c->fifo + (size_t)(c->fifoStart + c->fifoFrames) * c->channels;
+}
+
+static void
+fifo_consume(AudioConverterRef c, UInt32 frames) {
+    c->fifoStart += frames;
+    c->fifoFrames -= frames;
+    if (!c->fifoFrames) c->fifoStart = 0;
+}
+
+static void
+fifo_push_silence(AudioConverterRef c, UInt32 frames) {
+    if (!frames || !fifo_reserve(c, frames)) return;
+    memset(fifo_tail(c), 0, sizeof(SInt32) * frames * c->channels);
+    c->fifoFrames += frames;
+}
+
+// FIFO ---
+
+
+static void
+reset(AudioConverterRef c) {
+    c->fifoStart = 0;
+    c->fifoFrames = 0;
+    c->eof = false;
+    memset(c->energy, 0, sizeof(c->energy));
+    if (c->kind == kConvEncode) {
+        c->prime.trailingFrames = 0;
+        fifo_push_silence(c, c->prime.leadingFrames);
+    }
+}
+
+static UInt32
+max_packet_size(AudioConverterRef c) {
+    switch (c->codec->kind) {
+    case kCodecLossy:    return kLossyHeaderSize + c->codec->framesPerPacket * c->channels;
+    case kCodecLossless: return 4 + c->codec->framesPerPacket * c->channels * 4;
+    default:             return c->channels;
+    }
+}
+
+static AudioStreamBasicDescription
+compressed_format(const AudioStreamBasicDescription* f, const Codec* codec) {
+    AudioStreamBasicDescription r = *f;
+    r.mFramesPerPacket = codec->framesPerPacket;
+    r.mBytesPerPacket = codec->kind == kCodecCBR ? f->mChannelsPerFrame : 0;
+    r.mBytesPerFrame = r.mBytesPerPacket;
+    r.mBitsPerChannel = codec->kind == kCodecCBR ? 8 : 0;
+    return r;
+}
+
+
+// Input proc +++
+
+// Asks the input proc for up to `want` packets, stores their list in
+// c->inList. Returns the proc's status, *got is 0 at end of stream.
+static OSStatus
+pull(AudioConverterRef c, AudioConverterComplexInputDataProc proc, void* user, UInt32 want, UInt32* got, AudioStreamPacketDescription** descs) {
+    bool planar = c->kind != kConvDecode && (c->in.mFormatFlags & kAudioFormatFlagIsNonInterleaved);
+    c->inList->mNumberBuffers = planar ? c->channels : 1;
+    for (UInt32 i = 0; i < c->inList->mNumberBuffers; ++i) {
+        c->inList->mBuffers[i].mNumberChannels = planar ? 1 : c->channels;
+        c->inList->mBuffers[i].mDataByteSize = 0;
+        c->inList->mBuffers[i].mData = NULL;
+    }
+
+    *got = want;
+    *descs = NULL;
+    OSStatus rc = proc(c, got, c->inList, descs, user);
+    if (rc) *got = 0;
+    return rc;
+}
+
+// Tops the fifo up with PCM from the input proc.
+static OSStatus
+pull_pcm(AudioConverterRef c, AudioConverterComplexInputDataProc proc, void* user, UInt32 want) {
+    UInt32 got;
+    AudioStreamPacketDescription* descs;
+    OSStatus rc = pull(c, proc, user, want, &got, &descs);
+    if (rc) return rc;
+    if (!got) {
+        c->eof = true;
+        return noErr;
+    }
+
+    UInt32 avail = pcm_list_frames(&c->in, c->inList);
+    if (got > avail) got = avail;
+    if (!fifo_reserve(c, got)) return kAudio_UnimplementedError;
+    pcm_read(&c->in, c->inList, 0, got, fifo_tail(c));
+    c->fifoFrames += got;
+    return noErr;
+}
+
+// Input proc ---
+
+
+// Encode +++
+
+static SInt8
+quantize(SInt32 v) {
+    SInt32 q = (v >> 24) + ((v >> 23) & 1);
+    return (SInt8)(q > 127 ? 127 : q);
+}
+
+static UInt32
+isqrt(UInt64 v) {
+    UInt64 r = 0;
+    for (UInt64 bit = (UInt64)1 << 62; bit; bit >>= 2) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else {
+            r >>= 1;
+        }
+    }
+    return (UInt32)r;
+}
+
+// A 16-bit step of an eighth of the RMS of the history. After silence
+// that is 1 and louder samples clip, which is what starting cold costs.
+static UInt32
+lossy_step(AudioConverterRef c) {
+    UInt64 energy = 0;
+    for (UInt32 i = 0; i < history_; ++i) energy += c->energy[i];
+    UInt32 rms = isqrt(energy / ((UInt64)history_ * c->codec->framesPerPacket * c->channels));
+    return rms / kLossyStepsPerRms ? rms / kLossyStepsPerRms : 1;
+}
+
+static SInt8
+quantize_step(SInt32 v, UInt32 step) {
+    SInt32 x = v >> 16;
+    SInt32 q = (x >= 0 ? x + (SInt32)step / 2 : x - (SInt32)step / 2) / (SInt32)step;
+    return (SInt8)(q > 127 ? 127 : q < -127 ? -127 : q);
+}
+
+static void
+lossy_remember(AudioConverterRef c, const SInt32* src, UInt32 n) {
+    UInt64 energy = 0;
+    for (UInt32 i = 0; i < n; ++i) {
+        SInt64 v = src[i] >> 16;
+        energy += (UInt64)(v * v);
+    }
+    memmove(c->energy, c->energy + 1, (history_ - 1) * sizeof(c->energy[0]));
+    c->energy[history_ - 1] = energy;
+}
+
+static UInt32
+encode_packet(AudioConverterRef c, const SInt32* src, UInt32 frames, UInt8* dst) {
+    UInt32 n = frames * c->channels;
+    spin_us(cost_.packetUs);
+
+    switch (c->codec->kind) {
+    case kCodecLossy: {
+        UInt32 step = lossy_step(c);
+        bool silent = true;
+        for (UInt32 i = 0; i < n; ++i) {
+            SInt8 q = quantize_step(src[i], step);
+            dst[kLossyHeaderSize + i] = (UInt8)q;
+            if (q) silent = false;
+        }
+        lossy_remember(c, src, n);
+        dst[0] = silent ? kLossyHeaderSilent : kLossyHeaderFull;
+        dst[1] = (UInt8)step;
+        dst[2] = (UInt8)(step >> 8);
+        return silent ? 1 : kLossyHeaderSize + n;
+    }
+    case kCodecLossless:
+        memcpy(dst, &frames, 4);
+        memcpy(dst + 4, src, sizeof(SInt32) * n);
+        return 4 + sizeof(SInt32) * n;
+    default:
+        for (UInt32 i = 0; i < n; ++i) dst[i] = (UInt8)quantize(src[i]);
+        return n;
+    }
+}
+
+static OSStatus
+encode(AudioConverterRef c, AudioConverterComplexInputDataProc proc, void* user, UInt32* ioPackets, AudioBufferList* out, AudioStreamPacketDescription* descs) {
+    UInt32 fpp = c->codec->framesPerPacket;
+    UInt32 cap = *ioPackets;
+    UInt8* dst = out->mBuffers[0].mData;
+    UInt32 dstCap = out->mBuffers[0].mDataByteSize;
+    UInt32 used = 0;
+    UInt32 done = 0;
+    OSStatus rc = noErr;
+
+    while (done < cap) {
+        if (c->fifoFrames < fpp && !c->eof) {
+            rc = pull_pcm(c, proc, user, fpp - c->fifoFrames);
+            if (rc) break;
+            continue;
+        }
+        if (!c->fifoFrames) break;
+
+        // Flushing, pad the last packet like the real encoders do.
+        // ALAC sends the short packet as is.
+        if (c->fifoFrames < fpp && c->codec->kind != kCodecLossless) {
+            UInt32 pad = fpp - c->fifoFrames;
+            c->prime.trailingFrames = pad;
+            fifo_push_silence(c, pad);
+        }
+
+        UInt32 frames = c->fifoFrames < fpp ? c->fifoFrames : fpp;
+        if (used + max_packet_size(c) > dstCap) break;
+        UInt32 size = encode_packet(c, fifo_head(c), frames, dst + used);
+        fifo_consume(c, frames);
+
+        if (descs) {
+            descs[done].mStartOffset = used;
+            descs[done].mVariableFramesInPacket = c->codec->kind == kCodecLossless && frames != fpp ? frames : 0;
+            descs[done].mDataByteSize = size;
+        }
+        used += size;
+        ++done;
+    }
+
+    *ioPackets = done;
+    out->mBuffers[0].mDataByteSize = used;
+    return rc;
+}
+
+// Encode ---
+
+
+// Decode +++
+
+static void
+decode_packet(AudioConverterRef c, const UInt8* src, UInt32 size) {
+    UInt32 ch = c->channels;
+    spin_us(cost_.packetUs);
+
+    switch (c->codec->kind) {
+    case kCodecLossy: {
+        UInt32 frames = c->codec->framesPerPacket;
+        if (!size || !fifo_reserve(c, frames)) return;
+        SInt32* dst = fifo_tail(c);
+        if (src[0] == kLossyHeaderSilent || size < kLossyHeaderSize + frames * ch) {
+            memset(dst, 0, sizeof(SInt32) * frames * ch);
+        }
+        else {
+            SInt32 step = src[1] | src[2] << 8;
+            for (UInt32 i = 0; i < frames * ch; ++i) {
+                SInt32 x = (SInt8)src[kLossyHeaderSize + i] * step;
+                x = x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+                dst[i] = (SInt32)((UInt32)x << 16);
+            }
+        }
+        c->fifoFrames += frames;
+        break;
+    }
+    case kCodecLossless: {
+        UInt32 frames;
+        if (size < 4) return;
+        memcpy(&frames, src, 4);
+        if (size < 4 + frames * ch * 4 || !fifo_reserve(c, frames)) return;
+        memcpy(fifo_tail(c), src + 4, sizeof(SInt32) * frames * ch);
+        c->fifoFrames += frames;
+        break;
+    }
+    default: {
+        UInt32 frames = size / ch;
+        if (!fifo_reserve(c, frames)) return;
+        SInt32* dst = fifo_tail(c);
+        for (UInt32 i = 0; i < frames * ch; ++i) dst[i] = (SInt32)((UInt32)(SInt8)src[i] << 24);
+        c->fifoFrames += frames;
+        break;
+    }
+    }
+}
+
+static OSStatus
+decode(AudioConverterRef c, AudioConverterComplexInputDataProc proc, void* user, UInt32* ioPackets, AudioBufferList* out) {
+    UInt32 cap = *ioPackets;
+    UInt32 done = 0;
+    OSStatus rc = noErr;
+
+    while (done < cap) {
+        if (c->fifoFrames) {
+            UInt32 n = cap - done < c->fifoFrames ? cap - done : c->fifoFrames;
+            pcm_write(&c->out, out, done, n, fifo_head(c));
+            fifo_consume(c, n);
+            done += n;
+            continue;
+        }
+        if (c->eof) break;
+
+        UInt32 got;
+        AudioStreamPacketDescription* descs;
+        rc = pull(c, proc, user, 1, &got, &descs);
+        if (rc) break;
+        if (!got) {
+            c->eof = true;
+            continue;
+        }
+
+        const UInt8* data = c->inList->mBuffers[0].mData;
+        UInt32 bytes = c->inList->mBuffers[0].mDataByteSize;
+        if (!data) continue;
+        if (c->codec->kind == kCodecCBR) {
+            decode_packet(c, data, bytes < got * c->channels ? bytes : got * c->channels);
+            continue;
+        }
+        for (UInt32 i = 0; i < got; ++i) {
+            SInt64 off = descs ? descs[i].mStartOffset : 0;
+            UInt32 size = descs ? descs[i].mDataByteSize : bytes;
+            if (off < 0 || off + size > bytes) break;
+            decode_packet(c, data + off, size);
+        }
+    }
+
+    *ioPackets = done;
+    bool planar = c->out.mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+    for (UInt32 i = 0; i < out->mNumberBuffers; ++i) {
+        out->mBuffers[i].mDataByteSize = done * (planar ? c->out.mBitsPerChannel / 8 : pcm_frame_bytes(&c->out));
+    }
+    return rc;
+}
+
+// Decode ---
+
+
+static OSStatus
+convert_pcm(AudioConverterRef c, AudioConverterComplexInputDataProc proc, void* user, UInt32* ioPackets, AudioBufferList* out) {
+    UInt32 cap = *ioPackets;
+    UInt32 done = 0;
+    OSStatus rc = noErr;
+
+    while (done < cap && !c->eof) {
+        if (!c->fifoFrames) {
+            rc = pull_pcm(c, proc, user, cap - done);
+            if (rc) break;
+            continue;
+        }
+        UInt32 n = cap - done < c->fifoFrames ? cap - done : c->fifoFrames;
+        pcm_write(&c->out, out, done, n, fifo_head(c));
+        fifo_consume(c, n);
+        done += n;
+    }
+    if (c->eof && c->fifoFrames && done < cap) {
+        UInt32 n = cap - done < c->fifoFrames ? cap - done : c->fifoFrames;
+        pcm_write(&c->out, out, done, n, fifo_head(c));
+        fifo_consume(c, n);
+        done += n;
+    }
+
+    *ioPackets = done;
+    bool planar = c->out.mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+    for (UInt32 i = 0; i < out->mNumberBuffers; ++i) {
+        out->mBuffers[i].mDataByteSize = done * (planar ? c->out.mBitsPerChannel / 8 : pcm_frame_bytes(&c->out));
+    }
+    return rc;
+}
+
+
+// Properties +++
+
+static bool
+set_blob(void** dst, UInt32* dstSize, const void* src, UInt32 size) {
+    void* p = NULL;
+    if (size) {
+        p = malloc(size);
+        if (!p) return false;
+        memcpy(p, src, size);
+    }
+    free(*dst);
+    *dst = p;
+    *dstSize = size;
+    return true;
+}
+
+static UInt32
+layout_size(UInt32 n) {
+    return (UInt32)(offsetof(AudioChannelLayout, mChannelDescriptions) + sizeof(AudioChannelDescription) * n);
+}
+
+static const AudioValueRange kBitRates[] = {
+    {  32000,  32000 }, {  48000,  48000 }, {  64000,  64000 }, {  96000,  96000 },
+    { 128000, 128000 }, { 160000, 160000 }, { 192000, 192000 }, { 256000, 256000 },
+    { 320000, 320000 },
+};
+
+// Size of a readable property, 0 if unknown.
+static UInt32
+property_size(AudioConverterRef c, AudioConverterPropertyID id) {
+    switch (id) {
+    case kAudioConverterCurrentInputStreamDescription:
+    case kAudioConverterCurrentOutputStreamDescription:
+        return sizeof(AudioStreamBasicDescription);
+    case kAudioConverterPrimeInfo:
+        return sizeof(AudioConverterPrimeInfo);
+    case kAudioConverterPropertyMaximumOutputPacketSize:
+    case kAudioConverterEncodeBitRate:
+    case kAudioConverterCodecQuality:
+    case kAudioCodecPropertyBitRateControlMode:
+    case kAudioCodecPropertySoundQualityForVBR:
+    case kAudioConverterPropertyBitDepthHint:
+        return sizeof(UInt32);
+    case kAudioConverterApplicableEncodeBitRates:
+        return c->kind == kConvEncode ? sizeof(kBitRates) : 0;
+    case kAudioConverterCompressionMagicCookie:
+        return c->kind == kConvEncode ? 20 : 0;
+    case kAudioConverterDecompressionMagicCookie:
+        return c->cookieSize;
+    case kAudioConverterInputChannelLayout:
+        return c->inLayoutSize ? c->inLayoutSize : layout_size(0);
+    case kAudioConverterOutputChannelLayout:
+        return c->outLayoutSize ? c->outLayoutSize : layout_size(0);
+    default:
+        return 0;
+    }
+}
+
+static OSStatus
+get_property(AudioConverterRef c, AudioConverterPropertyID id, UInt32* ioSize, void* data) {
+    UInt32 size = property_size(c, id);
+    if (!size && id != kAudioConverterDecompressionMagicCookie) return kAudioFormatUnsupportedDataFormatError;
+    if (*ioSize < size) return kAudioFormatUnsupportedDataFormatError;
+
+    UInt32 v = 0;
+    const void* src = &v;
+    AudioStreamBasicDescription f;
+    UInt8 cookie[20];
+    AudioChannelLayout empty = { .mChannelLayoutTag = kAudioChannelLayoutTag_UseChannelDescriptions };
+
+    switch (id) {
+    case kAudioConverterCurrentInputStreamDescription:
+        f = c->kind == kConvDecode ? compressed_format(&c->in, c->codec) : c->in;
+        src = &f;
+        break;
+    case kAudioConverterCurrentOutputStreamDescription:
+        f = c->kind == kConvEncode ? compressed_format(&c->out, c->codec) : c->out;
+        src = &f;
+        break;
+    case kAudioConverterPrimeInfo:
+        src = &c->prime;
+        break;
+    case kAudioConverterPropertyMaximumOutputPacketSize:
+        v = c->kind == kConvEncode ? max_packet_size(c) : pcm_frame_bytes(&c->out);
+        break;
+    case kAudioConverterEncodeBitRate:          v = c->bitRate;      break;
+    case kAudioConverterCodecQuality:           v = c->codecQuality; break;
+    case kAudioCodecPropertyBitRateControlMode: v = c->controlMode;  break;
+    case kAudioCodecPropertySoundQualityForVBR: v = c->vbrQuality;   break;
+    case kAudioConverterPropertyBitDepthHint:   v = c->bitDepthHint; break;
+    case kAudioConverterApplicableEncodeBitRates:
+        src = kBitRates;
+        break;
+    case kAudioConverterCompressionMagicCookie:
+        memcpy(cookie, "w4fm", 4);
+        memcpy(cookie + 4, &c->out.mFormatID, 4);
+        memcpy(cookie + 8, &c->codec->framesPerPacket, 4);
+        memcpy(cookie + 12, &c->channels, 4);
+        memcpy(cookie + 16, &c->bitRate, 4);      // As an esds has it
+        src = cookie;
+        break;
+    case kAudioConverterDecompressionMagicCookie:
+        src = c->cookie;
+        break;
+    case kAudioConverterInputChannelLayout:
+        src = c->inLayoutSize ? c->inLayout : &empty;
+        break;
+    case kAudioConverterOutputChannelLayout:
+        src = c->outLayoutSize ? c->outLayout : &empty;
+        break;
+    }
+
+    if (size) memcpy(data, src, size);
+    *ioSize = size;
+    return noErr;
+}
+
+static OSStatus
+set_property(AudioConverterRef c, AudioConverterPropertyID id, UInt32 size, const void* data) {
+    UInt32* target = NULL;
+
+    switch (id) {
+    case kAudioConverterEncodeBitRate:          target = &c->bitRate;      break;
+    case kAudioConverterCodecQuality:           target = &c->codecQuality; break;
+    case kAudioCodecPropertyBitRateControlMode: target = &c->controlMode;  break;
+    case kAudioCodecPropertySoundQualityForVBR: target = &c->vbrQuality;   break;
+    case kAudioConverterPropertyBitDepthHint:   target = &c->bitDepthHint; break;
+    case kAudioConverterPrimeInfo:
+        if (size < sizeof(c->prime)) return kAudioFormatUnsupportedDataFormatError;
+        memcpy(&c->prime, data, sizeof(c->prime));
+        return noErr;
+    case kAudioConverterDecompressionMagicCookie:
+        return set_blob(&c->cookie, &c->cookieSize, data, size) ? noErr : kAudio_UnimplementedError;
+    case kAudioConverterInputChannelLayout:
+        return set_blob(&c->inLayout, &c->inLayoutSize, data, size) ? noErr : kAudio_UnimplementedError;
+    case kAudioConverterOutputChannelLayout:
+        return set_blob(&c->outLayout, &c->outLayoutSize, data, size) ? noErr : kAudio_UnimplementedError;
+    default:
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+
+    if (size < sizeof(UInt32)) return kAudioFormatUnsupportedDataFormatError;
+    memcpy(target, data, sizeof(UInt32));
+    return noErr;
+}
+
+// Properties ---
+
+
+// Converter API +++
+
+MOCK_EXPORT OSStatus
+AudioConverterNew(const AudioStreamBasicDescription* p1, const AudioStreamBasicDescription* p2, AudioConverterRef* p3) {
+    sleep_us(cost_.newUs);
+    if (!p1 || !p2 || !p3) return kAudio_UnimplementedError;
+    if (p1->mSampleRate != p2->mSampleRate || p1->mChannelsPerFrame != p2->mChannelsPerFrame) {
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+
+    ConvKind kind;
+    const Codec* codec = NULL;
+    if (p1->mFormatID == kAudioFormatLinearPCM && p2->mFormatID == kAudioFormatLinearPCM) {
+        if (!pcm_supported(p1) || !pcm_supported(p2)) return kAudioFormatUnsupportedDataFormatError;
+        kind = kConvPCM;
+    }
+    else if (p1->mFormatID == kAudioFormatLinearPCM) {
+        codec = find_codec(p2->mFormatID);
+        if (!codec || !pcm_supported(p1)) return kAudioFormatUnsupportedDataFormatError;
+        kind = kConvEncode;
+    }
+    else if (p2->mFormatID == kAudioFormatLinearPCM) {
+        codec = find_codec(p1->mFormatID);
+        if (!codec || !pcm_supported(p2)) return kAudioFormatUnsupportedDataFormatError;
+        kind = kConvDecode;
+    }
+    else {
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+
+    AudioConverterRef c = calloc(1, sizeof(*c));
+    if (!c) return kAudio_UnimplementedError;
+    c->in = *p1;
+    c->out = *p2;
+    c->kind = kind;
+    c->codec = codec;
+    c->channels = p1->mChannelsPerFrame;
+    c->bitRate = 128000;
+    c->controlMode = kAudioCodecBitRateControlMode_LongTermAverage;
+    c->vbrQuality = 64;
+    if (kind == kConvEncode) c->prime.leadingFrames = codec->leadingFrames;
+
+    c->inList = calloc(1, offsetof(AudioBufferList, mBuffers) + sizeof(AudioBuffer) * c->channels);
+    if (!c->inList) {
+        free(c);
+        return kAudio_UnimplementedError;
+    }
+    reset(c);
+
+    *p3 = c;
+    return noErr;
+}
+
+MOCK_EXPORT OSStatus
+AudioConverterDispose(AudioConverterRef p1) {
+    if (!p1) return kAudio_UnimplementedError;
+    free(p1->fifo);
+    free(p1->inList);
+    free(p1->cookie);
+    free(p1->inLayout);
+    free(p1->outLayout);
+    free(p1);
+    return noErr;
+}
+
+MOCK_EXPORT OSStatus
+AudioConverterReset(AudioConverterRef p1) {
+    if (!p1) return kAudio_UnimplementedError;
+    reset(p1);
+    return noErr;
+}
+
+MOCK_EXPORT OSStatus
+AudioConverterFillComplexBuffer(AudioConverterRef p1, AudioConverterComplexInputDataProc p2, void* p3, UInt32* p4, AudioBufferList* p5, AudioStreamPacketDescription* p6) {
+    if (!p1 || !p2 || !p4 || !p5) return kAudio_UnimplementedError;
+    sleep_us(cost_.callUs);
+
+    switch (p1->kind) {
+    case kConvEncode: return encode(p1, p2, p3, p4, p5, p6);
+    case kConvDecode: return decode(p1, p2, p3, p4, p5);
+    default:          return convert_pcm(p1, p2, p3, p4, p5);
+    }
+}
+
+MOCK_EXPORT OSStatus
+AudioConverterGetPropertyInfo(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, Boolean* p4) {
+    if (!p1) return kAudio_UnimplementedError;
+    UInt32 size = property_size(p1, p2);
+    if (!size && p2 != kAudioConverterDecompressionMagicCookie) return kAudioFormatUnsupportedDataFormatError;
+    if (p3) *p3 = size;
+    if (p4) *p4 = p2 != kAudioConverterCurrentInputStreamDescription
+               && p2 != kAudioConverterCurrentOutputStreamDescription
+               && p2 != kAudioConverterApplicableEncodeBitRates
+               && p2 != kAudioConverterCompressionMagicCookie
+               && p2 != kAudioConverterPropertyMaximumOutputPacketSize;
+    return noErr;
+}
+
+MOCK_EXPORT OSStatus
+AudioConverterGetProperty(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, void* p4) {
+    if (!p1 || !p3 || !p4) return kAudio_UnimplementedError;
+    return get_property(p1, p2, p3, p4);
+}
+
+MOCK_EXPORT OSStatus
+AudioConverterSetProperty(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32 p3, const void* p4) {
+    if (!p1 || (!p4 && p3)) return kAudio_UnimplementedError;
+    return set_property(p1, p2, p3, p4);
+}
+
+// Converter API ---
+
+
+// Format API +++
+
+// Labels 1 to n, Left, Right, Center, LFE and so on, mono gets its own.
+static UInt32
+layout_for_count(UInt32 n, AudioChannelLayout* layout) {
+    layout->mChannelLayoutTag = kAudioChannelLayoutTag_UseChannelDescriptions;
+    layout->mChannelBitmap = 0;
+    layout->mNumberChannelDescriptions = n;
+    for (UInt32 i = 0; i < n; ++i) {
+        AudioChannelDescription* d = &layout->mChannelDescriptions[i];
+        memset(d, 0, sizeof(*d));
+        d->mChannelLabel = n == 1 ? kAudioChannelLabel_Mono : i + 1;
+    }
+    return layout_size(n);
+}
+
+static UInt32
+bitmap_count(UInt32 bitmap) {
+    UInt32 n = 0;
+    for (; bitmap; bitmap &= bitmap - 1) ++n;
+    return n;
+}
+
+static OSStatus
+format_property_size(AudioFormatPropertyID id, UInt32 specSize, const void* spec, UInt32* size) {
+    UInt32 v = 0;
+    switch (id) {
+    case kAudioFormatProperty_FormatInfo:
+        *size = sizeof(AudioStreamBasicDescription);
+        return noErr;
+    case kAudioFormatProperty_ChannelLayoutForTag:
+    case kAudioFormatProperty_ChannelLayoutForBitmap:
+        if (specSize < sizeof(UInt32) || !spec) return kAudioFormatUnsupportedDataFormatError;
+        memcpy(&v, spec, sizeof(v));
+        *size = layout_size(id == kAudioFormatProperty_ChannelLayoutForTag ? (v & 0xffff) : bitmap_count(v));
+        return noErr;
+    default:
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+}
+
+MOCK_EXPORT OSStatus
+AudioFormatGetPropertyInfo(AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4) {
+    if (!p4) return kAudio_UnimplementedError;
+    return format_property_size(p1, p2, p3, p4);
+}
+
+MOCK_EXPORT OSStatus
+AudioFormatGetProperty(AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4, void* p5) {
+    UInt32 size;
+    if (!p4 || !p5) return kAudio_UnimplementedError;
+    OSStatus rc = format_property_size(p1, p2, p3, &size);
+    if (rc) return rc;
+    if (*p4 < size) return kAudioFormatUnsupportedDataFormatError;
+
+    if (p1 == kAudioFormatProperty_FormatInfo) {
+        AudioStreamBasicDescription* f = p5;
+        const Codec* codec = find_codec(f->mFormatID);
+        if (!codec) return kAudioFormatUnsupportedDataFormatError;
+        *f = compressed_format(f, codec);
+    }
+    else {
+        UInt32 v;
+        memcpy(&v, p3, sizeof(v));
+        AudioChannelLayout* layout = p5;
+        if (p1 == kAudioFormatProperty_ChannelLayoutForTag) {
+            layout_for_count(v & 0xffff, layout);
+        }
+        else {
+            UInt32 i = 0;
+            layout_for_count(bitmap_count(v), layout);
+            for (UInt32 bit = 0; bit < 32; ++bit) {
+                if (v & (1U << bit)) layout->mChannelDescriptions[i++].mChannelLabel = bit + 1;
+            }
+        }
+    }
+
+    *p4 = size;
+    return noErr;
+}
+
+// Format API ---
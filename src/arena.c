@@ -0,0 +1,169 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Per-converter arenas, see wat4ff_arena_acquire().
+ *
+ * Each block is one allocation: the header, the packet descriptions, then
+ * the data aligned to a cache line. Blocks lent in the current generation
+ * are on the used list, recycling moves them all to the free list at once.
+ * A converter is used by one thread at a time, so arenas need no lock, only
+ * the process-wide counters are shared.
+*/
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "conv.h"
+#include "plat.h"
+
+
+enum {
+    kAlign = 64,
+};
+
+typedef struct Block {
+    struct Block* next;
+    size_t bytes;                      // Of the whole allocation
+    UInt8* data;
+    UInt32 dataSize;
+    UInt32 packetCount;
+    AudioStreamPacketDescription packets[];
+}Block;
+
+struct Arena {
+    Block* used;
+    Block* free;
+    UInt32 generation;
+};
+
+static volatile SInt64 acquires_ = 0;
+static volatile SInt64 allocations_ = 0;
+static volatile SInt64 bytes_ = 0;
+static volatile SInt64 peak_bytes_ = 0;
+
+
+static Block*
+block_new(UInt32 packets, UInt32 dataSize) {
+    size_t head = sizeof(Block) + sizeof(AudioStreamPacketDescription) * packets;
+    size_t bytes = head + kAlign - 1 + dataSize;
+    Block* b = plat_alloc(bytes);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->bytes = bytes;
+    b->data = (UInt8*)(((size_t)b + head + kAlign - 1) & ~(size_t)(kAlign - 1));
+    b->dataSize = dataSize;
+    b->packetCount = packets;
+
+    plat_counter_add(&allocations_, 1);
+    plat_counter_max(&peak_bytes_, plat_counter_add(&bytes_, (SInt64)bytes));
+    return b;
+}
+
+static void
+block_free(Block* b) {
+    plat_counter_add(&bytes_, -(SInt64)b->bytes);
+    plat_free(b);
+}
+
+static void
+list_free(Block* b) {
+    while (b) {
+        Block* next = b->next;
+        block_free(b);
+        b = next;
+    }
+}
+
+// Takes the first free block big enough. Ones too small for what the
+// converter needs now are let go, they would never fit again.
+static Block*
+take_free(Arena* a, UInt32 packets, UInt32 dataSize, UInt32 maxPacket) {
+    Block** link = &a->free;
+    while (*link) {
+        Block* b = *link;
+        if (b->packetCount >= packets && b->dataSize >= dataSize) {
+            *link = b->next;
+            return b;
+        }
+        if (b->dataSize < maxPacket) {
+            *link = b->next;
+            block_free(b);
+            continue;
+        }
+        link = &b->next;
+    }
+    return NULL;
+}
+
+void
+arena_recycle(Arena* a) {
+    if (!a) return;
+    while (a->used) {
+        Block* b = a->used;
+        a->used = b->next;
+        b->next = a->free;
+        a->free = b;
+    }
+    ++a->generation;
+}
+
+void
+arena_free(Arena* a) {
+    if (!a) return;
+    list_free(a->used);
+    list_free(a->free);
+    plat_free(a);
+}
+
+
+// API +++
+
+OSStatus
+wat4ff_arena_acquire(AudioConverterRef conv, UInt32 packets, Wat4ffPacketBuffer* buf) {
+    Conv* c = (Conv*)conv;
+    if (!c || !buf || !packets) return kAudio_ParamError;
+
+    UInt32 maxPacket = 0;
+    UInt32 size = sizeof(maxPacket);
+    OSStatus rc = conv_AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &maxPacket);
+    if (rc) return rc;
+    if (!maxPacket || (UInt64)maxPacket * packets > 0x7fffffff) return kAudio_ParamError;
+
+    if (!c->arena) {
+        c->arena = plat_calloc(sizeof(Arena));
+        if (!c->arena) return kAudio_MemFullError;
+    }
+    Arena* a = c->arena;
+    UInt32 dataSize = maxPacket * packets;
+    Block* b = take_free(a, packets, dataSize, maxPacket);
+    if (!b) b = block_new(packets, dataSize);
+    if (!b) return kAudio_MemFullError;
+    b->next = a->used;
+    a->used = b;
+    plat_counter_add(&acquires_, 1);
+
+    buf->data = b->data;
+    buf->dataSize = dataSize;
+    buf->packets = b->packets;
+    buf->packetCount = packets;
+    buf->generation = a->generation;
+    return noErr;
+}
+
+void
+wat4ff_arena_recycle(AudioConverterRef conv) {
+    Conv* c = (Conv*)conv;
+    if (c) arena_recycle(c->arena);
+}
+
+void
+wat4ff_get_arena_stats(Wat4ffArenaStats* stats) {
+    stats->acquires = (UInt64)plat_counter_get(&acquires_);
+    stats->allocations = (UInt64)plat_counter_get(&allocations_);
+    stats->bytes = (UInt64)plat_counter_get(&bytes_);
+    stats->peakBytes = (UInt64)plat_counter_get(&peak_bytes_);
+}
+
+// API ---
@@ -0,0 +1,92 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Batched decode, see wat4ff_decode_batch().
+ *
+ * FFmpeg asks for one packet's worth of output per FillComplexBuffer call,
+ * paying for the call and an input proc round trip every packet, which
+ * dominates for tiny AMR, ulaw and alaw packets. Here the input proc hands
+ * out the caller's packets where they are, and says it has run dry rather
+ * than that the stream has ended, so the converter keeps its state and
+ * whatever it has decoded but not yet returned for the next batch.
+*/
+
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "plat.h"
+
+
+enum {
+    kBatchDrained = 1,   // Input proc result, not an error, see above
+};
+
+typedef struct BatchFeed {
+    Wat4ffPacketBatch* batch;
+    UInt32 bytesPerPacket;   // CBR input only
+}BatchFeed;
+
+static OSStatus
+batch_feed_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                AudioStreamPacketDescription** descs, void* user) {
+    BatchFeed* f = user;
+    Wat4ffPacketBatch* b = f->batch;
+    UInt32 left = b->count - b->used;
+    if (!left) {
+        *packets = 0;
+        return b->end ? noErr : kBatchDrained;
+    }
+
+    UInt32 n = *packets < left ? *packets : left;
+    if (!n) n = 1;
+    const UInt8* start;
+    UInt64 size;
+    if (b->packets) {
+        // The descriptions go as they are, so the data starts where the
+        // first packet's offset is counted from.
+        const AudioStreamPacketDescription* d = b->packets + b->used;
+        start = b->data;
+        size = 0;
+        for (UInt32 i = 0; i < n; ++i) {
+            UInt64 e = (UInt64)d[i].mStartOffset + d[i].mDataByteSize;
+            if (e > size) size = e;
+        }
+        if (descs) *descs = (AudioStreamPacketDescription*)d;
+    }
+    else {
+        start = b->data + (size_t)b->used * f->bytesPerPacket;
+        size = (UInt64)n * f->bytesPerPacket;
+    }
+    if (size > UINT32_MAX) return kAudio_ParamError;
+
+    data->mBuffers[0].mData = (void*)start;
+    data->mBuffers[0].mDataByteSize = (UInt32)size;
+    b->used += n;
+    *packets = n;
+    return noErr;
+}
+
+OSStatus
+wat4ff_decode_batch(AudioConverterRef conv, Wat4ffPacketBatch* batch, AudioBufferList* out, UInt32* frames) {
+    if (!conv || !batch || !out || !frames || batch->used > batch->count
+        || (batch->count && !batch->data)) {
+        return kAudio_ParamError;
+    }
+
+    BatchFeed feed = { batch, 0 };
+    if (!batch->packets) {
+        AudioStreamBasicDescription fmt;
+        UInt32 size = sizeof(fmt);
+        OSStatus rc = AudioConverterGetProperty(conv, kAudioConverterCurrentInputStreamDescription, &size, &fmt);
+        if (rc) return rc;
+        if (!fmt.mBytesPerPacket) return kAudio_ParamError;
+        feed.bytesPerPacket = fmt.mBytesPerPacket;
+    }
+
+    OSStatus rc = AudioConverterFillComplexBuffer(conv, batch_feed_proc, &feed, frames, out, NULL);
+    return rc == kBatchDrained ? noErr : rc;
+}
@@ -0,0 +1,73 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Buffer lists pointing at caller owned planes, see Wat4ffPcmSource.
+ * A converter taking non-interleaved PCM hands its input proc a list with a
+ * buffer per channel, so planar audio from FFmpeg can go in without being
+ * interleaved or copied first.
+*/
+
+#include <stddef.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+
+UInt32
+wat4ff_buffer_list_size(UInt32 count) {
+    return (UInt32)(offsetof(AudioBufferList, mBuffers) + sizeof(AudioBuffer) * (count ? count : 1));
+}
+
+void
+wat4ff_buffer_list_wrap(AudioBufferList* list, void* const* planes, UInt32 count, UInt32 channels,
+                        UInt32 offset, UInt32 size) {
+    list->mNumberBuffers = count;
+    for (UInt32 i = 0; i < count; ++i) {
+        list->mBuffers[i].mNumberChannels = channels;
+        list->mBuffers[i].mDataByteSize = size;
+        list->mBuffers[i].mData = (UInt8*)planes[i] + offset;
+    }
+}
+
+OSStatus
+wat4ff_pcm_source_init(Wat4ffPcmSource* s, const AudioStreamBasicDescription* fmt,
+                       const void* const* planes, UInt64 frames) {
+    if (!s || !fmt || fmt->mFormatID != kAudioFormatLinearPCM || !fmt->mBytesPerFrame
+        || !fmt->mChannelsPerFrame || (!planes && frames)) {
+        return kAudio_ParamError;
+    }
+    bool planar = fmt->mFormatFlags & kAudioFormatFlagIsNonInterleaved;
+    if (planar && fmt->mChannelsPerFrame > kWat4ffMaxBuffers) return kAudio_ParamError;
+    s->planes = planes;
+    s->count = planar ? fmt->mChannelsPerFrame : 1;
+    s->channels = planar ? 1 : fmt->mChannelsPerFrame;
+    s->bytesPerFrame = fmt->mBytesPerFrame;
+    s->frames = frames;
+    s->pos = 0;
+    return noErr;
+}
+
+UInt32
+wat4ff_pcm_source_take(Wat4ffPcmSource* s, AudioBufferList* list, UInt32 frames) {
+    UInt64 left = s->frames - s->pos;
+    if (frames > left) frames = (UInt32)left;
+    size_t offset = (size_t)(s->pos * s->bytesPerFrame);
+    list->mNumberBuffers = s->count;
+    for (UInt32 i = 0; i < s->count; ++i) {
+        list->mBuffers[i].mNumberChannels = s->channels;
+        list->mBuffers[i].mDataByteSize = frames * s->bytesPerFrame;
+        list->mBuffers[i].mData = (UInt8*)s->planes[i] + offset;
+    }
+    s->pos += frames;
+    return frames;
+}
+
+OSStatus
+wat4ff_pcm_source_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                       AudioStreamPacketDescription** descs, void* user) {
+    *packets = wat4ff_pcm_source_take(user, data, *packets);
+    if (descs) *descs = NULL;
+    return noErr;
+}
@@ -0,0 +1,389 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Capture of converter call streams, see capture.h.
+ *
+ * Records go whole into one of two buffers under a lock, and a writer
+ * thread writes out the other, so callers never wait for the disk unless
+ * it falls a full buffer behind. Then they wait rather than lose records,
+ * a replay needs every one.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wat4ff.h>
+
+#include "capture.h"
+
+
+#ifdef WAT4FF_ENABLE_CAPTURE
+
+enum {
+    kBufferBytes = 4 << 20,
+    kMaxPath     = 1024,
+};
+
+typedef struct Slot {
+    AudioConverterRef ref;
+    UInt32 id;
+}Slot;
+
+bool capture_enabled_ = false;
+
+static PlatMutex lock_ = PLAT_MUTEX_INIT;
+static PlatCond cond_;                 // A buffer written, or one to write
+static bool cond_ready_ = false;
+static bool running_ = false;
+static bool stopping_ = false;
+static bool failed_ = false;
+static FILE* file_ = NULL;
+static PlatThread writer_;
+static UInt8* buffers_[2];
+static UInt32 active_ = 0;
+static UInt32 filled_ = 0;             // Of the active buffer
+static UInt32 pending_ = 0;            // Of the other, 0 once written
+static SInt64 origin_ = 0;
+
+// Live converters, few enough to search in order.
+static Slot* slots_ = NULL;
+static UInt32 slot_count_ = 0;
+static UInt32 slot_capacity_ = 0;
+static UInt32 next_id_ = 0;
+
+
+// Writer +++
+
+static void
+writer_main(void* arg) {
+    plat_mutex_lock(&lock_);
+    for (;;) {
+        while (!pending_ && !stopping_) plat_cond_wait(&cond_, &lock_);
+        if (!pending_) break;
+        const UInt8* buf = buffers_[active_ ^ 1];
+        UInt32 n = pending_;
+        plat_mutex_unlock(&lock_);
+        bool ok = fwrite(buf, 1, n, file_) == n;
+        plat_mutex_lock(&lock_);
+        if (!ok) failed_ = true;
+        pending_ = 0;
+        plat_cond_broadcast(&cond_);
+    }
+    plat_mutex_unlock(&lock_);
+}
+
+// Lock held.
+static void
+swap_buffers(void) {
+    while (pending_) plat_cond_wait(&cond_, &lock_);
+    pending_ = filled_;
+    filled_ = 0;
+    active_ ^= 1;
+    plat_cond_broadcast(&cond_);
+}
+
+// Lock held.
+static void
+put(const void* data, UInt32 size) {
+    const UInt8* p = data;
+    while (size) {
+        if (filled_ == kBufferBytes) swap_buffers();
+        UInt32 n = kBufferBytes - filled_;
+        if (n > size) n = size;
+        if (p) memcpy(buffers_[active_] + filled_, p, n);
+        else memset(buffers_[active_] + filled_, 0, n);
+        filled_ += n;
+        size -= n;
+        if (p) p += n;
+    }
+}
+
+static inline UInt32
+round8(UInt32 n) {
+    return (n + 7) & ~7u;
+}
+
+// Lock held. Pads the payload put after it.
+static void
+put_record(UInt32 op, UInt32 conv, SInt64 begin, SInt64 nanos, OSStatus rc, UInt32 payload,
+           UInt32 flags, UInt32 a, UInt32 b, UInt32 c) {
+    CaptureRecord r = {
+        .size = (UInt32)sizeof(r) + round8(payload),
+        .op = op,
+        .conv = conv,
+        .thread = plat_thread_id(),
+        .begin = begin - origin_,
+        .nanos = nanos,
+        .status = rc,
+        .flags = flags,
+        .a = a,
+        .b = b,
+        .c = c,
+    };
+    put(&r, sizeof(r));
+}
+
+static void
+put_padding(UInt32 size) {
+    put(NULL, round8(size) - size);
+}
+
+// Writer ---
+
+
+// Converters +++
+
+// Lock held.
+static UInt32
+find_id(AudioConverterRef conv) {
+    for (UInt32 i = 0; i < slot_count_; ++i) {
+        if (slots_[i].ref == conv) return slots_[i].id;
+    }
+    return 0;
+}
+
+void
+capture_new(SInt64 begin, const AudioStreamBasicDescription* from, const AudioStreamBasicDescription* to,
+            AudioConverterRef conv, OSStatus rc) {
+    SInt64 nanos = plat_now_ns() - begin;
+    static const AudioStreamBasicDescription kNone;
+    plat_mutex_lock(&lock_);
+    if (!running_) goto fin;
+
+    UInt32 id = 0;
+    if (rc == noErr && conv) {
+        if (slot_count_ == slot_capacity_) {
+            UInt32 capacity = slot_capacity_ ? slot_capacity_ * 2 : 16;
+            Slot* slots = plat_realloc(slots_, capacity * sizeof(Slot));
+            if (!slots) goto fin;
+            slots_ = slots;
+            slot_capacity_ = capacity;
+        }
+        id = ++next_id_;
+        slots_[slot_count_++] = (Slot){ conv, id };
+    }
+    put_record(kCaptureNew, id, begin, nanos, rc, 2 * sizeof(kNone), 0, 0, 0, 0);
+    put(from ? from : &kNone, sizeof(kNone));
+    put(to ? to : &kNone, sizeof(kNone));
+
+fin:
+    plat_mutex_unlock(&lock_);
+}
+
+void
+capture_reset(SInt64 begin, AudioConverterRef conv, OSStatus rc) {
+    SInt64 nanos = plat_now_ns() - begin;
+    plat_mutex_lock(&lock_);
+    UInt32 id = find_id(conv);
+    if (running_ && id) put_record(kCaptureReset, id, begin, nanos, rc, 0, 0, 0, 0, 0);
+    plat_mutex_unlock(&lock_);
+}
+
+UInt32
+capture_forget(AudioConverterRef conv) {
+    UInt32 id = 0;
+    plat_mutex_lock(&lock_);
+    for (UInt32 i = 0; i < slot_count_; ++i) {
+        if (slots_[i].ref == conv) {
+            id = slots_[i].id;
+            slots_[i] = slots_[--slot_count_];
+            break;
+        }
+    }
+    plat_mutex_unlock(&lock_);
+    return id;
+}
+
+void
+capture_dispose(SInt64 begin, UInt32 conv, OSStatus rc) {
+    SInt64 nanos = plat_now_ns() - begin;
+    plat_mutex_lock(&lock_);
+    if (running_) put_record(kCaptureDispose, conv, begin, nanos, rc, 0, 0, 0, 0, 0);
+    plat_mutex_unlock(&lock_);
+}
+
+void
+capture_property(SInt64 begin, AudioConverterRef conv, AudioConverterPropertyID id, UInt32 size,
+                 const void* value, OSStatus rc) {
+    SInt64 nanos = plat_now_ns() - begin;
+    if (!value) size = 0;
+    plat_mutex_lock(&lock_);
+    UInt32 n = find_id(conv);
+    if (running_ && n) {
+        put_record(kCaptureSetProperty, n, begin, nanos, rc, size, 0, id, size, 0);
+        put(value, size);
+        put_padding(size);
+    }
+    plat_mutex_unlock(&lock_);
+}
+
+// Converters ---
+
+
+// Fill +++
+
+static UInt32
+snapshot(const AudioBufferList* list, CaptureBuffer* buffers) {
+    if (!list) return 0;
+    UInt32 count = list->mNumberBuffers < kCaptureMaxBuffers ? list->mNumberBuffers : kCaptureMaxBuffers;
+    for (UInt32 i = 0; i < count; ++i) {
+        buffers[i].channels = list->mBuffers[i].mNumberChannels;
+        buffers[i].bytes = list->mBuffers[i].mDataByteSize;
+    }
+    return count;
+}
+
+static OSStatus
+input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    CaptureInput* in = user;
+    UInt32 asked = *packets;
+    SInt64 t0 = plat_now_ns();
+    OSStatus rc = in->proc(conv, packets, data, descs, in->data);
+    SInt64 nanos = plat_now_ns() - t0;
+
+    UInt32 given = *packets;
+    CaptureBuffer buffers[kCaptureMaxBuffers];
+    UInt32 count = given ? snapshot(data, buffers) : 0;
+    const AudioStreamPacketDescription* given_descs = given && descs ? *descs : NULL;
+    UInt32 payload = count * (UInt32)sizeof(CaptureBuffer);
+    for (UInt32 i = 0; i < count; ++i) payload += round8(buffers[i].bytes);
+    if (given_descs) payload += given * (UInt32)sizeof(*given_descs);
+
+    plat_mutex_lock(&lock_);
+    if (running_) {
+        put_record(kCaptureInput, in->conv, t0, nanos, rc, payload, given_descs ? kCaptureHasDescs : 0,
+                   asked, given, count);
+        put(buffers, count * (UInt32)sizeof(CaptureBuffer));
+        for (UInt32 i = 0; i < count; ++i) {
+            put(data->mBuffers[i].mData, buffers[i].bytes);
+            put_padding(buffers[i].bytes);
+        }
+        if (given_descs) put(given_descs, given * (UInt32)sizeof(*given_descs));
+    }
+    plat_mutex_unlock(&lock_);
+    return rc;
+}
+
+bool
+capture_fill_begin(CaptureFill* fill, AudioConverterRef conv, AudioConverterComplexInputDataProc* proc,
+                   void** data, const UInt32* packets, const AudioBufferList* list) {
+    plat_mutex_lock(&lock_);
+    fill->conv = find_id(conv);
+    plat_mutex_unlock(&lock_);
+    if (!fill->conv) return false;
+
+    fill->asked = packets ? *packets : 0;
+    fill->count = snapshot(list, fill->buffers);
+    if (*proc) {
+        fill->input = (CaptureInput){ *proc, *data, fill->conv };
+        *proc = input_proc;
+        *data = &fill->input;
+    }
+    return true;
+}
+
+void
+capture_fill_end(const CaptureFill* fill, SInt64 begin, const UInt32* packets,
+                 const AudioStreamPacketDescription* descs, OSStatus rc) {
+    SInt64 nanos = plat_now_ns() - begin;
+    UInt32 payload = fill->count * (UInt32)sizeof(CaptureBuffer);
+    plat_mutex_lock(&lock_);
+    if (running_) {
+        put_record(kCaptureFill, fill->conv, begin, nanos, rc, payload, descs ? kCaptureHasDescs : 0,
+                   fill->asked, packets ? *packets : 0, fill->count);
+        put(fill->buffers, payload);
+    }
+    plat_mutex_unlock(&lock_);
+}
+
+// Fill ---
+
+
+bool
+wat4ff_capture_start(const char* path) {
+    bool ok = false;
+    plat_mutex_lock(&lock_);
+    if (running_) goto fin;
+    if (!cond_ready_) {
+        plat_cond_init(&cond_);
+        cond_ready_ = true;
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (!buffers_[i] && !(buffers_[i] = plat_alloc(kBufferBytes))) goto fin;
+    }
+    file_ = fopen(path, "wb");
+    if (!file_) goto fin;
+
+    CaptureHeader h = { kCaptureMagic, kCaptureVersion, plat_process_id(), 0 };
+    stopping_ = false;
+    failed_ = fwrite(&h, sizeof(h), 1, file_) != 1;
+    filled_ = pending_ = 0;
+    slot_count_ = 0;
+    next_id_ = 0;
+    origin_ = plat_now_ns();
+    if (!plat_thread_start(&writer_, writer_main, NULL)) {
+        fclose(file_);
+        goto fin;
+    }
+    running_ = true;
+    capture_enabled_ = true;
+    ok = true;
+
+fin:
+    plat_mutex_unlock(&lock_);
+    return ok;
+}
+
+bool
+wat4ff_capture_stop(void) {
+    plat_mutex_lock(&lock_);
+    if (!running_) {
+        plat_mutex_unlock(&lock_);
+        return false;
+    }
+    capture_enabled_ = false;
+    running_ = false;
+    if (filled_) swap_buffers();
+    stopping_ = true;
+    plat_cond_broadcast(&cond_);
+    plat_mutex_unlock(&lock_);
+
+    plat_thread_join(writer_);
+    bool ok = !failed_;
+    if (fclose(file_)) ok = false;
+    file_ = NULL;
+    return ok;
+}
+
+static void
+stop_at_exit(void) {
+    wat4ff_capture_stop();
+}
+
+// WAT4FF_CAPTURE=path captures the whole process.
+static void
+capture_from_env(void) {
+    char val[kMaxPath];
+    if (!plat_getenv("WAT4FF_CAPTURE", val, sizeof(val))) return;
+    if (wat4ff_capture_start(val)) atexit(stop_at_exit);
+}
+
+PLAT_CONSTRUCTOR(capture_from_env)
+
+#else
+
+bool
+wat4ff_capture_start(const char* path) {
+    return false;
+}
+
+bool
+wat4ff_capture_stop(void) {
+    return false;
+}
+
+#endif
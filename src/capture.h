@@ -0,0 +1,171 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Capture of converter call streams, for wat4ff_bench_replay to play back.
+ * Compiled in with WAT4FF_ENABLE_CAPTURE and switched on at run time,
+ * otherwise every hook expands to nothing.
+ *
+ * The capture column of PROC_TABLE picks what a record holds:
+ * CAPTURE_NONE     Not captured.
+ * CAPTURE_NEW      Both formats and the converter created.
+ * CAPTURE_RESET    The converter.
+ * CAPTURE_DISPOSE  The converter, forgotten before the call, so a new one
+ *                  at the same address is never mistaken for it.
+ * CAPTURE_PROP     The property ID and value.
+ * CAPTURE_FILL     Output buffer sizes, packets asked for and produced, and
+ *                  before it an Input record for every input proc call.
+ *
+ * A capture file is a CaptureHeader, then records in the order their calls
+ * returned, native byte order. Each record is a CaptureRecord and its
+ * payload, padded to 8 bytes:
+ * kCaptureNew          Input then output AudioStreamBasicDescription.
+ * kCaptureSetProperty  a property ID, b value size, then the value.
+ * kCaptureFill         a packets asked for, b produced, c buffers, then c
+ *                      CaptureBuffer of the output list as it was passed.
+ * kCaptureInput        a packets asked for, b given, c buffers, then c
+ *                      CaptureBuffer, the data of each padded to 8 bytes,
+ *                      then b packet descriptions if kCaptureHasDescs.
+ * Converters are numbered from 1 in order of creation, a failed New has 0.
+*/
+
+#ifndef WAT4FF_CAPTURE_H
+#define WAT4FF_CAPTURE_H
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "plat.h"
+
+
+enum {
+    kCaptureMagic   = 0x43463457,       // "W4FC"
+    kCaptureVersion = 1,
+
+    kCaptureNew = 1,
+    kCaptureSetProperty,
+    kCaptureReset,
+    kCaptureDispose,
+    kCaptureFill,
+    kCaptureInput,
+
+    kCaptureHasDescs = 1,               // flags
+
+    kCaptureMaxBuffers = 64,
+};
+
+typedef struct CaptureHeader {
+    UInt32 magic;
+    UInt32 version;
+    UInt32 pid;
+    UInt32 reserved;
+}CaptureHeader;
+
+typedef struct CaptureRecord {
+    UInt32 size;                        // Payload included
+    UInt32 op;
+    UInt32 conv;
+    UInt32 thread;
+    SInt64 begin;                       // Since the capture started
+    SInt64 nanos;                       // In the call, or the input proc
+    SInt32 status;
+    UInt32 flags;
+    UInt32 a;
+    UInt32 b;
+    UInt32 c;
+    UInt32 reserved;
+}CaptureRecord;
+
+typedef struct CaptureBuffer {
+    UInt32 channels;
+    UInt32 bytes;
+}CaptureBuffer;
+
+
+#ifdef WAT4FF_ENABLE_CAPTURE
+
+extern bool capture_enabled_;
+
+typedef struct CaptureInput {
+    AudioConverterComplexInputDataProc proc;
+    void* data;
+    UInt32 conv;
+}CaptureInput;
+
+// Snapshot of a FillComplexBuffer call, taken before it runs.
+typedef struct CaptureFill {
+    UInt32 conv;
+    UInt32 asked;
+    UInt32 count;
+    CaptureBuffer buffers[kCaptureMaxBuffers];
+    CaptureInput input;
+}CaptureFill;
+
+void
+capture_new(SInt64 begin, const AudioStreamBasicDescription* from, const AudioStreamBasicDescription* to,
+            AudioConverterRef conv, OSStatus rc);
+
+void
+capture_reset(SInt64 begin, AudioConverterRef conv, OSStatus rc);
+
+// Returns the number of conv, 0 if it is not captured.
+UInt32
+capture_forget(AudioConverterRef conv);
+
+void
+capture_dispose(SInt64 begin, UInt32 conv, OSStatus rc);
+
+void
+capture_property(SInt64 begin, AudioConverterRef conv, AudioConverterPropertyID id, UInt32 size,
+                 const void* value, OSStatus rc);
+
+// Points *proc and *data at a recording input proc. Returns false for a
+// converter created before the capture started, which is left out.
+bool
+capture_fill_begin(CaptureFill* fill, AudioConverterRef conv, AudioConverterComplexInputDataProc* proc,
+                   void** data, const UInt32* packets, const AudioBufferList* list);
+
+void
+capture_fill_end(const CaptureFill* fill, SInt64 begin, const UInt32* packets,
+                 const AudioStreamPacketDescription* descs, OSStatus rc);
+
+#define CAPTURE_ENTER(kind) kind ## _ENTER
+#define CAPTURE_LEAVE(kind, proc, rc) kind ## _LEAVE(proc, rc)
+
+#define CAPTURE_BEGIN SInt64 capture_t0_ = capture_enabled_ ? plat_now_ns() : 0
+
+#define CAPTURE_NONE_ENTER (void)0
+#define CAPTURE_NONE_LEAVE(proc, rc) (void)0
+
+#define CAPTURE_NEW_ENTER CAPTURE_BEGIN
+#define CAPTURE_NEW_LEAVE(proc, rc) \
+    if (capture_t0_) capture_new(capture_t0_, p1, p2, rc == noErr && p3 ? *p3 : NULL, rc)
+
+#define CAPTURE_RESET_ENTER CAPTURE_BEGIN
+#define CAPTURE_RESET_LEAVE(proc, rc) \
+    if (capture_t0_) capture_reset(capture_t0_, p1, rc)
+
+#define CAPTURE_DISPOSE_ENTER \
+    CAPTURE_BEGIN; UInt32 capture_conv_ = capture_t0_ ? capture_forget(p1) : 0
+#define CAPTURE_DISPOSE_LEAVE(proc, rc) \
+    if (capture_conv_) capture_dispose(capture_t0_, capture_conv_, rc)
+
+#define CAPTURE_PROP_ENTER CAPTURE_BEGIN
+#define CAPTURE_PROP_LEAVE(proc, rc) \
+    if (capture_t0_) capture_property(capture_t0_, p1, p2, p3, p4, rc)
+
+// Swaps the caller's input proc for the recording one, before any wrap.
+#define CAPTURE_FILL_ENTER \
+    CAPTURE_BEGIN; CaptureFill capture_fill_; \
+    if (capture_t0_ && !capture_fill_begin(&capture_fill_, p1, &p2, &p3, p4, p5)) capture_t0_ = 0
+#define CAPTURE_FILL_LEAVE(proc, rc) \
+    if (capture_t0_) capture_fill_end(&capture_fill_, capture_t0_, p4, p6, rc)
+
+#else
+
+#define CAPTURE_ENTER(kind) (void)0
+#define CAPTURE_LEAVE(kind, proc, rc) (void)0
+
+#endif
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The converter layer, see conv.h.
+ *
+ * With the pool on, AudioConverterNew for an in/out pair that has a parked
+ * converter returns a pending handle. The first call on it takes a parked
+ * converter, one whose first property matches if that call is SetProperty,
+ * or creates one and applies the property, so its status is the real one.
+ * Every SetProperty is recorded, and dropped again if it failed, so a
+ * parked converter's properties all applied. SetProperty calls that repeat
+ * what the parked converter had applied next are skipped. If the new owner
+ * leaves out one of those, its first Fill or Reset swaps in a fresh
+ * converter, so a converter never converts with a property its owner did
+ * not set.
+ *
+ * Read-only properties ffmpeg asks for more than once are answered from
+ * Conv.cache after the first time, until SetProperty or Reset.
+*/
+
+#include <string.h>
+#include <stdbool.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "conv.h"
+#include "plat.h"
+
+
+// Properties +++
+
+static bool
+props_append(PropList* list, AudioConverterPropertyID id, UInt32 size, const void* data) {
+    UInt32 need = list->size + sizeof(PropHeader) + size;
+    if (need > list->capacity) {
+        UInt32 capacity = list->capacity ? list->capacity * 2 : 256;
+        while (capacity < need) capacity *= 2;
+        UInt8* p = plat_realloc(list->data, capacity);
+        if (!p) return false;
+        list->data = p;
+        list->capacity = capacity;
+    }
+
+    PropHeader h = { id, size };
+    memcpy(list->data + list->size, &h, sizeof(h));
+    if (size) memcpy(list->data + list->size + sizeof(h), data, size);
+    list->size = need;
+    return true;
+}
+
+static PropHeader
+props_header(const PropList* list, UInt32 pos) {
+    PropHeader h;
+    memcpy(&h, list->data + pos, sizeof(h));
+    return h;
+}
+
+static UInt32
+props_next(const PropList* list, UInt32 pos) {
+    return pos + sizeof(PropHeader) + props_header(list, pos).size;
+}
+
+static bool
+props_has_id(const PropList* list, UInt32 from, AudioConverterPropertyID id) {
+    for (UInt32 pos = from; pos < list->size; pos = props_next(list, pos)) {
+        if (props_header(list, pos).id == id) return true;
+    }
+    return false;
+}
+
+static void
+props_free(PropList* list) {
+    plat_free(list->data);
+    memset(list, 0, sizeof(*list));
+}
+
+// Applies records from pos on, up to the first that fails.
+static OSStatus
+props_replay(const PropList* list, UInt32 pos, AudioConverterRef real) {
+    for (; pos < list->size; pos = props_next(list, pos)) {
+        PropHeader h = props_header(list, pos);
+        OSStatus rc = PROCPTR(AudioConverterSetProperty)(real, h.id, h.size, list->data + pos + sizeof(h));
+        if (rc) return rc;
+    }
+    return noErr;
+}
+
+// Properties ---
+
+
+// Cache +++
+
+enum {
+    kPrimeSlot = 4,
+};
+
+// Properties nothing but SetProperty and Reset can change. PrimeInfo learns
+// its trailing frames as the stream ends, so Fill drops that one.
+static int
+cache_slot(AudioConverterPropertyID id) {
+    switch (id) {
+    case kAudioConverterApplicableEncodeBitRates:        return 0;
+    case kAudioConverterPropertyMaximumOutputPacketSize: return 1;
+    case kAudioConverterCurrentOutputStreamDescription:  return 2;
+    case kAudioConverterCurrentInputStreamDescription:   return 3;
+    case kAudioConverterPrimeInfo:                       return kPrimeSlot;
+    default:                                             return -1;
+    }
+}
+
+static void
+cache_drop(CachedProp* e) {
+    plat_free(e->data);
+    memset(e, 0, sizeof(*e));
+}
+
+static void
+cache_clear(Conv* c) {
+    for (int i = 0; i < kConvCachedProps; ++i) cache_drop(&c->cache[i]);
+}
+
+static void
+cache_store(CachedProp* e, const void* data, UInt32 size) {
+    void* p = plat_alloc(size ? size : 1);
+    if (!p) return;
+    memcpy(p, data, size);
+    plat_free(e->data);
+    e->data = p;
+    e->size = size;
+}
+
+// Cache ---
+
+
+// Real +++
+
+static OSStatus
+real_new(Conv* c) {
+    OSStatus rc = PROCPTR(AudioConverterNew)(&c->in, &c->out, &c->real);
+    if (rc == noErr) lib_retain();
+    return rc;
+}
+
+static void
+real_dispose(Conv* c) {
+    PROCPTR(AudioConverterDispose)(c->real);
+    c->real = NULL;
+    lib_release();
+}
+
+// Real ---
+
+
+// Pending +++
+
+// Gives c a real converter, a parked one set up the same way if possible.
+static OSStatus
+materialize(Conv* c) {
+    c->pending = false;
+    c->applied = c->props.size;
+
+    Conv* parked = pool_take(&c->in, &c->out, &c->props);
+    if (parked) {
+        c->real = parked->real;
+        c->inherited = parked->props;
+        // Its recycled blocks carry over, the arena drops any too small.
+        c->arena = parked->arena;
+        c->settled = c->inherited.size == c->applied;
+        if (c->settled) props_free(&c->inherited);
+        plat_free(parked);
+        return noErr;
+    }
+
+    pool_count_miss();
+    c->settled = true;
+    OSStatus rc = real_new(c);
+    if (rc) {
+        c->pending = true;
+        return rc;
+    }
+    return props_replay(&c->props, 0, c->real);
+}
+
+// True if the previous owner applied a property, after the prefix they
+// share, that this owner has not set since.
+static bool
+stale(const Conv* c) {
+    for (UInt32 pos = c->applied; pos < c->inherited.size; pos = props_next(&c->inherited, pos)) {
+        if (!props_has_id(&c->props, c->applied, props_header(&c->inherited, pos).id)) return true;
+    }
+    return false;
+}
+
+// Called before the first conversion of a converter taken from the pool.
+static OSStatus
+settle(Conv* c) {
+    bool swap = stale(c);
+    props_free(&c->inherited);
+    c->settled = true;
+    if (!swap) return noErr;
+
+    pool_count_stale();
+    cache_clear(c);
+    real_dispose(c);
+    OSStatus rc = real_new(c);
+    if (rc) {
+        c->pending = true;
+        return rc;
+    }
+    return props_replay(&c->props, 0, c->real);
+}
+
+static inline OSStatus
+ready(Conv* c) {
+    if (c->pending) return materialize(c);
+    return noErr;
+}
+
+// Pending ---
+
+
+// Input +++
+
+typedef struct ConvInput {
+    AudioConverterComplexInputDataProc proc;
+    void* data;
+    AudioConverterRef handle;
+}ConvInput;
+
+// Hands the input proc the caller's handle rather than the real converter.
+static OSStatus
+conv_input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                AudioStreamPacketDescription** descs, void* user) {
+    ConvInput* in = user;
+    return in->proc(in->handle, packets, data, descs, in->data);
+}
+
+// Input ---
+
+
+// Hooks +++
+
+void
+conv_destroy(Conv* c) {
+    if (c->real) real_dispose(c);
+    cache_clear(c);
+    arena_free(c->arena);
+    props_free(&c->props);
+    props_free(&c->inherited);
+    plat_free(c);
+}
+
+OSStatus
+conv_AudioConverterNew(const AudioStreamBasicDescription* p1, const AudioStreamBasicDescription* p2,
+                       AudioConverterRef* p3) {
+    if (!p1 || !p2 || !p3) return kAudio_ParamError;
+
+    Conv* c = plat_calloc(sizeof(*c));
+    if (!c) return kAudio_MemFullError;
+    c->in = *p1;
+    c->out = *p2;
+    c->pooled = pool_enabled();
+
+    // Without a parked converter of the pair, create one now, so a format
+    // CoreAudioToolbox rejects fails right here as it would unpooled.
+    if (c->pooled && pool_has_pair(p1, p2)) {
+        c->pending = true;
+    }
+    else {
+        if (c->pooled) pool_count_miss();
+        OSStatus rc = real_new(c);
+        if (rc) {
+            plat_free(c);
+            return rc;
+        }
+        c->settled = true;
+    }
+
+    *p3 = (AudioConverterRef)c;
+    return noErr;
+}
+
+OSStatus
+conv_AudioConverterDispose(AudioConverterRef p1) {
+    Conv* c = (Conv*)p1;
+    if (!c) return kAudio_ParamError;
+
+    if (c->pooled && !c->pending) {
+        // A converter still carrying someone else's properties has no
+        // honest key, let it go.
+        if ((c->settled || !stale(c)) && PROCPTR(AudioConverterReset)(c->real) == noErr) {
+            props_free(&c->inherited);
+            cache_clear(c);
+            arena_recycle(c->arena);
+            c->next = c->prev = NULL;
+            if (pool_park(c)) return noErr;
+        }
+    }
+    conv_destroy(c);
+    return noErr;
+}
+
+OSStatus
+conv_AudioConverterReset(AudioConverterRef p1) {
+    Conv* c = (Conv*)p1;
+    if (!c) return kAudio_ParamError;
+    if (c->pending) return noErr;
+
+    if (!c->settled) {
+        OSStatus rc = settle(c);
+        if (rc) return rc;
+    }
+    cache_clear(c);
+    return PROCPTR(AudioConverterReset)(c->real);
+}
+
+OSStatus
+conv_AudioConverterFillComplexBuffer(AudioConverterRef p1, AudioConverterComplexInputDataProc p2, void* p3,
+                                     UInt32* p4, AudioBufferList* p5, AudioStreamPacketDescription* p6) {
+    Conv* c = (Conv*)p1;
+    if (!c) return kAudio_ParamError;
+
+    OSStatus rc = ready(c);
+    if (!rc && !c->settled) rc = settle(c);
+    if (rc) return rc;
+
+    if (c->cache[kPrimeSlot].data) cache_drop(&c->cache[kPrimeSlot]);
+    ConvInput in = { p2, p3, p1 };
+    return PROCPTR(AudioConverterFillComplexBuffer)(c->real, p2 ? conv_input_proc : NULL, &in, p4, p5, p6);
+}
+
+OSStatus
+conv_AudioConverterGetProperty(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, void* p4) {
+    Conv* c = (Conv*)p1;
+    if (!c) return kAudio_ParamError;
+
+    OSStatus rc = ready(c);
+    if (!rc && !c->settled) rc = settle(c);
+    if (rc) return rc;
+
+    int slot = cache_slot(p2);
+    if (slot < 0 || !p3 || !p4) return PROCPTR(AudioConverterGetProperty)(c->real, p2, p3, p4);
+
+    // A buffer too small for the cached value gets whatever
+    // CoreAudioToolbox makes of it.
+    CachedProp* e = &c->cache[slot];
+    if (e->data && *p3 >= e->size) {
+        memcpy(p4, e->data, e->size);
+        *p3 = e->size;
+        return noErr;
+    }
+    rc = PROCPTR(AudioConverterGetProperty)(c->real, p2, p3, p4);
+    if (rc == noErr) cache_store(e, p4, *p3);
+    return rc;
+}
+
+OSStatus
+conv_AudioConverterGetPropertyInfo(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, Boolean* p4) {
+    Conv* c = (Conv*)p1;
+    if (!c) return kAudio_ParamError;
+
+    OSStatus rc = ready(c);
+    if (!rc && !c->settled) rc = settle(c);
+    if (rc) return rc;
+
+    int slot = cache_slot(p2);
+    if (slot < 0) return PROCPTR(AudioConverterGetPropertyInfo)(c->real, p2, p3, p4);
+
+    CachedProp* e = &c->cache[slot];
+    if (!e->info) {
+        rc = PROCPTR(AudioConverterGetPropertyInfo)(c->real, p2, &e->infoSize, &e->writable);
+        if (rc) return rc;
+        e->info = true;
+    }
+    if (p3) *p3 = e->infoSize;
+    if (p4) *p4 = e->writable;
+    return noErr;
+}
+
+OSStatus
+conv_AudioConverterSetProperty(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32 p3, const void* p4) {
+    Conv* c = (Conv*)p1;
+    if (!c) return kAudio_ParamError;
+    cache_clear(c);
+    if (!c->pooled) return PROCPTR(AudioConverterSetProperty)(c->real, p2, p3, p4);
+    if (p3 && !p4) return kAudio_ParamError;
+
+    UInt32 size = c->props.size;
+    if (!props_append(&c->props, p2, p3, p4)) {
+        // Out of memory, fall back to an ordinary converter.
+        OSStatus rc = ready(c);
+        if (rc) return rc;
+        c->pooled = false;
+        return PROCPTR(AudioConverterSetProperty)(c->real, p2, p3, p4);
+    }
+
+    OSStatus rc;
+    if (c->pending) {
+        rc = materialize(c);
+    }
+    else if (!c->settled && c->inherited.size >= c->props.size
+             && !memcmp(c->inherited.data + c->applied, c->props.data + c->applied, c->props.size - c->applied)) {
+        // The parked converter went through these very settings, in order.
+        return noErr;
+    }
+    else {
+        rc = PROCPTR(AudioConverterSetProperty)(c->real, p2, p3, p4);
+    }
+
+    if (rc) {
+        c->props.size = size;
+        if (c->applied > size) c->applied = size;
+    }
+    return rc;
+}
+
+// Hooks ---
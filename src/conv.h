@@ -0,0 +1,117 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The converter layer. AudioConverterRef values wat4ff hands out point to a
+ * Conv, which holds the CoreAudioToolbox converter and what wat4ff needs to
+ * know about it. Callers cannot tell the difference, input procs see the
+ * same AudioConverterRef the caller passed in.
+*/
+
+#ifndef WAT4FF_CONV_H
+#define WAT4FF_CONV_H
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "procs.h"
+
+
+// Properties applied to a converter, in the order they were applied. Each
+// record is a PropHeader followed by size bytes of data.
+typedef struct PropList {
+    UInt8* data;
+    UInt32 size;
+    UInt32 capacity;
+}PropList;
+
+typedef struct PropHeader {
+    AudioConverterPropertyID id;
+    UInt32 size;
+}PropHeader;
+
+// A read-only property remembered until something can change it, see conv.c.
+typedef struct CachedProp {
+    void* data;                        // NULL if not cached
+    UInt32 size;
+    UInt32 infoSize;
+    Boolean writable;
+    bool info;                         // infoSize and writable are cached
+}CachedProp;
+
+enum {
+    kConvCachedProps = 5,
+};
+
+typedef struct Arena Arena;
+
+typedef struct Conv {
+    AudioConverterRef real;            // NULL while pending
+    AudioStreamBasicDescription in;
+    AudioStreamBasicDescription out;
+    bool pooled;                       // Properties are recorded, parked on dispose
+    bool pending;                      // No real converter until first used, see conv.c
+    bool settled;                      // No properties left over from a previous owner
+    UInt32 applied;                    // Bytes of props applied before first use
+    PropList props;
+    PropList inherited;                // Props of the parked converter it was given
+    CachedProp cache[kConvCachedProps];
+    Arena* arena;                      // NULL until something is acquired
+    SInt64 parkedAt;
+    struct Conv* next;                 // Pool list links
+    struct Conv* prev;
+}Conv;
+
+#define CONV_HOOK(fn) conv_ ## fn
+#define FORMAT_HOOK(fn) format_ ## fn
+
+#define DECL_HOOK(fn, params, args, hook, ...) hook ## _DECL(fn, params)
+#define FORWARD_DECL(fn, params)
+#define CONV_HOOK_DECL(fn, params) OSStatus CONV_HOOK(fn) params;
+#define FORMAT_HOOK_DECL(fn, params) OSStatus FORMAT_HOOK(fn) params;
+
+PROC_TABLE(DECL_HOOK)
+
+// Disposes the real converter and frees c.
+void
+conv_destroy(Conv* c);
+
+
+// Arena +++
+
+// Takes back what a is lending, so a converter parks with its room free.
+void
+arena_recycle(Arena* a);
+
+void
+arena_free(Arena* a);
+
+// Arena ---
+
+
+// Pool +++
+
+bool
+pool_enabled(void);
+
+// True if a converter for the in/out pair is parked, or was a moment ago.
+bool
+pool_has_pair(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out);
+
+// Unparks a converter for the pair whose properties begin with props.
+Conv*
+pool_take(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out, const PropList* props);
+
+// Parks c, which must have been reset. False if the pool is off.
+bool
+pool_park(Conv* c);
+
+void
+pool_count_miss(void);
+
+void
+pool_count_stale(void);
+
+// Pool ---
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * AudioFormat procedures. The properties the decoder asks for are pure
+ * functions of their arguments, so answers are kept in a process-wide
+ * table and the same question never reaches CoreAudioToolbox twice.
+ * Entries are never removed, so lookups walk the buckets without a lock.
+ * Channel layouts the built-in tables know skip even that, see layouts.h.
+*/
+
+#include <string.h>
+#include <stdbool.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "conv.h"
+#include "layouts.h"
+#include "plat.h"
+
+
+// Cache +++
+
+enum {
+    kBuckets    = 256,
+    kMaxEntries = 4096,
+};
+
+typedef enum CacheKind {
+    kCacheInfo,
+    kCacheData,
+}CacheKind;
+
+// key is the specifier, then for FormatInfo the ASBD passed in, which
+// CoreAudioToolbox completes. value follows key.
+typedef struct CacheEntry {
+    struct CacheEntry* next;
+    UInt32 hash;
+    AudioFormatPropertyID id;
+    CacheKind kind;
+    UInt32 keySize;
+    UInt32 valueSize;
+    UInt8 bytes[];
+}CacheEntry;
+
+static void* volatile buckets_[kBuckets];
+static volatile SInt64 entries_ = 0;
+
+
+static bool
+cacheable(AudioFormatPropertyID id) {
+    return id == kAudioFormatProperty_FormatInfo
+        || id == kAudioFormatProperty_ChannelLayoutForTag
+        || id == kAudioFormatProperty_ChannelLayoutForBitmap;
+}
+
+static UInt32
+hash_key(AudioFormatPropertyID id, CacheKind kind, const UInt8* key, UInt32 size) {
+    UInt32 h = 2166136261u ^ id ^ ((UInt32)kind << 31);
+    for (UInt32 i = 0; i < size; ++i) h = (h ^ key[i]) * 16777619u;
+    return h;
+}
+
+typedef enum CacheResult {
+    kCacheMiss,
+    kCacheHit,
+    kCacheTooSmall,     // Cached, but bigger than the caller's buffer
+}CacheResult;
+
+// Copies the cached value into value if it fits in *size.
+static CacheResult
+cache_get(AudioFormatPropertyID id, CacheKind kind, const UInt8* key, UInt32 keySize, void* value, UInt32* size) {
+    UInt32 h = hash_key(id, kind, key, keySize);
+    CacheResult found = kCacheMiss;
+
+    for (CacheEntry* e = plat_load_ptr(&buckets_[h % kBuckets]); e; e = e->next) {
+        if (e->hash == h && e->id == id && e->kind == kind && e->keySize == keySize
+            && !memcmp(e->bytes, key, keySize)) {
+            found = kCacheTooSmall;
+            if (e->valueSize <= *size) {
+                memcpy(value, e->bytes + keySize, e->valueSize);
+                *size = e->valueSize;
+                found = kCacheHit;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+static void
+cache_put(AudioFormatPropertyID id, CacheKind kind, const UInt8* key, UInt32 keySize,
+          const void* value, UInt32 valueSize) {
+    if (plat_counter_get(&entries_) >= kMaxEntries) return;
+    CacheEntry* e = plat_alloc(sizeof(*e) + keySize + valueSize);
+    if (!e) return;
+    e->hash = hash_key(id, kind, key, keySize);
+    e->id = id;
+    e->kind = kind;
+    e->keySize = keySize;
+    e->valueSize = valueSize;
+    if (keySize) memcpy(e->bytes, key, keySize);
+    memcpy(e->bytes + keySize, value, valueSize);
+
+    // Racing threads may both add the same answer, lookups find the newer.
+    void* volatile* bucket = &buckets_[e->hash % kBuckets];
+    do {
+        e->next = plat_load_ptr(bucket);
+    } while (!plat_cas_ptr(bucket, e->next, e));
+    plat_counter_add(&entries_, 1);
+}
+
+// Cache ---
+
+
+// Hooks +++
+
+OSStatus
+format_AudioFormatGetPropertyInfo(AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4) {
+    if (!cacheable(p1) || !p4 || (p2 && !p3)) return PROCPTR(AudioFormatGetPropertyInfo)(p1, p2, p3, p4);
+
+    UInt32 size = layout_size(p1, p2, p3);
+    if (size) {
+        *p4 = size;
+        return noErr;
+    }
+
+    size = sizeof(*p4);
+    if (cache_get(p1, kCacheInfo, p3, p2, p4, &size) == kCacheHit) return noErr;
+
+    OSStatus rc = PROCPTR(AudioFormatGetPropertyInfo)(p1, p2, p3, p4);
+    if (rc == noErr) cache_put(p1, kCacheInfo, p3, p2, p4, sizeof(*p4));
+    return rc;
+}
+
+OSStatus
+format_AudioFormatGetProperty(AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4, void* p5) {
+    if (!cacheable(p1) || !p4 || !p5 || (p2 && !p3)) return PROCPTR(AudioFormatGetProperty)(p1, p2, p3, p4, p5);
+
+    UInt32 size = layout_size(p1, p2, p3);
+    if (size && *p4 >= size) {
+        layout_fill(p1, p3, p5);
+        *p4 = size;
+        return noErr;
+    }
+
+    // FormatInfo reads the ASBD it fills in, it is part of the question.
+    UInt32 inSize = p1 == kAudioFormatProperty_FormatInfo ? *p4 : 0;
+    UInt32 keySize = p2 + inSize;
+    UInt8 small[256];
+    UInt8* key = keySize <= sizeof(small) ? small : plat_alloc(keySize);
+    if (!key) return PROCPTR(AudioFormatGetProperty)(p1, p2, p3, p4, p5);
+    if (p2) memcpy(key, p3, p2);
+    if (inSize) memcpy(key + p2, p5, inSize);
+
+    OSStatus rc = noErr;
+    CacheResult cached = cache_get(p1, kCacheData, key, keySize, p5, p4);
+    if (cached != kCacheHit) {
+        rc = PROCPTR(AudioFormatGetProperty)(p1, p2, p3, p4, p5);
+        if (rc == noErr && cached == kCacheMiss) cache_put(p1, kCacheData, key, keySize, p5, *p4);
+    }
+
+    if (key != small) plat_free(key);
+    return rc;
+}
+
+// Hooks ---
@@ -0,0 +1,540 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The host side of remote.c, see wat4ff_host_run(). A thread per client
+ * session watches its connection and starts a thread per lane the client
+ * uses. Lane threads make the calls through wat4ff's own AudioToolbox
+ * procedures, so converters clients dispose of are pooled for the next.
+ * Clients are trusted no further than their session: every size and
+ * handle they send is checked.
+*/
+
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "ipc.h"
+#include "plat.h"
+
+
+#define PAYLOAD(r) ((UInt8*)((IpcRecord*)(r) + 1))
+#define PAYLOAD_SIZE(r) ((r)->size - (UInt32)sizeof(IpcRecord))
+
+enum {
+    kSlotBits = 20,
+    kMaxSlots = 1 << kSlotBits,
+};
+
+typedef struct Slot {
+    AudioConverterRef conv;            // NULL if free
+    UInt32 generation;
+    UInt32 nextFree;
+}Slot;
+
+typedef struct Session Session;
+
+typedef struct Lane {
+    Session* session;
+    UInt32 index;
+    IpcLane* lane;
+    IpcRingView in;                    // toHost
+    IpcRingView out;                   // toClient
+    UInt32 need;
+    IpcRecord* record;
+}Lane;
+
+struct Session {
+    IpcConn* conn;
+    IpcMap* map;
+    IpcSession* shm;
+    PlatMutex lock;                    // Guards slots
+    Slot* slots;
+    UInt32 slotCount;
+    UInt32 slotCapacity;
+    UInt32 freeSlot;                   // Index + 1, 0 if none
+    PlatThread threads[kIpcLanes];
+    Lane lanes[kIpcLanes];
+};
+
+
+// Slots +++
+
+// Handles are index + 1 below kSlotBits and a generation above, so one
+// the client kept after Dispose does not find the slot's next converter.
+static UInt32
+slot_add(Session* s, AudioConverterRef conv) {
+    UInt32 handle = 0;
+    plat_mutex_lock(&s->lock);
+    UInt32 index;
+    if (s->freeSlot) {
+        index = s->freeSlot - 1;
+        s->freeSlot = s->slots[index].nextFree;
+    }
+    else {
+        if (s->slotCount == kMaxSlots - 1) goto fin;
+        if (s->slotCount == s->slotCapacity) {
+            UInt32 capacity = s->slotCapacity ? s->slotCapacity * 2 : 16;
+            Slot* slots = plat_realloc(s->slots, capacity * sizeof(Slot));
+            if (!slots) goto fin;
+            s->slots = slots;
+            s->slotCapacity = capacity;
+        }
+        index = s->slotCount++;
+        s->slots[index].generation = 0;
+    }
+    Slot* slot = &s->slots[index];
+    slot->conv = conv;
+    slot->generation = (slot->generation + 1) & ((1u << (32 - kSlotBits)) - 1);
+    handle = (slot->generation << kSlotBits) | (index + 1);
+
+fin:
+    plat_mutex_unlock(&s->lock);
+    return handle;
+}
+
+static Slot*
+slot_find(Session* s, UInt32 handle) {
+    UInt32 index = (handle & (kMaxSlots - 1)) - 1;
+    if (index >= s->slotCount) return NULL;
+    Slot* slot = &s->slots[index];
+    return slot->conv && slot->generation == handle >> kSlotBits ? slot : NULL;
+}
+
+static AudioConverterRef
+slot_get(Session* s, UInt32 handle) {
+    plat_mutex_lock(&s->lock);
+    Slot* slot = slot_find(s, handle);
+    AudioConverterRef conv = slot ? slot->conv : NULL;
+    plat_mutex_unlock(&s->lock);
+    return conv;
+}
+
+static AudioConverterRef
+slot_remove(Session* s, UInt32 handle) {
+    plat_mutex_lock(&s->lock);
+    Slot* slot = slot_find(s, handle);
+    AudioConverterRef conv = NULL;
+    if (slot) {
+        conv = slot->conv;
+        slot->conv = NULL;
+        slot->nextFree = s->freeSlot;
+        s->freeSlot = (UInt32)(slot - s->slots) + 1;
+    }
+    plat_mutex_unlock(&s->lock);
+    return conv;
+}
+
+// Slots ---
+
+
+// Lane +++
+
+static bool
+closing(void* arg) {
+    Lane* l = arg;
+    return plat_load32(&l->session->shm->closing) || l->in.broken;
+}
+
+static bool
+record_ready(void* arg) {
+    Lane* l = arg;
+    return (l->record = ring_next(&l->in)) != NULL;
+}
+
+// The next record from the client, NULL once the session is closing.
+static IpcRecord*
+await(Lane* l) {
+    IpcMap* m = l->session->map;
+    if (!bell_wait(m, IPC_HOST_BELL(l->index), &l->lane->hostBell, record_ready, closing, l)) return NULL;
+    return l->record;
+}
+
+// Frees what has been read from the client and tells it there is room.
+static void
+release(Lane* l) {
+    ring_release(&l->in);
+    bell_ring(l->session->map, IPC_CLIENT_BELL(l->index), &l->lane->clientBell);
+}
+
+static bool
+room(void* arg) {
+    Lane* l = arg;
+    return (l->record = ring_reserve(&l->out, l->need)) != NULL;
+}
+
+// A record to the client with room for payload bytes, NULL once closing.
+static IpcRecord*
+reply_begin(Lane* l, UInt32 op, UInt32 payload) {
+    l->need = (UInt32)sizeof(IpcRecord) + ipc_round8(payload);
+    IpcMap* m = l->session->map;
+    if (!bell_wait(m, IPC_HOST_BELL(l->index), &l->lane->hostBell, room, closing, l)) return NULL;
+
+    IpcRecord* r = l->record;
+    memset(r, 0, sizeof(*r));
+    r->size = l->need;
+    r->op = op;
+    return r;
+}
+
+// Sends r, shrunk to payload bytes.
+static void
+reply_end(Lane* l, IpcRecord* r, UInt32 payload) {
+    r->size = (UInt32)sizeof(IpcRecord) + ipc_round8(payload);
+    ring_commit(&l->out, r);
+    bell_ring(l->session->map, IPC_CLIENT_BELL(l->index), &l->lane->clientBell);
+}
+
+static void
+reply_status(Lane* l, OSStatus status) {
+    IpcRecord* r = reply_begin(l, kIpcReply, 0);
+    if (!r) return;
+    r->status = status;
+    reply_end(l, r, 0);
+}
+
+// Lane ---
+
+
+// Calls +++
+
+static void
+serve_new(Lane* l, IpcRecord* req) {
+    if (PAYLOAD_SIZE(req) < 2 * sizeof(AudioStreamBasicDescription)) {
+        reply_status(l, kAudio_ParamError);
+        return;
+    }
+    AudioStreamBasicDescription fmt[2];
+    memcpy(fmt, PAYLOAD(req), sizeof(fmt));
+    AudioConverterRef conv = NULL;
+    OSStatus rc = AudioConverterNew(&fmt[0], &fmt[1], &conv);
+    UInt32 handle = 0;
+    if (rc == noErr && !(handle = slot_add(l->session, conv))) {
+        AudioConverterDispose(conv);
+        rc = kAudio_MemFullError;
+    }
+    IpcRecord* r = reply_begin(l, kIpcReply, 0);
+    if (!r) return;
+    r->status = rc;
+    r->handle = handle;
+    reply_end(l, r, 0);
+}
+
+static void
+serve_get_property(Lane* l, IpcRecord* req, AudioConverterRef conv) {
+    UInt32 size = req->b;
+    if (size > PAYLOAD_SIZE(req) || size > kIpcMaxReply - sizeof(IpcRecord)) {
+        reply_status(l, kAudio_ParamError);
+        return;
+    }
+    IpcRecord* r = reply_begin(l, kIpcReply, size);
+    if (!r) return;
+    memcpy(PAYLOAD(r), PAYLOAD(req), size);
+    r->status = AudioConverterGetProperty(conv, req->a, req->flags & kIpcHasSize ? &size : NULL,
+                                          req->flags & kIpcHasData ? PAYLOAD(r) : NULL);
+    r->b = size;
+    reply_end(l, r, size < req->b ? size : req->b);
+}
+
+// Input of a fill, held in the client's ring until the next is asked for.
+typedef struct Input {
+    Lane* lane;
+    bool failed;
+}Input;
+
+static OSStatus
+input_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+           AudioStreamPacketDescription** descs, void* user) {
+    Input* in = user;
+    Lane* l = in->lane;
+    UInt32 want = *packets;
+    *packets = 0;
+    if (in->failed || data->mNumberBuffers > kWat4ffMaxBuffers) return kAudio_ParamError;
+    release(l);
+
+    UInt32 count = data->mNumberBuffers;
+    IpcRecord* r = reply_begin(l, kIpcInput, count * 4);
+    if (!r) goto fail;
+    r->a = want;
+    r->b = count;
+    r->c = descs != NULL;
+    for (UInt32 i = 0; i < count; ++i) ((UInt32*)PAYLOAD(r))[i] = data->mBuffers[i].mNumberChannels;
+    reply_end(l, r, count * 4);
+
+    if (!(r = await(l)) || r->op != kIpcInputData) goto fail;
+    UInt32 given = r->b;
+    UInt32 ndescs = r->c;
+    UInt64 need = (UInt64)given * 8 + (UInt64)ndescs * sizeof(**descs);
+    if (given > count || (ndescs && (!descs || ndescs < r->a)) || need > PAYLOAD_SIZE(r)) goto fail;
+
+    const UInt32* head = (const UInt32*)PAYLOAD(r);
+    UInt8* p = PAYLOAD(r) + given * 8;
+    if (descs) *descs = ndescs ? (AudioStreamPacketDescription*)p : NULL;
+    p += ndescs * sizeof(**descs);
+    for (UInt32 i = 0; i < given; ++i) {
+        UInt32 size = head[i * 2 + 1];
+        need += ipc_round8(size);
+        if (need > PAYLOAD_SIZE(r)) goto fail;
+        data->mBuffers[i].mNumberChannels = head[i * 2];
+        data->mBuffers[i].mDataByteSize = size;
+        data->mBuffers[i].mData = p;
+        p += ipc_round8(size);
+    }
+    data->mNumberBuffers = given;
+    *packets = r->a;
+    return r->status;
+
+fail:
+    in->failed = true;
+    return kAudio_ParamError;
+}
+
+static void
+serve_fill(Lane* l, IpcRecord* req, AudioConverterRef conv) {
+    UInt32 count = req->b;
+    UInt32 packets = req->a;
+    bool want_descs = req->c != 0;
+    UInt32 sizes[kWat4ffMaxBuffers];
+    UInt32 offsets[kWat4ffMaxBuffers];
+    if (count > kWat4ffMaxBuffers || PAYLOAD_SIZE(req) < count * 8) {
+        reply_status(l, kAudio_ParamError);
+        return;
+    }
+    Wat4ffBufferList list;
+    list.abl.mNumberBuffers = count;
+    const UInt32* head = (const UInt32*)PAYLOAD(req);
+    for (UInt32 i = 0; i < count; ++i) {
+        list.abl.mBuffers[i].mNumberChannels = head[i * 2];
+        sizes[i] = head[i * 2 + 1];
+    }
+    if (ipc_out_layout(packets, want_descs, count, sizes, offsets) > kIpcOutBytes) {
+        reply_status(l, kAudio_ParamError);
+        return;
+    }
+    for (UInt32 i = 0; i < count; ++i) {
+        list.abl.mBuffers[i].mDataByteSize = sizes[i];
+        list.abl.mBuffers[i].mData = l->lane->out + offsets[i];
+    }
+
+    Input in = { l, false };
+    AudioStreamPacketDescription* descs = want_descs ? (AudioStreamPacketDescription*)l->lane->out : NULL;
+    OSStatus rc = AudioConverterFillComplexBuffer(conv, input_proc, &in, &packets, &list.abl, descs);
+    release(l);
+    if (in.failed && plat_load32(&l->session->shm->closing)) return;
+
+    IpcRecord* r = reply_begin(l, kIpcReply, count * 4);
+    if (!r) return;
+    r->status = rc;
+    r->a = packets;
+    for (UInt32 i = 0; i < count; ++i) ((UInt32*)PAYLOAD(r))[i] = list.abl.mBuffers[i].mDataByteSize;
+    reply_end(l, r, count * 4);
+}
+
+static void
+serve_format(Lane* l, IpcRecord* req) {
+    UInt32 spec = req->b;
+    UInt32 size = req->c;
+    if (spec > PAYLOAD_SIZE(req) || size > PAYLOAD_SIZE(req) - spec || size > kIpcMaxReply - sizeof(IpcRecord)) {
+        reply_status(l, kAudio_ParamError);
+        return;
+    }
+    const void* specifier = spec ? PAYLOAD(req) : NULL;
+    if (req->op == kIpcFormatGetPropertyInfo) {
+        IpcRecord* r = reply_begin(l, kIpcReply, 0);
+        if (!r) return;
+        r->status = AudioFormatGetPropertyInfo(req->a, spec, specifier, &r->a);
+        reply_end(l, r, 0);
+        return;
+    }
+    IpcRecord* r = reply_begin(l, kIpcReply, size);
+    if (!r) return;
+    memcpy(PAYLOAD(r), PAYLOAD(req) + spec, size);
+    UInt32 got = size;
+    r->status = AudioFormatGetProperty(req->a, spec, specifier, req->flags & kIpcHasSize ? &got : NULL,
+                                       req->flags & kIpcHasData ? PAYLOAD(r) : NULL);
+    r->b = got;
+    reply_end(l, r, got < size ? got : size);
+}
+
+static void
+serve(Lane* l, IpcRecord* req) {
+    Session* s = l->session;
+    if (req->op == kIpcNew) {
+        serve_new(l, req);
+        return;
+    }
+    if (req->op == kIpcFormatGetPropertyInfo || req->op == kIpcFormatGetProperty) {
+        serve_format(l, req);
+        return;
+    }
+    if (req->op == kIpcDispose) {
+        AudioConverterRef conv = slot_remove(s, req->handle);
+        if (conv) AudioConverterDispose(conv);
+        return;
+    }
+
+    // A converter is used by one client thread at a time, so by one lane.
+    AudioConverterRef conv = slot_get(s, req->handle);
+    if (!conv) {
+        reply_status(l, kAudio_ParamError);
+        return;
+    }
+    switch (req->op) {
+    case kIpcReset:
+        reply_status(l, AudioConverterReset(conv));
+        break;
+    case kIpcSetProperty:
+        if (req->b > PAYLOAD_SIZE(req)) {
+            reply_status(l, kAudio_ParamError);
+            break;
+        }
+        reply_status(l, AudioConverterSetProperty(conv, req->a, req->b, PAYLOAD(req)));
+        break;
+    case kIpcGetProperty:
+        serve_get_property(l, req, conv);
+        break;
+    case kIpcGetPropertyInfo: {
+        IpcRecord* r = reply_begin(l, kIpcReply, 0);
+        if (!r) break;
+        Boolean writable = false;
+        r->status = AudioConverterGetPropertyInfo(conv, req->a, &r->a, &writable);
+        r->b = writable;
+        reply_end(l, r, 0);
+        break;
+    }
+    case kIpcFill:
+        serve_fill(l, req, conv);
+        break;
+    default:
+        reply_status(l, kAudio_ParamError);
+        break;
+    }
+}
+
+static void
+lane_main(void* param) {
+    Lane* l = param;
+    IpcRecord* req;
+    while ((req = await(l))) {
+        serve(l, req);
+        release(l);
+    }
+}
+
+// Calls ---
+
+
+// Session +++
+
+static bool
+lane_wanted(void* arg) {
+    Session* s = arg;
+    for (UInt32 i = 0; i < kIpcLanes; ++i) {
+        if (plat_load32(&s->shm->lanes[i].wanted) && !plat_load32(&s->shm->lanes[i].started)) return true;
+    }
+    return false;
+}
+
+static bool
+client_gone(void* arg) {
+    Session* s = arg;
+    return !ipc_alive(s->conn);
+}
+
+static bool
+session_open(Session* s) {
+    IpcHello hello;
+    if (!ipc_recv(s->conn, &hello, sizeof(hello))) return false;
+    hello.name[kIpcNameMax - 1] = '\0';
+    bool ok = hello.magic == kIpcMagic && hello.version == kIpcVersion
+           && (s->map = ipc_map_open(hello.name, sizeof(IpcSession), kIpcBells));
+    if (ok) {
+        s->shm = ipc_map_base(s->map);
+        ok = s->shm->magic == kIpcMagic && s->shm->version == kIpcVersion && s->shm->size == sizeof(IpcSession);
+    }
+    hello.magic = kIpcMagic;
+    hello.status = ok ? noErr : kAudio_ParamError;
+    return ipc_send(s->conn, &hello, sizeof(hello)) && ok;
+}
+
+static void
+session_main(void* param) {
+    Session* s = param;
+    bool started[kIpcLanes] = { false };
+    if (!session_open(s)) goto fin;
+
+    // Lane threads start when the client first takes their lane.
+    while (bell_wait(s->map, IPC_DOORBELL, &s->shm->doorbell, lane_wanted, client_gone, s)) {
+        for (UInt32 i = 0; i < kIpcLanes; ++i) {
+            IpcLane* lane = &s->shm->lanes[i];
+            if (started[i] || !plat_load32(&lane->wanted)) continue;
+            Lane* l = &s->lanes[i];
+            l->session = s;
+            l->index = i;
+            l->lane = lane;
+            ring_view(&l->in, &lane->toHost, lane->toHostData, kIpcToHostBytes);
+            ring_view(&l->out, &lane->toClient, lane->toClientData, kIpcToClientBytes);
+            started[i] = plat_thread_start(&s->threads[i], lane_main, l);
+            // Marked either way, the client would only ring again.
+            plat_store32(&lane->started, 1);
+        }
+    }
+
+    plat_store32(&s->shm->closing, 1);
+    for (UInt32 i = 0; i < kIpcLanes; ++i) {
+        if (!started[i]) continue;
+        bell_ring(s->map, IPC_HOST_BELL(i), &s->shm->lanes[i].hostBell);
+        plat_thread_join(s->threads[i]);
+    }
+    for (UInt32 i = 0; i < s->slotCount; ++i) {
+        if (s->slots[i].conv) AudioConverterDispose(s->slots[i].conv);
+    }
+
+fin:
+    ipc_map_close(s->map);
+    ipc_close(s->conn);
+    plat_free(s->slots);
+    plat_mutex_destroy(&s->lock);
+    plat_free(s);
+}
+
+// Session ---
+
+
+// API +++
+
+OSStatus
+wat4ff_host_run(const char* name) {
+    remote_disable();
+    IpcConn* listener = ipc_listen(name ? name : IPC_DEFAULT_NAME);
+    if (!listener) return kAudio_ParamError;
+    OSStatus rc = wat4ff_preload();
+    if (rc) {
+        ipc_close(listener);
+        return rc;
+    }
+
+    for (;;) {
+        IpcConn* conn = ipc_accept(listener);
+        if (!conn) {
+            plat_sleep_ms(10);
+            continue;
+        }
+        Session* s = plat_calloc(sizeof(*s));
+        if (!s) {
+            ipc_close(conn);
+            continue;
+        }
+        s->conn = conn;
+        plat_mutex_init(&s->lock);
+        if (!plat_thread_detach(session_main, s)) {
+            ipc_close(conn);
+            plat_mutex_destroy(&s->lock);
+            plat_free(s);
+        }
+    }
+}
+
+// API ---
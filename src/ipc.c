@@ -0,0 +1,129 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Rings and bells in a session's shared memory, the same on every OS,
+ * see ipc.h. The other side may be buggy or gone, so nothing it wrote is
+ * trusted further than the ring it wrote into.
+*/
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "ipc.h"
+#include "plat.h"
+
+
+enum {
+    kSpins = 64,
+};
+
+
+// Ring +++
+
+void
+ring_view(IpcRingView* v, IpcRing* ring, UInt8* data, UInt32 capacity) {
+    v->ring = ring;
+    v->data = data;
+    v->capacity = capacity;
+    v->cursor = (UInt32)plat_load32(&ring->tail);
+    v->padding = 0;
+    v->broken = false;
+}
+
+IpcRecord*
+ring_reserve(IpcRingView* v, UInt32 size) {
+    UInt32 head = (UInt32)plat_load32(&v->ring->head);
+    UInt32 tail = (UInt32)plat_load32(&v->ring->tail);
+    UInt32 at = head & (v->capacity - 1);
+    UInt32 contiguous = v->capacity - at;
+    UInt32 pad = size > contiguous ? contiguous : 0;
+    if (v->capacity - (head - tail) < pad + size) return NULL;
+
+    // Records never wrap, the rest of the ring is skipped instead.
+    if (pad) {
+        IpcRecord* r = (IpcRecord*)(v->data + at);
+        r->size = pad;
+        r->op = kIpcPad;
+        at = 0;
+    }
+    v->padding = pad;
+    return (IpcRecord*)(v->data + at);
+}
+
+void
+ring_commit(IpcRingView* v, IpcRecord* r) {
+    UInt32 head = (UInt32)plat_load32(&v->ring->head);
+    plat_store32(&v->ring->head, (SInt32)(head + v->padding + r->size));
+    v->padding = 0;
+}
+
+IpcRecord*
+ring_next(IpcRingView* v) {
+    for (;;) {
+        UInt32 head = (UInt32)plat_load32(&v->ring->head);
+        if (v->cursor == head || v->broken) return NULL;
+
+        UInt32 at = v->cursor & (v->capacity - 1);
+        IpcRecord* r = (IpcRecord*)(v->data + at);
+        UInt32 size = r->size;
+        bool pad = r->op == kIpcPad;
+        if (size % 8 || size < (pad ? 8 : sizeof(IpcRecord)) || size > v->capacity - at
+            || size > head - v->cursor) {
+            v->broken = true;
+            return NULL;
+        }
+        v->cursor += size;
+        if (!pad) return r;
+    }
+}
+
+void
+ring_release(IpcRingView* v) {
+    plat_store32(&v->ring->tail, (SInt32)v->cursor);
+}
+
+// Ring ---
+
+
+// Bell +++
+
+void
+bell_ring(IpcMap* m, UInt32 index, IpcBell* b) {
+    plat_fetch_add32(&b->seq, 1);
+    plat_fence();
+    if (plat_load32(&b->sleepers)) ipc_wake(m, index, &b->seq);
+}
+
+// Counting itself in sleepers before the last look at ready() means a
+// ringer either sees the sleeper or the sleeper sees what was rung for.
+bool
+bell_wait(IpcMap* m, UInt32 index, IpcBell* b, bool (* ready)(void*), bool (* gone)(void*), void* arg) {
+    for (int i = 0; i < kSpins; ++i) {
+        if (ready(arg)) return true;
+        plat_yield();
+    }
+    for (;;) {
+        plat_fetch_add32(&b->sleepers, 1);
+        plat_fence();
+        SInt32 seen = plat_load32(&b->seq);
+        if (!ready(arg)) ipc_wait(m, index, &b->seq, seen, kIpcWaitMillis);
+        plat_fetch_add32(&b->sleepers, -1);
+        if (ready(arg)) return true;
+        if (gone(arg)) return false;
+    }
+}
+
+// Bell ---
+
+
+UInt32
+ipc_out_layout(UInt32 packets, bool descs, UInt32 count, const UInt32* sizes, UInt32* offsets) {
+    UInt64 at = descs ? (UInt64)packets * sizeof(AudioStreamPacketDescription) : 0;
+    for (UInt32 i = 0; i < count; ++i) {
+        at = (at + 15) & ~(UInt64)15;
+        offsets[i] = at > 0xffffffff ? 0xffffffff : (UInt32)at;
+        at += sizes[i];
+    }
+    return at > 0xffffffff ? 0xffffffff : (UInt32)at;
+}
@@ -0,0 +1,277 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Talking to wat4ff_host, see wat4ff_host_run().
+ *
+ * A client process creates a session, a block of shared memory with a
+ * few lanes, and sends its name to the host over a local socket or pipe,
+ * which then stays open only to tell each side when the other is gone.
+ * Each lane carries one call at a time: records to the host in one ring,
+ * replies and requests for input back in another, and converter output in
+ * an area of its own, so PCM and packets are only ever copied in and out
+ * of shared memory. Bells wake whoever sleeps on the other side.
+*/
+
+#ifndef WAT4FF_IPC_H
+#define WAT4FF_IPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "procs.h"
+
+
+enum {
+    kIpcMagic         = 0x48463457,    // "W4FH"
+    kIpcVersion       = 1,
+    kIpcLanes         = 8,
+    kIpcToHostBytes   = 1 << 20,
+    kIpcToClientBytes = 1 << 16,
+    kIpcOutBytes      = 1 << 20,
+    kIpcMaxRecord     = kIpcToHostBytes / 4,
+    kIpcMaxReply      = kIpcToClientBytes / 4,
+    kIpcNameMax       = 64,
+    kIpcBells         = 1 + 2 * kIpcLanes,
+    kIpcWaitMillis    = 100,           // Between looks at whether the other side is alive
+};
+
+typedef enum IpcOp {
+    kIpcPad,                           // Fills the end of a ring, skip it
+    kIpcNew,
+    kIpcDispose,                       // Posted, no reply
+    kIpcReset,
+    kIpcSetProperty,
+    kIpcGetProperty,
+    kIpcGetPropertyInfo,
+    kIpcFill,
+    kIpcFormatGetPropertyInfo,
+    kIpcFormatGetProperty,
+    kIpcInput,                         // Host asking for input during a fill
+    kIpcInputData,
+    kIpcReply,
+}IpcOp;
+
+// Every record starts with this, the payload follows. What a, b and c
+// mean depends on op, see remote.c.
+typedef struct IpcRecord {
+    UInt32 size;                       // Header and payload, a multiple of 8
+    UInt32 op;
+    SInt32 status;
+    UInt32 handle;                     // Host converter
+    UInt32 a;
+    UInt32 b;
+    UInt32 c;
+    UInt32 flags;                      // kIpcHas*
+}IpcRecord;
+
+enum {
+    kIpcHasSize = 1,                   // A property call's size pointer was not NULL
+    kIpcHasData = 2,                   // Nor its data pointer
+};
+
+// The producer owns head, the consumer tail. Both only grow, wrapping at
+// 2^32, the capacity is a power of two.
+typedef struct IpcRing {
+    volatile SInt32 head;
+    UInt8 pad0[60];
+    volatile SInt32 tail;
+    UInt8 pad1[60];
+}IpcRing;
+
+// An event count. Whoever is about to sleep counts itself in sleepers, so
+// ringing costs one atomic add while nobody does.
+typedef struct IpcBell {
+    volatile SInt32 seq;
+    volatile SInt32 sleepers;
+    UInt8 pad[56];
+}IpcBell;
+
+typedef struct IpcLane {
+    volatile SInt32 owner;             // A client thread is using it
+    volatile SInt32 wanted;            // The client wants a host thread for it
+    volatile SInt32 started;           // The host has one
+    UInt8 pad[52];
+    IpcRing toHost;
+    IpcRing toClient;
+    IpcBell hostBell;                  // Rung when toHost gets a record
+    IpcBell clientBell;                // Rung when toClient gets one, or toHost room
+    UInt8 toHostData[kIpcToHostBytes];
+    UInt8 toClientData[kIpcToClientBytes];
+    UInt8 out[kIpcOutBytes];
+}IpcLane;
+
+typedef struct IpcSession {
+    UInt32 magic;
+    UInt32 version;
+    UInt32 size;
+    UInt32 clientPid;
+    volatile SInt32 closing;           // Set by the host when the client is gone
+    UInt8 pad[44];
+    IpcBell doorbell;                  // Rung when a lane is wanted
+    IpcLane lanes[kIpcLanes];
+}IpcSession;
+
+// Sent by the client over the connection, answered by an IpcHello with
+// status filled in.
+typedef struct IpcHello {
+    UInt32 magic;
+    UInt32 version;
+    UInt32 pid;
+    SInt32 status;
+    char name[kIpcNameMax];            // Of the session's shared memory
+}IpcHello;
+
+#define IPC_DEFAULT_NAME "wat4ff"
+
+#define IPC_DOORBELL 0
+#define IPC_HOST_BELL(lane) (1 + 2 * (lane))
+#define IPC_CLIENT_BELL(lane) (2 + 2 * (lane))
+
+
+// Shared memory +++
+
+typedef struct IpcMap IpcMap;
+
+// Creates and maps a zeroed block with bells wakeups, NULL if name is taken.
+IpcMap*
+ipc_map_create(const char* name, size_t size, UInt32 bells);
+
+IpcMap*
+ipc_map_open(const char* name, size_t size, UInt32 bells);
+
+void*
+ipc_map_base(IpcMap* m);
+
+// Removes the name, the memory stays until every process has closed it.
+void
+ipc_map_unlink(const char* name);
+
+void
+ipc_map_close(IpcMap* m);
+
+// Sleeps while *word is seen, at most ms. Wakeups may be spurious.
+void
+ipc_wait(IpcMap* m, UInt32 bell, volatile SInt32* word, SInt32 seen, UInt32 ms);
+
+void
+ipc_wake(IpcMap* m, UInt32 bell, volatile SInt32* word);
+
+// Shared memory ---
+
+
+// Connection +++
+
+typedef struct IpcConn IpcConn;
+
+IpcConn*
+ipc_listen(const char* name);
+
+// Waits for the next client, NULL on failure.
+IpcConn*
+ipc_accept(IpcConn* listener);
+
+IpcConn*
+ipc_connect(const char* name);
+
+bool
+ipc_send(IpcConn* c, const void* data, UInt32 size);
+
+bool
+ipc_recv(IpcConn* c, void* data, UInt32 size);
+
+// False once the other side has closed or died. Only after the hello, when
+// neither side sends anything more.
+bool
+ipc_alive(IpcConn* c);
+
+void
+ipc_close(IpcConn* c);
+
+// Connection ---
+
+
+// Ring +++
+
+// One side's view of a ring. The producer writes at head, the consumer
+// reads at cursor and frees up to it with ring_release(), so a record can
+// be held after the next one is read.
+typedef struct IpcRingView {
+    IpcRing* ring;
+    UInt8* data;
+    UInt32 capacity;
+    UInt32 cursor;
+    UInt32 padding;                    // Skipped by the reserved record
+    bool broken;                       // The other side wrote nonsense
+}IpcRingView;
+
+void
+ring_view(IpcRingView* v, IpcRing* ring, UInt8* data, UInt32 capacity);
+
+// Room for a record of size bytes, header included, NULL if full for now.
+IpcRecord*
+ring_reserve(IpcRingView* v, UInt32 size);
+
+// Publishes r, its size may have shrunk since ring_reserve().
+void
+ring_commit(IpcRingView* v, IpcRecord* r);
+
+// The next record, NULL if there is none yet or the ring is broken.
+IpcRecord*
+ring_next(IpcRingView* v);
+
+// Frees every record read so far.
+void
+ring_release(IpcRingView* v);
+
+static inline UInt32
+ipc_round8(UInt32 size) {
+    return (size + 7) & ~7u;
+}
+
+void
+bell_ring(IpcMap* m, UInt32 index, IpcBell* b);
+
+// Waits for ready(arg) on b, spinning a little before sleeping. Returns
+// false if gone(arg) first.
+bool
+bell_wait(IpcMap* m, UInt32 index, IpcBell* b, bool (* ready)(void*), bool (* gone)(void*), void* arg);
+
+// Where fill output goes in a lane's out area: packet descriptions first,
+// then each buffer, 16-byte aligned. Returns the bytes used.
+UInt32
+ipc_out_layout(UInt32 packets, bool descs, UInt32 count, const UInt32* sizes, UInt32* offsets);
+
+// Ring ---
+
+
+// Remote +++
+
+// The AudioToolbox procedures of a client, which forward to the host.
+// Implemented by remote.c.
+
+// name NULL turns hosting off again. False if it is too long.
+bool
+remote_set_name(const char* name);
+
+// True if a host is configured and this process is not one.
+bool
+remote_wanted(void);
+
+// Opens a session with the host and fills procs with the forwarders.
+bool
+remote_open(void* procs[kProcCount]);
+
+void
+remote_close(void);
+
+// For the host itself.
+void
+remote_disable(void);
+
+// Remote ---
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * No host transport, for Windows builds without WAT4FF_WIN_HOST until
+ * ipc_win.c has been built and run there. Nothing can be created, opened
+ * or connected to, so clients load the library themselves as when no host
+ * answers, and wat4ff_host_run() fails at once.
+*/
+
+#include <stdbool.h>
+
+#include "ipc.h"
+
+
+// Shared memory +++
+
+IpcMap*
+ipc_map_create(const char* name, size_t size, UInt32 bells) {
+    return NULL;
+}
+
+IpcMap*
+ipc_map_open(const char* name, size_t size, UInt32 bells) {
+    return NULL;
+}
+
+void*
+ipc_map_base(IpcMap* m) {
+    return NULL;
+}
+
+void
+ipc_map_unlink(const char* name) {
+}
+
+void
+ipc_map_close(IpcMap* m) {
+}
+
+void
+ipc_wait(IpcMap* m, UInt32 bell, volatile SInt32* word, SInt32 seen, UInt32 ms) {
+}
+
+void
+ipc_wake(IpcMap* m, UInt32 bell, volatile SInt32* word) {
+}
+
+// Shared memory ---
+
+
+// Connection +++
+
+IpcConn*
+ipc_listen(const char* name) {
+    return NULL;
+}
+
+IpcConn*
+ipc_accept(IpcConn* listener) {
+    return NULL;
+}
+
+IpcConn*
+ipc_connect(const char* name) {
+    return NULL;
+}
+
+bool
+ipc_send(IpcConn* c, const void* data, UInt32 size) {
+    return false;
+}
+
+bool
+ipc_recv(IpcConn* c, void* data, UInt32 size) {
+    return false;
+}
+
+bool
+ipc_alive(IpcConn* c) {
+    return false;
+}
+
+void
+ipc_close(IpcConn* c) {
+}
+
+// Connection ---
@@ -0,0 +1,256 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Shared memory, wakeups and the host connection on POSIX systems: POSIX
+ * shared memory, futexes on Linux, a Unix domain socket in /tmp.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
+#include "ipc.h"
+#include "plat.h"
+
+
+#ifdef SOCK_CLOEXEC
+#define SOCKET_TYPE (SOCK_STREAM | SOCK_CLOEXEC)
+#else
+#define SOCKET_TYPE SOCK_STREAM
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+struct IpcMap {
+    void* base;
+    size_t size;
+};
+
+struct IpcConn {
+    int fd;
+};
+
+
+// Shared memory +++
+
+// POSIX wants one leading slash and no other.
+static bool
+shm_name(const char* name, char* buf) {
+    size_t n = strlen(name);
+    if (n >= kIpcNameMax || strchr(name, '/')) return false;
+    buf[0] = '/';
+    memcpy(buf + 1, name, n + 1);
+    return true;
+}
+
+static IpcMap*
+map_fd(int fd, size_t size) {
+    IpcMap* m = plat_alloc(sizeof(*m));
+    void* base = m ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        plat_free(m);
+        return NULL;
+    }
+    m->base = base;
+    m->size = size;
+    return m;
+}
+
+IpcMap*
+ipc_map_create(const char* name, size_t size, UInt32 bells) {
+    char path[kIpcNameMax + 1];
+    if (!shm_name(name, path)) return NULL;
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, (off_t)size)) {
+        close(fd);
+        shm_unlink(path);
+        return NULL;
+    }
+    IpcMap* m = map_fd(fd, size);
+    if (!m) shm_unlink(path);
+    return m;
+}
+
+IpcMap*
+ipc_map_open(const char* name, size_t size, UInt32 bells) {
+    char path[kIpcNameMax + 1];
+    if (!shm_name(name, path)) return NULL;
+    int fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < size) {
+        close(fd);
+        return NULL;
+    }
+    return map_fd(fd, size);
+}
+
+void*
+ipc_map_base(IpcMap* m) {
+    return m->base;
+}
+
+void
+ipc_map_unlink(const char* name) {
+    char path[kIpcNameMax + 1];
+    if (shm_name(name, path)) shm_unlink(path);
+}
+
+void
+ipc_map_close(IpcMap* m) {
+    if (!m) return;
+    munmap(m->base, m->size);
+    plat_free(m);
+}
+
+// Without futexes, a short nap stands in for the wait.
+void
+ipc_wait(IpcMap* m, UInt32 bell, volatile SInt32* word, SInt32 seen, UInt32 ms) {
+#ifdef __linux__
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, &ts, NULL, 0);
+#else
+    struct timespec ts = { 0, 100000 };
+    if (plat_load32(word) == seen) nanosleep(&ts, NULL);
+#endif
+}
+
+void
+ipc_wake(IpcMap* m, UInt32 bell, volatile SInt32* word) {
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+#endif
+}
+
+// Shared memory ---
+
+
+// Connection +++
+
+// A name with a slash is a path, anything else goes in /tmp, per user.
+static bool
+socket_address(const char* name, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = strchr(name, '/')
+          ? snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", name)
+          : snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/%s-%u.sock", name, (unsigned)getuid());
+    return n > 0 && (size_t)n < sizeof(addr->sun_path);
+}
+
+static IpcConn*
+conn_new(int fd) {
+    IpcConn* c = plat_alloc(sizeof(*c));
+    if (!c) {
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    return c;
+}
+
+IpcConn*
+ipc_listen(const char* name) {
+    struct sockaddr_un addr;
+    if (!socket_address(name, &addr)) return NULL;
+
+    // A socket nobody answers on is left over from a host that died.
+    IpcConn* other = ipc_connect(name);
+    if (other) {
+        ipc_close(other);
+        return NULL;
+    }
+    unlink(addr.sun_path);
+
+    int fd = socket(AF_UNIX, SOCKET_TYPE, 0);
+    if (fd < 0) return NULL;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 64)) {
+        close(fd);
+        return NULL;
+    }
+    return conn_new(fd);
+}
+
+IpcConn*
+ipc_accept(IpcConn* listener) {
+    for (;;) {
+        int fd = accept(listener->fd, NULL, NULL);
+        if (fd >= 0) return conn_new(fd);
+        if (errno != EINTR && errno != ECONNABORTED) return NULL;
+    }
+}
+
+IpcConn*
+ipc_connect(const char* name) {
+    struct sockaddr_un addr;
+    if (!socket_address(name, &addr)) return NULL;
+    int fd = socket(AF_UNIX, SOCKET_TYPE, 0);
+    if (fd < 0) return NULL;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return NULL;
+    }
+    return conn_new(fd);
+}
+
+bool
+ipc_send(IpcConn* c, const void* data, UInt32 size) {
+    const UInt8* p = data;
+    while (size) {
+        ssize_t n = send(c->fd, p, size, SEND_FLAGS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (UInt32)n;
+    }
+    return true;
+}
+
+bool
+ipc_recv(IpcConn* c, void* data, UInt32 size) {
+    UInt8* p = data;
+    while (size) {
+        ssize_t n = recv(c->fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (UInt32)n;
+    }
+    return true;
+}
+
+// Nothing is sent after the hello, so anything readable is the end.
+bool
+ipc_alive(IpcConn* c) {
+    struct pollfd p = { c->fd, POLLIN, 0 };
+    return poll(&p, 1, 0) == 0;
+}
+
+void
+ipc_close(IpcConn* c) {
+    if (!c) return;
+    close(c->fd);
+    plat_free(c);
+}
+
+// Connection ---
@@ -0,0 +1,266 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Shared memory, wakeups and the host connection on Windows: a pagefile
+ * backed file mapping, an auto-reset event per bell, a named pipe.
+*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <windows.h>
+
+#include "ipc.h"
+#include "plat.h"
+
+
+enum {
+    kMaxName = 32 + kIpcNameMax,
+    kPipeBuffer = 4096,
+};
+
+struct IpcMap {
+    void* base;
+    HANDLE mapping;
+    UInt32 bells;
+    HANDLE events[kIpcBells];
+};
+
+struct IpcConn {
+    HANDLE pipe;
+    bool server;
+    char name[kMaxName];               // Of the pipe, for a listener
+};
+
+
+// Buf assumed to be kMaxName in size. Appends "-index" unless index is -1.
+static bool
+object_name(char* buf, const char* prefix, const char* name, int index) {
+    size_t np = strlen(prefix);
+    size_t nn = strlen(name);
+    if (np + nn + 12 > kMaxName || strchr(name, '\\')) return false;
+    memcpy(buf, prefix, np);
+    memcpy(buf + np, name, nn);
+    char* p = buf + np + nn;
+    if (index >= 0) {
+        char digits[12];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + index % 10);
+            index /= 10;
+        } while (index);
+        *p++ = '-';
+        while (n) *p++ = digits[--n];
+    }
+    *p = '\0';
+    return true;
+}
+
+
+// Shared memory +++
+
+static IpcMap*
+map_new(HANDLE mapping, UInt32 bells) {
+    IpcMap* m = plat_calloc(sizeof(*m));
+    void* base = m ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+    if (!base) {
+        plat_free(m);
+        CloseHandle(mapping);
+        return NULL;
+    }
+    m->base = base;
+    m->mapping = mapping;
+    m->bells = bells;
+    return m;
+}
+
+static bool
+map_events(IpcMap* m, const char* name, bool create) {
+    if (m->bells > kIpcBells) return false;
+    for (UInt32 i = 0; i < m->bells; ++i) {
+        char buf[kMaxName];
+        if (!object_name(buf, "Local\\", name, (int)i)) return false;
+        m->events[i] = create ? CreateEventA(NULL, FALSE, FALSE, buf)
+                              : OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, buf);
+        if (!m->events[i]) return false;
+    }
+    return true;
+}
+
+IpcMap*
+ipc_map_create(const char* name, size_t size, UInt32 bells) {
+    char buf[kMaxName];
+    if (!object_name(buf, "Local\\", name, -1)) return NULL;
+    UInt64 n = size;
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                        (DWORD)(n >> 32), (DWORD)n, buf);
+    if (!mapping) return NULL;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return NULL;
+    }
+    IpcMap* m = map_new(mapping, bells);
+    if (m && !map_events(m, name, true)) {
+        ipc_map_close(m);
+        return NULL;
+    }
+    return m;
+}
+
+IpcMap*
+ipc_map_open(const char* name, size_t size, UInt32 bells) {
+    char buf[kMaxName];
+    if (!object_name(buf, "Local\\", name, -1)) return NULL;
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, buf);
+    if (!mapping) return NULL;
+    IpcMap* m = map_new(mapping, bells);
+    if (!m) return NULL;
+
+    MEMORY_BASIC_INFORMATION info;
+    if (!VirtualQuery(m->base, &info, sizeof(info)) || info.RegionSize < size || !map_events(m, name, false)) {
+        ipc_map_close(m);
+        return NULL;
+    }
+    return m;
+}
+
+void*
+ipc_map_base(IpcMap* m) {
+    return m->base;
+}
+
+// Named objects go with their last handle.
+void
+ipc_map_unlink(const char* name) {
+}
+
+void
+ipc_map_close(IpcMap* m) {
+    if (!m) return;
+    for (UInt32 i = 0; i < m->bells; ++i) {
+        if (m->events[i]) CloseHandle(m->events[i]);
+    }
+    UnmapViewOfFile(m->base);
+    CloseHandle(m->mapping);
+    plat_free(m);
+}
+
+// Each bell has one sleeper at most, so an auto-reset event will do. One
+// set while nobody slept only makes the next wait return early.
+void
+ipc_wait(IpcMap* m, UInt32 bell, volatile SInt32* word, SInt32 seen, UInt32 ms) {
+    if (plat_load32(word) == seen) WaitForSingleObject(m->events[bell], ms);
+}
+
+void
+ipc_wake(IpcMap* m, UInt32 bell, volatile SInt32* word) {
+    SetEvent(m->events[bell]);
+}
+
+// Shared memory ---
+
+
+// Connection +++
+
+static IpcConn*
+conn_new(HANDLE pipe, bool server) {
+    IpcConn* c = plat_calloc(sizeof(*c));
+    if (!c) {
+        CloseHandle(pipe);
+        return NULL;
+    }
+    c->pipe = pipe;
+    c->server = server;
+    return c;
+}
+
+static HANDLE
+pipe_instance(const char* name, bool first) {
+    DWORD mode = PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0);
+    return CreateNamedPipeA(name, mode, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                            PIPE_UNLIMITED_INSTANCES, kPipeBuffer, kPipeBuffer, 0, NULL);
+}
+
+// The listener holds the next instance, so a client never finds none.
+IpcConn*
+ipc_listen(const char* name) {
+    IpcConn* c = plat_calloc(sizeof(*c));
+    if (!c) return NULL;
+    if (!object_name(c->name, "\\\\.\\pipe\\", name, -1)) goto fail;
+    c->pipe = pipe_instance(c->name, true);
+    if (c->pipe == INVALID_HANDLE_VALUE) goto fail;
+    c->server = true;
+    return c;
+
+fail:
+    plat_free(c);
+    return NULL;
+}
+
+IpcConn*
+ipc_accept(IpcConn* listener) {
+    if (!ConnectNamedPipe(listener->pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) return NULL;
+    HANDLE next = pipe_instance(listener->name, false);
+    if (next == INVALID_HANDLE_VALUE) return NULL;
+    HANDLE pipe = listener->pipe;
+    listener->pipe = next;
+    return conn_new(pipe, true);
+}
+
+IpcConn*
+ipc_connect(const char* name) {
+    char buf[kMaxName];
+    if (!object_name(buf, "\\\\.\\pipe\\", name, -1)) return NULL;
+    for (int tries = 0; tries < 10; ++tries) {
+        HANDLE pipe = CreateFileA(buf, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE) return conn_new(pipe, false);
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeA(buf, 100)) return NULL;
+    }
+    return NULL;
+}
+
+bool
+ipc_send(IpcConn* c, const void* data, UInt32 size) {
+    const UInt8* p = data;
+    while (size) {
+        DWORD n;
+        if (!WriteFile(c->pipe, p, size, &n, NULL) || !n) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool
+ipc_recv(IpcConn* c, void* data, UInt32 size) {
+    UInt8* p = data;
+    while (size) {
+        DWORD n;
+        if (!ReadFile(c->pipe, p, size, &n, NULL) || !n) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Nothing is sent after the hello, so anything to read is the end too.
+bool
+ipc_alive(IpcConn* c) {
+    DWORD avail = 0;
+    return PeekNamedPipe(c->pipe, NULL, 0, NULL, &avail, NULL) && !avail;
+}
+
+void
+ipc_close(IpcConn* c) {
+    if (!c) return;
+    if (c->server) {
+        FlushFileBuffers(c->pipe);
+        DisconnectNamedPipe(c->pipe);
+    }
+    CloseHandle(c->pipe);
+    plat_free(c);
+}
+
+// Connection ---
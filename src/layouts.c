@@ -0,0 +1,129 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Channel layout tables, see layouts.h. Like CoreAudioToolbox, both
+ * properties answer with channel descriptions, one per channel in stream
+ * order, and the tag kAudioChannelLayoutTag_UseChannelDescriptions.
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "layouts.h"
+
+
+enum {
+    kMaxLayoutChannels = 8,
+    kBitmapChannels    = 18,    // Bit n is label n + 1 up to TopBackRight
+};
+
+#define L   kAudioChannelLabel_Left
+#define R   kAudioChannelLabel_Right
+#define C   kAudioChannelLabel_Center
+#define LFE kAudioChannelLabel_LFEScreen
+#define Ls  kAudioChannelLabel_LeftSurround
+#define Rs  kAudioChannelLabel_RightSurround
+#define Lc  kAudioChannelLabel_LeftCenter
+#define Rc  kAudioChannelLabel_RightCenter
+#define Cs  kAudioChannelLabel_CenterSurround
+#define Rls kAudioChannelLabel_RearSurroundLeft
+#define Rrs kAudioChannelLabel_RearSurroundRight
+
+// Every kAudioChannelLayoutTag_* in AudioToolbox.h. The low 16 bits of a
+// tag are its channel count.
+static const struct {
+    AudioChannelLayoutTag tag;
+    UInt8 labels[kMaxLayoutChannels];
+} kTagLayouts[] = {
+    { kAudioChannelLayoutTag_Mono,             { kAudioChannelLabel_Mono } },
+    { kAudioChannelLayoutTag_Stereo,           { L, R } },
+    { kAudioChannelLayoutTag_AAC_3_0,          { C, L, R } },
+    { kAudioChannelLayoutTag_AAC_Quadraphonic, { L, R, Ls, Rs } },
+    { kAudioChannelLayoutTag_AAC_4_0,          { C, L, R, Cs } },
+    { kAudioChannelLayoutTag_AAC_5_0,          { C, L, R, Ls, Rs } },
+    { kAudioChannelLayoutTag_AAC_5_1,          { C, L, R, Ls, Rs, LFE } },
+    { kAudioChannelLayoutTag_AAC_6_0,          { C, L, R, Ls, Rs, Cs } },
+    { kAudioChannelLayoutTag_AAC_6_1,          { C, L, R, Ls, Rs, Cs, LFE } },
+    { kAudioChannelLayoutTag_AAC_7_0,          { C, L, R, Ls, Rs, Rls, Rrs } },
+    { kAudioChannelLayoutTag_AAC_7_1,          { C, Lc, Rc, L, R, Ls, Rs, LFE } },
+    { kAudioChannelLayoutTag_AAC_Octagonal,    { C, L, R, Ls, Rs, Rls, Rrs, Cs } },
+    { kAudioChannelLayoutTag_MPEG_7_1_C,       { L, R, C, LFE, Ls, Rs, Rls, Rrs } },
+};
+
+#undef L
+#undef R
+#undef C
+#undef LFE
+#undef Ls
+#undef Rs
+#undef Lc
+#undef Rc
+#undef Cs
+#undef Rls
+#undef Rrs
+
+
+static UInt32
+size_for(UInt32 channels) {
+    return (UInt32)(offsetof(AudioChannelLayout, mChannelDescriptions) + sizeof(AudioChannelDescription) * channels);
+}
+
+static int
+find_tag(AudioChannelLayoutTag tag) {
+    for (int i = 0; i < (int)(sizeof(kTagLayouts) / sizeof(kTagLayouts[0])); ++i) {
+        if (kTagLayouts[i].tag == tag) return i;
+    }
+    return -1;
+}
+
+static UInt32
+bitmap_channels(AudioChannelBitmap bitmap) {
+    UInt32 n = 0;
+    for (; bitmap; bitmap &= bitmap - 1) ++n;
+    return n;
+}
+
+UInt32
+layout_size(AudioFormatPropertyID id, UInt32 specSize, const void* spec) {
+    UInt32 v;
+    if (specSize != sizeof(v) || !spec) return 0;
+    memcpy(&v, spec, sizeof(v));
+
+    if (id == kAudioFormatProperty_ChannelLayoutForTag) {
+        return find_tag(v) < 0 ? 0 : size_for(v & 0xffff);
+    }
+    if (id == kAudioFormatProperty_ChannelLayoutForBitmap) {
+        if (!v || v >> kBitmapChannels) return 0;
+        return size_for(bitmap_channels(v));
+    }
+    return 0;
+}
+
+void
+layout_fill(AudioFormatPropertyID id, const void* spec, AudioChannelLayout* layout) {
+    UInt32 v;
+    memcpy(&v, spec, sizeof(v));
+
+    UInt32 n = 0;
+    AudioChannelLabel labels[kBitmapChannels];
+    if (id == kAudioFormatProperty_ChannelLayoutForTag) {
+        int i = find_tag(v);
+        for (; n < (v & 0xffff); ++n) labels[n] = kTagLayouts[i].labels[n];
+    }
+    else {
+        for (UInt32 bit = 0; bit < kBitmapChannels; ++bit) {
+            if (v & (1U << bit)) labels[n++] = bit + 1;
+        }
+    }
+
+    layout->mChannelLayoutTag = kAudioChannelLayoutTag_UseChannelDescriptions;
+    layout->mChannelBitmap = 0;
+    layout->mNumberChannelDescriptions = n;
+    for (UInt32 i = 0; i < n; ++i) {
+        AudioChannelDescription* d = &layout->mChannelDescriptions[i];
+        memset(d, 0, sizeof(*d));
+        d->mChannelLabel = labels[i];
+    }
+}
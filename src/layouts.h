@@ -0,0 +1,25 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Channel layouts built in, so kAudioFormatProperty_ChannelLayoutForTag and
+ * ChannelLayoutForBitmap need neither CoreAudioToolbox nor even its load.
+*/
+
+#ifndef WAT4FF_LAYOUTS_H
+#define WAT4FF_LAYOUTS_H
+
+#include <AudioToolbox/AudioToolbox.h>
+
+
+// Bytes of the AudioChannelLayout property id yields for the tag or bitmap
+// in spec, or 0 if the tables do not know it.
+UInt32
+layout_size(AudioFormatPropertyID id, UInt32 specSize, const void* spec);
+
+// Writes that layout, layout must hold layout_size() bytes.
+void
+layout_fill(AudioFormatPropertyID id, const void* spec, AudioChannelLayout* layout);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Finds and loads a CoreAudioToolbox stand-in on POSIX systems, normally
+ * the mock backend built from mock/.
+*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "plat.h"
+
+
+#ifdef __APPLE__
+static const char kLibFile[] = "libCoreAudioToolbox.dylib";
+#else
+static const char kLibFile[] = "libCoreAudioToolbox.so";
+#endif
+
+enum {
+    kMaxPath = PATH_MAX,
+    kDLFlags = RTLD_NOW | RTLD_LOCAL,
+};
+
+
+// Buf assumed to be kMaxPath in size.
+static bool
+get_override_lib_path(char* buf) {
+    return plat_getenv("WAT4FF_LIB_PATH", buf, kMaxPath);
+}
+
+// Buf assumed to be kMaxPath in size.
+// Next to the executable, the POSIX counterpart of QTfiles.
+static bool
+get_portable_lib_path(char* buf) {
+    ssize_t n = readlink("/proc/self/exe", buf, kMaxPath - 1);
+    if (n <= 0) return false;
+    buf[n] = '\0';
+
+    char* p = strrchr(buf, '/');
+    if (!p) return false;
+    ++p;
+    if ((size_t)(p - buf) + sizeof(kLibFile) > kMaxPath) return false;
+    memcpy(p, kLibFile, sizeof(kLibFile));
+
+    return access(buf, F_OK) == 0;
+}
+
+// Buf assumed to be kMaxPath in size.
+// A bare name, left to the dynamic loader's search path.
+static bool
+get_system_lib_path(char* buf) {
+    memcpy(buf, kLibFile, sizeof(kLibFile));
+    return true;
+}
+
+// Buf assumed to be kMaxPath in size.
+static void*
+try_load_lib(char* buf, bool (* get_path)(char*), int probe, Wat4ffLoadTiming* timing) {
+    SInt64 t0 = plat_now_ns();
+    bool ok = get_path(buf);
+    SInt64 t1 = plat_now_ns();
+    timing->probeNanos[probe] = t1 - t0;
+    if (!ok) return NULL;
+
+    void* lib = dlopen(buf, kDLFlags);
+    timing->loadLibraryNanos[probe] = plat_now_ns() - t1;
+    if (lib) timing->source = probe;
+    return lib;
+}
+
+PlatLib
+plat_lib_open(Wat4ffLoadTiming* timing) {
+    char* path = plat_alloc(kMaxPath);
+    if (!path) return NULL;
+
+    void* lib = NULL;
+
+    // An explicit path is final, falling back would hide a typo.
+    if (get_override_lib_path(path)) {
+        lib = try_load_lib(path, get_override_lib_path, kWat4ffProbeOverride, timing);
+        goto fin;
+    }
+
+    if ((lib = try_load_lib(path, get_portable_lib_path, kWat4ffProbePortable, timing))) goto fin;
+    if ((lib = try_load_lib(path, get_system_lib_path, kWat4ffProbeSystem, timing))) goto fin;
+
+fin:
+    plat_free(path);
+    return lib;
+}
+
+void*
+plat_lib_sym(PlatLib lib, const char* name) {
+    return dlsym(lib, name);
+}
+
+void
+plat_lib_close(PlatLib lib) {
+    dlclose(lib);
+}
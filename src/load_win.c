@@ -0,0 +1,364 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Finds and loads CoreAudioToolbox.dll on Windows.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+#include <stdbool.h>
+
+#include <windows.h>
+#ifdef WAT4FF_USE_APPMODEL
+#include <appmodel.h>
+#endif
+
+#include "plat.h"
+
+
+static const wchar_t kLibFile[] = L"CoreAudioToolbox.dll";
+#ifdef _WIN64
+static const wchar_t kLibDir[] = L"QTfiles64";
+#else
+static const wchar_t kLibDir[] = L"QTfiles";
+#endif
+
+enum {
+    kMaxPath = MAX_PATH,
+    kLLFlags = LOAD_LIBRARY_SEARCH_DLL_LOAD_DIR | LOAD_LIBRARY_SEARCH_SYSTEM32 | LOAD_IGNORE_CODE_AUTHZ_LEVEL,
+};
+
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_app_root(wchar_t* buf, wchar_t** rootp) {
+    size_t cch = GetModuleFileNameW(NULL, buf, kMaxPath);
+    if (cch >= kMaxPath) return false;
+
+    wchar_t* p = buf + cch - 1;
+    for (; *p != L'\\'; --p) {
+        if (p == buf) return false;
+    }
+    *++p = L'\0';
+    *rootp = p;
+
+    return true;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+calc_portable_lib_path(wchar_t* buf, wchar_t* rootp) {
+    wchar_t* p = rootp;
+    const wchar_t* end = buf + kMaxPath;
+    const wchar_t* pp = p + sizeof(kLibDir) / sizeof(*kLibDir) + sizeof(kLibFile) / sizeof(*kLibFile);
+    if (pp > end) return false;
+
+    memcpy(p, kLibDir, sizeof(kLibDir));
+    p += sizeof(kLibDir) / sizeof(*kLibDir) - 1;
+    *p++ = L'\\';
+
+    memcpy(p, kLibFile, sizeof(kLibFile));
+
+    return true;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+// Checks the file exists, a failed LoadLibraryExW costs more than that.
+static bool
+get_portable_lib_path(wchar_t* buf) {
+    wchar_t* rootp;
+    bool ok;
+
+    ok = get_app_root(buf, &rootp);
+    if (!ok) return false;
+
+    ok = calc_portable_lib_path(buf, rootp);
+    if (!ok) return false;
+
+    return GetFileAttributesW(buf) != INVALID_FILE_ATTRIBUTES;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+calc_app_lib_path(wchar_t* buf, wchar_t* rootp) {
+    const wchar_t* end = buf + kMaxPath;
+    const wchar_t* pp = rootp + sizeof(kLibFile) / sizeof(*kLibFile);
+    if (pp > end) return false;
+
+    memcpy(rootp, kLibFile, sizeof(kLibFile));
+
+    return true;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_itunes_prog_lib_path(wchar_t* buf) {
+    const wchar_t kSubKey[] = L"SOFTWARE\\Apple Computer, Inc.\\iTunes";
+    const wchar_t kValName[] = L"InstallDir";
+
+    DWORD sz = sizeof(wchar_t) * kMaxPath;
+    if (ERROR_SUCCESS != RegGetValueW(HKEY_LOCAL_MACHINE, kSubKey, kValName, RRF_RT_REG_SZ, NULL, buf, &sz)) return false;
+    sz = (sz / sizeof(wchar_t)) - 1;
+    return calc_app_lib_path(buf, buf + sz);
+}
+
+#ifdef WAT4FF_USE_APPMODEL
+static wchar_t*
+gen_wapp_full_name(const wchar_t* family_name) {
+    wchar_t* rlt = NULL;
+    UINT32 count = 0;
+    UINT32 buf_len = 0;
+    wchar_t* buf = NULL;
+    wchar_t** full_names = NULL;
+
+    LONG rc = FindPackagesByPackageFamily(
+        family_name, PACKAGE_FILTER_HEAD,
+        &count, NULL, &buf_len, NULL, NULL
+    );
+    // If Not found, rc == 0
+    if (rc != ERROR_INSUFFICIENT_BUFFER) return false;
+
+    buf = HeapAlloc(GetProcessHeap(), 0, sizeof(*buf) * buf_len);
+    if (!buf) goto fin;
+    full_names = HeapAlloc(GetProcessHeap(), 0, sizeof(*full_names) * count);
+    if (!full_names) goto fin;
+
+    rc = FindPackagesByPackageFamily(
+        family_name, PACKAGE_FILTER_HEAD,
+        &count, full_names, &buf_len, buf, NULL
+    );
+    if (rc) goto fin;
+
+    rlt = buf;
+
+fin:
+    if (!rlt && buf) HeapFree(GetProcessHeap(), 0, buf);
+    if (full_names) HeapFree(GetProcessHeap(), 0, full_names);
+    return rlt;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_wapp_dir_by_full_name(wchar_t* buf, wchar_t** rootp, const wchar_t* full_name) {
+    UINT32 cch = 0;
+    LONG rc = GetPackagePathByFullName(full_name, &cch, NULL);
+    if (rc != ERROR_INSUFFICIENT_BUFFER) return false;
+    if (cch >= kMaxPath - 1) return false; // We'll add trailing backslash, so kMaxPath - 1
+    
+    rc = GetPackagePathByFullName(full_name, &cch, buf);
+    if (rc) return false;
+
+    buf[cch - 1] = L'\\';
+    buf[cch]   = L'\0';
+    *rootp = buf + cch;
+
+    return true;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_wapp_dir_by_family_name(wchar_t* buf, wchar_t** rootp, const wchar_t* family_name) {
+    wchar_t* full_name = gen_wapp_full_name(family_name);
+    if (!full_name) return false;
+
+    bool rlt = get_wapp_dir_by_full_name(buf, rootp, full_name);
+    HeapFree(GetProcessHeap(), 0, full_name);
+    return rlt;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_itunes_app_lib_path(wchar_t* buf) {
+    const wchar_t kFamilyName[] = L"AppleInc.iTunes_nzyj5cx40ttqa";
+
+    wchar_t* rootp;
+    bool ok = get_wapp_dir_by_family_name(buf, &rootp, kFamilyName);
+    if (!ok) return false;
+
+    return calc_app_lib_path(buf, rootp);
+}
+#endif //#ifdef WAT4FF_USE_APPMODEL
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_override_lib_path(wchar_t* buf) {
+    DWORD cch = GetEnvironmentVariableW(L"WAT4FF_LIB_PATH", buf, kMaxPath);
+    return cch && cch < kMaxPath;
+}
+
+// The last path found by a slow probe, so other processes skip the registry
+// and package manager. Invalidated when the file it names changes.
+typedef struct LibPathCache {
+    UInt32   magic;
+    UInt32   cch;
+    FILETIME mtime;
+    UInt64   size;
+    wchar_t  path[kMaxPath];
+}LibPathCache;
+
+enum {
+    kCacheMagic = 0x63663477, // "w4fc"
+};
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_cache_file_path(wchar_t* buf, bool make_dir) {
+    static const wchar_t kCacheDir[] = L"\\wat4ff";
+    static const wchar_t kCacheFile[] = L"\\libpath.cache";
+
+    wchar_t val[2];
+    if (GetEnvironmentVariableW(L"WAT4FF_LIB_CACHE", val, 2) == 1 && val[0] == L'0') return false;
+
+    DWORD cch = GetEnvironmentVariableW(L"LOCALAPPDATA", buf, kMaxPath);
+    if (!cch || cch >= kMaxPath) return false;
+    if (cch + sizeof(kCacheDir) / sizeof(*kCacheDir) + sizeof(kCacheFile) / sizeof(*kCacheFile) > kMaxPath) return false;
+
+    memcpy(buf + cch, kCacheDir, sizeof(kCacheDir));
+    cch += sizeof(kCacheDir) / sizeof(*kCacheDir) - 1;
+    if (make_dir) CreateDirectoryW(buf, NULL);
+    memcpy(buf + cch, kCacheFile, sizeof(kCacheFile));
+
+    return true;
+}
+
+static bool
+get_file_stamp(const wchar_t* path, FILETIME* mtime, UInt64* size) {
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(path, GetFileExInfoStandard, &attr)) return false;
+
+    *mtime = attr.ftLastWriteTime;
+    *size = ((UInt64)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    return true;
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static bool
+get_cached_lib_path(wchar_t* buf) {
+    bool rlt = false;
+    LibPathCache* cache = HeapAlloc(GetProcessHeap(), 0, sizeof(*cache));
+    if (!cache) return false;
+    if (!get_cache_file_path(cache->path, false)) goto fin;
+
+    HANDLE file = CreateFileW(cache->path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) goto fin;
+    DWORD sz = 0;
+    BOOL ok = ReadFile(file, cache, sizeof(*cache), &sz, NULL);
+    CloseHandle(file);
+    if (!ok || sz < offsetof(LibPathCache, path)) goto fin;
+
+    if (cache->magic != kCacheMagic) goto fin;
+    if (!cache->cch || cache->cch >= kMaxPath) goto fin;
+    if (sz != offsetof(LibPathCache, path) + sizeof(wchar_t) * (cache->cch + 1)) goto fin;
+    if (cache->path[cache->cch]) goto fin;
+
+    FILETIME mtime;
+    UInt64 size;
+    if (!get_file_stamp(cache->path, &mtime, &size)) goto fin;
+    if (mtime.dwLowDateTime != cache->mtime.dwLowDateTime
+        || mtime.dwHighDateTime != cache->mtime.dwHighDateTime
+        || size != cache->size) goto fin;
+
+    memcpy(buf, cache->path, sizeof(wchar_t) * (cache->cch + 1));
+    rlt = true;
+
+fin:
+    HeapFree(GetProcessHeap(), 0, cache);
+    return rlt;
+}
+
+// Best effort, a cache we cannot write only costs the next process a probe.
+static void
+save_cached_lib_path(const wchar_t* path) {
+    LibPathCache* cache = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*cache));
+    wchar_t* file_path = HeapAlloc(GetProcessHeap(), 0, sizeof(wchar_t) * kMaxPath);
+    wchar_t* tmp_path = HeapAlloc(GetProcessHeap(), 0, sizeof(wchar_t) * (kMaxPath + 12));
+    if (!cache || !file_path || !tmp_path) goto fin;
+
+    cache->magic = kCacheMagic;
+    cache->cch = (UInt32)wcslen(path);
+    if (cache->cch >= kMaxPath) goto fin;
+    memcpy(cache->path, path, sizeof(wchar_t) * (cache->cch + 1));
+    if (!get_file_stamp(path, &cache->mtime, &cache->size)) goto fin;
+    if (!get_cache_file_path(file_path, true)) goto fin;
+
+    // Write aside then rename, so concurrent readers never see half a file.
+    // Suffix the process ID, two processes may be saving at once.
+    size_t cch = wcslen(file_path);
+    memcpy(tmp_path, file_path, sizeof(wchar_t) * cch);
+    tmp_path[cch++] = L'.';
+    for (DWORD pid = GetCurrentProcessId(); pid; pid /= 10) tmp_path[cch++] = L'0' + pid % 10;
+    tmp_path[cch] = L'\0';
+    HANDLE file = CreateFileW(tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) goto fin;
+    DWORD sz = offsetof(LibPathCache, path) + sizeof(wchar_t) * (cache->cch + 1);
+    DWORD written = 0;
+    BOOL ok = WriteFile(file, cache, sz, &written, NULL);
+    CloseHandle(file);
+    if (!ok || written != sz || !MoveFileExW(tmp_path, file_path, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(tmp_path);
+    }
+
+fin:
+    if (tmp_path) HeapFree(GetProcessHeap(), 0, tmp_path);
+    if (file_path) HeapFree(GetProcessHeap(), 0, file_path);
+    if (cache) HeapFree(GetProcessHeap(), 0, cache);
+}
+
+// Buf assumed to be kMaxPath in cch size.
+static HMODULE
+try_load_lib(wchar_t* buf, bool (* get_path)(wchar_t*), int probe, Wat4ffLoadTiming* timing) {
+    SInt64 t0 = plat_now_ns();
+    bool ok = get_path(buf);
+    SInt64 t1 = plat_now_ns();
+    timing->probeNanos[probe] = t1 - t0;
+    if (!ok) return NULL;
+
+    HMODULE lib = LoadLibraryExW(buf, NULL, kLLFlags);
+    timing->loadLibraryNanos[probe] = plat_now_ns() - t1;
+    if (lib) timing->source = probe;
+    return lib;
+}
+
+PlatLib
+plat_lib_open(Wat4ffLoadTiming* timing) {
+    wchar_t* path = HeapAlloc(GetProcessHeap(), 0, sizeof(wchar_t) * kMaxPath);
+    if (!path) return NULL;
+
+    HMODULE lib = NULL;
+
+    // An explicit path is final, falling back would hide a typo.
+    if (get_override_lib_path(path)) {
+        lib = try_load_lib(path, get_override_lib_path, kWat4ffProbeOverride, timing);
+        goto fin;
+    }
+
+    // Portable goes before the cache, it is cheap and must keep winning
+    // for an ffmpeg that ships its own QTfiles.
+    if ((lib = try_load_lib(path, get_portable_lib_path, kWat4ffProbePortable, timing))) goto fin;
+    if ((lib = try_load_lib(path, get_cached_lib_path, kWat4ffProbeCache, timing))) goto fin;
+    if ((lib = try_load_lib(path, get_itunes_prog_lib_path, kWat4ffProbeITunes, timing))) goto save;
+#ifdef WAT4FF_USE_APPMODEL
+    if ((lib = try_load_lib(path, get_itunes_app_lib_path, kWat4ffProbeAppModel, timing))) goto save;
+#endif
+    goto fin;
+
+save:
+    save_cached_lib_path(path);
+
+fin:
+    HeapFree(GetProcessHeap(), 0, path);
+    return lib;
+}
+
+void*
+plat_lib_sym(PlatLib lib, const char* name) {
+    return (void*)GetProcAddress(lib, name);
+}
+
+void
+plat_lib_close(PlatLib lib) {
+    FreeLibrary(lib);
+}
@@ -0,0 +1,1187 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Parallel encoding and decoding, see wat4ff_encode_parallel(),
+ * wat4ff_alac_encode(), wat4ff_encode_fanout() and wat4ff_decode_parallel().
+ *
+ * Output packet k of the serial encode covers input frames
+ * [k * fpp - leading, (k + 1) * fpp - leading). A converter fed input from
+ * frame s * fpp on produces that same packet as its packet k - s, so a
+ * segment of packets [first, end) is encoded from packet first - overlap,
+ * where overlap covers the priming plus job->overlapPackets, and is fed a
+ * little past end so the encoder does not flush early. Only [first, end)
+ * is kept.
+ *
+ * ALAC packets stand alone, so the lossless path needs none of that. Work
+ * is cut into small batches of packets. Each thread owns a range of them,
+ * takes from its front and, once it runs dry, steals half of what is left
+ * of the busiest range from its back. Encoded batches finish in any order
+ * and are appended to the output in order as soon as all before them are.
+ *
+ * The fan-out path runs one converter per rendition over the same input.
+ * The calling thread reads it into a ring, and each converter is handed
+ * pointers into the ring. A converter may keep using what it was handed
+ * until its input proc is called again, so only frames before that are
+ * free to overwrite.
+ *
+ * Decoding splits the packets the same way. A decoder's output for packet k
+ * depends on the packets just before it, overlapped transforms and SBR, so
+ * each segment starts decoding prerollPackets early and drops what those
+ * decode to.
+*/
+
+#include <string.h>
+#include <stdbool.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "parallel.h"
+#include "plat.h"
+
+
+enum {
+    kDefaultSegmentSeconds = 10,
+    kDefaultOverlapPackets = 2,
+    kPacketsPerFill        = 64,
+    kAdtsHeaderSize        = 7,
+    kMaxAdtsFrame          = 8191,
+    kDefaultBatchPackets   = 16,
+    kDefaultRingSeconds    = 2,
+    kCacheLine             = 64,
+};
+
+typedef struct Segment {
+    UInt64 first;                     // Packets of the serial encode it covers
+    UInt64 end;                       // UINT64_MAX for the last segment
+    UInt8* data;
+    UInt64 size;
+    UInt64 capacity;
+    AudioStreamPacketDescription* packets;
+    UInt64 count;
+    UInt64 packetCapacity;
+    AudioConverterPrimeInfo prime;    // Last segment only
+    OSStatus status;
+    bool done;                        // Batches and decoded segments
+}Segment;
+
+typedef struct Job {
+    const Wat4ffParallelEncode* cfg;
+    const UInt8* pcm;
+    UInt64 frames;
+    UInt32 fpp;
+    UInt32 leading;
+    UInt32 overlap;                   // Packets before a segment to encode and drop
+    UInt32 maxPacket;
+    Segment* segments;
+    UInt32 segmentCount;
+    volatile SInt32 next;
+}Job;
+
+// Interleaved PCM handed to a converter, frames [pos, end) of pcm.
+typedef struct Feed {
+    const UInt8* pcm;
+    UInt32 bytesPerFrame;
+    UInt32 channels;
+    UInt64 pos;
+    UInt64 end;
+}Feed;
+
+// Packets [next, end) of a stream handed to a decoder.
+typedef struct PacketFeed {
+    const Wat4ffEncodedStream* in;
+    UInt64 next;
+    UInt64 end;
+    AudioStreamPacketDescription descs[kPacketsPerFill];
+}PacketFeed;
+
+
+// Converter +++
+
+OSStatus
+parallel_new_converter(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out,
+                       const Wat4ffConverterProperty* props, UInt32 count, AudioConverterRef* conv) {
+    OSStatus rc = AudioConverterNew(in, out, conv);
+    if (rc) return rc;
+    for (UInt32 i = 0; i < count; ++i) {
+        const Wat4ffConverterProperty* p = &props[i];
+        rc = AudioConverterSetProperty(*conv, p->id, p->size, p->data);
+        if (rc) {
+            AudioConverterDispose(*conv);
+            return rc;
+        }
+    }
+    return noErr;
+}
+
+OSStatus
+parallel_copy_cookie(AudioConverterRef conv, UInt8** cookie, UInt32* cookieSize) {
+    UInt32 size = 0;
+    if (AudioConverterGetPropertyInfo(conv, kAudioConverterCompressionMagicCookie, &size, NULL) || !size) return noErr;
+    *cookie = plat_alloc(size);
+    if (!*cookie) return kAudio_MemFullError;
+    OSStatus rc = AudioConverterGetProperty(conv, kAudioConverterCompressionMagicCookie, &size, *cookie);
+    if (!rc) *cookieSize = size;
+    return rc;
+}
+
+// Learns the packet geometry of an encoder from one set up like the rest.
+static OSStatus
+probe(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* outFormat,
+      const Wat4ffConverterProperty* props, UInt32 count,
+      UInt32* fpp, UInt32* maxPacket, UInt32* leading, Wat4ffEncodedStream* out) {
+    AudioConverterRef conv;
+    OSStatus rc = parallel_new_converter(in, outFormat, props, count, &conv);
+    if (rc) return rc;
+
+    AudioStreamBasicDescription fmt;
+    UInt32 size = sizeof(fmt);
+    rc = AudioConverterGetProperty(conv, kAudioConverterCurrentOutputStreamDescription, &size, &fmt);
+    if (rc) goto fin;
+    *fpp = fmt.mFramesPerPacket;
+    if (!*fpp) {
+        rc = kAudioFormatUnsupportedDataFormatError;
+        goto fin;
+    }
+
+    size = sizeof(*maxPacket);
+    rc = AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, maxPacket);
+    if (rc) goto fin;
+
+    AudioConverterPrimeInfo prime = { 0, 0 };
+    size = sizeof(prime);
+    if (AudioConverterGetProperty(conv, kAudioConverterPrimeInfo, &size, &prime) == noErr) {
+        *leading = prime.leadingFrames;
+    }
+
+    rc = parallel_copy_cookie(conv, &out->magicCookie, &out->magicCookieSize);
+
+fin:
+    AudioConverterDispose(conv);
+    return rc;
+}
+
+static OSStatus
+feed_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+          AudioStreamPacketDescription** descs, void* user) {
+    Feed* f = user;
+    UInt64 left = f->end - f->pos;
+    if (*packets > left) *packets = (UInt32)left;
+
+    data->mBuffers[0].mData = (void*)(f->pcm + f->pos * f->bytesPerFrame);
+    data->mBuffers[0].mDataByteSize = *packets * f->bytesPerFrame;
+    data->mBuffers[0].mNumberChannels = f->channels;
+    f->pos += *packets;
+    return noErr;
+}
+
+// Hands out runs of packets that sit back to back in the stream.
+static OSStatus
+packet_feed_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                 AudioStreamPacketDescription** descs, void* user) {
+    PacketFeed* f = user;
+    UInt64 left = f->end - f->next;
+    UInt32 n = *packets < kPacketsPerFill ? *packets : kPacketsPerFill;
+    if (n > left) n = (UInt32)left;
+    if (!n) {
+        *packets = 0;
+        return noErr;
+    }
+
+    const AudioStreamPacketDescription* src = f->in->packets + f->next;
+    SInt64 base = src[0].mStartOffset;
+    SInt64 expect = base;
+    UInt32 i = 0;
+    for (; i < n && src[i].mStartOffset == expect; ++i) {
+        f->descs[i] = src[i];
+        f->descs[i].mStartOffset -= base;
+        expect += src[i].mDataByteSize;
+    }
+
+    data->mBuffers[0].mData = f->in->data + base;
+    data->mBuffers[0].mDataByteSize = (UInt32)(expect - base);
+    if (descs) *descs = f->descs;
+    f->next += i;
+    *packets = i;
+    return noErr;
+}
+
+// Decodes up to room frames from feed into dst, *got gets the number decoded.
+static OSStatus
+decode_frames(AudioConverterRef conv, PacketFeed* feed, const AudioStreamBasicDescription* fmt,
+              UInt8* dst, UInt64 room, UInt64* got) {
+    UInt32 bpf = fmt->mBytesPerFrame;
+    UInt64 done = 0;
+    OSStatus rc = noErr;
+    while (done < room) {
+        UInt64 left = room - done;
+        UInt32 n = left < 0x10000 ? (UInt32)left : 0x10000;
+        AudioBufferList list = { 1, { { fmt->mChannelsPerFrame, n * bpf, dst + done * bpf } } };
+        rc = AudioConverterFillComplexBuffer(conv, packet_feed_proc, feed, &n, &list, NULL);
+        if (rc || !n) break;
+        done += n;
+    }
+    *got = done;
+    return rc;
+}
+
+// Runs fn on n threads, the calling one included. Thread i gets
+// args + i * stride.
+static void
+run_threads(PlatThreadProc fn, void* args, size_t stride, UInt32 n) {
+    PlatThread* threads = n > 1 ? plat_alloc(sizeof(PlatThread) * (n - 1)) : NULL;
+    UInt32 started = 0;
+    for (; threads && started < n - 1; ++started) {
+        if (!plat_thread_start(&threads[started], fn, (UInt8*)args + (started + 1) * stride)) break;
+    }
+    fn(args);
+    for (UInt32 i = 0; i < started; ++i) plat_thread_join(threads[i]);
+    plat_free(threads);
+}
+
+// Converter ---
+
+
+// Segment +++
+
+static bool
+reserve(void** p, UInt64* capacity, UInt64 need, size_t unit) {
+    if (need <= *capacity) return true;
+    UInt64 cap = *capacity ? *capacity * 2 : 64;
+    while (cap < need) cap *= 2;
+    void* q = plat_realloc(*p, (size_t)(cap * unit));
+    if (!q) return false;
+    *p = q;
+    *capacity = cap;
+    return true;
+}
+
+static OSStatus
+keep_packet(Segment* seg, const UInt8* data, const AudioStreamPacketDescription* desc) {
+    if (!reserve((void**)&seg->data, &seg->capacity, seg->size + desc->mDataByteSize, 1)
+        || !reserve((void**)&seg->packets, &seg->packetCapacity, seg->count + 1, sizeof(*seg->packets))) {
+        return kAudio_MemFullError;
+    }
+    memcpy(seg->data + seg->size, data + desc->mStartOffset, desc->mDataByteSize);
+    AudioStreamPacketDescription* d = &seg->packets[seg->count++];
+    *d = *desc;
+    d->mStartOffset = seg->size;
+    seg->size += desc->mDataByteSize;
+    return noErr;
+}
+
+static OSStatus
+encode_segment(const Job* job, Segment* seg) {
+    bool last = seg->end == UINT64_MAX;
+    UInt64 start = seg->first > job->overlap ? seg->first - job->overlap : 0;
+
+    // Feeding the overlap past the end keeps the encoder from flushing
+    // before the last packet kept.
+    const Wat4ffParallelEncode* cfg = job->cfg;
+    Feed feed = { job->pcm, cfg->input.mBytesPerFrame, cfg->input.mChannelsPerFrame, start * job->fpp, job->frames };
+    if (!last) {
+        UInt64 end = (seg->end + job->overlap) * job->fpp;
+        end = end > job->leading ? end - job->leading : 0;
+        if (end < feed.end) feed.end = end;
+    }
+
+    AudioConverterRef conv;
+    OSStatus rc = parallel_new_converter(&cfg->input, &cfg->output, cfg->properties, cfg->propertyCount, &conv);
+    if (rc) return rc;
+
+    UInt32 bufSize = job->maxPacket * kPacketsPerFill;
+    UInt8* buf = plat_alloc(bufSize);
+    if (!buf) {
+        rc = kAudio_MemFullError;
+        goto fin;
+    }
+
+    AudioStreamPacketDescription descs[kPacketsPerFill];
+    UInt64 packet = start;
+    while (last || packet < seg->end) {
+        UInt32 n = kPacketsPerFill;
+        AudioBufferList list = { 1, { { cfg->output.mChannelsPerFrame, bufSize, buf } } };
+        rc = AudioConverterFillComplexBuffer(conv, feed_proc, &feed, &n, &list, descs);
+        if (rc || !n) break;
+
+        for (UInt32 i = 0; i < n && (last || packet < seg->end); ++i, ++packet) {
+            if (packet < seg->first) continue;
+            rc = keep_packet(seg, buf, &descs[i]);
+            if (rc) goto fin;
+        }
+    }
+
+    if (!rc && last) {
+        UInt32 size = sizeof(seg->prime);
+        AudioConverterGetProperty(conv, kAudioConverterPrimeInfo, &size, &seg->prime);
+    }
+
+fin:
+    plat_free(buf);
+    AudioConverterDispose(conv);
+    return rc;
+}
+
+static void
+worker(void* param) {
+    Job* job = param;
+    for (;;) {
+        SInt32 i = plat_fetch_add32(&job->next, 1);
+        if (i >= (SInt32)job->segmentCount) break;
+        job->segments[i].status = encode_segment(job, &job->segments[i]);
+    }
+}
+
+// Segment ---
+
+
+// ADTS +++
+
+static int
+adts_rate_index(Float64 rate) {
+    static const UInt32 kRates[] = {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350,
+    };
+    for (int i = 0; i < (int)(sizeof(kRates) / sizeof(kRates[0])); ++i) {
+        if (rate == kRates[i]) return i;
+    }
+    return -1;
+}
+
+// AAC LC, no CRC. 7.1 is channel configuration 7, other counts map to
+// themselves up to 5.1.
+static bool
+adts_header(const AudioStreamBasicDescription* fmt, UInt32 payload, UInt8* h) {
+    int rate = adts_rate_index(fmt->mSampleRate);
+    UInt32 ch = fmt->mChannelsPerFrame == 8 ? 7 : fmt->mChannelsPerFrame;
+    UInt32 len = kAdtsHeaderSize + payload;
+    if (fmt->mFormatID != kAudioFormatMPEG4AAC || rate < 0 || !ch || ch > 7
+        || fmt->mChannelsPerFrame == 7 || len > kMaxAdtsFrame) {
+        return false;
+    }
+
+    h[0] = 0xff;
+    h[1] = 0xf1;
+    h[2] = (UInt8)((1 << 6) | (rate << 2) | (ch >> 2));
+    h[3] = (UInt8)(((ch & 3) << 6) | (len >> 11));
+    h[4] = (UInt8)(len >> 3);
+    h[5] = (UInt8)(((len & 7) << 5) | 0x1f);
+    h[6] = 0xfc;
+    return true;
+}
+
+// ADTS ---
+
+
+// Stitch +++
+
+static OSStatus
+stitch(const Job* job, Wat4ffEncodedStream* out) {
+    bool adts = job->cfg->adts;
+    UInt64 size = 0;
+    UInt64 count = 0;
+    for (UInt32 i = 0; i < job->segmentCount; ++i) {
+        size += job->segments[i].size;
+        count += job->segments[i].count;
+    }
+    if (adts) size += count * kAdtsHeaderSize;
+
+    out->data = plat_alloc(size ? (size_t)size : 1);
+    out->packets = plat_alloc(count ? (size_t)(count * sizeof(*out->packets)) : 1);
+    if (!out->data || !out->packets) return kAudio_MemFullError;
+
+    UInt64 pos = 0;
+    UInt64 n = 0;
+    for (UInt32 i = 0; i < job->segmentCount; ++i) {
+        const Segment* seg = &job->segments[i];
+        for (UInt64 k = 0; k < seg->count; ++k) {
+            AudioStreamPacketDescription d = seg->packets[k];
+            const UInt8* src = seg->data + d.mStartOffset;
+            d.mStartOffset = pos;
+            if (adts) {
+                if (!adts_header(&job->cfg->output, d.mDataByteSize, out->data + pos)) {
+                    return kAudioFormatUnsupportedDataFormatError;
+                }
+                pos += kAdtsHeaderSize;
+                d.mDataByteSize += kAdtsHeaderSize;
+            }
+            memcpy(out->data + pos, src, seg->packets[k].mDataByteSize);
+            pos += seg->packets[k].mDataByteSize;
+            out->packets[n++] = d;
+        }
+    }
+
+    out->dataSize = pos;
+    out->packetCount = n;
+    out->framesPerPacket = job->fpp;
+    out->prime.leadingFrames = job->leading;
+    out->prime.trailingFrames = job->segments[job->segmentCount - 1].prime.trailingFrames;
+    out->segments = job->segmentCount;
+    return noErr;
+}
+
+// Stitch ---
+
+
+// Lossless +++
+
+typedef struct Lossless {
+    const Wat4ffAlacJob* cfg;
+    const UInt8* pcm;                 // Encode input, or decode output
+    UInt64 frames;
+    const Wat4ffEncodedStream* in;    // Decode input
+    Wat4ffEncodedStream* out;         // Encode output, may be NULL
+    UInt32 fpp;
+    UInt32 maxPacket;
+    Segment* batches;
+    UInt32 batchCount;
+    UInt8* lanes;                     // One Lane per cache line
+    UInt32 laneCount;
+    volatile SInt64 decoded;
+    volatile SInt32 setup;            // Why a thread could not start, if one could not
+
+    PlatMutex lock;                   // Guards the rest
+    UInt32 emitted;                   // Batches passed on so far
+    UInt64 dataCapacity;
+    UInt64 packetCapacity;
+    OSStatus status;
+}Lossless;
+
+// The batches a thread has left, first | end << 32. The owner takes from
+// the front, thieves cut off the back.
+typedef struct Lane {
+    volatile SInt64 range;
+    Lossless* job;
+}Lane;
+
+static inline SInt64
+pack_range(UInt32 first, UInt32 end) {
+    return (SInt64)((UInt64)first | (UInt64)end << 32);
+}
+
+static inline Lane*
+lane_at(const Lossless* job, UInt32 i) {
+    return (Lane*)(job->lanes + (size_t)i * kCacheLine);
+}
+
+static SInt64
+take(Lane* lane) {
+    for (;;) {
+        SInt64 r = plat_counter_get(&lane->range);
+        UInt32 first = (UInt32)r;
+        UInt32 end = (UInt32)((UInt64)r >> 32);
+        if (first >= end) return -1;
+        if (plat_cas64(&lane->range, r, pack_range(first + 1, end))) return first;
+    }
+}
+
+// Takes the back half of the fullest other lane, or -1 once all are empty.
+static SInt64
+steal(Lossless* job, Lane* self) {
+    for (;;) {
+        Lane* victim = NULL;
+        SInt64 seen = 0;
+        UInt32 most = 0;
+        for (UInt32 i = 0; i < job->laneCount; ++i) {
+            Lane* lane = lane_at(job, i);
+            if (lane == self) continue;
+            SInt64 r = plat_counter_get(&lane->range);
+            UInt32 first = (UInt32)r;
+            UInt32 end = (UInt32)((UInt64)r >> 32);
+            if (end > first && end - first > most) {
+                victim = lane;
+                seen = r;
+                most = end - first;
+            }
+        }
+        if (!victim) return -1;
+
+        UInt32 first = (UInt32)seen;
+        UInt32 end = (UInt32)((UInt64)seen >> 32);
+        UInt32 mid = first + most / 2;
+        if (!plat_cas64(&victim->range, seen, pack_range(first, mid))) continue;
+        plat_counter_set(&self->range, pack_range(mid + 1, end));
+        return mid;
+    }
+}
+
+static OSStatus
+encode_batch(const Lossless* job, AudioConverterRef conv, UInt8* buf, Segment* seg) {
+    const Wat4ffAlacJob* cfg = job->cfg;
+    UInt64 end = seg->end * job->fpp;
+    Feed feed = {
+        job->pcm, cfg->input.mBytesPerFrame, cfg->input.mChannelsPerFrame,
+        seg->first * job->fpp, end < job->frames ? end : job->frames,
+    };
+
+    OSStatus rc = AudioConverterReset(conv);
+    AudioStreamPacketDescription descs[kPacketsPerFill];
+    while (!rc) {
+        UInt32 n = kPacketsPerFill;
+        AudioBufferList list = { 1, { { cfg->output.mChannelsPerFrame, job->maxPacket * kPacketsPerFill, buf } } };
+        rc = AudioConverterFillComplexBuffer(conv, feed_proc, &feed, &n, &list, descs);
+        if (rc || !n) break;
+        for (UInt32 i = 0; i < n && !rc; ++i) rc = keep_packet(seg, buf, &descs[i]);
+    }
+    if (!rc && seg->count != seg->end - seg->first) rc = kAudioFormatUnsupportedDataFormatError;
+    return rc;
+}
+
+static OSStatus
+decode_batch(Lossless* job, AudioConverterRef conv, Segment* seg) {
+    const Wat4ffAlacJob* cfg = job->cfg;
+    bool last = seg->end == job->in->packetCount;
+    UInt32 bpf = cfg->output.mBytesPerFrame;
+    UInt8* dst = (UInt8*)job->pcm + seg->first * job->fpp * bpf;
+    UInt64 room = (seg->end - seg->first) * job->fpp;
+    PacketFeed feed = { job->in, seg->first, seg->end };
+
+    OSStatus rc = AudioConverterReset(conv);
+    UInt64 got = 0;
+    if (!rc) rc = decode_frames(conv, &feed, &cfg->output, dst, room, &got);
+
+    // Only the last packet may be short, or the batches after this one
+    // would be in the wrong place.
+    if (!rc && !last && got != room) rc = kAudioFormatUnsupportedDataFormatError;
+    if (!rc) plat_counter_add(&job->decoded, (SInt64)got);
+    return rc;
+}
+
+// Marks batch i done and passes on every finished batch that is next in line.
+static void
+reassemble(Lossless* job, UInt32 i) {
+    plat_mutex_lock(&job->lock);
+    job->batches[i].done = true;
+    for (; job->emitted < job->batchCount && job->batches[job->emitted].done; ++job->emitted) {
+        Segment* seg = &job->batches[job->emitted];
+        if (!job->status) job->status = seg->status;
+
+        Wat4ffEncodedStream* out = job->out;
+        if (!job->status && out) {
+            if (!reserve((void**)&out->data, &job->dataCapacity, out->dataSize + seg->size, 1)
+                || !reserve((void**)&out->packets, &job->packetCapacity, out->packetCount + seg->count,
+                            sizeof(*out->packets))) {
+                job->status = kAudio_MemFullError;
+            }
+            else {
+                if (seg->size) memcpy(out->data + out->dataSize, seg->data, (size_t)seg->size);
+                for (UInt64 k = 0; k < seg->count; ++k) {
+                    AudioStreamPacketDescription* d = &out->packets[out->packetCount++];
+                    *d = seg->packets[k];
+                    d->mStartOffset += out->dataSize;
+                }
+                out->dataSize += seg->size;
+            }
+        }
+        if (!job->status && job->cfg->emit) {
+            job->cfg->emit(job->cfg->emitUser, seg->data, seg->packets, (UInt32)seg->count);
+        }
+
+        plat_free(seg->data);
+        plat_free(seg->packets);
+        seg->data = NULL;
+        seg->packets = NULL;
+    }
+    plat_mutex_unlock(&job->lock);
+}
+
+static void
+lane_main(void* param) {
+    Lane* lane = param;
+    Lossless* job = lane->job;
+    const Wat4ffAlacJob* cfg = job->cfg;
+    UInt8* buf = NULL;
+
+    // A thread that cannot get a converter leaves its batches to thieves.
+    AudioConverterRef conv;
+    OSStatus rc = parallel_new_converter(&cfg->input, &cfg->output, cfg->properties, cfg->propertyCount, &conv);
+    if (rc) {
+        plat_store32(&job->setup, rc);
+        return;
+    }
+    if (job->in) {
+        if (job->in->magicCookieSize) {
+            rc = AudioConverterSetProperty(conv, kAudioConverterDecompressionMagicCookie,
+                                           job->in->magicCookieSize, job->in->magicCookie);
+            if (rc) {
+                plat_store32(&job->setup, rc);
+                goto fin;
+            }
+        }
+    }
+    else {
+        buf = plat_alloc((size_t)job->maxPacket * kPacketsPerFill);
+        if (!buf) {
+            plat_store32(&job->setup, kAudio_MemFullError);
+            goto fin;
+        }
+    }
+
+    for (;;) {
+        SInt64 i = take(lane);
+        if (i < 0) i = steal(job, lane);
+        if (i < 0) break;
+
+        Segment* seg = &job->batches[i];
+        if (job->in) {
+            seg->status = decode_batch(job, conv, seg);
+            seg->done = true;
+        }
+        else {
+            seg->status = encode_batch(job, conv, buf, seg);
+            reassemble(job, (UInt32)i);
+        }
+    }
+
+fin:
+    plat_free(buf);
+    AudioConverterDispose(conv);
+}
+
+// Cuts packets into batches, deals them out to the threads and runs them.
+static OSStatus
+run_lossless(Lossless* job, UInt64 packets) {
+    const Wat4ffAlacJob* cfg = job->cfg;
+    UInt64 per = cfg->batchPackets ? cfg->batchPackets : kDefaultBatchPackets;
+    UInt64 count = (packets + per - 1) / per;
+    if (count > 0x7fffffff) return kAudio_ParamError;
+    if (!count) return noErr;
+
+    job->batchCount = (UInt32)count;
+    job->batches = plat_calloc(sizeof(Segment) * job->batchCount);
+    UInt32 lanes = cfg->threads ? cfg->threads : plat_cpu_count();
+    if (lanes > job->batchCount) lanes = job->batchCount;
+    job->laneCount = lanes;
+    job->lanes = plat_calloc((size_t)lanes * kCacheLine);
+    if (!job->batches || !job->lanes) return kAudio_MemFullError;
+
+    for (UInt32 i = 0; i < job->batchCount; ++i) {
+        job->batches[i].first = i * per;
+        job->batches[i].end = i + 1 < job->batchCount ? (i + 1) * per : packets;
+    }
+    for (UInt32 i = 0; i < lanes; ++i) {
+        Lane* lane = lane_at(job, i);
+        lane->job = job;
+        lane->range = pack_range((UInt32)((UInt64)job->batchCount * i / lanes),
+                                 (UInt32)((UInt64)job->batchCount * (i + 1) / lanes));
+    }
+
+    run_threads(lane_main, job->lanes, kCacheLine, lanes);
+
+    // Batches left over had no thread that could start.
+    OSStatus rc = job->status;
+    for (UInt32 i = 0; i < job->batchCount && !rc; ++i) {
+        rc = job->batches[i].done ? job->batches[i].status : plat_load32(&job->setup);
+    }
+    return rc;
+}
+
+static void
+free_lossless(Lossless* job) {
+    if (job->batches) {
+        for (UInt32 i = 0; i < job->batchCount; ++i) {
+            plat_free(job->batches[i].data);
+            plat_free(job->batches[i].packets);
+        }
+        plat_free(job->batches);
+    }
+    plat_free(job->lanes);
+    plat_mutex_destroy(&job->lock);
+}
+
+// Lossless ---
+
+
+// Fan-out +++
+
+typedef struct Tap Tap;
+
+typedef struct Ring {
+    const Wat4ffFanOut* cfg;
+    UInt8* data;
+    UInt64 frames;                    // Capacity
+    Tap* taps;
+
+    PlatMutex lock;                   // Guards the rest
+    PlatCond readable;                // More written, or the end reached
+    PlatCond writable;                // A tap let go of some
+    UInt64 written;                   // Frames read into the ring so far
+    UInt32 live;                      // Taps still reading
+    bool end;
+    OSStatus status;                  // Why reading stopped early
+}Ring;
+
+// One rendition reading the ring.
+struct Tap {
+    Ring* ring;
+    const Wat4ffRendition* cfg;
+    Wat4ffEncodedStream* out;         // May be NULL
+    UInt64 pos;                       // Next frame to hand the converter
+    UInt64 held;                      // Frames from here on are in use, UINT64_MAX once done
+    Segment seg;                      // Packets kept for out
+    OSStatus status;
+};
+
+static UInt64
+oldest_held(const Ring* r) {
+    UInt64 oldest = UINT64_MAX;
+    for (UInt32 i = 0; i < r->cfg->renditionCount; ++i) {
+        if (r->taps[i].held < oldest) oldest = r->taps[i].held;
+    }
+    return oldest;
+}
+
+// Hands the converter frames where they sit in the ring, what it was handed
+// before is no longer in use.
+static OSStatus
+ring_feed_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+               AudioStreamPacketDescription** descs, void* user) {
+    Tap* t = user;
+    Ring* r = t->ring;
+    plat_mutex_lock(&r->lock);
+    t->held = t->pos;
+    plat_cond_broadcast(&r->writable);
+    while (t->pos == r->written && !r->end) plat_cond_wait(&r->readable, &r->lock);
+    OSStatus rc = r->status;
+    UInt64 left = r->written - t->pos;
+    plat_mutex_unlock(&r->lock);
+    if (rc) {
+        *packets = 0;
+        return rc;
+    }
+
+    UInt64 at = t->pos % r->frames;
+    if (left > r->frames - at) left = r->frames - at;
+    if (*packets > left) *packets = (UInt32)left;
+    UInt32 bpf = r->cfg->input.mBytesPerFrame;
+    data->mBuffers[0].mData = r->data + at * bpf;
+    data->mBuffers[0].mDataByteSize = *packets * bpf;
+    data->mBuffers[0].mNumberChannels = r->cfg->input.mChannelsPerFrame;
+    t->pos += *packets;
+    return noErr;
+}
+
+// Moves the packets kept into out, along with what a muxer needs to know.
+static OSStatus
+finish_tap(AudioConverterRef conv, Tap* t) {
+    Wat4ffEncodedStream* out = t->out;
+    AudioStreamBasicDescription fmt;
+    UInt32 size = sizeof(fmt);
+    OSStatus rc = AudioConverterGetProperty(conv, kAudioConverterCurrentOutputStreamDescription, &size, &fmt);
+    if (rc) return rc;
+    size = sizeof(out->prime);
+    AudioConverterGetProperty(conv, kAudioConverterPrimeInfo, &size, &out->prime);
+
+    out->data = t->seg.data;
+    out->dataSize = t->seg.size;
+    out->packets = t->seg.packets;
+    out->packetCount = t->seg.count;
+    out->framesPerPacket = fmt.mFramesPerPacket;
+    out->segments = 1;
+    t->seg.data = NULL;
+    t->seg.packets = NULL;
+    return parallel_copy_cookie(conv, &out->magicCookie, &out->magicCookieSize);
+}
+
+static OSStatus
+encode_tap(Tap* t) {
+    const Wat4ffRendition* cfg = t->cfg;
+    AudioConverterRef conv;
+    OSStatus rc = parallel_new_converter(&t->ring->cfg->input, &cfg->output, cfg->properties, cfg->propertyCount, &conv);
+    if (rc) return rc;
+
+    UInt32 maxPacket = 0;
+    UInt32 size = sizeof(maxPacket);
+    rc = AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &maxPacket);
+    UInt32 bufSize = maxPacket * kPacketsPerFill;
+    UInt8* buf = rc ? NULL : plat_alloc(bufSize);
+    if (!rc && !buf) rc = kAudio_MemFullError;
+
+    AudioStreamPacketDescription descs[kPacketsPerFill];
+    while (!rc) {
+        UInt32 n = kPacketsPerFill;
+        AudioBufferList list = { 1, { { cfg->output.mChannelsPerFrame, bufSize, buf } } };
+        rc = AudioConverterFillComplexBuffer(conv, ring_feed_proc, t, &n, &list, descs);
+        if (rc || !n) break;
+        if (cfg->emit) cfg->emit(cfg->emitUser, buf, descs, n);
+        for (UInt32 i = 0; i < n && t->out && !rc; ++i) rc = keep_packet(&t->seg, buf, &descs[i]);
+    }
+    if (!rc && t->out) rc = finish_tap(conv, t);
+
+    plat_free(buf);
+    AudioConverterDispose(conv);
+    return rc;
+}
+
+static void
+tap_main(void* param) {
+    Tap* t = param;
+    Ring* r = t->ring;
+    t->status = encode_tap(t);
+
+    plat_mutex_lock(&r->lock);
+    t->held = UINT64_MAX;
+    --r->live;
+    plat_cond_broadcast(&r->writable);
+    plat_mutex_unlock(&r->lock);
+}
+
+// Reads the input into the ring until it ends, fails, or no tap is left to
+// read it. Reads are kept to a quarter of the ring so taps get going early.
+static void
+fill_ring(Ring* r) {
+    const Wat4ffFanOut* cfg = r->cfg;
+    UInt64 chunk = r->frames / 4 ? r->frames / 4 : 1;
+    plat_mutex_lock(&r->lock);
+    for (;;) {
+        while (r->live && r->written - oldest_held(r) >= r->frames) plat_cond_wait(&r->writable, &r->lock);
+        if (!r->live) break;
+
+        UInt64 room = r->frames - (r->written - oldest_held(r));
+        UInt64 at = r->written % r->frames;
+        if (room > r->frames - at) room = r->frames - at;
+        if (room > chunk) room = chunk;
+        plat_mutex_unlock(&r->lock);
+
+        UInt32 n = room < UINT32_MAX ? (UInt32)room : UINT32_MAX;
+        OSStatus rc = cfg->read(cfg->readUser, r->data + at * cfg->input.mBytesPerFrame, &n);
+        if (!rc && n > room) rc = kAudio_ParamError;
+
+        plat_mutex_lock(&r->lock);
+        if (rc) {
+            r->status = rc;
+            break;
+        }
+        if (!n) break;
+        r->written += n;
+        plat_cond_broadcast(&r->readable);
+    }
+    r->end = true;
+    plat_cond_broadcast(&r->readable);
+    plat_mutex_unlock(&r->lock);
+}
+
+// Fan-out ---
+
+
+// Decode +++
+
+typedef struct Decode {
+    const Wat4ffParallelDecode* cfg;
+    const Wat4ffEncodedStream* in;
+    UInt8* pcm;
+    UInt32 fpp;
+    UInt32 preroll;
+    Segment* segments;
+    UInt32 segmentCount;
+    volatile SInt32 next;
+    volatile SInt64 decoded;
+    volatile SInt32 setup;            // Why a thread could not start, if one could not
+}Decode;
+
+// Decodes the packets of seg into their place in pcm, after decoding and
+// dropping up to preroll packets before them.
+static OSStatus
+decode_segment(Decode* job, AudioConverterRef conv, UInt8* scratch, Segment* seg) {
+    const AudioStreamBasicDescription* fmt = &job->cfg->output;
+    UInt64 start = seg->first > job->preroll ? seg->first - job->preroll : 0;
+    PacketFeed feed = { job->in, start, seg->end };
+
+    OSStatus rc = AudioConverterReset(conv);
+    UInt64 skip = (seg->first - start) * job->fpp;
+    UInt64 got = 0;
+    if (!rc && skip) rc = decode_frames(conv, &feed, fmt, scratch, skip, &got);
+    if (!rc && got != skip) rc = kAudioFormatUnsupportedDataFormatError;
+    if (rc) return rc;
+
+    UInt64 room = (seg->end - seg->first) * job->fpp;
+    rc = decode_frames(conv, &feed, fmt, job->pcm + seg->first * job->fpp * fmt->mBytesPerFrame, room, &got);
+    if (!rc && seg->end != job->in->packetCount && got != room) rc = kAudioFormatUnsupportedDataFormatError;
+    if (!rc) plat_counter_add(&job->decoded, (SInt64)got);
+    return rc;
+}
+
+static void
+decode_worker(void* param) {
+    Decode* job = param;
+    const Wat4ffParallelDecode* cfg = job->cfg;
+    AudioConverterRef conv;
+    OSStatus rc = parallel_new_converter(&cfg->input, &cfg->output, NULL, 0, &conv);
+    if (rc) {
+        plat_store32(&job->setup, rc);
+        return;
+    }
+    UInt8* scratch = NULL;
+    if (job->in->magicCookieSize) {
+        rc = AudioConverterSetProperty(conv, kAudioConverterDecompressionMagicCookie,
+                                       job->in->magicCookieSize, job->in->magicCookie);
+        if (rc) {
+            plat_store32(&job->setup, rc);
+            goto fin;
+        }
+    }
+    if (job->preroll) scratch = plat_alloc((size_t)job->preroll * job->fpp * cfg->output.mBytesPerFrame);
+    if (job->preroll && !scratch) {
+        plat_store32(&job->setup, kAudio_MemFullError);
+        goto fin;
+    }
+
+    for (;;) {
+        SInt32 i = plat_fetch_add32(&job->next, 1);
+        if (i >= (SInt32)job->segmentCount) break;
+        job->segments[i].status = decode_segment(job, conv, scratch, &job->segments[i]);
+        job->segments[i].done = true;
+    }
+
+fin:
+    plat_free(scratch);
+    AudioConverterDispose(conv);
+}
+
+// Decode ---
+
+
+// API +++
+
+void
+wat4ff_free_encoded(Wat4ffEncodedStream* stream) {
+    plat_free(stream->data);
+    plat_free(stream->packets);
+    plat_free(stream->magicCookie);
+    memset(stream, 0, sizeof(*stream));
+}
+
+OSStatus
+wat4ff_encode_parallel(const Wat4ffParallelEncode* cfg, const void* pcm, UInt64 frames, Wat4ffEncodedStream* out) {
+    memset(out, 0, sizeof(*out));
+    if (!cfg || (!pcm && frames) || cfg->input.mFormatID != kAudioFormatLinearPCM
+        || !cfg->input.mBytesPerFrame || (cfg->input.mFormatFlags & kAudioFormatFlagIsNonInterleaved)) {
+        return kAudio_ParamError;
+    }
+
+    Job job = { .cfg = cfg, .pcm = pcm, .frames = frames };
+    OSStatus rc = probe(&cfg->input, &cfg->output, cfg->properties, cfg->propertyCount,
+                        &job.fpp, &job.maxPacket, &job.leading, out);
+    if (rc) goto fin;
+
+    // Segments are whole packets of the serial encode, the last one takes
+    // whatever the encoder flushes.
+    UInt64 seconds = (UInt64)(cfg->input.mSampleRate * kDefaultSegmentSeconds);
+    UInt64 segFrames = cfg->segmentFrames ? cfg->segmentFrames : seconds;
+    UInt64 segPackets = (segFrames + job.fpp - 1) / job.fpp;
+    UInt64 totalPackets = (frames + job.leading + job.fpp - 1) / job.fpp;
+    UInt64 count = totalPackets ? (totalPackets + segPackets - 1) / segPackets : 1;
+    if (count > 0x7fffffff) {
+        rc = kAudio_ParamError;
+        goto fin;
+    }
+
+    UInt32 extra = cfg->overlapPackets ? cfg->overlapPackets : kDefaultOverlapPackets;
+    job.overlap = (job.leading + job.fpp - 1) / job.fpp + extra;
+    job.segmentCount = (UInt32)count;
+    job.segments = plat_calloc(sizeof(Segment) * job.segmentCount);
+    if (!job.segments) {
+        rc = kAudio_MemFullError;
+        goto fin;
+    }
+    for (UInt32 i = 0; i < job.segmentCount; ++i) {
+        job.segments[i].first = i * segPackets;
+        job.segments[i].end = i + 1 < job.segmentCount ? (i + 1) * segPackets : UINT64_MAX;
+    }
+
+    UInt32 threads = cfg->threads ? cfg->threads : plat_cpu_count();
+    if (threads > job.segmentCount) threads = job.segmentCount;
+    run_threads(worker, &job, 0, threads);
+
+    for (UInt32 i = 0; i < job.segmentCount && !rc; ++i) rc = job.segments[i].status;
+    if (!rc) rc = stitch(&job, out);
+
+fin:
+    if (job.segments) {
+        for (UInt32 i = 0; i < job.segmentCount; ++i) {
+            plat_free(job.segments[i].data);
+            plat_free(job.segments[i].packets);
+        }
+        plat_free(job.segments);
+    }
+    if (rc) wat4ff_free_encoded(out);
+    return rc;
+}
+
+OSStatus
+wat4ff_alac_encode(const Wat4ffAlacJob* cfg, const void* pcm, UInt64 frames, Wat4ffEncodedStream* out) {
+    if (out) memset(out, 0, sizeof(*out));
+    if (!cfg || (!pcm && frames) || (!out && !cfg->emit)
+        || cfg->input.mFormatID != kAudioFormatLinearPCM || !cfg->input.mBytesPerFrame
+        || (cfg->input.mFormatFlags & kAudioFormatFlagIsNonInterleaved)
+        || cfg->output.mFormatID != kAudioFormatAppleLossless) {
+        return kAudio_ParamError;
+    }
+
+    Lossless job = { .cfg = cfg, .pcm = pcm, .frames = frames, .out = out };
+    plat_mutex_init(&job.lock);
+    Wat4ffEncodedStream info = { 0 };
+    UInt32 leading = 0;
+    OSStatus rc = probe(&cfg->input, &cfg->output, cfg->properties, cfg->propertyCount,
+                        &job.fpp, &job.maxPacket, &leading, &info);
+    if (rc) goto fin;
+    if (leading) {
+        rc = kAudioFormatUnsupportedDataFormatError;
+        goto fin;
+    }
+
+    rc = run_lossless(&job, (frames + job.fpp - 1) / job.fpp);
+    if (!rc && out) {
+        out->framesPerPacket = job.fpp;
+        out->magicCookie = info.magicCookie;
+        out->magicCookieSize = info.magicCookieSize;
+        out->segments = job.batchCount;
+        info.magicCookie = NULL;
+    }
+
+fin:
+    free_lossless(&job);
+    plat_free(info.magicCookie);
+    if (rc && out) wat4ff_free_encoded(out);
+    return rc;
+}
+
+OSStatus
+wat4ff_alac_decode(const Wat4ffAlacJob* cfg, const Wat4ffEncodedStream* in, void* pcm, UInt64* frames) {
+    if (!cfg || !in || !frames || (!pcm && in->packetCount)
+        || cfg->input.mFormatID != kAudioFormatAppleLossless
+        || cfg->output.mFormatID != kAudioFormatLinearPCM || !cfg->output.mBytesPerFrame
+        || (cfg->output.mFormatFlags & kAudioFormatFlagIsNonInterleaved)) {
+        return kAudio_ParamError;
+    }
+    *frames = 0;
+
+    Lossless job = { .cfg = cfg, .pcm = pcm, .in = in };
+    plat_mutex_init(&job.lock);
+    job.fpp = in->framesPerPacket ? in->framesPerPacket : cfg->input.mFramesPerPacket;
+    OSStatus rc = job.fpp ? run_lossless(&job, in->packetCount) : kAudio_ParamError;
+    if (!rc) *frames = (UInt64)plat_counter_get(&job.decoded);
+    free_lossless(&job);
+    return rc;
+}
+
+OSStatus
+wat4ff_encode_fanout(const Wat4ffFanOut* cfg, Wat4ffEncodedStream* outs) {
+    if (!cfg) return kAudio_ParamError;
+    if (outs) memset(outs, 0, sizeof(*outs) * cfg->renditionCount);
+    if (!cfg->read || !cfg->renditionCount || !cfg->renditions
+        || cfg->input.mFormatID != kAudioFormatLinearPCM || !cfg->input.mBytesPerFrame
+        || (cfg->input.mFormatFlags & kAudioFormatFlagIsNonInterleaved)) {
+        return kAudio_ParamError;
+    }
+    for (UInt32 i = 0; i < cfg->renditionCount; ++i) {
+        if (!outs && !cfg->renditions[i].emit) return kAudio_ParamError;
+    }
+
+    Ring ring = { .cfg = cfg };
+    ring.frames = cfg->ringFrames ? cfg->ringFrames : (UInt64)(cfg->input.mSampleRate * kDefaultRingSeconds);
+    if (!ring.frames) return kAudio_ParamError;
+    plat_mutex_init(&ring.lock);
+    plat_cond_init(&ring.readable);
+    plat_cond_init(&ring.writable);
+
+    OSStatus rc = noErr;
+    ring.data = plat_alloc((size_t)(ring.frames * cfg->input.mBytesPerFrame));
+    ring.taps = plat_calloc(sizeof(Tap) * cfg->renditionCount);
+    PlatThread* threads = plat_alloc(sizeof(PlatThread) * cfg->renditionCount);
+    if (!ring.data || !ring.taps || !threads) {
+        rc = kAudio_MemFullError;
+        goto fin;
+    }
+
+    for (UInt32 i = 0; i < cfg->renditionCount; ++i) {
+        ring.taps[i].ring = &ring;
+        ring.taps[i].cfg = &cfg->renditions[i];
+        ring.taps[i].out = outs ? &outs[i] : NULL;
+    }
+    ring.live = cfg->renditionCount;
+    UInt32 started = 0;
+    for (; started < cfg->renditionCount; ++started) {
+        if (!plat_thread_start(&threads[started], tap_main, &ring.taps[started])) break;
+    }
+
+    // Nobody waits for renditions that got no thread.
+    plat_mutex_lock(&ring.lock);
+    for (UInt32 i = started; i < cfg->renditionCount; ++i) {
+        ring.taps[i].status = kAudio_MemFullError;
+        ring.taps[i].held = UINT64_MAX;
+        --ring.live;
+    }
+    plat_mutex_unlock(&ring.lock);
+
+    fill_ring(&ring);
+    for (UInt32 i = 0; i < started; ++i) plat_thread_join(threads[i]);
+
+    rc = ring.status;
+    for (UInt32 i = 0; i < cfg->renditionCount && !rc; ++i) rc = ring.taps[i].status;
+
+fin:
+    if (ring.taps) {
+        for (UInt32 i = 0; i < cfg->renditionCount; ++i) {
+            plat_free(ring.taps[i].seg.data);
+            plat_free(ring.taps[i].seg.packets);
+        }
+    }
+    if (rc && outs) {
+        for (UInt32 i = 0; i < cfg->renditionCount; ++i) wat4ff_free_encoded(&outs[i]);
+    }
+    plat_free(threads);
+    plat_free(ring.taps);
+    plat_free(ring.data);
+    plat_cond_destroy(&ring.writable);
+    plat_cond_destroy(&ring.readable);
+    plat_mutex_destroy(&ring.lock);
+    return rc;
+}
+
+OSStatus
+wat4ff_decode_parallel(const Wat4ffParallelDecode* cfg, const Wat4ffEncodedStream* in, void* pcm, UInt64* frames) {
+    if (!cfg || !in || !frames || (!pcm && in->packetCount)
+        || cfg->output.mFormatID != kAudioFormatLinearPCM || !cfg->output.mBytesPerFrame
+        || (cfg->output.mFormatFlags & kAudioFormatFlagIsNonInterleaved)
+        || cfg->output.mSampleRate != cfg->input.mSampleRate) {
+        return kAudio_ParamError;
+    }
+    *frames = 0;
+
+    Decode job = { .cfg = cfg, .in = in, .pcm = pcm };
+    job.fpp = in->framesPerPacket ? in->framesPerPacket : cfg->input.mFramesPerPacket;
+    job.preroll = cfg->prerollPackets ? cfg->prerollPackets : kDefaultOverlapPackets;
+    if (!job.fpp) return kAudio_ParamError;
+    if (!in->packetCount) return noErr;
+
+    UInt64 seconds = (UInt64)(cfg->input.mSampleRate * kDefaultSegmentSeconds) / job.fpp;
+    UInt64 segPackets = cfg->segmentPackets ? cfg->segmentPackets : seconds;
+    if (!segPackets) segPackets = 1;
+    UInt64 count = (in->packetCount + segPackets - 1) / segPackets;
+    if (count > 0x7fffffff) return kAudio_ParamError;
+    job.segmentCount = (UInt32)count;
+    job.segments = plat_calloc(sizeof(Segment) * job.segmentCount);
+    if (!job.segments) return kAudio_MemFullError;
+    for (UInt32 i = 0; i < job.segmentCount; ++i) {
+        job.segments[i].first = i * segPackets;
+        job.segments[i].end = i + 1 < job.segmentCount ? (i + 1) * segPackets : in->packetCount;
+    }
+
+    UInt32 threads = cfg->threads ? cfg->threads : plat_cpu_count();
+    if (threads > job.segmentCount) threads = job.segmentCount;
+    run_threads(decode_worker, &job, 0, threads);
+
+    // Segments left over had no thread that could start.
+    OSStatus rc = noErr;
+    for (UInt32 i = 0; i < job.segmentCount && !rc; ++i) {
+        rc = job.segments[i].done ? job.segments[i].status : plat_load32(&job.setup);
+    }
+    if (!rc) *frames = (UInt64)plat_counter_get(&job.decoded);
+    plat_free(job.segments);
+    return rc;
+}
+
+// API ---
@@ -0,0 +1,26 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Converter setup parallel.c shares with the other encoders.
+*/
+
+#ifndef WAT4FF_PARALLEL_H
+#define WAT4FF_PARALLEL_H
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+
+// Creates a converter and sets props on it in order.
+OSStatus
+parallel_new_converter(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out,
+                       const Wat4ffConverterProperty* props, UInt32 count, AudioConverterRef* conv);
+
+// Copies the compression cookie into a new buffer, leaves *cookie alone if
+// the codec has none.
+OSStatus
+parallel_copy_cookie(AudioConverterRef conv, UInt8** cookie, UInt32* cookieSize);
+
+#endif
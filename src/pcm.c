@@ -0,0 +1,913 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Sample format conversion and (de)interleaving, see wat4ff_pcm_convert().
+ *
+ * Every kernel exists in plain C and, where the CPU has them, SSE2, AVX2 or
+ * NEON. The plain C ones define the results: floats are clamped with
+ * v < hi ? v : hi then v > lo ? v : lo, which is what minps and maxps do, so
+ * NaN ends up high, and rounded to nearest even, which is what cvtps2dq and
+ * fcvtns do. The vector ones must match them bit for bit.
+ * Only stereo has (de)interleave shuffles of its own. Other channel counts
+ * convert a block at a time and spread it with a plain strided loop.
+*/
+
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "plat.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PCM_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PCM_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and clang only emit instructions a function is marked for, MSVC emits
+// whatever intrinsics ask for.
+#if defined(PCM_X86) && defined(__GNUC__)
+#define PCM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PCM_TARGET(isa)
+#endif
+
+
+enum {
+    kBlockFrames = 256,
+};
+
+// Scales and limits of floats going to integers. 2147483520 is the largest
+// float below 2^31.
+#define kS16Scale   32768.0f
+#define kS16High    32767.0f
+#define kS16Low     -32768.0f
+#define kS32Scale   2147483648.0f
+#define kS32High    2147483520.0f
+#define kS32Low     -2147483648.0f
+#define kS16Inverse (1.0f / 32768.0f)
+#define kS32Inverse (1.0f / 2147483648.0f)
+
+typedef void (* ConvertProc)(void* dst, const void* src, size_t n);
+typedef void (* InterleaveProc)(void* dst, const void* left, const void* right, size_t n);
+typedef void (* DeinterleaveProc)(void* left, void* right, const void* src, size_t n);
+
+typedef struct Kernels {
+    UInt32 simd;
+    ConvertProc convert[kWat4ffSampleCount][kWat4ffSampleCount];   // [src][dst]
+    InterleaveProc interleave16;
+    InterleaveProc interleave32;
+    DeinterleaveProc deinterleave16;
+    DeinterleaveProc deinterleave32;
+}Kernels;
+
+static UInt32
+sample_size(UInt32 format) {
+    return format == kWat4ffSampleS16 ? 2 : 4;
+}
+
+
+// Scalar +++
+
+// Rounds to nearest even without libm, v must fit an SInt32. Truncating
+// and taking the fraction are both exact, so unlike adding 2^23 this holds
+// with x87 excess precision too.
+static inline SInt32
+round_even(float v) {
+    SInt32 i = (SInt32)v;
+    float f = v - (float)i;
+    if (f > 0.5f || (f == 0.5f && (i & 1))) return i + 1;
+    if (f < -0.5f || (f == -0.5f && (i & 1))) return i - 1;
+    return i;
+}
+
+static inline float
+clamp(float v, float lo, float hi) {
+    v = v < hi ? v : hi;
+    return v > lo ? v : lo;
+}
+
+static void
+s16_to_s32_c(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt32* d = dst;
+    for (size_t i = 0; i < n; ++i) d[i] = (SInt32)s[i] * 65536;
+}
+
+static void
+s32_to_s16_c(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    SInt16* d = dst;
+    for (size_t i = 0; i < n; ++i) d[i] = (SInt16)(s[i] >> 16);
+}
+
+static void
+s16_to_f32_c(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    float* d = dst;
+    for (size_t i = 0; i < n; ++i) d[i] = (float)s[i] * kS16Inverse;
+}
+
+static void
+s32_to_f32_c(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    float* d = dst;
+    for (size_t i = 0; i < n; ++i) d[i] = (float)s[i] * kS32Inverse;
+}
+
+static void
+f32_to_s16_c(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt16* d = dst;
+    for (size_t i = 0; i < n; ++i) d[i] = (SInt16)round_even(clamp(s[i] * kS16Scale, kS16Low, kS16High));
+}
+
+static void
+f32_to_s32_c(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt32* d = dst;
+    for (size_t i = 0; i < n; ++i) d[i] = round_even(clamp(s[i] * kS32Scale, kS32Low, kS32High));
+}
+
+static void
+interleave16_c(void* dst, const void* left, const void* right, size_t n) {
+    const SInt16* l = left;
+    const SInt16* r = right;
+    SInt16* d = dst;
+    for (size_t i = 0; i < n; ++i) {
+        d[2 * i] = l[i];
+        d[2 * i + 1] = r[i];
+    }
+}
+
+static void
+interleave32_c(void* dst, const void* left, const void* right, size_t n) {
+    const UInt32* l = left;
+    const UInt32* r = right;
+    UInt32* d = dst;
+    for (size_t i = 0; i < n; ++i) {
+        d[2 * i] = l[i];
+        d[2 * i + 1] = r[i];
+    }
+}
+
+static void
+deinterleave16_c(void* left, void* right, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt16* l = left;
+    SInt16* r = right;
+    for (size_t i = 0; i < n; ++i) {
+        l[i] = s[2 * i];
+        r[i] = s[2 * i + 1];
+    }
+}
+
+static void
+deinterleave32_c(void* left, void* right, const void* src, size_t n) {
+    const UInt32* s = src;
+    UInt32* l = left;
+    UInt32* r = right;
+    for (size_t i = 0; i < n; ++i) {
+        l[i] = s[2 * i];
+        r[i] = s[2 * i + 1];
+    }
+}
+
+static const Kernels kScalar = {
+    kWat4ffSimdNone,
+    {
+        [kWat4ffSampleS16] = { [kWat4ffSampleS32] = s16_to_s32_c, [kWat4ffSampleF32] = s16_to_f32_c },
+        [kWat4ffSampleS32] = { [kWat4ffSampleS16] = s32_to_s16_c, [kWat4ffSampleF32] = s32_to_f32_c },
+        [kWat4ffSampleF32] = { [kWat4ffSampleS16] = f32_to_s16_c, [kWat4ffSampleS32] = f32_to_s32_c },
+    },
+    interleave16_c, interleave32_c, deinterleave16_c, deinterleave32_c,
+};
+
+// Scalar ---
+
+
+#ifdef PCM_X86
+
+// SSE2 +++
+
+PCM_TARGET("sse2") static void
+s16_to_s32_sse2(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt32* d = dst;
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        _mm_storeu_si128((__m128i*)(d + i), _mm_unpacklo_epi16(zero, v));
+        _mm_storeu_si128((__m128i*)(d + i + 4), _mm_unpackhi_epi16(zero, v));
+    }
+    s16_to_s32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("sse2") static void
+s32_to_s16_sse2(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    SInt16* d = dst;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(s + i)), 16);
+        __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(s + i + 4)), 16);
+        _mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a, b));
+    }
+    s32_to_s16_c(d + i, s + i, n - i);
+}
+
+// x << 16 converts exactly, so scaling it by 2^-31 gives x / 32768.
+PCM_TARGET("sse2") static void
+s16_to_f32_sse2(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    float* d = dst;
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(kS32Inverse);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(zero, v)), scale));
+        _mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(zero, v)), scale));
+    }
+    s16_to_f32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("sse2") static void
+s32_to_f32_sse2(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    float* d = dst;
+    size_t i = 0;
+    const __m128 scale = _mm_set1_ps(kS32Inverse);
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(s + i)));
+        _mm_storeu_ps(d + i, _mm_mul_ps(v, scale));
+    }
+    s32_to_f32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("sse2") static inline __m128i
+f32_to_int_sse2(const float* s, __m128 scale, __m128 lo, __m128 hi) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(s), scale);
+    return _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(v, hi), lo));
+}
+
+PCM_TARGET("sse2") static void
+f32_to_s16_sse2(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt16* d = dst;
+    size_t i = 0;
+    const __m128 scale = _mm_set1_ps(kS16Scale);
+    const __m128 lo = _mm_set1_ps(kS16Low);
+    const __m128 hi = _mm_set1_ps(kS16High);
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = f32_to_int_sse2(s + i, scale, lo, hi);
+        __m128i b = f32_to_int_sse2(s + i + 4, scale, lo, hi);
+        _mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a, b));
+    }
+    f32_to_s16_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("sse2") static void
+f32_to_s32_sse2(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt32* d = dst;
+    size_t i = 0;
+    const __m128 scale = _mm_set1_ps(kS32Scale);
+    const __m128 lo = _mm_set1_ps(kS32Low);
+    const __m128 hi = _mm_set1_ps(kS32High);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128((__m128i*)(d + i), f32_to_int_sse2(s + i, scale, lo, hi));
+    }
+    f32_to_s32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("sse2") static void
+interleave16_sse2(void* dst, const void* left, const void* right, size_t n) {
+    const SInt16* l = left;
+    const SInt16* r = right;
+    SInt16* d = dst;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(l + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(r + i));
+        _mm_storeu_si128((__m128i*)(d + 2 * i), _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128((__m128i*)(d + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+    }
+    interleave16_c(d + 2 * i, l + i, r + i, n - i);
+}
+
+PCM_TARGET("sse2") static void
+interleave32_sse2(void* dst, const void* left, const void* right, size_t n) {
+    const UInt32* l = left;
+    const UInt32* r = right;
+    UInt32* d = dst;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(l + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(r + i));
+        _mm_storeu_si128((__m128i*)(d + 2 * i), _mm_unpacklo_epi32(a, b));
+        _mm_storeu_si128((__m128i*)(d + 2 * i + 4), _mm_unpackhi_epi32(a, b));
+    }
+    interleave32_c(d + 2 * i, l + i, r + i, n - i);
+}
+
+// Each 32-bit pair is one frame. Shifting it both ways sign extends either
+// half, and packs puts eight of them back together without saturating.
+PCM_TARGET("sse2") static void
+deinterleave16_sse2(void* left, void* right, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt16* l = left;
+    SInt16* r = right;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 2 * i + 8));
+        __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        _mm_storeu_si128((__m128i*)(l + i), _mm_packs_epi32(la, lb));
+        _mm_storeu_si128((__m128i*)(r + i), _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+    }
+    deinterleave16_c(l + i, r + i, s + 2 * i, n - i);
+}
+
+PCM_TARGET("sse2") static void
+deinterleave32_sse2(void* left, void* right, const void* src, size_t n) {
+    const float* s = src;
+    float* l = left;
+    float* r = right;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(s + 2 * i);
+        __m128 b = _mm_loadu_ps(s + 2 * i + 4);
+        _mm_storeu_ps(l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    deinterleave32_c(l + i, r + i, s + 2 * i, n - i);
+}
+
+static const Kernels kSse2 = {
+    kWat4ffSimdSSE2,
+    {
+        [kWat4ffSampleS16] = { [kWat4ffSampleS32] = s16_to_s32_sse2, [kWat4ffSampleF32] = s16_to_f32_sse2 },
+        [kWat4ffSampleS32] = { [kWat4ffSampleS16] = s32_to_s16_sse2, [kWat4ffSampleF32] = s32_to_f32_sse2 },
+        [kWat4ffSampleF32] = { [kWat4ffSampleS16] = f32_to_s16_sse2, [kWat4ffSampleS32] = f32_to_s32_sse2 },
+    },
+    interleave16_sse2, interleave32_sse2, deinterleave16_sse2, deinterleave32_sse2,
+};
+
+// SSE2 ---
+
+
+// AVX2 +++
+
+// The 256-bit packs and unpacks work within 128-bit lanes, permute4x64
+// with 0xD8 and permute2x128 put the lanes back in order.
+
+PCM_TARGET("avx2") static void
+s16_to_s32_avx2(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt32* d = dst;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(s + i)));
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_slli_epi32(v, 16));
+    }
+    s16_to_s32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+s32_to_s16_avx2(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    SInt16* d = dst;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(s + i)), 16);
+        __m256i b = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(s + i + 8)), 16);
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i*)(d + i), v);
+    }
+    s32_to_s16_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+s16_to_f32_avx2(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    float* d = dst;
+    size_t i = 0;
+    const __m256 scale = _mm256_set1_ps(kS16Inverse);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(s + i)));
+        _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    s16_to_f32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+s32_to_f32_avx2(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    float* d = dst;
+    size_t i = 0;
+    const __m256 scale = _mm256_set1_ps(kS32Inverse);
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(s + i)));
+        _mm256_storeu_ps(d + i, _mm256_mul_ps(v, scale));
+    }
+    s32_to_f32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("avx2") static inline __m256i
+f32_to_int_avx2(const float* s, __m256 scale, __m256 lo, __m256 hi) {
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(s), scale);
+    return _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(v, hi), lo));
+}
+
+PCM_TARGET("avx2") static void
+f32_to_s16_avx2(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt16* d = dst;
+    size_t i = 0;
+    const __m256 scale = _mm256_set1_ps(kS16Scale);
+    const __m256 lo = _mm256_set1_ps(kS16Low);
+    const __m256 hi = _mm256_set1_ps(kS16High);
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = f32_to_int_avx2(s + i, scale, lo, hi);
+        __m256i b = f32_to_int_avx2(s + i + 8, scale, lo, hi);
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i*)(d + i), v);
+    }
+    f32_to_s16_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+f32_to_s32_avx2(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt32* d = dst;
+    size_t i = 0;
+    const __m256 scale = _mm256_set1_ps(kS32Scale);
+    const __m256 lo = _mm256_set1_ps(kS32Low);
+    const __m256 hi = _mm256_set1_ps(kS32High);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256((__m256i*)(d + i), f32_to_int_avx2(s + i, scale, lo, hi));
+    }
+    f32_to_s32_c(d + i, s + i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+interleave16_avx2(void* dst, const void* left, const void* right, size_t n) {
+    const SInt16* l = left;
+    const SInt16* r = right;
+    SInt16* d = dst;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(l + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(r + i));
+        __m256i lo = _mm256_unpacklo_epi16(a, b);
+        __m256i hi = _mm256_unpackhi_epi16(a, b);
+        _mm256_storeu_si256((__m256i*)(d + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(d + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    interleave16_c(d + 2 * i, l + i, r + i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+interleave32_avx2(void* dst, const void* left, const void* right, size_t n) {
+    const UInt32* l = left;
+    const UInt32* r = right;
+    UInt32* d = dst;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(l + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(r + i));
+        __m256i lo = _mm256_unpacklo_epi32(a, b);
+        __m256i hi = _mm256_unpackhi_epi32(a, b);
+        _mm256_storeu_si256((__m256i*)(d + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(d + 2 * i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    interleave32_c(d + 2 * i, l + i, r + i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+deinterleave16_avx2(void* left, void* right, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt16* l = left;
+    SInt16* r = right;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + 2 * i + 16));
+        __m256i la = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+        __m256i lb = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+        __m256i ra = _mm256_srai_epi32(a, 16);
+        __m256i rb = _mm256_srai_epi32(b, 16);
+        _mm256_storeu_si256((__m256i*)(l + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(la, lb), 0xD8));
+        _mm256_storeu_si256((__m256i*)(r + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(ra, rb), 0xD8));
+    }
+    deinterleave16_c(l + i, r + i, s + 2 * i, n - i);
+}
+
+PCM_TARGET("avx2") static void
+deinterleave32_avx2(void* left, void* right, const void* src, size_t n) {
+    const float* s = src;
+    float* l = left;
+    float* r = right;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(s + 2 * i);
+        __m256 b = _mm256_loadu_ps(s + 2 * i + 8);
+        __m256d lv = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256d rv = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm256_storeu_ps(l + i, _mm256_castpd_ps(_mm256_permute4x64_pd(lv, 0xD8)));
+        _mm256_storeu_ps(r + i, _mm256_castpd_ps(_mm256_permute4x64_pd(rv, 0xD8)));
+    }
+    deinterleave32_c(l + i, r + i, s + 2 * i, n - i);
+}
+
+static const Kernels kAvx2 = {
+    kWat4ffSimdAVX2,
+    {
+        [kWat4ffSampleS16] = { [kWat4ffSampleS32] = s16_to_s32_avx2, [kWat4ffSampleF32] = s16_to_f32_avx2 },
+        [kWat4ffSampleS32] = { [kWat4ffSampleS16] = s32_to_s16_avx2, [kWat4ffSampleF32] = s32_to_f32_avx2 },
+        [kWat4ffSampleF32] = { [kWat4ffSampleS16] = f32_to_s16_avx2, [kWat4ffSampleS32] = f32_to_s32_avx2 },
+    },
+    interleave16_avx2, interleave32_avx2, deinterleave16_avx2, deinterleave32_avx2,
+};
+
+// AVX2 ---
+
+#endif // PCM_X86
+
+
+#ifdef PCM_NEON
+
+// NEON +++
+
+// vminq and vmaxq let NaN through, the selects below do as minps does.
+
+static void
+s16_to_s32_neon(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt32* d = dst;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(s + i);
+        vst1q_s32(d + i, vshll_n_s16(vget_low_s16(v), 16));
+        vst1q_s32(d + i + 4, vshll_n_s16(vget_high_s16(v), 16));
+    }
+    s16_to_s32_c(d + i, s + i, n - i);
+}
+
+static void
+s32_to_s16_neon(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    SInt16* d = dst;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x4_t a = vshrn_n_s32(vld1q_s32(s + i), 16);
+        int16x4_t b = vshrn_n_s32(vld1q_s32(s + i + 4), 16);
+        vst1q_s16(d + i, vcombine_s16(a, b));
+    }
+    s32_to_s16_c(d + i, s + i, n - i);
+}
+
+static void
+s16_to_f32_neon(void* dst, const void* src, size_t n) {
+    const SInt16* s = src;
+    float* d = dst;
+    size_t i = 0;
+    const float32x4_t scale = vdupq_n_f32(kS16Inverse);
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(s + i);
+        vst1q_f32(d + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+        vst1q_f32(d + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+    }
+    s16_to_f32_c(d + i, s + i, n - i);
+}
+
+static void
+s32_to_f32_neon(void* dst, const void* src, size_t n) {
+    const SInt32* s = src;
+    float* d = dst;
+    size_t i = 0;
+    const float32x4_t scale = vdupq_n_f32(kS32Inverse);
+    for (; i + 4 <= n; i += 4) vst1q_f32(d + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(s + i)), scale));
+    s32_to_f32_c(d + i, s + i, n - i);
+}
+
+static inline int32x4_t
+f32_to_int_neon(const float* s, float32x4_t scale, float32x4_t lo, float32x4_t hi) {
+    float32x4_t v = vmulq_f32(vld1q_f32(s), scale);
+    v = vbslq_f32(vcltq_f32(v, hi), v, hi);
+    v = vbslq_f32(vcgtq_f32(v, lo), v, lo);
+    return vcvtnq_s32_f32(v);
+}
+
+static void
+f32_to_s16_neon(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt16* d = dst;
+    size_t i = 0;
+    const float32x4_t scale = vdupq_n_f32(kS16Scale);
+    const float32x4_t lo = vdupq_n_f32(kS16Low);
+    const float32x4_t hi = vdupq_n_f32(kS16High);
+    for (; i + 8 <= n; i += 8) {
+        int16x4_t a = vmovn_s32(f32_to_int_neon(s + i, scale, lo, hi));
+        int16x4_t b = vmovn_s32(f32_to_int_neon(s + i + 4, scale, lo, hi));
+        vst1q_s16(d + i, vcombine_s16(a, b));
+    }
+    f32_to_s16_c(d + i, s + i, n - i);
+}
+
+static void
+f32_to_s32_neon(void* dst, const void* src, size_t n) {
+    const float* s = src;
+    SInt32* d = dst;
+    size_t i = 0;
+    const float32x4_t scale = vdupq_n_f32(kS32Scale);
+    const float32x4_t lo = vdupq_n_f32(kS32Low);
+    const float32x4_t hi = vdupq_n_f32(kS32High);
+    for (; i + 4 <= n; i += 4) vst1q_s32(d + i, f32_to_int_neon(s + i, scale, lo, hi));
+    f32_to_s32_c(d + i, s + i, n - i);
+}
+
+static void
+interleave16_neon(void* dst, const void* left, const void* right, size_t n) {
+    const SInt16* l = left;
+    const SInt16* r = right;
+    SInt16* d = dst;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8x2_t v = { { vld1q_s16(l + i), vld1q_s16(r + i) } };
+        vst2q_s16(d + 2 * i, v);
+    }
+    interleave16_c(d + 2 * i, l + i, r + i, n - i);
+}
+
+static void
+interleave32_neon(void* dst, const void* left, const void* right, size_t n) {
+    const UInt32* l = left;
+    const UInt32* r = right;
+    UInt32* d = dst;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4x2_t v = { { vld1q_u32(l + i), vld1q_u32(r + i) } };
+        vst2q_u32(d + 2 * i, v);
+    }
+    interleave32_c(d + 2 * i, l + i, r + i, n - i);
+}
+
+static void
+deinterleave16_neon(void* left, void* right, const void* src, size_t n) {
+    const SInt16* s = src;
+    SInt16* l = left;
+    SInt16* r = right;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8x2_t v = vld2q_s16(s + 2 * i);
+        vst1q_s16(l + i, v.val[0]);
+        vst1q_s16(r + i, v.val[1]);
+    }
+    deinterleave16_c(l + i, r + i, s + 2 * i, n - i);
+}
+
+static void
+deinterleave32_neon(void* left, void* right, const void* src, size_t n) {
+    const UInt32* s = src;
+    UInt32* l = left;
+    UInt32* r = right;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4x2_t v = vld2q_u32(s + 2 * i);
+        vst1q_u32(l + i, v.val[0]);
+        vst1q_u32(r + i, v.val[1]);
+    }
+    deinterleave32_c(l + i, r + i, s + 2 * i, n - i);
+}
+
+static const Kernels kNeon = {
+    kWat4ffSimdNEON,
+    {
+        [kWat4ffSampleS16] = { [kWat4ffSampleS32] = s16_to_s32_neon, [kWat4ffSampleF32] = s16_to_f32_neon },
+        [kWat4ffSampleS32] = { [kWat4ffSampleS16] = s32_to_s16_neon, [kWat4ffSampleF32] = s32_to_f32_neon },
+        [kWat4ffSampleF32] = { [kWat4ffSampleS16] = f32_to_s16_neon, [kWat4ffSampleS32] = f32_to_s32_neon },
+    },
+    interleave16_neon, interleave32_neon, deinterleave16_neon, deinterleave32_neon,
+};
+
+// NEON ---
+
+#endif // PCM_NEON
+
+
+// Dispatch +++
+
+static PlatOnce once_ = PLAT_ONCE_INIT;
+static const Kernels* best_ = &kScalar;
+static const Kernels* volatile active_ = &kScalar;
+
+#ifdef PCM_X86
+// AVX2 also needs the OS to save the upper halves of the registers.
+static bool
+cpu_has(UInt32 simd) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0);
+    int top = r[0];
+    __cpuid(r, 1);
+    if (simd == kWat4ffSimdSSE2) return (r[3] >> 26) & 1;
+    if (top < 7 || !((r[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(r, 7, 0);
+    return (r[1] >> 5) & 1;
+#else
+    __builtin_cpu_init();
+    if (simd == kWat4ffSimdSSE2) return __builtin_cpu_supports("sse2");
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static const Kernels*
+kernels_of(UInt32 simd) {
+#ifdef PCM_X86
+    if (simd == kWat4ffSimdSSE2 && cpu_has(simd)) return &kSse2;
+    if (simd == kWat4ffSimdAVX2 && cpu_has(simd)) return &kAvx2;
+#endif
+#ifdef PCM_NEON
+    if (simd == kWat4ffSimdNEON) return &kNeon;
+#endif
+    return &kScalar;
+}
+
+static void
+pick_best(void) {
+    static const UInt32 order[] = { kWat4ffSimdAVX2, kWat4ffSimdSSE2, kWat4ffSimdNEON };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); ++i) {
+        const Kernels* k = kernels_of(order[i]);
+        if (k->simd != kWat4ffSimdNone) {
+            best_ = k;
+            break;
+        }
+    }
+    active_ = best_;
+}
+
+static inline const Kernels*
+kernels(void) {
+    plat_once(&once_, pick_best);
+    return active_;
+}
+
+// Dispatch ---
+
+
+// API +++
+
+bool
+wat4ff_pcm_sample_format(const AudioStreamBasicDescription* fmt, UInt32* format) {
+    if (!fmt || !format || fmt->mFormatID != kAudioFormatLinearPCM || !fmt->mChannelsPerFrame) return false;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if (!(fmt->mFormatFlags & kAudioFormatFlagIsBigEndian)) return false;
+#else
+    if (fmt->mFormatFlags & kAudioFormatFlagIsBigEndian) return false;
+#endif
+    UInt32 f;
+    if (fmt->mFormatFlags & kAudioFormatFlagIsFloat) {
+        if (fmt->mBitsPerChannel != 32) return false;
+        f = kWat4ffSampleF32;
+    }
+    else if (fmt->mFormatFlags & kAudioFormatFlagIsSignedInteger) {
+        if (fmt->mBitsPerChannel == 16) f = kWat4ffSampleS16;
+        else if (fmt->mBitsPerChannel == 32) f = kWat4ffSampleS32;
+        else return false;
+    }
+    else {
+        return false;
+    }
+    UInt32 channels = (fmt->mFormatFlags & kAudioFormatFlagIsNonInterleaved) ? 1 : fmt->mChannelsPerFrame;
+    if (fmt->mBytesPerFrame != channels * sample_size(f)) return false;
+    *format = f;
+    return true;
+}
+
+void
+wat4ff_pcm_convert(void* dst, UInt32 dstFormat, const void* src, UInt32 srcFormat, UInt64 samples) {
+    if (srcFormat >= kWat4ffSampleCount || dstFormat >= kWat4ffSampleCount) return;
+    if (srcFormat == dstFormat) {
+        if (dst != src) memmove(dst, src, (size_t)(samples * sample_size(srcFormat)));
+        return;
+    }
+    kernels()->convert[srcFormat][dstFormat](dst, src, (size_t)samples);
+}
+
+void
+wat4ff_pcm_interleave(void* dst, UInt32 dstFormat, const void* const* planes, UInt32 srcFormat,
+                      UInt32 channels, UInt32 frames) {
+    if (srcFormat >= kWat4ffSampleCount || dstFormat >= kWat4ffSampleCount || !channels) return;
+    if (channels == 1) {
+        wat4ff_pcm_convert(dst, dstFormat, planes[0], srcFormat, frames);
+        return;
+    }
+    const Kernels* k = kernels();
+    UInt32 srcSize = sample_size(srcFormat);
+    UInt32 dstSize = sample_size(dstFormat);
+    if (channels == 2 && srcFormat == dstFormat) {
+        (dstSize == 2 ? k->interleave16 : k->interleave32)(dst, planes[0], planes[1], frames);
+        return;
+    }
+
+    UInt32 tmp[2][kBlockFrames];
+    for (UInt32 at = 0; at < frames; at += kBlockFrames) {
+        UInt32 n = frames - at < kBlockFrames ? frames - at : kBlockFrames;
+        UInt8* d = (UInt8*)dst + (size_t)at * channels * dstSize;
+        if (channels == 2) {
+            k->convert[srcFormat][dstFormat](tmp[0], (const UInt8*)planes[0] + (size_t)at * srcSize, n);
+            k->convert[srcFormat][dstFormat](tmp[1], (const UInt8*)planes[1] + (size_t)at * srcSize, n);
+            (dstSize == 2 ? k->interleave16 : k->interleave32)(d, tmp[0], tmp[1], n);
+            continue;
+        }
+        for (UInt32 c = 0; c < channels; ++c) {
+            const void* p = (const UInt8*)planes[c] + (size_t)at * srcSize;
+            if (srcFormat != dstFormat) {
+                k->convert[srcFormat][dstFormat](tmp[0], p, n);
+                p = tmp[0];
+            }
+            if (dstSize == 2) {
+                const SInt16* s = p;
+                SInt16* o = (SInt16*)d + c;
+                for (UInt32 i = 0; i < n; ++i) o[(size_t)i * channels] = s[i];
+            }
+            else {
+                const UInt32* s = p;
+                UInt32* o = (UInt32*)d + c;
+                for (UInt32 i = 0; i < n; ++i) o[(size_t)i * channels] = s[i];
+            }
+        }
+    }
+}
+
+void
+wat4ff_pcm_deinterleave(void* const* planes, UInt32 dstFormat, const void* src, UInt32 srcFormat,
+                        UInt32 channels, UInt32 frames) {
+    if (srcFormat >= kWat4ffSampleCount || dstFormat >= kWat4ffSampleCount || !channels) return;
+    if (channels == 1) {
+        wat4ff_pcm_convert(planes[0], dstFormat, src, srcFormat, frames);
+        return;
+    }
+    const Kernels* k = kernels();
+    UInt32 srcSize = sample_size(srcFormat);
+    UInt32 dstSize = sample_size(dstFormat);
+    if (channels == 2 && srcFormat == dstFormat) {
+        (srcSize == 2 ? k->deinterleave16 : k->deinterleave32)(planes[0], planes[1], src, frames);
+        return;
+    }
+
+    UInt32 tmp[2][kBlockFrames];
+    for (UInt32 at = 0; at < frames; at += kBlockFrames) {
+        UInt32 n = frames - at < kBlockFrames ? frames - at : kBlockFrames;
+        const UInt8* s = (const UInt8*)src + (size_t)at * channels * srcSize;
+        if (channels == 2) {
+            (srcSize == 2 ? k->deinterleave16 : k->deinterleave32)(tmp[0], tmp[1], s, n);
+            k->convert[srcFormat][dstFormat]((UInt8*)planes[0] + (size_t)at * dstSize, tmp[0], n);
+            k->convert[srcFormat][dstFormat]((UInt8*)planes[1] + (size_t)at * dstSize, tmp[1], n);
+            continue;
+        }
+        for (UInt32 c = 0; c < channels; ++c) {
+            void* p = (UInt8*)planes[c] + (size_t)at * dstSize;
+            void* gathered = srcFormat == dstFormat ? p : tmp[0];
+            if (srcSize == 2) {
+                const SInt16* in = (const SInt16*)s + c;
+                SInt16* o = gathered;
+                for (UInt32 i = 0; i < n; ++i) o[i] = in[(size_t)i * channels];
+            }
+            else {
+                const UInt32* in = (const UInt32*)s + c;
+                UInt32* o = gathered;
+                for (UInt32 i = 0; i < n; ++i) o[i] = in[(size_t)i * channels];
+            }
+            if (srcFormat != dstFormat) k->convert[srcFormat][dstFormat](p, tmp[0], n);
+        }
+    }
+}
+
+UInt32
+wat4ff_pcm_simd(void) {
+    return kernels()->simd;
+}
+
+UInt32
+wat4ff_pcm_use_simd(UInt32 simd) {
+    plat_once(&once_, pick_best);
+    const Kernels* k = kernels_of(simd);
+    active_ = k;
+    return k->simd;
+}
+
+// API ---
@@ -0,0 +1,627 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The little wat4ff needs from the OS. Win32 on Windows, POSIX elsewhere.
+*/
+
+#ifndef WAT4FF_PLAT_H
+#define WAT4FF_PLAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+
+// Library +++
+
+typedef void* PlatLib;
+
+// Finds and loads CoreAudioToolbox, filling in timing as it goes.
+// Implemented by load_win.c or load_posix.c.
+PlatLib
+plat_lib_open(Wat4ffLoadTiming* timing);
+
+void*
+plat_lib_sym(PlatLib lib, const char* name);
+
+void
+plat_lib_close(PlatLib lib);
+
+// Library ---
+
+
+// Time +++
+
+static inline SInt64
+plat_now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (SInt64)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (SInt64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Time ---
+
+
+// Memory +++
+
+static inline void*
+plat_alloc(size_t size) {
+#ifdef _WIN32
+    return HeapAlloc(GetProcessHeap(), 0, size);
+#else
+    return malloc(size);
+#endif
+}
+
+static inline void*
+plat_calloc(size_t size) {
+#ifdef _WIN32
+    return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size);
+#else
+    return calloc(1, size);
+#endif
+}
+
+static inline void*
+plat_realloc(void* p, size_t size) {
+#ifdef _WIN32
+    return p ? HeapReAlloc(GetProcessHeap(), 0, p, size) : HeapAlloc(GetProcessHeap(), 0, size);
+#else
+    return realloc(p, size);
+#endif
+}
+
+static inline void
+plat_free(void* p) {
+#ifdef _WIN32
+    if (p) HeapFree(GetProcessHeap(), 0, p);
+#else
+    free(p);
+#endif
+}
+
+// Memory ---
+
+
+// Atomics +++
+
+// A 0/1 flag with acquire/release ordering.
+#ifdef _WIN32
+typedef volatile LONG PlatFlag;
+#else
+typedef volatile int PlatFlag;
+#endif
+
+static inline bool
+plat_flag_get(PlatFlag* flag) {
+#ifdef _WIN32
+    return InterlockedCompareExchange(flag, 0, 0) != 0;
+#else
+    return __atomic_load_n(flag, __ATOMIC_ACQUIRE) != 0;
+#endif
+}
+
+static inline void
+plat_flag_set(PlatFlag* flag) {
+#ifdef _WIN32
+    InterlockedExchange(flag, 1);
+#else
+    __atomic_store_n(flag, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+// Returns true if this call is the one that changed flag from 0 to 1.
+static inline bool
+plat_flag_test_and_set(PlatFlag* flag) {
+#ifdef _WIN32
+    return InterlockedCompareExchange(flag, 1, 0) == 0;
+#else
+    int expected = 0;
+    return __atomic_compare_exchange_n(flag, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void
+plat_publish_ptr(void* volatile* slot, void* p) {
+#ifdef _WIN32
+    InterlockedExchangePointer(slot, p);
+#else
+    __atomic_store_n(slot, p, __ATOMIC_RELEASE);
+#endif
+}
+
+// Counters, relaxed, only the final value matters. Add returns the sum.
+static inline SInt64
+plat_counter_add(volatile SInt64* p, SInt64 v) {
+#ifdef _WIN32
+    return InterlockedExchangeAdd64((LONGLONG volatile*)p, v) + v;
+#else
+    return __atomic_add_fetch(p, v, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline SInt64
+plat_counter_get(volatile SInt64* p) {
+#ifdef _WIN32
+    return InterlockedCompareExchange64((LONGLONG volatile*)p, 0, 0);
+#else
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void
+plat_counter_set(volatile SInt64* p, SInt64 v) {
+#ifdef _WIN32
+    InterlockedExchange64((LONGLONG volatile*)p, v);
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void
+plat_counter_max(volatile SInt64* p, SInt64 v) {
+    SInt64 cur = plat_counter_get(p);
+    while (cur < v) {
+#ifdef _WIN32
+        SInt64 seen = InterlockedCompareExchange64((LONGLONG volatile*)p, v, cur);
+        if (seen == cur) break;
+        cur = seen;
+#else
+        if (__atomic_compare_exchange_n(p, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+#endif
+    }
+}
+
+// Returns true if *p was expected and is now desired.
+static inline bool
+plat_cas32(volatile SInt32* p, SInt32 expected, SInt32 desired) {
+#ifdef _WIN32
+    return InterlockedCompareExchange((LONG volatile*)p, desired, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline SInt32
+plat_load32(volatile SInt32* p) {
+#ifdef _WIN32
+    return InterlockedCompareExchange((LONG volatile*)p, 0, 0);
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void
+plat_store32(volatile SInt32* p, SInt32 v) {
+#ifdef _WIN32
+    InterlockedExchange((LONG volatile*)p, v);
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+// Returns the value before the add.
+static inline SInt32
+plat_fetch_add32(volatile SInt32* p, SInt32 v) {
+#ifdef _WIN32
+    return InterlockedExchangeAdd((LONG volatile*)p, v);
+#else
+    return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// Returns the sum. Sequentially consistent, unlike the counters.
+static inline SInt64
+plat_add64(volatile SInt64* p, SInt64 v) {
+#ifdef _WIN32
+    return InterlockedExchangeAdd64((LONGLONG volatile*)p, v) + v;
+#else
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Orders every load and store before it against every one after it.
+static inline void
+plat_fence(void) {
+#ifdef _WIN32
+    MemoryBarrier();
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+// Returns true if *p was expected and is now desired.
+static inline bool
+plat_cas64(volatile SInt64* p, SInt64 expected, SInt64 desired) {
+#ifdef _WIN32
+    return InterlockedCompareExchange64((LONGLONG volatile*)p, desired, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// Returns true if *p was expected and is now desired.
+static inline bool
+plat_cas_ptr(void* volatile* p, void* expected, void* desired) {
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer(p, desired, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void*
+plat_load_ptr(void* volatile* p) {
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer(p, NULL, NULL);
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// An acquire load cheap enough for every call, with no interlocked
+// operation: MSVC's volatile reads acquire on x86 and x64.
+static inline void*
+plat_acquire_ptr(void* volatile* p) {
+#if defined(__GNUC__)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#elif defined(_M_ARM64)
+    return (void*)__ldar64((unsigned __int64 volatile*)p);
+#else
+    return *p;
+#endif
+}
+
+// Index of the highest set bit, v must not be 0.
+static inline int
+plat_log2(UInt64 v) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanReverse64(&i, v);
+    return (int)i;
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+#if defined(_MSC_VER)
+#define PLAT_THREAD_LOCAL __declspec(thread)
+#else
+#define PLAT_THREAD_LOCAL __thread
+#endif
+
+// Atomics ---
+
+
+// Mutex +++
+
+#ifdef _WIN32
+typedef SRWLOCK PlatMutex;
+#define PLAT_MUTEX_INIT SRWLOCK_INIT
+#else
+typedef pthread_mutex_t PlatMutex;
+#define PLAT_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+// For mutexes that are not static, PLAT_MUTEX_INIT is for those.
+static inline void
+plat_mutex_init(PlatMutex* m) {
+#ifdef _WIN32
+    InitializeSRWLock(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
+
+static inline void
+plat_mutex_destroy(PlatMutex* m) {
+#ifndef _WIN32
+    pthread_mutex_destroy(m);
+#endif
+}
+
+static inline void
+plat_mutex_lock(PlatMutex* m) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+static inline void
+plat_mutex_unlock(PlatMutex* m) {
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
+
+#ifdef _WIN32
+typedef CONDITION_VARIABLE PlatCond;
+#else
+typedef pthread_cond_t PlatCond;
+#endif
+
+static inline void
+plat_cond_init(PlatCond* c) {
+#ifdef _WIN32
+    InitializeConditionVariable(c);
+#else
+    pthread_cond_init(c, NULL);
+#endif
+}
+
+static inline void
+plat_cond_destroy(PlatCond* c) {
+#ifndef _WIN32
+    pthread_cond_destroy(c);
+#endif
+}
+
+// Releases m while it sleeps, holds it again on return. Wakeups may be
+// spurious, check the condition in a loop.
+static inline void
+plat_cond_wait(PlatCond* c, PlatMutex* m) {
+#ifdef _WIN32
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+#else
+    pthread_cond_wait(c, m);
+#endif
+}
+
+static inline void
+plat_cond_broadcast(PlatCond* c) {
+#ifdef _WIN32
+    WakeAllConditionVariable(c);
+#else
+    pthread_cond_broadcast(c);
+#endif
+}
+
+// Wakes one sleeper, if any.
+static inline void
+plat_cond_signal(PlatCond* c) {
+#ifdef _WIN32
+    WakeConditionVariable(c);
+#else
+    pthread_cond_signal(c);
+#endif
+}
+
+// Mutex ---
+
+
+// Once +++
+
+#ifdef _WIN32
+typedef INIT_ONCE PlatOnce;
+#define PLAT_ONCE_INIT INIT_ONCE_STATIC_INIT
+
+static inline BOOL CALLBACK
+plat_once_thunk(PINIT_ONCE once, PVOID param, PVOID* ctx) {
+    ((void (*)(void))param)();
+    return TRUE;
+}
+#else
+typedef pthread_once_t PlatOnce;
+#define PLAT_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+// Runs fn exactly once, other callers sleep until it has returned.
+static inline void
+plat_once(PlatOnce* once, void (* fn)(void)) {
+#ifdef _WIN32
+    InitOnceExecuteOnce(once, plat_once_thunk, (PVOID)fn, NULL);
+#else
+    pthread_once(once, fn);
+#endif
+}
+
+// Runs fn before main(). MSVC only runs what the linker keeps of .CRT$XCU,
+// and from a static library it keeps nothing unreferenced, so the pointer
+// is external and named to the linker with /include.
+#if defined(__GNUC__)
+#define PLAT_CONSTRUCTOR(fn) \
+    __attribute__((constructor)) static void fn ## _ctor(void) { fn(); }
+#elif defined(_MSC_VER)
+#ifdef _WIN64
+#define PLAT_SYMBOL(name) #name
+#else
+#define PLAT_SYMBOL(name) "_" #name
+#endif
+#pragma section(".CRT$XCU", read)
+#define PLAT_CONSTRUCTOR(fn) \
+    __declspec(allocate(".CRT$XCU")) void (* wat4ff_ctor_ ## fn)(void) = fn; \
+    __pragma(comment(linker, "/include:" PLAT_SYMBOL(wat4ff_ctor_ ## fn)))
+#endif
+
+// Once ---
+
+
+// Thread +++
+
+typedef void (* PlatThreadProc)(void*);
+
+typedef struct PlatThreadStart {
+    PlatThreadProc proc;
+    void* arg;
+}PlatThreadStart;
+
+#ifdef _WIN32
+typedef HANDLE PlatThread;
+
+static inline DWORD WINAPI
+plat_thread_main(LPVOID p) {
+    PlatThreadStart start = *(PlatThreadStart*)p;
+    plat_free(p);
+    start.proc(start.arg);
+    return 0;
+}
+#else
+typedef pthread_t PlatThread;
+
+static inline void*
+plat_thread_main(void* p) {
+    PlatThreadStart start = *(PlatThreadStart*)p;
+    plat_free(p);
+    start.proc(start.arg);
+    return NULL;
+}
+#endif
+
+static inline bool
+plat_thread_start(PlatThread* thread, PlatThreadProc proc, void* arg) {
+    PlatThreadStart* start = plat_alloc(sizeof(*start));
+    if (!start) return false;
+    start->proc = proc;
+    start->arg = arg;
+
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, plat_thread_main, start, 0, NULL);
+    if (*thread) return true;
+#else
+    if (!pthread_create(thread, NULL, plat_thread_main, start)) return true;
+#endif
+    plat_free(start);
+    return false;
+}
+
+static inline void
+plat_thread_join(PlatThread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+static inline UInt32
+plat_process_id(void) {
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return (UInt32)getpid();
+#endif
+}
+
+static inline UInt32
+plat_thread_id(void) {
+#if defined(_WIN32)
+    return GetCurrentThreadId();
+#elif defined(__linux__)
+    return (UInt32)syscall(SYS_gettid);
+#else
+    return (UInt32)(uintptr_t)pthread_self();
+#endif
+}
+
+static inline UInt32
+plat_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (UInt32)n : 1;
+#endif
+}
+
+static inline void
+plat_sleep_ms(UInt32 ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    while (nanosleep(&ts, &ts)) {}
+#endif
+}
+
+// Lets another thread run, if one is waiting for the CPU.
+static inline void
+plat_yield(void) {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+// Raises the calling thread's priority for audio rendering, if the OS lets
+// it.
+static inline void
+plat_thread_boost(void) {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+    struct sched_param sp = { .sched_priority = sched_get_priority_min(SCHED_FIFO) };
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+#endif
+}
+
+// Starts a thread nobody joins.
+static inline bool
+plat_thread_detach(PlatThreadProc proc, void* arg) {
+    PlatThread thread;
+    if (!plat_thread_start(&thread, proc, arg)) return false;
+#ifdef _WIN32
+    CloseHandle(thread);
+#else
+    pthread_detach(thread);
+#endif
+    return true;
+}
+
+// Thread ---
+
+
+// Environment +++
+
+// Copies the variable into buf, false if unset or longer than size - 1.
+static inline bool
+plat_getenv(const char* name, char* buf, size_t size) {
+#ifdef _WIN32
+    DWORD n = GetEnvironmentVariableA(name, buf, (DWORD)size);
+    return n && n < size;
+#else
+    const char* val = getenv(name);
+    if (!val) return false;
+    size_t n = strlen(val);
+    if (n >= size) return false;
+    memcpy(buf, val, n + 1);
+    return true;
+#endif
+}
+
+// Environment ---
+
+#endif
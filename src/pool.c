@@ -0,0 +1,239 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Converter pool. Disposed converters are reset and parked here, most
+ * recently parked first, until a matching AudioConverterNew takes them back
+ * or they exceed the size or idle limit. With an idle limit, a sweeper
+ * thread enforces it even if the pool is not used again. See conv.c for how
+ * a match is made.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <wat4ff.h>
+
+#include "conv.h"
+#include "plat.h"
+
+
+enum {
+    kDefaultIdleMillis = 60000,
+    kMaxSweepMillis    = 1000,
+};
+
+static PlatMutex lock_ = PLAT_MUTEX_INIT;
+static Conv* head_ = NULL;
+static Conv* tail_ = NULL;
+static UInt32 parked_ = 0;
+static UInt32 max_parked_ = 0;
+static SInt64 max_idle_ns_ = 0;
+static volatile SInt32 enabled_ = 0;
+static PlatFlag sweeping_ = 0;
+
+static volatile SInt64 hits_ = 0;
+static volatile SInt64 misses_ = 0;
+static volatile SInt64 stale_ = 0;
+static volatile SInt64 evictions_ = 0;
+
+
+static bool
+same_pair(const Conv* c, const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out) {
+    return !memcmp(&c->in, in, sizeof(*in)) && !memcmp(&c->out, out, sizeof(*out));
+}
+
+static void
+remove_parked(Conv* c) {
+    if (c->prev) c->prev->next = c->next;
+    else head_ = c->next;
+    if (c->next) c->next->prev = c->prev;
+    else tail_ = c->prev;
+    c->next = c->prev = NULL;
+    --parked_;
+}
+
+// Moves converters over the limits onto *doomed, oldest at the tail.
+static void
+evict(SInt64 now, Conv** doomed) {
+    while (tail_ && (parked_ > max_parked_ || (max_idle_ns_ && now - tail_->parkedAt > max_idle_ns_))) {
+        Conv* c = tail_;
+        remove_parked(c);
+        c->next = *doomed;
+        *doomed = c;
+        plat_counter_add(&evictions_, 1);
+    }
+}
+
+// Disposes outside the lock, CoreAudioToolbox may take its time.
+static void
+destroy_all(Conv* doomed) {
+    while (doomed) {
+        Conv* next = doomed->next;
+        conv_destroy(doomed);
+        doomed = next;
+    }
+}
+
+// Wakes a few times per idle period, so a converter is gone soon after
+// its time is up rather than at the next AudioConverterNew.
+static void
+sweeper_main(void* param) {
+    for (;;) {
+        plat_mutex_lock(&lock_);
+        SInt64 tick = max_idle_ns_ ? max_idle_ns_ / 4000000 : kMaxSweepMillis;
+        plat_mutex_unlock(&lock_);
+        plat_sleep_ms(tick < 1 ? 1 : tick > kMaxSweepMillis ? kMaxSweepMillis : (UInt32)tick);
+
+        Conv* doomed = NULL;
+        plat_mutex_lock(&lock_);
+        evict(plat_now_ns(), &doomed);
+        plat_mutex_unlock(&lock_);
+        destroy_all(doomed);
+    }
+}
+
+bool
+pool_enabled(void) {
+    return plat_load32(&enabled_);
+}
+
+bool
+pool_has_pair(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out) {
+    bool found = false;
+    Conv* doomed = NULL;
+
+    plat_mutex_lock(&lock_);
+    evict(plat_now_ns(), &doomed);
+    for (Conv* c = head_; c; c = c->next) {
+        if (same_pair(c, in, out)) {
+            found = true;
+            break;
+        }
+    }
+    plat_mutex_unlock(&lock_);
+
+    destroy_all(doomed);
+    return found;
+}
+
+Conv*
+pool_take(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out, const PropList* props) {
+    Conv* found = NULL;
+    Conv* doomed = NULL;
+
+    plat_mutex_lock(&lock_);
+    evict(plat_now_ns(), &doomed);
+    // Prefer one with nothing applied beyond props, it cannot go stale.
+    for (Conv* c = head_; c; c = c->next) {
+        if (same_pair(c, in, out) && c->props.size >= props->size
+            && (!props->size || !memcmp(c->props.data, props->data, props->size))) {
+            if (!found || (found->props.size != props->size && c->props.size == props->size)) found = c;
+            if (found->props.size == props->size) break;
+        }
+    }
+    if (found) remove_parked(found);
+    plat_mutex_unlock(&lock_);
+
+    destroy_all(doomed);
+    if (found) plat_counter_add(&hits_, 1);
+    return found;
+}
+
+bool
+pool_park(Conv* c) {
+    if (!pool_enabled()) return false;
+
+    Conv* doomed = NULL;
+    plat_mutex_lock(&lock_);
+    SInt64 now = plat_now_ns();
+    c->parkedAt = now;
+    c->prev = NULL;
+    c->next = head_;
+    if (head_) head_->prev = c;
+    else tail_ = c;
+    head_ = c;
+    ++parked_;
+    evict(now, &doomed);
+    plat_mutex_unlock(&lock_);
+
+    destroy_all(doomed);
+    return true;
+}
+
+void
+pool_count_miss(void) {
+    plat_counter_add(&misses_, 1);
+}
+
+void
+pool_count_stale(void) {
+    plat_counter_add(&stale_, 1);
+}
+
+
+// API +++
+
+void
+wat4ff_pool_configure(UInt32 maxConverters, UInt32 maxIdleMillis) {
+    Conv* doomed = NULL;
+
+    plat_mutex_lock(&lock_);
+    max_parked_ = maxConverters;
+    max_idle_ns_ = (SInt64)maxIdleMillis * 1000000;
+    plat_store32(&enabled_, maxConverters != 0);
+    evict(plat_now_ns(), &doomed);
+    plat_mutex_unlock(&lock_);
+
+    destroy_all(doomed);
+
+    // Without a sweeper, idle converters go the next time the pool is used.
+    if (maxConverters && maxIdleMillis && plat_flag_test_and_set(&sweeping_)) {
+        plat_thread_detach(sweeper_main, NULL);
+    }
+}
+
+void
+wat4ff_pool_trim(void) {
+    Conv* doomed = NULL;
+
+    plat_mutex_lock(&lock_);
+    while (tail_) {
+        Conv* c = tail_;
+        remove_parked(c);
+        c->next = doomed;
+        doomed = c;
+    }
+    plat_mutex_unlock(&lock_);
+
+    destroy_all(doomed);
+}
+
+void
+wat4ff_get_pool_stats(Wat4ffPoolStats* stats) {
+    stats->hits = plat_counter_get(&hits_);
+    stats->misses = plat_counter_get(&misses_);
+    stats->stale = plat_counter_get(&stale_);
+    stats->evictions = plat_counter_get(&evictions_);
+
+    plat_mutex_lock(&lock_);
+    stats->parked = parked_;
+    plat_mutex_unlock(&lock_);
+}
+
+// WAT4FF_POOL=n keeps up to n converters, WAT4FF_POOL_IDLE_MS how long.
+static void
+pool_from_env(void) {
+    char val[16];
+    if (!plat_getenv("WAT4FF_POOL", val, sizeof(val))) return;
+    UInt32 max = (UInt32)strtoul(val, NULL, 10);
+
+    UInt32 idle = kDefaultIdleMillis;
+    if (plat_getenv("WAT4FF_POOL_IDLE_MS", val, sizeof(val))) idle = (UInt32)strtoul(val, NULL, 10);
+    wat4ff_pool_configure(max, idle);
+}
+
+PLAT_CONSTRUCTOR(pool_from_env)
+
+// API ---
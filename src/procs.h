@@ -0,0 +1,89 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The AudioToolbox procedures wat4ff forwards to CoreAudioToolbox.
+*/
+
+#ifndef WAT4FF_PROCS_H
+#define WAT4FF_PROCS_H
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "plat.h"
+
+
+// Every exported procedure, one row each:
+// X(name, params, args, hook, wrap, trace, capture).
+// hook is where the call goes, FORWARD straight to CoreAudioToolbox,
+// CONV_HOOK to the converter layer or FORMAT_HOOK to format.c, see conv.h.
+// wrap rewrites args on the way in, see stats.h.
+// trace says what a trace event records about the call, see trace.h.
+// capture says what a capture record holds, see capture.h.
+#define PROC_TABLE(X)                                                         \
+    /* Shared by dec, enc */                                                  \
+    X(AudioConverterDispose,                                                  \
+      (AudioConverterRef p1),                                                 \
+      (p1), CONV_HOOK, NO_WRAP, TRACE_CONV, CAPTURE_DISPOSE)                  \
+    X(AudioConverterFillComplexBuffer,                                        \
+      (AudioConverterRef p1, AudioConverterComplexInputDataProc p2, void* p3, \
+       UInt32* p4, AudioBufferList* p5, AudioStreamPacketDescription* p6),    \
+      (p1, p2, p3, p4, p5, p6), CONV_HOOK, WRAP_INPUT, TRACE_FILL, CAPTURE_FILL) \
+    X(AudioConverterGetProperty,                                              \
+      (AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, void* p4), \
+      (p1, p2, p3, p4), CONV_HOOK, NO_WRAP, TRACE_NONE, CAPTURE_NONE)         \
+    X(AudioConverterGetPropertyInfo,                                          \
+      (AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, Boolean* p4), \
+      (p1, p2, p3, p4), CONV_HOOK, NO_WRAP, TRACE_NONE, CAPTURE_NONE)         \
+    X(AudioConverterNew,                                                      \
+      (const AudioStreamBasicDescription* p1, const AudioStreamBasicDescription* p2, \
+       AudioConverterRef* p3),                                                \
+      (p1, p2, p3), CONV_HOOK, NO_WRAP, TRACE_NEW, CAPTURE_NEW)               \
+    X(AudioConverterReset,                                                    \
+      (AudioConverterRef p1),                                                 \
+      (p1), CONV_HOOK, NO_WRAP, TRACE_CONV, CAPTURE_RESET)                    \
+    X(AudioConverterSetProperty,                                              \
+      (AudioConverterRef p1, AudioConverterPropertyID p2, UInt32 p3, const void* p4), \
+      (p1, p2, p3, p4), CONV_HOOK, NO_WRAP, TRACE_PROP, CAPTURE_PROP)         \
+    /* Used only by dec */                                                    \
+    X(AudioFormatGetPropertyInfo,                                             \
+      (AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4),      \
+      (p1, p2, p3, p4), FORMAT_HOOK, NO_WRAP, TRACE_NONE, CAPTURE_NONE)       \
+    X(AudioFormatGetProperty,                                                 \
+      (AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4, void* p5), \
+      (p1, p2, p3, p4, p5), FORMAT_HOOK, NO_WRAP, TRACE_NONE, CAPTURE_NONE)
+
+#define NO_WRAP(...) (__VA_ARGS__)
+
+#define PROCTYPE(fn) fn ## Proc
+#define PROCSLOT(fn) wat4ff_p ## fn
+#define PROCPTR(fn) ((PROCTYPE(fn))plat_acquire_ptr((void* volatile*)&PROCSLOT(fn)))
+#define FORWARD(fn) PROCPTR(fn)
+
+// PROCSLOT(fn) holds the CoreAudioToolbox entry point, see wat4ff.c, and
+// PROCPTR(fn) reads it. Idle unload swaps it while calls run, so the read
+// is atomic. Prefixed, as a static wat4ff exports it to whatever links it.
+#define DECL_PROCPTR(fn, params, ...)         \
+    typedef OSStatus (* PROCTYPE(fn)) params; \
+    extern PROCTYPE(fn) volatile PROCSLOT(fn);
+
+PROC_TABLE(DECL_PROCPTR)
+
+// Each live CoreAudioToolbox converter keeps the library loaded while idle
+// unload is on, see wat4ff.c.
+void
+lib_retain(void);
+
+void
+lib_release(void);
+
+#define PROC_INDEX(fn, ...) kProc_ ## fn,
+#define PROC_NAME(fn, ...) #fn,
+
+enum {
+    PROC_TABLE(PROC_INDEX)
+    kProcCount
+};
+
+#endif
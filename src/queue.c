@@ -0,0 +1,312 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * AudioQueue output, played by a sink, see wat4ff_sink_register().
+ *
+ * Enqueued buffers go through a bounded lock-free ring to a render thread
+ * of the queue's own, which writes each to the sink and then hands it back
+ * through the output callback. Producers claim slots with a compare and
+ * swap, so buffers may also be enqueued from the callback. The render
+ * thread only takes a lock to sleep on an empty ring, or to wake someone
+ * waiting for buffers to play. From AudioQueueStart() on, nothing but
+ * AudioQueueAllocateBuffer() allocates.
+*/
+
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "plat.h"
+#include "sink.h"
+
+
+enum {
+    kRingSlots = 256,                   // Also the most buffers a queue has
+};
+
+typedef struct QueueBuffer {
+    AudioQueueBuffer aq;                // First, so the pointers convert
+    struct QueueBuffer* next;
+    AudioQueueRef queue;
+    volatile SInt32 queued;
+}QueueBuffer;
+
+typedef struct Slot {
+    volatile SInt32 seq;
+    QueueBuffer* buffer;
+}Slot;
+
+struct OpaqueAudioQueue {
+    AudioStreamBasicDescription format;
+    AudioQueueOutputCallback callback;
+    void* user;
+    const Wat4ffSink* sink;
+    void* stream;
+    QueueBuffer* buffers;
+    UInt32 bufferCount;
+    PlatThread thread;
+    bool started;
+    bool disposing;
+
+    Slot slots[kRingSlots];
+    volatile SInt32 tail;               // Producers
+    SInt32 head;                        // Render thread only
+    volatile SInt32 played;
+    volatile SInt32 status;             // First error from the sink
+
+    PlatMutex lock;                     // Guards buffers and sleeping
+    PlatCond wake;                      // Something enqueued, or stopping
+    PlatCond drained;                   // A buffer played while someone waits
+    volatile SInt32 sleeping;
+    volatile SInt32 waiters;
+    volatile SInt32 stop;
+};
+
+
+// Ring +++
+
+// Returns false if the ring is full, which it cannot be while each of at
+// most kRingSlots buffers is in it once.
+static bool
+ring_push(AudioQueueRef q, QueueBuffer* b) {
+    UInt32 pos = (UInt32)plat_load32(&q->tail);
+    for (;;) {
+        Slot* s = &q->slots[pos % kRingSlots];
+        SInt32 diff = (SInt32)((UInt32)plat_load32(&s->seq) - pos);
+        if (diff < 0) return false;
+        if (!diff && plat_cas32(&q->tail, (SInt32)pos, (SInt32)(pos + 1))) {
+            s->buffer = b;
+            plat_store32(&s->seq, (SInt32)(pos + 1));
+            break;
+        }
+        pos = (UInt32)plat_load32(&q->tail);
+    }
+    plat_fence();
+    if (plat_load32(&q->sleeping)) {
+        plat_mutex_lock(&q->lock);
+        plat_cond_broadcast(&q->wake);
+        plat_mutex_unlock(&q->lock);
+    }
+    return true;
+}
+
+static QueueBuffer*
+ring_try_pop(AudioQueueRef q) {
+    UInt32 pos = (UInt32)q->head;
+    Slot* s = &q->slots[pos % kRingSlots];
+    if ((UInt32)plat_load32(&s->seq) != pos + 1) return NULL;
+    QueueBuffer* b = s->buffer;
+    plat_store32(&s->seq, (SInt32)(pos + kRingSlots));
+    q->head = (SInt32)(pos + 1);
+    return b;
+}
+
+// Sleeps until a buffer is enqueued, NULL once stopping.
+static QueueBuffer*
+ring_pop(AudioQueueRef q) {
+    for (;;) {
+        if (plat_load32(&q->stop)) return NULL;
+        QueueBuffer* b = ring_try_pop(q);
+        if (b) return b;
+
+        plat_store32(&q->sleeping, 1);
+        plat_fence();
+        plat_mutex_lock(&q->lock);
+        while (!plat_load32(&q->stop)
+               && (UInt32)plat_load32(&q->slots[(UInt32)q->head % kRingSlots].seq) != (UInt32)q->head + 1) {
+            plat_cond_wait(&q->wake, &q->lock);
+        }
+        plat_mutex_unlock(&q->lock);
+        plat_store32(&q->sleeping, 0);
+    }
+}
+
+// Ring ---
+
+
+// Render +++
+
+static void
+render_main(void* param) {
+    AudioQueueRef q = param;
+    plat_thread_boost();
+    QueueBuffer* b;
+    while ((b = ring_pop(q))) {
+        if (!plat_load32(&q->status)) {
+            OSStatus rc = q->sink->write(q->stream, b->aq.mAudioData, b->aq.mAudioDataByteSize);
+            if (rc) plat_store32(&q->status, rc);
+        }
+        plat_store32(&b->queued, 0);
+        q->callback(q->user, q, &b->aq);
+
+        plat_fetch_add32(&q->played, 1);
+        plat_fence();
+        if (plat_load32(&q->waiters)) {
+            plat_mutex_lock(&q->lock);
+            plat_cond_broadcast(&q->drained);
+            plat_mutex_unlock(&q->lock);
+        }
+    }
+}
+
+// Sleeps until every buffer enqueued so far has played.
+static void
+wait_played(AudioQueueRef q) {
+    UInt32 target = (UInt32)plat_load32(&q->tail);
+    plat_fetch_add32(&q->waiters, 1);
+    plat_fence();
+    plat_mutex_lock(&q->lock);
+    while ((SInt32)((UInt32)plat_load32(&q->played) - target) < 0) plat_cond_wait(&q->drained, &q->lock);
+    plat_mutex_unlock(&q->lock);
+    plat_fetch_add32(&q->waiters, -1);
+}
+
+// Render ---
+
+
+// AudioQueue +++
+
+OSStatus
+AudioQueueNewOutput(const AudioStreamBasicDescription* p1, AudioQueueOutputCallback p2, void* p3, CFRunLoopRef p4, CFStringRef p5, UInt32 p6, AudioQueueRef* p7) {
+    if (!p1 || !p2 || !p7 || p4) return kAudio_ParamError;
+    if (p1->mFormatID != kAudioFormatLinearPCM || !p1->mBytesPerFrame || !p1->mChannelsPerFrame
+        || p1->mFramesPerPacket > 1 || p1->mSampleRate <= 0) {
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+
+    AudioQueueRef q = plat_calloc(sizeof(*q));
+    if (!q) return kAudio_MemFullError;
+    q->format = *p1;
+    q->callback = p2;
+    q->user = p3;
+    q->sink = sink_find(NULL);
+    for (UInt32 i = 0; i < kRingSlots; ++i) q->slots[i].seq = (SInt32)i;
+    plat_mutex_init(&q->lock);
+    plat_cond_init(&q->wake);
+    plat_cond_init(&q->drained);
+    *p7 = q;
+    return noErr;
+}
+
+OSStatus
+AudioQueueSetProperty(AudioQueueRef p1, AudioQueuePropertyID p2, const void* p3, UInt32 p4) {
+    if (!p1) return kAudio_ParamError;
+    if (p2 != kAudioQueueProperty_CurrentDevice) return kAudioQueueErr_InvalidProperty;
+    if (p4 != sizeof(CFStringRef) || !p3) return kAudioQueueErr_InvalidPropertySize;
+    if (p1->started) return kAudioQueueErr_InvalidRunState;
+    const Wat4ffSink* sink = sink_find(CFStringGetCStringPtr(*(const CFStringRef*)p3, kCFStringEncodingMacRoman));
+    if (!sink) return kAudioQueueErr_InvalidDevice;
+    p1->sink = sink;
+    return noErr;
+}
+
+OSStatus
+AudioQueueAllocateBuffer(AudioQueueRef p1, UInt32 p2, AudioQueueBufferRef* p3) {
+    if (!p1 || !p2 || !p3) return kAudio_ParamError;
+    size_t header = (sizeof(QueueBuffer) + 15) & ~(size_t)15;
+    QueueBuffer* b = plat_alloc(header + p2);
+    if (!b) return kAudio_MemFullError;
+    AudioQueueBuffer aq = {
+        .mAudioDataBytesCapacity = p2,
+        .mAudioData = (UInt8*)b + header,
+    };
+    memcpy(&b->aq, &aq, sizeof(aq));
+    b->queue = p1;
+    b->queued = 0;
+
+    OSStatus rc = noErr;
+    plat_mutex_lock(&p1->lock);
+    if (p1->bufferCount == kRingSlots) {
+        rc = kAudio_MemFullError;
+    }
+    else {
+        b->next = p1->buffers;
+        p1->buffers = b;
+        ++p1->bufferCount;
+    }
+    plat_mutex_unlock(&p1->lock);
+    if (rc) {
+        plat_free(b);
+        return rc;
+    }
+    *p3 = &b->aq;
+    return noErr;
+}
+
+// Descriptions are for compressed formats, which a queue never has.
+OSStatus
+AudioQueueEnqueueBuffer(AudioQueueRef p1, AudioQueueBufferRef p2, UInt32 p3, const AudioStreamPacketDescription* p4) {
+    if (!p1 || !p2) return kAudio_ParamError;
+    QueueBuffer* b = (QueueBuffer*)p2;
+    if (b->queue != p1 || p2->mAudioDataByteSize > p2->mAudioDataBytesCapacity) return kAudioQueueErr_InvalidBuffer;
+    if (!p2->mAudioDataByteSize) return kAudioQueueErr_BufferEmpty;
+    if (p1->disposing) return kAudioQueueErr_DisposalPending;
+    OSStatus rc = plat_load32(&p1->status);
+    if (rc) return rc;
+    if (!plat_cas32(&b->queued, 0, 1)) return kAudioQueueErr_BufferInQueue;
+    if (!ring_push(p1, b)) {
+        plat_store32(&b->queued, 0);
+        return kAudioQueueErr_BufferInQueue;
+    }
+    return noErr;
+}
+
+// Opens the sink and starts rendering. The time to start at is ignored,
+// playback starts now.
+OSStatus
+AudioQueueStart(AudioQueueRef p1, const AudioTimeStamp* p2) {
+    if (!p1) return kAudio_ParamError;
+    if (p1->started) return noErr;
+    if (!p1->sink) return kAudioQueueErr_InvalidDevice;
+    OSStatus rc = p1->sink->open(p1->sink->user, &p1->format, &p1->stream);
+    if (rc) return rc;
+    if (!plat_thread_start(&p1->thread, render_main, p1)) {
+        p1->sink->close(p1->stream, false);
+        return kAudio_MemFullError;
+    }
+    p1->started = true;
+    return noErr;
+}
+
+// Returns once every buffer enqueued before the call has played, unlike
+// AudioToolbox's, so a Dispose right after drops nothing.
+OSStatus
+AudioQueueFlush(AudioQueueRef p1) {
+    if (!p1) return kAudio_ParamError;
+    if (p1->started) wait_played(p1);
+    return plat_load32(&p1->status);
+}
+
+// Without immediate, buffers enqueued before the call play first. Not from
+// the output callback.
+OSStatus
+AudioQueueDispose(AudioQueueRef p1, Boolean p2) {
+    if (!p1) return kAudio_ParamError;
+    p1->disposing = true;
+    if (p1->started) {
+        if (!p2) wait_played(p1);
+        plat_mutex_lock(&p1->lock);
+        plat_store32(&p1->stop, 1);
+        plat_cond_broadcast(&p1->wake);
+        plat_mutex_unlock(&p1->lock);
+        plat_thread_join(p1->thread);
+        p1->sink->close(p1->stream, !p2);
+    }
+
+    QueueBuffer* b = p1->buffers;
+    while (b) {
+        QueueBuffer* next = b->next;
+        plat_free(b);
+        b = next;
+    }
+    plat_cond_destroy(&p1->drained);
+    plat_cond_destroy(&p1->wake);
+    plat_mutex_destroy(&p1->lock);
+    plat_free(p1);
+    return noErr;
+}
+
+// AudioQueue ---
@@ -0,0 +1,591 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The AudioToolbox procedures of a process served by wat4ff_host, see
+ * ipc.h. They stand in for CoreAudioToolbox's below the converter layer,
+ * so pooling and caching work as before, and a converter is simply the
+ * host's number for it.
+ *
+ * Records by op, to the host and back:
+ * New              payload in and out ASBD       reply handle
+ * Dispose          handle, posted, no reply
+ * Reset            handle
+ * SetProperty      handle, a id, b size, payload data
+ * GetProperty      handle, a id, b size, payload data in
+ *                                                 reply b size, payload data
+ * GetPropertyInfo  handle, a id                   reply a size, b writable
+ * Fill             handle, a packets, b buffers, c descriptions wanted,
+ *                  payload channels and size of each buffer
+ *                                                 reply a packets, payload
+ *                                                 size of each buffer, the
+ *                                                 output itself in out
+ * FormatGetPropertyInfo
+ *                  a id, b specifier size, payload specifier
+ *                                                 reply a size
+ * FormatGetProperty
+ *                  a id, b specifier size, c size, payload specifier then
+ *                  data in                        reply b size, payload data
+ * Input, to the client, during a fill
+ *                  a packets, b buffers, c descriptions wanted,
+ *                  payload channels of each buffer
+ * InputData        status, a packets, b buffers, c descriptions, payload
+ *                  channels and size of each buffer, descriptions, data
+*/
+
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "ipc.h"
+#include "plat.h"
+
+
+#define PAYLOAD(r) ((UInt8*)((IpcRecord*)(r) + 1))
+#define PAYLOAD_SIZE(r) ((r)->size - (UInt32)sizeof(IpcRecord))
+
+// A call in progress on a lane the calling thread owns.
+typedef struct Call {
+    UInt32 index;
+    IpcLane* lane;
+    IpcRingView post;                  // toHost
+    IpcRingView* replies;              // toClient
+    UInt32 need;
+    IpcRecord* record;
+}Call;
+
+static char name_[kIpcNameMax];
+static bool disabled_ = false;
+static IpcConn* conn_ = NULL;
+static IpcMap* map_ = NULL;
+static IpcSession* session_ = NULL;
+static volatile SInt32 gone_ = 0;
+static volatile SInt32 sessions_ = 0;
+static IpcRingView replies_[kIpcLanes];
+static PLAT_THREAD_LOCAL UInt32 hint_;
+
+
+// Lane +++
+
+static bool
+host_gone(void) {
+    if (!plat_load32(&gone_) && !ipc_alive(conn_)) plat_store32(&gone_, 1);
+    return plat_load32(&gone_) != 0;
+}
+
+static bool
+call_gone(void* arg) {
+    Call* c = arg;
+    if (c->replies->broken) plat_store32(&gone_, 1);
+    return host_gone();
+}
+
+// Starts where this thread last found one free, so a thread keeps its lane.
+static bool
+lane_take(Call* c) {
+    for (;;) {
+        if (plat_load32(&gone_)) return false;
+        for (UInt32 i = 0; i < kIpcLanes; ++i) {
+            UInt32 index = (hint_ + i) % kIpcLanes;
+            IpcLane* lane = &session_->lanes[index];
+            if (plat_load32(&lane->owner) || !plat_cas32(&lane->owner, 0, 1)) continue;
+
+            hint_ = index;
+            if (!plat_load32(&lane->wanted)) {
+                plat_store32(&lane->wanted, 1);
+                bell_ring(map_, IPC_DOORBELL, &session_->doorbell);
+            }
+            c->index = index;
+            c->lane = lane;
+            ring_view(&c->post, &lane->toHost, lane->toHostData, kIpcToHostBytes);
+            c->replies = &replies_[index];
+            return true;
+        }
+        if (host_gone()) return false;
+        plat_yield();
+    }
+}
+
+static void
+lane_give(Call* c) {
+    plat_store32(&c->lane->owner, 0);
+}
+
+static bool
+room(void* arg) {
+    Call* c = arg;
+    return (c->record = ring_reserve(&c->post, c->need)) != NULL;
+}
+
+// A record with payload bytes after the header, waiting for room if need
+// be. NULL if the host is gone or it would never fit.
+static IpcRecord*
+post_begin(Call* c, UInt32 op, UInt32 handle, UInt32 payload) {
+    if (payload > kIpcMaxRecord - sizeof(IpcRecord)) return NULL;
+    c->need = (UInt32)sizeof(IpcRecord) + ipc_round8(payload);
+    if (!bell_wait(map_, IPC_CLIENT_BELL(c->index), &c->lane->clientBell, room, call_gone, c)) return NULL;
+
+    IpcRecord* r = c->record;
+    memset(r, 0, sizeof(*r));
+    r->size = c->need;
+    r->op = op;
+    r->handle = handle;
+    return r;
+}
+
+static void
+post_end(Call* c, IpcRecord* r) {
+    ring_commit(&c->post, r);
+    bell_ring(map_, IPC_HOST_BELL(c->index), &c->lane->hostBell);
+}
+
+static bool
+reply_ready(void* arg) {
+    Call* c = arg;
+    return (c->record = ring_next(c->replies)) != NULL;
+}
+
+// The next record from the host, valid until reply_done(). NULL if the
+// host is gone.
+static IpcRecord*
+await(Call* c) {
+    if (!bell_wait(map_, IPC_CLIENT_BELL(c->index), &c->lane->clientBell, reply_ready, call_gone, c)) return NULL;
+    return c->record;
+}
+
+static void
+reply_done(Call* c) {
+    ring_release(c->replies);
+}
+
+// Posts r and waits for the reply, which must be a plain one.
+static IpcRecord*
+call(Call* c, IpcRecord* r) {
+    post_end(c, r);
+    r = await(c);
+    if (r && r->op != kIpcReply) {
+        plat_store32(&gone_, 1);
+        return NULL;
+    }
+    return r;
+}
+
+// Lane ---
+
+
+// Converter +++
+
+static inline UInt32
+handle_of(AudioConverterRef conv) {
+    return (UInt32)(uintptr_t)conv;
+}
+
+static OSStatus
+remote_AudioConverterNew(const AudioStreamBasicDescription* p1, const AudioStreamBasicDescription* p2,
+                         AudioConverterRef* p3) {
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcNew, 0, 2 * sizeof(*p1));
+    if (!r) goto fin;
+    memcpy(PAYLOAD(r), p1, sizeof(*p1));
+    memcpy(PAYLOAD(r) + sizeof(*p1), p2, sizeof(*p2));
+    if (!(r = call(&c, r))) goto fin;
+    rc = r->status;
+    if (rc == noErr) *p3 = (AudioConverterRef)(uintptr_t)r->handle;
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+// Posted without waiting, the host gets to it before the lane's next call.
+static OSStatus
+remote_AudioConverterDispose(AudioConverterRef p1) {
+    Call c;
+    if (!lane_take(&c)) return noErr;
+    IpcRecord* r = post_begin(&c, kIpcDispose, handle_of(p1), 0);
+    if (r) post_end(&c, r);
+    lane_give(&c);
+    return noErr;
+}
+
+static OSStatus
+remote_AudioConverterReset(AudioConverterRef p1) {
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcReset, handle_of(p1), 0);
+    if (!r || !(r = call(&c, r))) goto fin;
+    rc = r->status;
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+static OSStatus
+remote_AudioConverterSetProperty(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32 p3, const void* p4) {
+    if (p3 && !p4) return kAudio_ParamError;
+    if (p3 > kIpcMaxRecord - sizeof(IpcRecord)) return kAudio_ParamError;
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcSetProperty, handle_of(p1), p3);
+    if (!r) goto fin;
+    r->a = p2;
+    r->b = p3;
+    if (p3) memcpy(PAYLOAD(r), p4, p3);
+    if (!(r = call(&c, r))) goto fin;
+    rc = r->status;
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+// The data goes both ways, some properties take an argument in it.
+static OSStatus
+remote_AudioConverterGetProperty(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, void* p4) {
+    UInt32 size = p3 && p4 ? *p3 : 0;
+    if (size > kIpcMaxReply - sizeof(IpcRecord)) return kAudio_ParamError;
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcGetProperty, handle_of(p1), size);
+    if (!r) goto fin;
+    r->a = p2;
+    r->b = size;
+    r->flags = (p3 ? kIpcHasSize : 0) | (p4 ? kIpcHasData : 0);
+    if (size) memcpy(PAYLOAD(r), p4, size);
+    if (!(r = call(&c, r))) goto fin;
+    rc = r->status;
+    if (p3) {
+        UInt32 got = r->b < PAYLOAD_SIZE(r) ? r->b : PAYLOAD_SIZE(r);
+        if (p4) memcpy(p4, PAYLOAD(r), got < size ? got : size);
+        *p3 = r->b;
+    }
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+static OSStatus
+remote_AudioConverterGetPropertyInfo(AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, Boolean* p4) {
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcGetPropertyInfo, handle_of(p1), 0);
+    if (!r) goto fin;
+    r->a = p2;
+    if (!(r = call(&c, r))) goto fin;
+    rc = r->status;
+    if (p3) *p3 = r->a;
+    if (p4) *p4 = r->b != 0;
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+// Converter ---
+
+
+// Fill +++
+
+// Shrinks a fill whose output would not fit the out area, a fill may
+// always give fewer packets than asked for.
+static bool
+fit_out(UInt32* packets, bool descs, UInt32 count, UInt32* sizes, UInt32* offsets) {
+    UInt32 end = ipc_out_layout(*packets, descs, count, sizes, offsets);
+    if (end <= kIpcOutBytes) return true;
+
+    UInt32 want = *packets;
+    UInt32 n = (UInt32)((UInt64)want * (kIpcOutBytes - 16 * count) / end);
+    if (!n) return false;
+    for (UInt32 i = 0; i < count; ++i) sizes[i] = (UInt32)((UInt64)sizes[i] * n / want);
+    *packets = n;
+    return ipc_out_layout(n, descs, count, sizes, offsets) <= kIpcOutBytes;
+}
+
+// Runs the caller's input proc for the host and posts what it gave, data
+// and all. False if the host is gone.
+static bool
+serve_input(Call* c, IpcRecord* req, AudioConverterRef conv, AudioConverterComplexInputDataProc proc, void* user) {
+    UInt32 count = req->b;
+    if (count > kWat4ffMaxBuffers || PAYLOAD_SIZE(req) < count * 4) return false;
+    Wat4ffBufferList list;
+    list.abl.mNumberBuffers = count;
+    const UInt32* channels = (const UInt32*)PAYLOAD(req);
+    for (UInt32 i = 0; i < count; ++i) list.abl.mBuffers[i] = (AudioBuffer){ channels[i], 0, NULL };
+    UInt32 packets = req->a;
+    bool want_descs = req->c != 0;
+    reply_done(c);
+
+    AudioStreamPacketDescription* descs = NULL;
+    OSStatus status = proc(conv, &packets, &list.abl, want_descs ? &descs : NULL, user);
+    if (list.abl.mNumberBuffers > count) status = kAudio_ParamError;
+    count = status ? 0 : list.abl.mNumberBuffers;
+    UInt32 ndescs = descs && !status ? packets : 0;
+
+    UInt64 payload = (UInt64)count * 8 + (UInt64)ndescs * sizeof(*descs);
+    for (UInt32 i = 0; i < count; ++i) payload += ipc_round8(list.abl.mBuffers[i].mDataByteSize);
+    if (payload > kIpcMaxRecord - sizeof(IpcRecord)) {
+        status = kAudio_ParamError;
+        payload = count = ndescs = 0;
+    }
+    if (status) packets = 0;
+
+    IpcRecord* r = post_begin(c, kIpcInputData, 0, (UInt32)payload);
+    if (!r) return false;
+    r->status = status;
+    r->a = packets;
+    r->b = count;
+    r->c = ndescs;
+    UInt32* head = (UInt32*)PAYLOAD(r);
+    UInt8* p = PAYLOAD(r) + count * 8;
+    if (ndescs) {
+        memcpy(p, descs, ndescs * sizeof(*descs));
+        p += ndescs * sizeof(*descs);
+    }
+    for (UInt32 i = 0; i < count; ++i) {
+        const AudioBuffer* b = &list.abl.mBuffers[i];
+        head[i * 2] = b->mNumberChannels;
+        head[i * 2 + 1] = b->mDataByteSize;
+        if (b->mDataByteSize) memcpy(p, b->mData, b->mDataByteSize);
+        p += ipc_round8(b->mDataByteSize);
+    }
+    post_end(c, r);
+    return true;
+}
+
+static OSStatus
+remote_AudioConverterFillComplexBuffer(AudioConverterRef p1, AudioConverterComplexInputDataProc p2, void* p3,
+                                       UInt32* p4, AudioBufferList* p5, AudioStreamPacketDescription* p6) {
+    if (!p2 || !p4 || !p5 || p5->mNumberBuffers > kWat4ffMaxBuffers) return kAudio_ParamError;
+    UInt32 count = p5->mNumberBuffers;
+    UInt32 sizes[kWat4ffMaxBuffers];
+    UInt32 offsets[kWat4ffMaxBuffers];
+    for (UInt32 i = 0; i < count; ++i) sizes[i] = p5->mBuffers[i].mDataByteSize;
+    UInt32 packets = *p4;
+    if (!fit_out(&packets, p6 != NULL, count, sizes, offsets)) return kAudio_ParamError;
+    *p4 = 0;
+
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcFill, handle_of(p1), count * 8);
+    if (!r) goto fin;
+    r->a = packets;
+    r->b = count;
+    r->c = p6 != NULL;
+    UInt32* head = (UInt32*)PAYLOAD(r);
+    for (UInt32 i = 0; i < count; ++i) {
+        head[i * 2] = p5->mBuffers[i].mNumberChannels;
+        head[i * 2 + 1] = sizes[i];
+    }
+    post_end(&c, r);
+
+    for (;;) {
+        if (!(r = await(&c))) goto fin;
+        if (r->op != kIpcInput) break;
+        if (!serve_input(&c, r, p1, p2, p3)) goto fin;
+    }
+    if (r->op != kIpcReply || r->a > packets || PAYLOAD_SIZE(r) < count * 4) {
+        plat_store32(&gone_, 1);
+        goto fin;
+    }
+
+    const UInt32* got = (const UInt32*)PAYLOAD(r);
+    for (UInt32 i = 0; i < count; ++i) {
+        UInt32 n = got[i] < sizes[i] ? got[i] : sizes[i];
+        memcpy(p5->mBuffers[i].mData, c.lane->out + offsets[i], n);
+        p5->mBuffers[i].mDataByteSize = n;
+    }
+    if (p6 && r->a) memcpy(p6, c.lane->out, r->a * sizeof(*p6));
+    *p4 = r->a;
+    rc = r->status;
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+// Fill ---
+
+
+// Format +++
+
+static OSStatus
+remote_AudioFormatGetPropertyInfo(AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4) {
+    if (p2 && !p3) return kAudio_ParamError;
+    if (p2 > kIpcMaxRecord - sizeof(IpcRecord)) return kAudio_ParamError;
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcFormatGetPropertyInfo, 0, p2);
+    if (!r) goto fin;
+    r->a = p1;
+    r->b = p2;
+    if (p2) memcpy(PAYLOAD(r), p3, p2);
+    if (!(r = call(&c, r))) goto fin;
+    rc = r->status;
+    if (p4) *p4 = r->a;
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+// Like the converter's, the data goes both ways. FormatInfo completes the
+// ASBD it is given.
+static OSStatus
+remote_AudioFormatGetProperty(AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4, void* p5) {
+    UInt32 size = p4 && p5 ? *p4 : 0;
+    if ((p2 && !p3) || size > kIpcMaxReply - sizeof(IpcRecord)
+        || p2 > kIpcMaxRecord - sizeof(IpcRecord) - kIpcMaxReply) {
+        return kAudio_ParamError;
+    }
+    Call c;
+    if (!lane_take(&c)) return NSExecutableLoadError;
+
+    OSStatus rc = NSExecutableLoadError;
+    IpcRecord* r = post_begin(&c, kIpcFormatGetProperty, 0, p2 + size);
+    if (!r) goto fin;
+    r->a = p1;
+    r->b = p2;
+    r->c = size;
+    r->flags = (p4 ? kIpcHasSize : 0) | (p5 ? kIpcHasData : 0);
+    if (p2) memcpy(PAYLOAD(r), p3, p2);
+    if (size) memcpy(PAYLOAD(r) + p2, p5, size);
+    if (!(r = call(&c, r))) goto fin;
+    rc = r->status;
+    if (p4) {
+        UInt32 got = r->b < PAYLOAD_SIZE(r) ? r->b : PAYLOAD_SIZE(r);
+        if (p5) memcpy(p5, PAYLOAD(r), got < size ? got : size);
+        *p4 = r->b;
+    }
+    reply_done(&c);
+
+fin:
+    lane_give(&c);
+    return rc;
+}
+
+// Format ---
+
+
+// Session +++
+
+#define REMOTE_ENTRY(fn, ...) (void*)remote_ ## fn,
+
+static void* const kRemoteProcs[kProcCount] = {
+    PROC_TABLE(REMOTE_ENTRY)
+};
+
+bool
+remote_set_name(const char* name) {
+    if (!name) {
+        name_[0] = '\0';
+        return true;
+    }
+    size_t n = strlen(name);
+    if (!n || n >= kIpcNameMax) return false;
+    memcpy(name_, name, n + 1);
+    return true;
+}
+
+bool
+remote_wanted(void) {
+    return name_[0] && !disabled_;
+}
+
+void
+remote_disable(void) {
+    disabled_ = true;
+}
+
+// Buf assumed to be kIpcNameMax in size.
+static void
+session_name(char* buf) {
+    static const char kPrefix[] = IPC_DEFAULT_NAME "-";
+    UInt32 nums[2] = { plat_process_id(), (UInt32)plat_fetch_add32(&sessions_, 1) };
+    memcpy(buf, kPrefix, sizeof(kPrefix) - 1);
+    char* p = buf + sizeof(kPrefix) - 1;
+    for (int i = 0; i < 2; ++i) {
+        char digits[10];
+        int n = 0;
+        UInt32 v = nums[i];
+        do {
+            digits[n++] = (char)('0' + v % 10);
+            v /= 10;
+        } while (v);
+        if (i) *p++ = '-';
+        while (n) *p++ = digits[--n];
+    }
+    *p = '\0';
+}
+
+// The session is named after this process, the host maps it by name and
+// the name goes at once, so nobody else can.
+bool
+remote_open(void* procs[kProcCount]) {
+    IpcHello hello = { kIpcMagic, kIpcVersion, plat_process_id(), noErr };
+    session_name(hello.name);
+    IpcMap* map = ipc_map_create(hello.name, sizeof(IpcSession), kIpcBells);
+    if (!map) return false;
+    IpcSession* s = ipc_map_base(map);
+    s->magic = kIpcMagic;
+    s->version = kIpcVersion;
+    s->size = sizeof(IpcSession);
+    s->clientPid = hello.pid;
+
+    IpcConn* conn = ipc_connect(name_);
+    bool ok = conn && ipc_send(conn, &hello, sizeof(hello)) && ipc_recv(conn, &hello, sizeof(hello))
+           && hello.magic == kIpcMagic && hello.status == noErr;
+    ipc_map_unlink(hello.name);
+    if (!ok) {
+        ipc_close(conn);
+        ipc_map_close(map);
+        return false;
+    }
+
+    for (UInt32 i = 0; i < kIpcLanes; ++i) {
+        ring_view(&replies_[i], &s->lanes[i].toClient, s->lanes[i].toClientData, kIpcToClientBytes);
+    }
+    conn_ = conn;
+    map_ = map;
+    session_ = s;
+    plat_store32(&gone_, 0);
+    memcpy(procs, kRemoteProcs, sizeof(kRemoteProcs));
+    return true;
+}
+
+// Closing the connection tells the host to dispose of whatever is left.
+void
+remote_close(void) {
+    ipc_close(conn_);
+    ipc_map_close(map_);
+    conn_ = NULL;
+    map_ = NULL;
+    session_ = NULL;
+}
+
+// Session ---
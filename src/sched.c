@@ -0,0 +1,679 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Stream scheduler, see wat4ff_sched_open().
+ *
+ * Many streams share a few workers instead of a thread each. A stream with
+ * input waits in one worker's queue, live streams in a heap on their
+ * deadline, bulk streams in a FIFO. A worker runs a turn of the stream due
+ * first, a FillComplexBuffer call for quantumPackets packets, and puts the
+ * stream back in line if it has more to do, so bulk streams never hold a
+ * worker for longer than a turn while a live one waits. Once its own queue
+ * is empty, a worker takes the most urgent live stream, or the oldest bulk
+ * one of the longest queue, from another worker.
+ *
+ * The input proc never waits: with the ring empty it returns kNoInputYet,
+ * which ends the call with the packets made so far, and the converter
+ * carries on from there next turn. Pushes wake the stream. Like the
+ * streaming encoder, frames handed to the converter stay in use until the
+ * proc is called again.
+ *
+ * A stream's deadline is deadlineMillis after the oldest push the converter
+ * has not taken in full. Latency is from the push that completes a packet's
+ * input, packet k covering frames up to (k + 1) * fpp - leading, to emit.
+*/
+
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "parallel.h"
+#include "plat.h"
+
+
+enum {
+    kNoInputYet       = -1,       // Input proc result with the ring empty, but more to come
+    kMarks            = 64,
+    kDefaultQuantum   = 1,
+};
+
+enum {
+    kIdle,                        // In no queue, with nothing to do
+    kQueued,
+    kRunning,
+};
+
+static const SInt64 kNoDeadline = (SInt64)(~0ULL >> 1);
+
+// Frames up to end were pushed at time.
+typedef struct Mark {
+    UInt64 end;
+    SInt64 time;
+}Mark;
+
+struct Wat4ffSchedStream {
+    Wat4ffScheduler* sched;
+    AudioConverterRef conv;
+    AudioStreamBasicDescription input;
+    UInt32 outChannels;
+    UInt32 fpp;
+    UInt32 maxPacket;
+    UInt32 quantum;
+    UInt32 leading;
+    SInt64 budget;                    // Nanoseconds, 0 for bulk
+    Wat4ffPacketProc emit;
+    void* emitUser;
+    UInt8* cookie;
+    UInt32 cookieSize;
+    UInt8* ring;
+    UInt64 frames;                    // Ring capacity
+    UInt8* out;
+    AudioStreamPacketDescription* descs;
+    UInt64 packetsOut;                // Worker running it only
+    bool eof;                         // Worker running it only
+
+    SInt64 deadline;                  // Set before it is queued
+    struct Wat4ffSchedStream* next;   // In a bulk queue
+
+    PlatMutex lock;                   // Guards the rest
+    PlatCond cond;                    // Room made, or gone idle
+    UInt32 waiters;
+    UInt32 state;
+    UInt32 home;                      // Worker whose queue it goes to
+    UInt64 pos;                       // Next frame for the converter
+    UInt64 pushed;
+    UInt64 held;                      // Frames from here on are in use
+    Mark marks[kMarks];               // Pushes not yet covered by packets, oldest first
+    UInt32 markFirst;
+    UInt32 markCount;
+    bool end;
+    bool done;
+    bool removed;
+    OSStatus status;
+    AudioConverterPrimeInfo prime;
+    Wat4ffSchedStreamStats stats;
+};
+
+typedef struct Worker {
+    Wat4ffScheduler* sched;
+    UInt32 index;
+    PlatThread thread;
+    bool started;
+
+    PlatMutex lock;                   // Guards the queues
+    Wat4ffSchedStream** live;         // Heap, earliest deadline first
+    UInt32 capacity;
+    Wat4ffSchedStream* bulkHead;
+    Wat4ffSchedStream* bulkTail;
+    volatile SInt32 liveCount;        // Also read without the lock, to pick a victim
+    volatile SInt32 bulkCount;
+    volatile SInt64 urgent;           // Earliest deadline in the heap
+
+    volatile SInt64 quanta;
+    volatile SInt64 steals;
+    volatile SInt64 busyNanos;
+}Worker;
+
+struct Wat4ffScheduler {
+    Worker* workers;
+    UInt32 workerCount;
+    SInt64 opened;
+    volatile SInt32 ready;            // Streams in all queues
+    volatile SInt32 idle;             // Workers asleep, or about to be
+    volatile SInt32 stop;
+
+    PlatMutex lock;                   // Guards the rest, and sleeping
+    PlatCond wake;                    // A stream queued, or stopping
+    UInt32 streamCount;
+    UInt32 nextHome;
+};
+
+
+// Queues +++
+
+static void
+heap_push(Worker* w, Wat4ffSchedStream* s) {
+    UInt32 i = (UInt32)w->liveCount;
+    while (i) {
+        UInt32 parent = (i - 1) / 2;
+        if (w->live[parent]->deadline <= s->deadline) break;
+        w->live[i] = w->live[parent];
+        i = parent;
+    }
+    w->live[i] = s;
+    plat_store32(&w->liveCount, w->liveCount + 1);
+}
+
+static Wat4ffSchedStream*
+heap_pop(Worker* w) {
+    UInt32 n = (UInt32)w->liveCount - 1;
+    Wat4ffSchedStream* top = w->live[0];
+    Wat4ffSchedStream* last = w->live[n];
+    UInt32 i = 0;
+    for (;;) {
+        UInt32 child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && w->live[child + 1]->deadline < w->live[child]->deadline) ++child;
+        if (last->deadline <= w->live[child]->deadline) break;
+        w->live[i] = w->live[child];
+        i = child;
+    }
+    w->live[i] = last;
+    plat_store32(&w->liveCount, (SInt32)n);
+    return top;
+}
+
+// Wakes a sleeping worker, any will do, as it can take from any queue.
+static void
+notify(Wat4ffScheduler* sched) {
+    plat_fence();
+    if (!plat_load32(&sched->idle)) return;
+    plat_mutex_lock(&sched->lock);
+    plat_cond_signal(&sched->wake);
+    plat_mutex_unlock(&sched->lock);
+}
+
+static void
+put(Worker* w, Wat4ffSchedStream* s) {
+    plat_mutex_lock(&w->lock);
+    if (s->budget) {
+        heap_push(w, s);
+        plat_counter_set(&w->urgent, w->live[0]->deadline);
+    }
+    else {
+        s->next = NULL;
+        if (w->bulkTail) w->bulkTail->next = s;
+        else w->bulkHead = s;
+        w->bulkTail = s;
+        plat_store32(&w->bulkCount, w->bulkCount + 1);
+    }
+    plat_fetch_add32(&w->sched->ready, 1);
+    plat_mutex_unlock(&w->lock);
+    notify(w->sched);
+}
+
+static Wat4ffSchedStream*
+take(Worker* w, bool live) {
+    if (!plat_load32(live ? &w->liveCount : &w->bulkCount)) return NULL;
+    Wat4ffSchedStream* s = NULL;
+    plat_mutex_lock(&w->lock);
+    if (live && w->liveCount) {
+        s = heap_pop(w);
+        plat_counter_set(&w->urgent, w->liveCount ? w->live[0]->deadline : kNoDeadline);
+    }
+    else if (!live && w->bulkHead) {
+        s = w->bulkHead;
+        w->bulkHead = s->next;
+        if (!w->bulkHead) w->bulkTail = NULL;
+        plat_store32(&w->bulkCount, w->bulkCount - 1);
+    }
+    if (s) plat_fetch_add32(&w->sched->ready, -1);
+    plat_mutex_unlock(&w->lock);
+    return s;
+}
+
+// Takes the most urgent live stream, or the first bulk stream of the
+// longest queue, from another worker. NULL once they have none.
+static Wat4ffSchedStream*
+steal(Worker* self, bool live) {
+    Wat4ffScheduler* sched = self->sched;
+    for (;;) {
+        Worker* victim = NULL;
+        SInt64 best = kNoDeadline;
+        SInt32 most = 0;
+        for (UInt32 i = 0; i < sched->workerCount; ++i) {
+            Worker* w = &sched->workers[i];
+            if (w == self) continue;
+            if (live) {
+                SInt64 due = plat_counter_get(&w->urgent);
+                if (plat_load32(&w->liveCount) && due <= best) {
+                    victim = w;
+                    best = due;
+                }
+            }
+            else {
+                SInt32 n = plat_load32(&w->bulkCount);
+                if (n > most) {
+                    victim = w;
+                    most = n;
+                }
+            }
+        }
+        if (!victim) return NULL;
+        Wat4ffSchedStream* s = take(victim, live);
+        if (s) {
+            plat_counter_add(&self->steals, 1);
+            return s;
+        }
+    }
+}
+
+// Queues ---
+
+
+// Turns +++
+
+// Due budget after the oldest push the converter has not taken in full,
+// or after now if it has taken them all. Locked.
+static SInt64
+deadline_of(const Wat4ffSchedStream* s, SInt64 now) {
+    if (!s->budget) return 0;
+    for (UInt32 i = 0; i < s->markCount; ++i) {
+        const Mark* m = &s->marks[(s->markFirst + i) % kMarks];
+        if (m->end > s->pos) return m->time + s->budget;
+    }
+    return now + s->budget;
+}
+
+// Books the latency of the last packet of a turn, from the push that
+// completed its input to now. Locked.
+static void
+book_latency(Wat4ffSchedStream* s, SInt64 now) {
+    UInt64 covered = s->packetsOut * s->fpp;
+    covered = covered > s->leading ? covered - s->leading : 1;
+    if (covered > s->pushed) covered = s->pushed;
+    while (s->markCount && s->marks[s->markFirst].end < covered) {
+        s->markFirst = (s->markFirst + 1) % kMarks;
+        --s->markCount;
+    }
+    if (!s->markCount) return;
+
+    SInt64 latency = now - s->marks[s->markFirst].time;
+    if (latency < 1) latency = 1;
+    Wat4ffSchedStreamStats* st = &s->stats;
+    st->totalLatencyNanos += (UInt64)latency;
+    if ((UInt64)latency > st->maxLatencyNanos) st->maxLatencyNanos = (UInt64)latency;
+    int bucket = plat_log2((UInt64)latency);
+    if (bucket >= kWat4ffStatsBuckets) bucket = kWat4ffStatsBuckets - 1;
+    ++st->latency[bucket];
+    if (s->budget && latency > s->budget) ++st->late;
+}
+
+static OSStatus
+sched_feed_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                AudioStreamPacketDescription** descs, void* user) {
+    Wat4ffSchedStream* s = user;
+    plat_mutex_lock(&s->lock);
+    s->held = s->pos;
+    if (s->waiters) plat_cond_broadcast(&s->cond);
+    bool end = s->end;
+    UInt64 at = s->pos % s->frames;
+    UInt64 left = s->pushed - s->pos;
+    if (left > s->frames - at) left = s->frames - at;
+    if (*packets > left) *packets = (UInt32)left;
+    s->pos += *packets;
+    plat_mutex_unlock(&s->lock);
+
+    if (!*packets) {
+        if (!end) return kNoInputYet;
+        s->eof = true;
+        return noErr;
+    }
+    UInt32 bpf = s->input.mBytesPerFrame;
+    data->mBuffers[0].mData = s->ring + at * bpf;
+    data->mBuffers[0].mDataByteSize = *packets * bpf;
+    data->mBuffers[0].mNumberChannels = s->input.mChannelsPerFrame;
+    return noErr;
+}
+
+static void
+run(Worker* w, Wat4ffSchedStream* s) {
+    plat_mutex_lock(&s->lock);
+    bool skip = s->removed;
+    s->state = skip ? kIdle : kRunning;
+    s->home = w->index;
+    if (skip) plat_cond_broadcast(&s->cond);
+    plat_mutex_unlock(&s->lock);
+    if (skip) return;
+
+    SInt64 t0 = plat_now_ns();
+    UInt32 n = s->quantum;
+    AudioBufferList list = { 1, { { s->outChannels, s->maxPacket * n, s->out } } };
+    OSStatus rc = AudioConverterFillComplexBuffer(s->conv, sched_feed_proc, s, &n, &list, s->descs);
+    if (rc == kNoInputYet) rc = noErr;
+    if (rc) n = 0;
+    if (n) s->emit(s->emitUser, s->out, s->descs, n);
+    s->packetsOut += n;
+
+    // Flushed once the converter has seen the end and comes up short.
+    bool flushed = !rc && s->eof && n < s->quantum;
+    AudioConverterPrimeInfo prime = { 0, 0 };
+    UInt32 size = sizeof(prime);
+    if (flushed) AudioConverterGetProperty(s->conv, kAudioConverterPrimeInfo, &size, &prime);
+    SInt64 t1 = plat_now_ns();
+
+    plat_mutex_lock(&s->lock);
+    ++s->stats.quanta;
+    s->stats.packets += n;
+    s->stats.totalNanos += (UInt64)(t1 - t0);
+    if (n) book_latency(s, t1);
+    if (rc || flushed) {
+        s->status = rc;
+        s->prime = prime;
+        s->done = true;
+    }
+    bool again = !s->done && !s->removed && (n == s->quantum || s->pos < s->pushed || s->end);
+    if (again) {
+        s->state = kQueued;
+        s->deadline = deadline_of(s, t1);
+    }
+    else {
+        s->state = kIdle;
+        if (s->waiters) plat_cond_broadcast(&s->cond);
+    }
+    plat_mutex_unlock(&s->lock);
+
+    plat_counter_add(&w->quanta, 1);
+    plat_counter_add(&w->busyNanos, t1 - t0);
+    if (again) put(w, s);
+}
+
+static void
+worker_main(void* param) {
+    Worker* w = param;
+    Wat4ffScheduler* sched = w->sched;
+    while (!plat_load32(&sched->stop)) {
+        Wat4ffSchedStream* s = take(w, true);
+        if (!s) s = steal(w, true);
+        if (!s) s = take(w, false);
+        if (!s) s = steal(w, false);
+        if (s) {
+            run(w, s);
+            continue;
+        }
+
+        plat_fetch_add32(&sched->idle, 1);
+        plat_fence();
+        plat_mutex_lock(&sched->lock);
+        while (!plat_load32(&sched->ready) && !plat_load32(&sched->stop)) plat_cond_wait(&sched->wake, &sched->lock);
+        plat_mutex_unlock(&sched->lock);
+        plat_fetch_add32(&sched->idle, -1);
+    }
+}
+
+// Turns ---
+
+
+// API +++
+
+OSStatus
+wat4ff_sched_open(UInt32 threads, Wat4ffScheduler** sched) {
+    if (!sched) return kAudio_ParamError;
+    *sched = NULL;
+    if (!threads) threads = plat_cpu_count();
+    if (threads > kWat4ffSchedMaxWorkers) threads = kWat4ffSchedMaxWorkers;
+
+    Wat4ffScheduler* d = plat_calloc(sizeof(*d));
+    if (!d) return kAudio_MemFullError;
+    plat_mutex_init(&d->lock);
+    plat_cond_init(&d->wake);
+    d->opened = plat_now_ns();
+
+    OSStatus rc = kAudio_MemFullError;
+    d->workers = plat_calloc(sizeof(Worker) * threads);
+    if (!d->workers) goto fin;
+    d->workerCount = threads;
+    for (UInt32 i = 0; i < threads; ++i) {
+        Worker* w = &d->workers[i];
+        w->sched = d;
+        w->index = i;
+        w->urgent = kNoDeadline;
+        plat_mutex_init(&w->lock);
+    }
+    for (UInt32 i = 0; i < threads; ++i) {
+        Worker* w = &d->workers[i];
+        w->started = plat_thread_start(&w->thread, worker_main, w);
+        if (!w->started) goto fin;
+    }
+    rc = noErr;
+
+fin:
+    if (rc) wat4ff_sched_close(d);
+    else *sched = d;
+    return rc;
+}
+
+static void
+free_stream(Wat4ffSchedStream* s) {
+    if (s->conv) AudioConverterDispose(s->conv);
+    plat_free(s->descs);
+    plat_free(s->out);
+    plat_free(s->ring);
+    plat_free(s->cookie);
+    plat_cond_destroy(&s->cond);
+    plat_mutex_destroy(&s->lock);
+    plat_free(s);
+}
+
+// Makes room in every heap for one more stream, as they may all end up in
+// one, and picks the stream's first worker.
+static OSStatus
+grow_queues(Wat4ffScheduler* sched, Wat4ffSchedStream* s) {
+    OSStatus rc = noErr;
+    plat_mutex_lock(&sched->lock);
+    UInt32 count = sched->streamCount + 1;
+    for (UInt32 i = 0; i < sched->workerCount && !rc; ++i) {
+        Worker* w = &sched->workers[i];
+        if (w->capacity >= count) continue;
+        plat_mutex_lock(&w->lock);
+        Wat4ffSchedStream** live = plat_realloc(w->live, sizeof(*live) * count * 2);
+        if (live) {
+            w->live = live;
+            w->capacity = count * 2;
+        }
+        else {
+            rc = kAudio_MemFullError;
+        }
+        plat_mutex_unlock(&w->lock);
+    }
+    if (!rc) {
+        sched->streamCount = count;
+        s->home = sched->nextHome++ % sched->workerCount;
+    }
+    plat_mutex_unlock(&sched->lock);
+    return rc;
+}
+
+OSStatus
+wat4ff_sched_add(Wat4ffScheduler* sched, const Wat4ffSchedStreamConfig* cfg, Wat4ffSchedStream** stream) {
+    if (!stream) return kAudio_ParamError;
+    *stream = NULL;
+    if (!sched || !cfg || !cfg->emit || cfg->input.mFormatID != kAudioFormatLinearPCM || !cfg->input.mBytesPerFrame
+        || (cfg->input.mFormatFlags & kAudioFormatFlagIsNonInterleaved)) {
+        return kAudio_ParamError;
+    }
+
+    Wat4ffSchedStream* s = plat_calloc(sizeof(*s));
+    if (!s) return kAudio_MemFullError;
+    plat_mutex_init(&s->lock);
+    plat_cond_init(&s->cond);
+    s->sched = sched;
+    s->input = cfg->input;
+    s->outChannels = cfg->output.mChannelsPerFrame;
+    s->frames = cfg->queueFrames ? cfg->queueFrames : (UInt64)cfg->input.mSampleRate;
+    s->quantum = cfg->quantumPackets ? cfg->quantumPackets : kDefaultQuantum;
+    s->budget = (SInt64)cfg->deadlineMillis * 1000000;
+    s->emit = cfg->emit;
+    s->emitUser = cfg->emitUser;
+
+    OSStatus rc = parallel_new_converter(&cfg->input, &cfg->output, cfg->properties, cfg->propertyCount, &s->conv);
+    if (rc) goto fin;
+
+    AudioStreamBasicDescription fmt;
+    UInt32 size = sizeof(fmt);
+    rc = AudioConverterGetProperty(s->conv, kAudioConverterCurrentOutputStreamDescription, &size, &fmt);
+    if (rc) goto fin;
+    s->fpp = fmt.mFramesPerPacket;
+    size = sizeof(s->maxPacket);
+    rc = AudioConverterGetProperty(s->conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &s->maxPacket);
+    if (rc) goto fin;
+    if (!s->fpp || !s->frames) {
+        rc = kAudio_ParamError;
+        goto fin;
+    }
+    AudioConverterPrimeInfo prime = { 0, 0 };
+    size = sizeof(prime);
+    if (!AudioConverterGetProperty(s->conv, kAudioConverterPrimeInfo, &size, &prime)) {
+        s->leading = prime.leadingFrames;
+        s->prime = prime;
+    }
+    rc = parallel_copy_cookie(s->conv, &s->cookie, &s->cookieSize);
+    if (rc) goto fin;
+
+    s->ring = plat_alloc((size_t)(s->frames * cfg->input.mBytesPerFrame));
+    s->out = plat_alloc((size_t)s->maxPacket * s->quantum);
+    s->descs = plat_alloc(sizeof(*s->descs) * s->quantum);
+    if (!s->ring || !s->out || !s->descs) {
+        rc = kAudio_MemFullError;
+        goto fin;
+    }
+    rc = grow_queues(sched, s);
+
+fin:
+    if (rc) free_stream(s);
+    else *stream = s;
+    return rc;
+}
+
+OSStatus
+wat4ff_sched_push(Wat4ffSchedStream* s, bool wait, const void* pcm, UInt32 frames) {
+    if (!s || (!pcm && frames) || frames > s->frames) return kAudio_ParamError;
+    OSStatus rc = noErr;
+    Worker* wake = NULL;
+    plat_mutex_lock(&s->lock);
+    for (;;) {
+        if (s->done) {
+            rc = s->status ? s->status : kAudio_ParamError;
+            goto fin;
+        }
+        if (s->end) {
+            rc = kAudio_ParamError;
+            goto fin;
+        }
+        if (s->frames - (s->pushed - s->held) >= frames) break;
+        if (!wait) {
+            rc = kWat4ffQueueFull;
+            goto fin;
+        }
+        ++s->waiters;
+        plat_cond_wait(&s->cond, &s->lock);
+        --s->waiters;
+    }
+
+    SInt64 now = plat_now_ns();
+    if (frames) {
+        UInt32 bpf = s->input.mBytesPerFrame;
+        UInt64 at = s->pushed % s->frames;
+        UInt64 first = s->frames - at < frames ? s->frames - at : frames;
+        memcpy(s->ring + at * bpf, pcm, (size_t)(first * bpf));
+        if (first < frames) memcpy(s->ring, (const UInt8*)pcm + first * bpf, (size_t)((frames - first) * bpf));
+        s->pushed += frames;
+
+        // Out of marks, the last one grows, which can only overstate latency.
+        if (s->markCount == kMarks) {
+            s->marks[(s->markFirst + kMarks - 1) % kMarks].end = s->pushed;
+        }
+        else {
+            s->marks[(s->markFirst + s->markCount) % kMarks] = (Mark){ s->pushed, now };
+            ++s->markCount;
+        }
+    }
+    else {
+        s->end = true;
+    }
+    if (s->state == kIdle) {
+        s->state = kQueued;
+        s->deadline = deadline_of(s, now);
+        wake = &s->sched->workers[s->home];
+    }
+fin:
+    plat_mutex_unlock(&s->lock);
+    if (wake) put(wake, s);
+    return rc;
+}
+
+OSStatus
+wat4ff_sched_wait(Wat4ffSchedStream* s) {
+    if (!s) return kAudio_ParamError;
+    plat_mutex_lock(&s->lock);
+    ++s->waiters;
+    while (s->state != kIdle) plat_cond_wait(&s->cond, &s->lock);
+    --s->waiters;
+    OSStatus rc = s->status;
+    plat_mutex_unlock(&s->lock);
+    return rc;
+}
+
+void
+wat4ff_sched_get_info(Wat4ffSchedStream* s, Wat4ffStreamInfo* info) {
+    info->framesPerPacket = s->fpp;
+    info->maxPacketSize = s->maxPacket;
+    info->magicCookie = s->cookie;
+    info->magicCookieSize = s->cookieSize;
+    plat_mutex_lock(&s->lock);
+    info->prime = s->prime;
+    plat_mutex_unlock(&s->lock);
+}
+
+void
+wat4ff_sched_get_stream_stats(Wat4ffSchedStream* s, Wat4ffSchedStreamStats* stats) {
+    plat_mutex_lock(&s->lock);
+    *stats = s->stats;
+    plat_mutex_unlock(&s->lock);
+}
+
+void
+wat4ff_sched_get_stats(Wat4ffScheduler* sched, Wat4ffSchedStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    SInt64 elapsed = plat_now_ns() - sched->opened;
+    stats->workerCount = sched->workerCount;
+    for (UInt32 i = 0; i < sched->workerCount; ++i) {
+        Worker* w = &sched->workers[i];
+        Wat4ffSchedWorkerStats* ws = &stats->workers[i];
+        ws->quanta = (UInt64)plat_counter_get(&w->quanta);
+        ws->steals = (UInt64)plat_counter_get(&w->steals);
+        ws->busyNanos = (UInt64)plat_counter_get(&w->busyNanos);
+        ws->elapsedNanos = (UInt64)elapsed;
+    }
+}
+
+void
+wat4ff_sched_remove(Wat4ffSchedStream* s) {
+    if (!s) return;
+    Wat4ffScheduler* sched = s->sched;
+    plat_mutex_lock(&s->lock);
+    s->removed = true;
+    ++s->waiters;
+    while (s->state != kIdle) plat_cond_wait(&s->cond, &s->lock);
+    --s->waiters;
+    plat_mutex_unlock(&s->lock);
+
+    plat_mutex_lock(&sched->lock);
+    --sched->streamCount;
+    plat_mutex_unlock(&sched->lock);
+    free_stream(s);
+}
+
+void
+wat4ff_sched_close(Wat4ffScheduler* sched) {
+    if (!sched) return;
+    plat_mutex_lock(&sched->lock);
+    plat_store32(&sched->stop, 1);
+    plat_cond_broadcast(&sched->wake);
+    plat_mutex_unlock(&sched->lock);
+    for (UInt32 i = 0; i < sched->workerCount; ++i) {
+        Worker* w = &sched->workers[i];
+        if (w->started) plat_thread_join(w->thread);
+        plat_free(w->live);
+        plat_mutex_destroy(&w->lock);
+    }
+    plat_free(sched->workers);
+    plat_cond_destroy(&sched->wake);
+    plat_mutex_destroy(&sched->lock);
+    plat_free(sched);
+}
+
+// API ---
@@ -0,0 +1,304 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Audio output sinks, see wat4ff_sink_register(), and the audio devices
+ * AudioObject lists for them, one per sink.
+ *
+ * Sinks are never removed, so the list is read without a lock: an entry is
+ * filled in before the count that covers it is published.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#endif
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "plat.h"
+#include "sink.h"
+
+#if defined(_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x2
+#endif
+
+
+struct __CFString {
+    const char* cstr;
+};
+
+enum {
+    kMaxSinks    = 16,
+    kFirstDevice = 0x100,               // AudioDeviceID of the first sink
+    kFileBuffer  = 1 << 16,
+    kMaxPath     = 1024,
+};
+
+typedef struct Entry {
+    const Wat4ffSink* sink;
+    struct __CFString uid;
+    struct __CFString name;
+}Entry;
+
+static Entry sinks_[kMaxSinks];
+static volatile SInt32 count_;
+static PlatMutex lock_ = PLAT_MUTEX_INIT; // Serializes registration
+static void* volatile default_;
+static PlatOnce once_ = PLAT_ONCE_INIT;
+
+
+// Null +++
+
+// Plays nothing, in real time. A write returns once what came before it
+// has played, as if the device held one buffer ahead. Written late, it
+// plays on from then.
+typedef struct NullStream {
+    double nanosPerByte;
+    SInt64 base;
+    UInt64 bytes;                       // Written since base
+#ifdef _WIN32
+    HANDLE timer;
+#endif
+}NullStream;
+
+static void
+null_wait(NullStream* s, SInt64 until) {
+#ifdef _WIN32
+    SInt64 left = until - plat_now_ns();
+    if (left <= 0) return;
+    LARGE_INTEGER due = { .QuadPart = -(left / 100) };
+    if (SetWaitableTimer(s->timer, &due, 0, NULL, NULL, FALSE)) WaitForSingleObject(s->timer, INFINITE);
+#else
+    struct timespec ts = { until / 1000000000, until % 1000000000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+#endif
+}
+
+static SInt64
+null_end(const NullStream* s) {
+    return s->base + (SInt64)((double)s->bytes * s->nanosPerByte);
+}
+
+static OSStatus
+null_open(void* user, const AudioStreamBasicDescription* format, void** stream) {
+    UInt32 frame = format->mBytesPerFrame;
+    if (format->mFormatFlags & kAudioFormatFlagIsNonInterleaved) frame *= format->mChannelsPerFrame;
+    if (!frame || format->mSampleRate <= 0) return kAudioFormatUnsupportedDataFormatError;
+
+    NullStream* s = plat_calloc(sizeof(*s));
+    if (!s) return kAudio_MemFullError;
+    s->nanosPerByte = 1e9 / format->mSampleRate / frame;
+#ifdef _WIN32
+    s->timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!s->timer) s->timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+    if (!s->timer) {
+        plat_free(s);
+        return kAudio_MemFullError;
+    }
+#endif
+    *stream = s;
+    return noErr;
+}
+
+static OSStatus
+null_write(void* stream, const void* data, UInt32 bytes) {
+    NullStream* s = stream;
+    SInt64 start = null_end(s);
+    SInt64 now = plat_now_ns();
+    if (start < now) {
+        s->base = start = now;
+        s->bytes = 0;
+    }
+    s->bytes += bytes;
+    null_wait(s, start);
+    return noErr;
+}
+
+static void
+null_close(void* stream, bool drain) {
+    NullStream* s = stream;
+    if (drain) null_wait(s, null_end(s));
+#ifdef _WIN32
+    CloseHandle(s->timer);
+#endif
+    plat_free(s);
+}
+
+static const Wat4ffSink kNullSink = { "null", "wat4ff null output", NULL, null_open, null_write, null_close };
+
+// Null ---
+
+
+// File +++
+
+typedef struct FileStream {
+    FILE* file;
+    char buf[kFileBuffer];              // So stdio allocates nothing on write
+}FileStream;
+
+static OSStatus
+file_open(void* user, const AudioStreamBasicDescription* format, void** stream) {
+    char path[kMaxPath];
+    if (!plat_getenv("WAT4FF_SINK_FILE", path, sizeof(path))) strcpy(path, "wat4ff.pcm");
+
+    FileStream* s = plat_alloc(sizeof(*s));
+    if (!s) return kAudio_MemFullError;
+    s->file = fopen(path, "wb");
+    if (!s->file) {
+        plat_free(s);
+        return kAudioQueueErr_InvalidDevice;
+    }
+    setvbuf(s->file, s->buf, _IOFBF, sizeof(s->buf));
+    *stream = s;
+    return noErr;
+}
+
+static OSStatus
+file_write(void* stream, const void* data, UInt32 bytes) {
+    FileStream* s = stream;
+    return fwrite(data, 1, bytes, s->file) == bytes ? noErr : kAudioQueueErr_InvalidDevice;
+}
+
+static void
+file_close(void* stream, bool drain) {
+    FileStream* s = stream;
+    fclose(s->file);
+    plat_free(s);
+}
+
+static const Wat4ffSink kFileSink = { "file", "wat4ff file output", NULL, file_open, file_write, file_close };
+
+// File ---
+
+
+// Registry +++
+
+static Entry*
+find_entry(const char* uid) {
+    SInt32 n = plat_load32(&count_);
+    for (SInt32 i = 0; i < n; ++i) {
+        if (!strcmp(sinks_[i].uid.cstr, uid)) return &sinks_[i];
+    }
+    return NULL;
+}
+
+static Entry*
+device_entry(AudioObjectID id) {
+    UInt32 i = id - kFirstDevice;
+    return id >= kFirstDevice && i < (UInt32)plat_load32(&count_) ? &sinks_[i] : NULL;
+}
+
+static OSStatus
+add_sink(const Wat4ffSink* sink) {
+    OSStatus rc = kAudio_ParamError;
+    plat_mutex_lock(&lock_);
+    SInt32 n = plat_load32(&count_);
+    if (n == kMaxSinks || find_entry(sink->uid)) goto fin;
+    sinks_[n] = (Entry){ sink, { sink->uid }, { sink->name ? sink->name : sink->uid } };
+    plat_store32(&count_, n + 1);
+    rc = noErr;
+fin:
+    plat_mutex_unlock(&lock_);
+    return rc;
+}
+
+static void
+init_sinks(void) {
+#ifdef WAT4FF_WIN_WAVEOUT
+    add_sink(&sink_waveout_);
+#endif
+    add_sink(&kNullSink);
+    add_sink(&kFileSink);
+
+    char uid[64];
+    Entry* e = plat_getenv("WAT4FF_SINK", uid, sizeof(uid)) ? find_entry(uid) : NULL;
+    plat_publish_ptr(&default_, (void*)(e ? e : &sinks_[0])->sink);
+}
+
+const Wat4ffSink*
+sink_find(const char* uid) {
+    plat_once(&once_, init_sinks);
+    if (!uid) return plat_load_ptr(&default_);
+    Entry* e = find_entry(uid);
+    return e ? e->sink : NULL;
+}
+
+OSStatus
+wat4ff_sink_register(const Wat4ffSink* sink) {
+    if (!sink || !sink->uid || !sink->open || !sink->write || !sink->close) return kAudio_ParamError;
+    plat_once(&once_, init_sinks);
+    return add_sink(sink);
+}
+
+OSStatus
+wat4ff_sink_set_default(const char* uid) {
+    plat_once(&once_, init_sinks);
+    const Wat4ffSink* sink = uid ? sink_find(uid) : sinks_[0].sink;
+    if (!sink) return kAudioQueueErr_InvalidDevice;
+    plat_publish_ptr(&default_, (void*)sink);
+    return noErr;
+}
+
+// Registry ---
+
+
+// Devices +++
+
+const char*
+CFStringGetCStringPtr(CFStringRef p1, CFStringEncoding p2) {
+    return p1 ? p1->cstr : NULL;
+}
+
+OSStatus
+AudioObjectGetPropertyDataSize(AudioObjectID p1, const AudioObjectPropertyAddress* p2, UInt32 p3, const void* p4, UInt32* p5) {
+    if (!p2 || !p5) return kAudio_ParamError;
+    plat_once(&once_, init_sinks);
+    if (p1 == kAudioObjectSystemObject) {
+        if (p2->mSelector != kAudioHardwarePropertyDevices) return kAudio_UnimplementedError;
+        *p5 = (UInt32)plat_load32(&count_) * sizeof(AudioDeviceID);
+        return noErr;
+    }
+    if (!device_entry(p1)) return kAudio_ParamError;
+    if (p2->mSelector != kAudioDevicePropertyDeviceUID && p2->mSelector != kAudioDevicePropertyDeviceNameCFString) {
+        return kAudio_UnimplementedError;
+    }
+    *p5 = sizeof(CFStringRef);
+    return noErr;
+}
+
+OSStatus
+AudioObjectGetPropertyData(AudioObjectID p1, const AudioObjectPropertyAddress* p2, UInt32 p3, const void* p4, UInt32* p5, void* p6) {
+    if (!p2 || !p5 || !p6) return kAudio_ParamError;
+    plat_once(&once_, init_sinks);
+    if (p1 == kAudioObjectSystemObject) {
+        if (p2->mSelector != kAudioHardwarePropertyDevices) return kAudio_UnimplementedError;
+        UInt32 n = (UInt32)plat_load32(&count_);
+        if (n > *p5 / sizeof(AudioDeviceID)) n = *p5 / sizeof(AudioDeviceID);
+        for (UInt32 i = 0; i < n; ++i) ((AudioDeviceID*)p6)[i] = kFirstDevice + i;
+        *p5 = n * sizeof(AudioDeviceID);
+        return noErr;
+    }
+
+    Entry* e = device_entry(p1);
+    if (!e) return kAudio_ParamError;
+    if (*p5 < sizeof(CFStringRef)) return kAudio_ParamError;
+    switch (p2->mSelector) {
+    case kAudioDevicePropertyDeviceUID:
+        *(CFStringRef*)p6 = &e->uid;
+        break;
+    case kAudioDevicePropertyDeviceNameCFString:
+        *(CFStringRef*)p6 = &e->name;
+        break;
+    default:
+        return kAudio_UnimplementedError;
+    }
+    *p5 = sizeof(CFStringRef);
+    return noErr;
+}
+
+// Devices ---
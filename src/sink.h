@@ -0,0 +1,27 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Audio output sinks, and the audio devices AudioObject lists for them.
+*/
+
+#ifndef WAT4FF_SINK_H
+#define WAT4FF_SINK_H
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+
+// Returns the sink with uid, the default for NULL, or NULL if there is
+// none.
+const Wat4ffSink*
+sink_find(const char* uid);
+
+#ifdef WAT4FF_WIN_WAVEOUT
+// The system's default output through waveOut, see sink_win.c. Only
+// built with WAT4FF_WIN_WAVEOUT.
+extern const Wat4ffSink sink_waveout_;
+#endif
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The "waveout" sink, the system's default output through waveOut. winmm
+ * is loaded the first time a stream opens, like CoreAudioToolbox, so
+ * programs that never play need not link it.
+ *
+ * Writes are copied into a few short blocks the device plays in turn, so
+ * the latency past the queue is at most kBlocks of kBlockMillis. Mono and
+ * stereo interleaved little endian PCM only.
+*/
+
+#include <windows.h>
+#include <mmsystem.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "plat.h"
+#include "sink.h"
+
+
+enum {
+    kBlocks      = 4,
+    kBlockMillis = 10,
+};
+
+typedef MMRESULT (WINAPI* WaveOutOpenProc)(LPHWAVEOUT, UINT, LPCWAVEFORMATEX, DWORD_PTR, DWORD_PTR, DWORD);
+typedef MMRESULT (WINAPI* WaveOutHeaderProc)(HWAVEOUT, LPWAVEHDR, UINT);
+typedef MMRESULT (WINAPI* WaveOutProc)(HWAVEOUT);
+
+typedef struct WinMM {
+    WaveOutOpenProc open;
+    WaveOutHeaderProc prepare;
+    WaveOutHeaderProc unprepare;
+    WaveOutHeaderProc write;
+    WaveOutProc reset;
+    WaveOutProc close;
+}WinMM;
+
+typedef struct WaveStream {
+    HWAVEOUT out;
+    HANDLE done;                        // Set by the device as a block finishes
+    WAVEHDR blocks[kBlocks];
+    UInt32 blockBytes;
+    UInt32 next;                        // Block being filled
+    UInt32 fill;                        // Bytes in it
+    UInt8* data;
+}WaveStream;
+
+static WinMM winmm_;
+static bool have_winmm_ = false;
+static PlatOnce winmm_once_ = PLAT_ONCE_INIT;
+
+
+static void
+load_winmm(void) {
+    HMODULE lib = LoadLibraryW(L"winmm.dll");
+    if (!lib) return;
+    winmm_.open = (WaveOutOpenProc)(void*)GetProcAddress(lib, "waveOutOpen");
+    winmm_.prepare = (WaveOutHeaderProc)(void*)GetProcAddress(lib, "waveOutPrepareHeader");
+    winmm_.unprepare = (WaveOutHeaderProc)(void*)GetProcAddress(lib, "waveOutUnprepareHeader");
+    winmm_.write = (WaveOutHeaderProc)(void*)GetProcAddress(lib, "waveOutWrite");
+    winmm_.reset = (WaveOutProc)(void*)GetProcAddress(lib, "waveOutReset");
+    winmm_.close = (WaveOutProc)(void*)GetProcAddress(lib, "waveOutClose");
+    have_winmm_ = winmm_.open && winmm_.prepare && winmm_.unprepare && winmm_.write && winmm_.reset && winmm_.close;
+}
+
+// Sleeps until the block being filled is free to fill.
+static void
+wait_block(WaveStream* s) {
+    volatile WAVEHDR* h = &s->blocks[s->next];
+    while (h->dwFlags & WHDR_INQUEUE) WaitForSingleObject(s->done, INFINITE);
+}
+
+static OSStatus
+submit_block(WaveStream* s) {
+    WAVEHDR* h = &s->blocks[s->next];
+    h->dwBufferLength = s->fill;
+    h->dwFlags &= ~WHDR_DONE;
+    if (winmm_.write(s->out, h, sizeof(*h)) != MMSYSERR_NOERROR) return kAudioQueueErr_InvalidDevice;
+    s->next = (s->next + 1) % kBlocks;
+    s->fill = 0;
+    wait_block(s);
+    return noErr;
+}
+
+static void
+free_stream(WaveStream* s) {
+    for (int i = 0; i < kBlocks; ++i) {
+        if (s->blocks[i].dwFlags & WHDR_PREPARED) winmm_.unprepare(s->out, &s->blocks[i], sizeof(s->blocks[i]));
+    }
+    if (s->out) winmm_.close(s->out);
+    if (s->done) CloseHandle(s->done);
+    plat_free(s->data);
+    plat_free(s);
+}
+
+static OSStatus
+waveout_open(void* user, const AudioStreamBasicDescription* format, void** stream) {
+    plat_once(&winmm_once_, load_winmm);
+    if (!have_winmm_) return kAudioQueueErr_InvalidDevice;
+
+    bool is_float = format->mFormatFlags & kLinearPCMFormatFlagIsFloat;
+    if (format->mFormatFlags & (kAudioFormatFlagIsBigEndian | kAudioFormatFlagIsNonInterleaved)
+        || format->mBitsPerChannel % 8 || format->mBytesPerFrame != format->mChannelsPerFrame * format->mBitsPerChannel / 8
+        || (is_float && format->mBitsPerChannel != 32) || format->mChannelsPerFrame > 2) {
+        return kAudioFormatUnsupportedDataFormatError;
+    }
+
+    OSStatus rc = kAudio_MemFullError;
+    WaveStream* s = plat_calloc(sizeof(*s));
+    if (!s) return rc;
+    s->blockBytes = (UInt32)(format->mSampleRate * kBlockMillis / 1000) * format->mBytesPerFrame;
+    if (!s->blockBytes) s->blockBytes = format->mBytesPerFrame;
+    s->data = plat_alloc((size_t)s->blockBytes * kBlocks);
+    s->done = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (!s->data || !s->done) goto fin;
+
+    WAVEFORMATEX wf = {
+        .wFormatTag      = is_float ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM,
+        .nChannels       = (WORD)format->mChannelsPerFrame,
+        .nSamplesPerSec  = (DWORD)format->mSampleRate,
+        .nAvgBytesPerSec = (DWORD)format->mSampleRate * format->mBytesPerFrame,
+        .nBlockAlign     = (WORD)format->mBytesPerFrame,
+        .wBitsPerSample  = (WORD)format->mBitsPerChannel,
+    };
+    rc = kAudioQueueErr_InvalidDevice;
+    if (winmm_.open(&s->out, WAVE_MAPPER, &wf, (DWORD_PTR)s->done, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+        s->out = NULL;
+        goto fin;
+    }
+    for (int i = 0; i < kBlocks; ++i) {
+        s->blocks[i].lpData = (LPSTR)s->data + (size_t)i * s->blockBytes;
+        s->blocks[i].dwBufferLength = s->blockBytes;
+        if (winmm_.prepare(s->out, &s->blocks[i], sizeof(s->blocks[i])) != MMSYSERR_NOERROR) goto fin;
+    }
+    *stream = s;
+    return noErr;
+
+fin:
+    free_stream(s);
+    return rc;
+}
+
+static OSStatus
+waveout_write(void* stream, const void* data, UInt32 bytes) {
+    WaveStream* s = stream;
+    const UInt8* p = data;
+    while (bytes) {
+        UInt32 n = s->blockBytes - s->fill;
+        if (n > bytes) n = bytes;
+        memcpy(s->blocks[s->next].lpData + s->fill, p, n);
+        s->fill += n;
+        p += n;
+        bytes -= n;
+        if (s->fill == s->blockBytes) {
+            OSStatus rc = submit_block(s);
+            if (rc) return rc;
+        }
+    }
+    return noErr;
+}
+
+static void
+waveout_close(void* stream, bool drain) {
+    WaveStream* s = stream;
+    if (drain) {
+        if (s->fill) submit_block(s);
+        for (int i = 0; i < kBlocks; ++i) {
+            s->next = i;
+            wait_block(s);
+        }
+    }
+    else {
+        winmm_.reset(s->out);
+    }
+    free_stream(s);
+}
+
+const Wat4ffSink sink_waveout_ = { "waveout", "Default output (waveOut)", NULL, waveout_open, waveout_write, waveout_close };
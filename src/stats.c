@@ -0,0 +1,234 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Per procedure call statistics, see stats.h.
+ *
+ * Counters live in kShards cache line aligned copies, each thread sticks to
+ * one, so concurrent streams rarely write the same line. Readers add the
+ * shards up. Nothing on the hot path takes a lock.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wat4ff.h>
+
+#include "procs.h"
+#include "stats.h"
+
+
+#ifdef WAT4FF_ENABLE_STATS
+
+enum {
+    kShards = 16,
+};
+
+typedef struct ProcCounters {
+    volatile SInt64 calls;
+    volatile SInt64 errors;
+    volatile SInt64 totalNanos;
+    volatile SInt64 maxNanos;
+    volatile SInt64 callbackCalls;
+    volatile SInt64 callbackNanos;
+    volatile SInt64 latency[kWat4ffStatsBuckets];
+}ProcCounters;
+
+typedef struct Shard {
+    _Alignas(64) ProcCounters procs[kProcCount];
+}Shard;
+
+// Error statuses are rare, so they share one table per procedure.
+// A slot is free while its status is noErr, and claimed once by a CAS of
+// the status itself, which never changes after.
+typedef struct StatusTable {
+    volatile SInt32 status[kWat4ffStatsStatuses];
+    volatile SInt64 count[kWat4ffStatsStatuses];
+    volatile SInt64 other;
+}StatusTable;
+
+static const char* const kNames[kProcCount] = {
+    PROC_TABLE(PROC_NAME)
+};
+
+static Shard shards_[kShards];
+static StatusTable statuses_[kProcCount];
+static volatile SInt32 next_shard_ = 0;
+static PLAT_THREAD_LOCAL int shard_ = -1;
+static FILE* dump_file_ = NULL;
+
+
+static ProcCounters*
+counters(int proc) {
+    if (shard_ < 0) shard_ = (int)((UInt32)plat_fetch_add32(&next_shard_, 1) % kShards);
+    return &shards_[shard_].procs[proc];
+}
+
+static void
+record_status(int proc, OSStatus rc) {
+    StatusTable* t = &statuses_[proc];
+    for (int i = 0; i < kWat4ffStatsStatuses; ++i) {
+        // Losing the race to the same status counts it all the same.
+        SInt32 s = plat_load32(&t->status[i]);
+        if (s == noErr && !plat_cas32(&t->status[i], noErr, rc)) s = plat_load32(&t->status[i]);
+        if (s == noErr || s == rc) {
+            plat_counter_add(&t->count[i], 1);
+            return;
+        }
+    }
+    plat_counter_add(&t->other, 1);
+}
+
+void
+stats_record(int proc, OSStatus rc, SInt64 nanos) {
+    ProcCounters* c = counters(proc);
+    if (nanos < 1) nanos = 1;
+    int bucket = plat_log2((UInt64)nanos);
+    if (bucket >= kWat4ffStatsBuckets) bucket = kWat4ffStatsBuckets - 1;
+
+    plat_counter_add(&c->calls, 1);
+    plat_counter_add(&c->totalNanos, nanos);
+    plat_counter_max(&c->maxNanos, nanos);
+    plat_counter_add(&c->latency[bucket], 1);
+    if (rc != noErr) {
+        plat_counter_add(&c->errors, 1);
+        record_status(proc, rc);
+    }
+}
+
+OSStatus
+stats_input_proc(AudioConverterRef p1, UInt32* p2, AudioBufferList* p3, AudioStreamPacketDescription** p4, void* p5) {
+    const StatsInput* in = p5;
+    SInt64 t0 = plat_now_ns();
+    OSStatus rc = in->proc(p1, p2, p3, p4, in->data);
+    SInt64 nanos = plat_now_ns() - t0;
+
+    ProcCounters* c = counters(kProc_AudioConverterFillComplexBuffer);
+    plat_counter_add(&c->callbackCalls, 1);
+    plat_counter_add(&c->callbackNanos, nanos);
+    return rc;
+}
+
+bool
+wat4ff_get_stats(Wat4ffStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->procCount = kProcCount;
+
+    for (int p = 0; p < kProcCount; ++p) {
+        Wat4ffProcStats* out = &stats->procs[p];
+        out->name = kNames[p];
+        for (int s = 0; s < kShards; ++s) {
+            ProcCounters* c = &shards_[s].procs[p];
+            out->calls += plat_counter_get(&c->calls);
+            out->errors += plat_counter_get(&c->errors);
+            out->totalNanos += plat_counter_get(&c->totalNanos);
+            out->callbackCalls += plat_counter_get(&c->callbackCalls);
+            out->callbackNanos += plat_counter_get(&c->callbackNanos);
+            SInt64 mx = plat_counter_get(&c->maxNanos);
+            if ((UInt64)mx > out->maxNanos) out->maxNanos = mx;
+            for (int b = 0; b < kWat4ffStatsBuckets; ++b) out->latency[b] += plat_counter_get(&c->latency[b]);
+        }
+
+        StatusTable* t = &statuses_[p];
+        int n = 0;
+        for (int i = 0; i < kWat4ffStatsStatuses; ++i) {
+            SInt32 s = plat_load32(&t->status[i]);
+            if (s == noErr) continue;
+            out->statuses[n].status = s;
+            out->statuses[n].count = plat_counter_get(&t->count[i]);
+            ++n;
+        }
+        out->otherErrors = plat_counter_get(&t->other);
+    }
+    return true;
+}
+
+void
+wat4ff_reset_stats(void) {
+    for (int s = 0; s < kShards; ++s) {
+        for (int p = 0; p < kProcCount; ++p) {
+            ProcCounters* c = &shards_[s].procs[p];
+            volatile SInt64* v = &c->calls;
+            for (size_t i = 0; i < sizeof(*c) / sizeof(*v); ++i) plat_counter_set(&v[i], 0);
+        }
+    }
+    for (int p = 0; p < kProcCount; ++p) {
+        StatusTable* t = &statuses_[p];
+        for (int i = 0; i < kWat4ffStatsStatuses; ++i) plat_counter_set(&t->count[i], 0);
+        plat_counter_set(&t->other, 0);
+    }
+}
+
+// Upper bound of the bucket holding the q-th fraction of calls, capped by
+// the slowest call actually seen.
+static double
+percentile_us(const Wat4ffProcStats* s, double q) {
+    UInt64 want = (UInt64)(s->calls * q);
+    UInt64 seen = 0;
+    for (int b = 0; b < kWat4ffStatsBuckets; ++b) {
+        seen += s->latency[b];
+        if (seen > want) {
+            UInt64 bound = (UInt64)2 << b;
+            return (bound < s->maxNanos ? bound : s->maxNanos) / 1e3;
+        }
+    }
+    return s->maxNanos / 1e3;
+}
+
+static void
+dump(void) {
+    static Wat4ffStats stats;
+    wat4ff_get_stats(&stats);
+    FILE* f = dump_file_ ? dump_file_ : stderr;
+
+    fprintf(f, "wat4ff stats\n");
+    fprintf(f, "%-32s %10s %8s %12s %10s %10s %10s %10s\n",
+            "proc", "calls", "errors", "total ms", "avg us", "p50 us", "p99 us", "max us");
+    for (UInt32 p = 0; p < stats.procCount; ++p) {
+        const Wat4ffProcStats* s = &stats.procs[p];
+        if (!s->calls) continue;
+        fprintf(f, "%-32s %10llu %8llu %12.3f %10.3f %10.3f %10.3f %10.3f\n",
+                s->name, (unsigned long long)s->calls, (unsigned long long)s->errors,
+                s->totalNanos / 1e6, s->totalNanos / 1e3 / s->calls,
+                percentile_us(s, 0.5), percentile_us(s, 0.99), s->maxNanos / 1e3);
+        if (s->callbackCalls) {
+            fprintf(f, "  input proc: %llu calls, %.3f ms, %.1f%% of the total\n",
+                    (unsigned long long)s->callbackCalls, s->callbackNanos / 1e6,
+                    s->totalNanos ? 100.0 * s->callbackNanos / s->totalNanos : 0.0);
+        }
+        // A reset leaves statuses in place with a count of 0.
+        for (int i = 0; i < kWat4ffStatsStatuses && s->statuses[i].status; ++i) {
+            if (!s->statuses[i].count) continue;
+            fprintf(f, "  status %d: %llu\n", (int)s->statuses[i].status, (unsigned long long)s->statuses[i].count);
+        }
+        if (s->otherErrors) fprintf(f, "  other statuses: %llu\n", (unsigned long long)s->otherErrors);
+    }
+    if (dump_file_) fclose(dump_file_);
+}
+
+static void
+dump_from_env(void) {
+    char val[260];
+    if (!plat_getenv("WAT4FF_STATS", val, sizeof(val))) return;
+    if (!strcmp(val, "0")) return;
+
+    if (strcmp(val, "1")) dump_file_ = fopen(val, "w");
+    atexit(dump);
+}
+
+PLAT_CONSTRUCTOR(dump_from_env)
+
+#else
+
+bool
+wat4ff_get_stats(Wat4ffStats* stats) {
+    return false;
+}
+
+void
+wat4ff_reset_stats(void) {
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Per procedure call statistics. Compiled in with WAT4FF_ENABLE_STATS,
+ * otherwise every hook below expands to nothing.
+*/
+
+#ifndef WAT4FF_STATS_H
+#define WAT4FF_STATS_H
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "plat.h"
+
+
+#ifdef WAT4FF_ENABLE_STATS
+
+typedef struct StatsInput {
+    AudioConverterComplexInputDataProc proc;
+    void* data;
+}StatsInput;
+
+void
+stats_record(int proc, OSStatus rc, SInt64 nanos);
+
+// Times the caller's input proc, so FillComplexBuffer time splits into
+// codec and callback.
+OSStatus
+stats_input_proc(AudioConverterRef p1, UInt32* p2, AudioBufferList* p3, AudioStreamPacketDescription** p4, void* p5);
+
+#define STATS_ENTER() SInt64 stats_t0_ = plat_now_ns()
+#define STATS_LEAVE(proc, rc) stats_record(proc, rc, plat_now_ns() - stats_t0_)
+#define WRAP_INPUT(p1, p2, p3, p4, p5, p6) \
+    (p1, p2 ? stats_input_proc : NULL, &(StatsInput){ p2, p3 }, p4, p5, p6)
+
+#else
+
+#define STATS_ENTER() (void)0
+#define STATS_LEAVE(proc, rc) (void)0
+#define WRAP_INPUT(...) (__VA_ARGS__)
+
+#endif
+
+#endif
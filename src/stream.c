@@ -0,0 +1,360 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Streaming encoder, see wat4ff_enc_open().
+ *
+ * Pushed PCM goes into a ring the converter reads in place on the worker
+ * thread. A converter may keep using what its input proc handed it until the
+ * proc is called again, so only frames before that are free to overwrite.
+ * Encoded packets come out in blocks, one per FillComplexBuffer call, and
+ * wait in a queue of depth blocks to be pulled. Each call asks for the
+ * packets the queued input covers, so packets are not held back waiting for
+ * a full block.
+*/
+
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "parallel.h"
+#include "plat.h"
+
+
+enum {
+    kPacketsPerFill   = 64,
+    kDefaultDepth     = 2,
+    kStoppedError     = -1,       // Input proc result once the encoder is closed
+    kMaxPlanes        = 64,
+    kNoSampleFormat   = kWat4ffSampleCount,
+};
+
+typedef struct Block {
+    UInt8* data;
+    AudioStreamPacketDescription descs[kPacketsPerFill];
+    UInt32 count;
+    UInt32 taken;                     // Packets pulled so far
+}Block;
+
+struct Wat4ffStreamEncoder {
+    AudioConverterRef conv;
+    AudioStreamBasicDescription input;
+    UInt32 ringFormat;                // kWat4ffSample* of input, or kNoSampleFormat
+    UInt32 outChannels;
+    UInt32 fpp;
+    UInt32 maxPacket;
+    UInt8* cookie;
+    UInt32 cookieSize;
+    UInt8* ring;
+    UInt64 frames;                    // Ring capacity
+    Block* blocks;
+    UInt32 depth;
+    UInt64 pos;                       // Next frame for the converter, worker only
+    PlatThread thread;
+    bool started;
+
+    PlatMutex lock;                   // Guards the rest
+    PlatCond work;                    // Input pushed, a block pulled, or closing
+    PlatCond caller;                  // Input let go of, a block filled, or done
+    UInt64 pushed;
+    UInt64 held;                      // Frames from here on are in use
+    UInt64 filled;                    // Blocks
+    UInt64 drained;
+    bool end;
+    bool stop;
+    bool done;
+    OSStatus status;
+    AudioConverterPrimeInfo prime;
+};
+
+
+// Worker +++
+
+static OSStatus
+stream_feed_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                 AudioStreamPacketDescription** descs, void* user) {
+    Wat4ffStreamEncoder* e = user;
+    plat_mutex_lock(&e->lock);
+    e->held = e->pos;
+    plat_cond_broadcast(&e->caller);
+    while (e->pos == e->pushed && !e->end && !e->stop) plat_cond_wait(&e->work, &e->lock);
+    bool stop = e->stop;
+    UInt64 left = e->pushed - e->pos;
+    plat_mutex_unlock(&e->lock);
+    if (stop) {
+        *packets = 0;
+        return kStoppedError;
+    }
+
+    UInt64 at = e->pos % e->frames;
+    if (left > e->frames - at) left = e->frames - at;
+    if (*packets > left) *packets = (UInt32)left;
+    UInt32 bpf = e->input.mBytesPerFrame;
+    data->mBuffers[0].mData = e->ring + at * bpf;
+    data->mBuffers[0].mDataByteSize = *packets * bpf;
+    data->mBuffers[0].mNumberChannels = e->input.mChannelsPerFrame;
+    e->pos += *packets;
+    return noErr;
+}
+
+static void
+worker_main(void* param) {
+    Wat4ffStreamEncoder* e = param;
+    OSStatus rc = noErr;
+    for (;;) {
+        plat_mutex_lock(&e->lock);
+        while (e->filled - e->drained == e->depth && !e->stop) plat_cond_wait(&e->work, &e->lock);
+        bool stop = e->stop;
+        bool end = e->end;
+        UInt64 ready = e->pushed - e->pos;
+        Block* b = &e->blocks[e->filled % e->depth];
+        plat_mutex_unlock(&e->lock);
+        if (stop) break;
+
+        UInt32 n = kPacketsPerFill;
+        if (!end && ready / e->fpp < n) n = ready >= e->fpp ? (UInt32)(ready / e->fpp) : 1;
+        AudioBufferList list = { 1, { { e->outChannels, e->maxPacket * n, b->data } } };
+        rc = AudioConverterFillComplexBuffer(e->conv, stream_feed_proc, e, &n, &list, b->descs);
+        if (rc || !n) break;
+
+        b->count = n;
+        b->taken = 0;
+        plat_mutex_lock(&e->lock);
+        ++e->filled;
+        plat_cond_broadcast(&e->caller);
+        plat_mutex_unlock(&e->lock);
+    }
+
+    AudioConverterPrimeInfo prime = { 0, 0 };
+    UInt32 size = sizeof(prime);
+    if (!rc) AudioConverterGetProperty(e->conv, kAudioConverterPrimeInfo, &size, &prime);
+
+    plat_mutex_lock(&e->lock);
+    e->status = rc;
+    e->prime = prime;
+    e->done = true;
+    plat_cond_broadcast(&e->caller);
+    plat_mutex_unlock(&e->lock);
+}
+
+// Worker ---
+
+
+// API +++
+
+OSStatus
+wat4ff_enc_open(const Wat4ffStreamConfig* cfg, Wat4ffStreamEncoder** enc) {
+    if (!enc) return kAudio_ParamError;
+    *enc = NULL;
+    if (!cfg || cfg->input.mFormatID != kAudioFormatLinearPCM || !cfg->input.mBytesPerFrame
+        || (cfg->input.mFormatFlags & kAudioFormatFlagIsNonInterleaved)) {
+        return kAudio_ParamError;
+    }
+
+    Wat4ffStreamEncoder* e = plat_calloc(sizeof(*e));
+    if (!e) return kAudio_MemFullError;
+    plat_mutex_init(&e->lock);
+    plat_cond_init(&e->work);
+    plat_cond_init(&e->caller);
+    e->input = cfg->input;
+    if (!wat4ff_pcm_sample_format(&cfg->input, &e->ringFormat)) e->ringFormat = kNoSampleFormat;
+    e->outChannels = cfg->output.mChannelsPerFrame;
+    e->frames = cfg->queueFrames ? cfg->queueFrames : (UInt64)cfg->input.mSampleRate;
+    e->depth = cfg->depth ? cfg->depth : kDefaultDepth;
+
+    OSStatus rc = parallel_new_converter(&cfg->input, &cfg->output, cfg->properties, cfg->propertyCount, &e->conv);
+    if (rc) goto fin;
+
+    AudioStreamBasicDescription fmt;
+    UInt32 size = sizeof(fmt);
+    rc = AudioConverterGetProperty(e->conv, kAudioConverterCurrentOutputStreamDescription, &size, &fmt);
+    if (rc) goto fin;
+    e->fpp = fmt.mFramesPerPacket;
+    size = sizeof(e->maxPacket);
+    rc = AudioConverterGetProperty(e->conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &e->maxPacket);
+    if (rc) goto fin;
+    if (!e->fpp || !e->frames) {
+        rc = kAudio_ParamError;
+        goto fin;
+    }
+    rc = parallel_copy_cookie(e->conv, &e->cookie, &e->cookieSize);
+    if (rc) goto fin;
+
+    e->ring = plat_alloc((size_t)(e->frames * cfg->input.mBytesPerFrame));
+    e->blocks = plat_calloc(sizeof(Block) * e->depth);
+    if (!e->ring || !e->blocks) {
+        rc = kAudio_MemFullError;
+        goto fin;
+    }
+    for (UInt32 i = 0; i < e->depth; ++i) {
+        e->blocks[i].data = plat_alloc((size_t)e->maxPacket * kPacketsPerFill);
+        if (!e->blocks[i].data) {
+            rc = kAudio_MemFullError;
+            goto fin;
+        }
+    }
+
+    e->started = plat_thread_start(&e->thread, worker_main, e);
+    if (!e->started) rc = kAudio_MemFullError;
+
+fin:
+    if (rc) wat4ff_enc_close(e);
+    else *enc = e;
+    return rc;
+}
+
+// Waits for room for frames, locked, and sets *at to where they go.
+// 0 frames ends the input.
+static OSStatus
+reserve(Wat4ffStreamEncoder* e, bool wait, UInt32 frames, UInt64* at) {
+    OSStatus rc = noErr;
+    plat_mutex_lock(&e->lock);
+    if (e->end) {
+        rc = kAudio_ParamError;
+    }
+    else if (!frames) {
+        e->end = true;
+        plat_cond_broadcast(&e->work);
+    }
+    else {
+        // Without wait, only as long as the worker can make room by itself.
+        for (;;) {
+            if (e->done) {
+                rc = e->status ? e->status : kAudio_ParamError;
+                break;
+            }
+            if (e->frames - (e->pushed - e->held) >= frames) break;
+            if (!wait && e->filled - e->drained == e->depth) {
+                rc = kWat4ffQueueFull;
+                break;
+            }
+            plat_cond_wait(&e->caller, &e->lock);
+        }
+    }
+    *at = e->pushed % e->frames;
+    plat_mutex_unlock(&e->lock);
+    return rc;
+}
+
+// The room is ours until pushed moves past it.
+static void
+commit(Wat4ffStreamEncoder* e, UInt32 frames) {
+    plat_mutex_lock(&e->lock);
+    e->pushed += frames;
+    plat_cond_broadcast(&e->work);
+    plat_mutex_unlock(&e->lock);
+}
+
+OSStatus
+wat4ff_enc_push(Wat4ffStreamEncoder* e, bool wait, const void* pcm, UInt32 frames) {
+    if (!e || (!pcm && frames) || frames > e->frames) return kAudio_ParamError;
+    UInt64 at;
+    OSStatus rc = reserve(e, wait, frames, &at);
+    if (rc || !frames) return rc;
+
+    UInt32 bpf = e->input.mBytesPerFrame;
+    UInt64 first = e->frames - at < frames ? e->frames - at : frames;
+    memcpy(e->ring + at * bpf, pcm, (size_t)(first * bpf));
+    if (first < frames) memcpy(e->ring, (const UInt8*)pcm + first * bpf, (size_t)((frames - first) * bpf));
+    commit(e, frames);
+    return noErr;
+}
+
+OSStatus
+wat4ff_enc_push_planes(Wat4ffStreamEncoder* e, bool wait, const void* const* planes, UInt32 format,
+                       UInt32 frames) {
+    if (!e || (!planes && frames) || frames > e->frames || format >= kWat4ffSampleCount
+        || e->ringFormat == kNoSampleFormat || e->input.mChannelsPerFrame > kMaxPlanes) {
+        return kAudio_ParamError;
+    }
+    UInt64 at;
+    OSStatus rc = reserve(e, wait, frames, &at);
+    if (rc || !frames) return rc;
+
+    UInt32 channels = e->input.mChannelsPerFrame;
+    UInt32 bpf = e->input.mBytesPerFrame;
+    UInt32 first = e->frames - at < frames ? (UInt32)(e->frames - at) : frames;
+    wat4ff_pcm_interleave(e->ring + at * bpf, e->ringFormat, planes, format, channels, first);
+    if (first < frames) {
+        const void* rest[kMaxPlanes];
+        UInt32 size = format == kWat4ffSampleS16 ? 2 : 4;
+        for (UInt32 c = 0; c < channels; ++c) rest[c] = (const UInt8*)planes[c] + (size_t)first * size;
+        wat4ff_pcm_interleave(e->ring, e->ringFormat, rest, format, channels, frames - first);
+    }
+    commit(e, frames);
+    return noErr;
+}
+
+OSStatus
+wat4ff_enc_pull(Wat4ffStreamEncoder* e, bool wait, UInt8* data, UInt32 dataSize,
+                AudioStreamPacketDescription* packets, UInt32* count) {
+    if (!e || !count || (*count && (!data || !packets))) return kAudio_ParamError;
+    UInt32 want = *count;
+    UInt32 got = 0;
+    UInt32 used = 0;
+    *count = 0;
+
+    OSStatus rc = noErr;
+    plat_mutex_lock(&e->lock);
+    while (wait && e->drained == e->filled && !e->done) plat_cond_wait(&e->caller, &e->lock);
+    while (got < want && e->drained < e->filled) {
+        Block* b = &e->blocks[e->drained % e->depth];
+        for (; b->taken < b->count && got < want; ++b->taken, ++got) {
+            const AudioStreamPacketDescription* d = &b->descs[b->taken];
+            if (d->mDataByteSize > dataSize - used) break;
+            memcpy(data + used, b->data + d->mStartOffset, d->mDataByteSize);
+            packets[got] = *d;
+            packets[got].mStartOffset = used;
+            used += d->mDataByteSize;
+        }
+        if (b->taken < b->count) break;
+        ++e->drained;
+        plat_cond_broadcast(&e->work);
+    }
+    if (!got && want) {
+        if (e->drained < e->filled) rc = kAudio_ParamError;
+        else if (e->done) rc = e->status ? e->status : kWat4ffEndOfStream;
+    }
+    plat_mutex_unlock(&e->lock);
+
+    *count = got;
+    return rc;
+}
+
+void
+wat4ff_enc_get_info(Wat4ffStreamEncoder* e, Wat4ffStreamInfo* info) {
+    info->framesPerPacket = e->fpp;
+    info->maxPacketSize = e->maxPacket;
+    info->magicCookie = e->cookie;
+    info->magicCookieSize = e->cookieSize;
+    plat_mutex_lock(&e->lock);
+    info->prime = e->prime;
+    plat_mutex_unlock(&e->lock);
+}
+
+void
+wat4ff_enc_close(Wat4ffStreamEncoder* e) {
+    if (!e) return;
+    if (e->started) {
+        plat_mutex_lock(&e->lock);
+        e->stop = true;
+        plat_cond_broadcast(&e->work);
+        plat_mutex_unlock(&e->lock);
+        plat_thread_join(e->thread);
+    }
+    if (e->conv) AudioConverterDispose(e->conv);
+    if (e->blocks) {
+        for (UInt32 i = 0; i < e->depth; ++i) plat_free(e->blocks[i].data);
+    }
+    plat_free(e->blocks);
+    plat_free(e->ring);
+    plat_free(e->cookie);
+    plat_cond_destroy(&e->caller);
+    plat_cond_destroy(&e->work);
+    plat_mutex_destroy(&e->lock);
+    plat_free(e);
+}
+
+// API ---
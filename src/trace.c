@@ -0,0 +1,210 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Timeline tracing of converter calls, see trace.h. Output is Chrome
+ * trace-event JSON, open it in chrome://tracing or ui.perfetto.dev.
+ *
+ * Each thread appends to its own chunk of events and publishes the count
+ * with a release store, so recording takes no locks. Full chunks stay on a
+ * global push-only list until the process exits. The first start sets the
+ * cap and origin before it publishes trace_enabled_, and the path is only
+ * touched holding flushing_.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wat4ff.h>
+
+#include "procs.h"
+#include "trace.h"
+
+
+#ifdef WAT4FF_ENABLE_TRACE
+
+enum {
+    kChunkEvents      = 4096,
+    kDefaultMaxEvents = 1 << 20,
+    kMaxPath          = 1024,
+};
+
+typedef struct TraceEvent {
+    SInt64      begin;
+    SInt64      end;
+    const void* conv;
+    UInt32      arg1;
+    UInt32      arg2;
+    SInt32      status;
+    SInt32      proc;
+}TraceEvent;
+
+typedef struct Chunk {
+    struct Chunk*   next;
+    UInt32          tid;
+    volatile SInt32 count;
+    TraceEvent      events[kChunkEvents];
+}Chunk;
+
+static const char* const kNames[kProcCount] = {
+    PROC_TABLE(PROC_NAME)
+};
+
+PlatFlag trace_enabled_ = 0;
+
+static PlatFlag started_ = 0;
+static char path_[kMaxPath];
+static SInt64 origin_ = 0;
+static void* volatile chunks_ = NULL;
+static volatile SInt64 chunks_left_ = 0;
+static volatile SInt64 dropped_ = 0;
+static PlatFlag flushing_ = 0;
+static PLAT_THREAD_LOCAL Chunk* chunk_ = NULL;
+
+
+static Chunk*
+new_chunk(void) {
+    // Takers past the cap drive the count below zero and get nothing.
+    if (plat_counter_add(&chunks_left_, -1) < 0) return NULL;
+
+    Chunk* c = plat_calloc(sizeof(*c));
+    if (!c) return NULL;
+    c->tid = plat_thread_id();
+
+    void* head;
+    do {
+        head = plat_load_ptr(&chunks_);
+        c->next = head;
+    } while (!plat_cas_ptr(&chunks_, head, c));
+    return c;
+}
+
+void
+trace_event(int proc, SInt64 begin, const void* conv, UInt32 arg1, UInt32 arg2, OSStatus rc) {
+    SInt64 end = plat_now_ns();
+    Chunk* c = chunk_;
+    if (!c || c->count == kChunkEvents) {
+        c = chunk_ = new_chunk();
+        if (!c) {
+            plat_counter_add(&dropped_, 1);
+            return;
+        }
+    }
+
+    TraceEvent* e = &c->events[c->count];
+    e->begin = begin;
+    e->end = end;
+    e->conv = conv;
+    e->arg1 = arg1;
+    e->arg2 = arg2;
+    e->status = rc;
+    e->proc = proc;
+    plat_store32(&c->count, c->count + 1);
+}
+
+static void
+write_fourcc(FILE* f, UInt32 v) {
+    char s[5] = { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v, 0 };
+    for (int i = 0; i < 4; ++i) {
+        if (s[i] < 0x20 || s[i] > 0x7e || s[i] == '"' || s[i] == '\\') {
+            fprintf(f, "%u", v);
+            return;
+        }
+    }
+    fprintf(f, "\"%s\"", s);
+}
+
+static void
+write_event(FILE* f, UInt32 pid, UInt32 tid, const TraceEvent* e, bool first) {
+    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"wat4ff\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,"
+               "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"converter\":\"%p\",\"status\":%d",
+            first ? "" : ",", kNames[e->proc], pid, tid,
+            (e->begin - origin_) / 1e3, (e->end - e->begin) / 1e3, e->conv, (int)e->status);
+
+    if (e->proc == kProc_AudioConverterFillComplexBuffer) {
+        fprintf(f, ",\"asked\":%u,\"produced\":%u", e->arg1, e->arg2);
+    }
+    else if (e->proc == kProc_AudioConverterSetProperty) {
+        fprintf(f, ",\"property\":");
+        write_fourcc(f, e->arg1);
+    }
+    fprintf(f, "}}");
+}
+
+bool
+wat4ff_trace_start(const char* path) {
+    size_t n = strlen(path);
+    if (!n || n >= kMaxPath) return false;
+
+    while (!plat_flag_test_and_set(&flushing_)) plat_yield();
+    memcpy(path_, path, n + 1);
+    plat_store32((volatile SInt32*)&flushing_, 0);
+
+    if (plat_flag_test_and_set(&started_)) {
+        SInt64 max_events = kDefaultMaxEvents;
+        char val[32];
+        if (plat_getenv("WAT4FF_TRACE_EVENTS", val, sizeof(val)) && atoll(val) > 0) max_events = atoll(val);
+        plat_counter_set(&chunks_left_, (max_events + kChunkEvents - 1) / kChunkEvents);
+        origin_ = plat_now_ns();
+        plat_flag_set(&trace_enabled_);
+    }
+    return true;
+}
+
+bool
+wat4ff_trace_flush(void) {
+    if (!plat_flag_get(&trace_enabled_)) return false;
+    if (!plat_flag_test_and_set(&flushing_)) return false;
+
+    bool ok = false;
+    FILE* f = fopen(path_, "w");
+    if (!f) goto fin;
+
+    UInt32 pid = plat_process_id();
+    bool first = true;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (Chunk* c = plat_load_ptr(&chunks_); c; c = c->next) {
+        SInt32 n = plat_load32(&c->count);
+        for (SInt32 i = 0; i < n; ++i) {
+            write_event(f, pid, c->tid, &c->events[i], first);
+            first = false;
+        }
+    }
+    fprintf(f, "\n],\"otherData\":{\"dropped\":%lld}}\n", (long long)plat_counter_get(&dropped_));
+    ok = fclose(f) == 0;
+
+fin:
+    plat_store32((volatile SInt32*)&flushing_, 0);
+    return ok;
+}
+
+static void
+flush_at_exit(void) {
+    wat4ff_trace_flush();
+}
+
+// WAT4FF_TRACE=path traces the whole process.
+static void
+trace_from_env(void) {
+    char val[kMaxPath];
+    if (!plat_getenv("WAT4FF_TRACE", val, sizeof(val))) return;
+    if (wat4ff_trace_start(val)) atexit(flush_at_exit);
+}
+
+PLAT_CONSTRUCTOR(trace_from_env)
+
+#else
+
+bool
+wat4ff_trace_start(const char* path) {
+    return false;
+}
+
+bool
+wat4ff_trace_flush(void) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Timeline tracing of converter calls. Compiled in with WAT4FF_ENABLE_TRACE
+ * and switched on at run time, otherwise every hook expands to nothing.
+ *
+ * The trace column of PROC_TABLE picks what an event records:
+ * TRACE_NONE  Not traced.
+ * TRACE_CONV  The converter, p1.
+ * TRACE_NEW   The converter just created, *p3.
+ * TRACE_FILL  The converter, packets asked for and packets produced.
+ * TRACE_PROP  The converter and the property ID.
+*/
+
+#ifndef WAT4FF_TRACE_H
+#define WAT4FF_TRACE_H
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "plat.h"
+
+
+#ifdef WAT4FF_ENABLE_TRACE
+
+extern PlatFlag trace_enabled_;
+
+void
+trace_event(int proc, SInt64 begin, const void* conv, UInt32 arg1, UInt32 arg2, OSStatus rc);
+
+#define TRACE_ENTER(kind) kind ## _ENTER
+#define TRACE_LEAVE(kind, proc, rc) kind ## _LEAVE(proc, rc)
+
+#define TRACE_BEGIN SInt64 trace_t0_ = plat_flag_get(&trace_enabled_) ? plat_now_ns() : 0
+
+#define TRACE_NONE_ENTER (void)0
+#define TRACE_NONE_LEAVE(proc, rc) (void)0
+
+#define TRACE_CONV_ENTER TRACE_BEGIN
+#define TRACE_CONV_LEAVE(proc, rc) \
+    if (trace_t0_) trace_event(proc, trace_t0_, p1, 0, 0, rc)
+
+#define TRACE_NEW_ENTER TRACE_BEGIN
+#define TRACE_NEW_LEAVE(proc, rc) \
+    if (trace_t0_) trace_event(proc, trace_t0_, rc == noErr && p3 ? *p3 : NULL, 0, 0, rc)
+
+#define TRACE_FILL_ENTER TRACE_BEGIN; UInt32 trace_asked_ = p4 ? *p4 : 0
+#define TRACE_FILL_LEAVE(proc, rc) \
+    if (trace_t0_) trace_event(proc, trace_t0_, p1, trace_asked_, p4 ? *p4 : 0, rc)
+
+#define TRACE_PROP_ENTER TRACE_BEGIN
+#define TRACE_PROP_LEAVE(proc, rc) \
+    if (trace_t0_) trace_event(proc, trace_t0_, p1, p2, 0, rc)
+
+#else
+
+#define TRACE_ENTER(kind) (void)0
+#define TRACE_LEAVE(kind, proc, rc) (void)0
+
+#endif
+
+#endif
@@ -5,304 +5,400 @@
  *
  * wat4ff is an AudioToolbox wrapper for FFmpeg on Windows.
  * Support aac_at encoder and decoder.
+ * It also builds on POSIX systems, where it loads a stand-in library,
+ * so the wrapper can be tested and benchmarked without iTunes.
  * 
  * Inspired by github.com/dantmnf/AudioToolboxWrapper
 */
 
-#include <wchar.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 
-#include <windows.h>
-#ifdef WAT4FF_USE_APPMODEL
-#include <appmodel.h>
-#endif
-
 #include <AudioToolbox/AudioToolbox.h>
-
-
-static const wchar_t kLibFile[] = L"CoreAudioToolbox.dll";
-#ifdef _WIN64
-static const wchar_t kLibDir[] = L"QTfiles64";
-#else
-static const wchar_t kLibDir[] = L"QTfiles";
-#endif
-
-#define PROCTYPE(fn) fn ## Proc
-#define PROCPTR(fn) p ## fn
-
-#define DECL_PROC(rt, fn, ...) typedef rt (* PROCTYPE(fn))(__VA_ARGS__); static PROCTYPE(fn) PROCPTR(fn) = NULL; rt fn(__VA_ARGS__)
-#define GET_PROC(lib, fn)  PROCPTR(fn) = (PROCTYPE(fn))GetProcAddress(lib, #fn)
-#define CALL_PROC(fn, ...) PROCPTR(fn)(__VA_ARGS__)
-
-#define LOAD_LIB                                    \
-    if (!loaded_) {                                 \
-        load();                                     \
-        if (!loaded_) return NSExecutableLoadError; \
+#include <wat4ff.h>
+
+#include "capture.h"
+#include "conv.h"
+#include "ipc.h"
+#include "plat.h"
+#include "procs.h"
+#include "stats.h"
+#include "trace.h"
+
+
+#define RESOLVER(fn) resolve_ ## fn
+#define ENTRY(fn) entry_ ## fn
+#define ENTRY_PTR(fn) ((PROCTYPE(fn))plat_acquire_ptr((void* volatile*)&ENTRY(fn)))
+#define STARTER(fn) start_ ## fn
+#define CALL(fn) call_ ## fn
+#define PINNED(fn) pinned_ ## fn
+
+// Each exported procedure jumps through PROCPTR(fn), which starts out
+// pointing at RESOLVER(fn). The resolver loads the library, load() then
+// swaps every PROCPTR to the real entry point, so later calls pay nothing
+// but the indirect jump. Converter procedures get there by way of the
+// converter layer, which keeps its own handles, see conv.h.
+// The exported procedure itself jumps through ENTRY(fn), which starts out
+// at STARTER(fn). load_once() points it at CALL(fn) for good, or with idle
+// unload on at PINNED(fn), which pins the library while the call runs, so
+// calls never test whether unload is on. Unloading points every PROCPTR
+// back at its resolver, see Lifetime.
+#define DECL_PROC(fn, params, args, hook, wrap, trace, capture) \
+    static OSStatus RESOLVER(fn) params;                        \
+    PROCTYPE(fn) volatile PROCSLOT(fn) = RESOLVER(fn);          \
+    static OSStatus RESOLVER(fn) params {                       \
+        if (!load()) return NSExecutableLoadError;              \
+        return PROCPTR(fn) args;                                \
+    }                                                           \
+    static OSStatus CALL(fn) params {                           \
+        STATS_ENTER();                                          \
+        TRACE_ENTER(trace);                                     \
+        CAPTURE_ENTER(capture);                                 \
+        OSStatus rc = hook(fn) wrap args;                       \
+        CAPTURE_LEAVE(capture, kProc_ ## fn, rc);               \
+        TRACE_LEAVE(trace, kProc_ ## fn, rc);                   \
+        STATS_LEAVE(kProc_ ## fn, rc);                          \
+        return rc;                                              \
+    }                                                           \
+    static OSStatus PINNED(fn) params {                         \
+        lib_pin();                                              \
+        OSStatus rc = CALL(fn) args;                            \
+        lib_unpin();                                            \
+        return rc;                                              \
+    }                                                           \
+    static OSStatus STARTER(fn) params;                         \
+    static PROCTYPE(fn) volatile ENTRY(fn) = STARTER(fn);       \
+    static OSStatus STARTER(fn) params {                        \
+        load();                                                 \
+        return ENTRY_PTR(fn) args;                              \
+    }                                                           \
+    OSStatus fn params {                                        \
+        return ENTRY_PTR(fn) args;                              \
     }
 
-enum {
-    kMaxPath = MAX_PATH,
+#define PROC_ENTRY(fn, ...) {                                                     \
+    #fn, (void* volatile*)&PROCSLOT(fn), (void*)RESOLVER(fn),                    \
+    (void* volatile*)&ENTRY(fn), (void*)CALL(fn), (void*)PINNED(fn) },
+
+// Written only inside load_once(), plat_once() orders them before any
+// reader that went through load(). With idle unload on, lib_ changes
+// later too, under state_lock_.
+static PlatLib lib_ = NULL;
+static bool hosted_ = false;           // Entry points forward to wat4ff_host
+static bool loaded_ = false;
+static PlatOnce load_once_ = PLAT_ONCE_INIT;
+static Wat4ffLoadTiming timing_ = { .source = -1 };
+static PlatFlag load_done_ = 0;
+static PlatFlag preloading_ = 0;
+
+// The low 32 bits of refs_ count calls in progress and live converters,
+// the high 32 bits count finished calls, so one load tells the reaper both
+// whether the library may go and whether it has been used since.
+static bool lifetime_ = false;         // Idle unload on, fixed before the first load
+static bool load_begun_ = false;
+static volatile SInt64 idle_ns_ = 0;
+static volatile SInt64 refs_ = 0;
+static volatile SInt32 mapped_ = 0;
+static volatile SInt64 loads_ = 0;
+static volatile SInt64 unloads_ = 0;
+static PlatMutex state_lock_ = PLAT_MUTEX_INIT;
+static void* real_[kProcCount];
+
+static bool load(void);
+static void lib_pin(void);
+static void lib_unpin(void);
+
+
+PROC_TABLE(DECL_PROC)
+
+static const struct {
+    const char* name;
+    void* volatile* slot;
+    void* resolver;
+    void* volatile* entry;
+    void* call;
+    void* pinned;
+} kProcs[kProcCount] = {
+    PROC_TABLE(PROC_ENTRY)
 };
 
-static HMODULE lib_ = NULL;
-static volatile LONG loading_ = 0;
-static volatile LONG loaded_ = 0;
-
-static void load(void);
 
+static void
+publish(void* const procs[kProcCount]) {
+    for (int i = 0; i < kProcCount; ++i) {
+        real_[i] = procs[i];
+        plat_publish_ptr(kProcs[i].slot, procs[i]);
+    }
+}
 
-// Buf assumed to be kMaxPath in cch size.
+// Opens the library and publishes every entry point, or neither. With a
+// host configured, its forwarders are the entry points if it answers.
 static bool
-get_app_root(wchar_t* buf, wchar_t** rootp) {
-    size_t cch = GetModuleFileNameW(NULL, buf, kMaxPath);
-    if (cch >= kMaxPath) return false;
-
-    wchar_t* p = buf + cch - 1;
-    for (; *p != L'\\'; --p) {
-        if (p == buf) return false;
+map_lib(Wat4ffLoadTiming* timing) {
+    if (remote_wanted()) {
+        SInt64 t0 = plat_now_ns();
+        void* procs[kProcCount];
+        bool ok = remote_open(procs);
+        timing->loadLibraryNanos[kWat4ffProbeHost] = plat_now_ns() - t0;
+        if (ok) {
+            publish(procs);
+            timing->source = kWat4ffProbeHost;
+            hosted_ = true;
+            return true;
+        }
     }
-    *++p = L'\0';
-    *rootp = p;
 
+    PlatLib lib = plat_lib_open(timing);
+    if (!lib) return false;
+
+    // Resolve everything before publishing anything, a partial set of
+    // entry points is worse than none.
+    SInt64 t1 = plat_now_ns();
+    void* procs[kProcCount];
+    for (int i = 0; i < kProcCount; ++i) {
+        procs[i] = plat_lib_sym(lib, kProcs[i].name);
+        if (!procs[i]) {
+            plat_lib_close(lib);
+            timing->source = -1;
+            return false;
+        }
+    }
+    publish(procs);
+    timing->resolveNanos = plat_now_ns() - t1;
+    lib_ = lib;
+    hosted_ = false;
     return true;
 }
 
-// Buf assumed to be kMaxPath in cch size.
-static bool
-calc_portable_lib_path(wchar_t* buf, wchar_t* rootp) {
-    wchar_t* p = rootp;
-    const wchar_t* end = buf + kMaxPath;
-    const wchar_t* pp = p + sizeof(kLibDir) / sizeof(*kLibDir) + sizeof(kLibFile) / sizeof(*kLibFile);
-    if (pp > end) return false;
+static void
+unmap_lib(void) {
+    if (hosted_) remote_close();
+    else plat_lib_close(lib_);
+    lib_ = NULL;
+}
 
-    memcpy(p, kLibDir, sizeof(kLibDir));
-    p += sizeof(kLibDir) / sizeof(*kLibDir) - 1;
-    *p++ = L'\\';
+static void reaper_main(void* param);
 
-    memcpy(p, kLibFile, sizeof(kLibFile));
+// Runs exactly once per process. Waiters sleep inside plat_once() rather
+// than spin. A failed load is final too, later calls return
+// NSExecutableLoadError without probing the disk again.
+static void
+load_once(void) {
+    SInt64 t0 = plat_now_ns();
+    plat_mutex_lock(&state_lock_);
+    load_begun_ = true;
+    loaded_ = map_lib(&timing_);
+    if (loaded_ && lifetime_) {
+        plat_store32(&mapped_, 1);
+        plat_counter_add(&loads_, 1);
+        // Without a reaper the library simply stays.
+        plat_thread_detach(reaper_main, NULL);
+    }
+    for (int i = 0; i < kProcCount; ++i) {
+        plat_publish_ptr(kProcs[i].entry, lifetime_ ? kProcs[i].pinned : kProcs[i].call);
+    }
+    plat_mutex_unlock(&state_lock_);
 
-    return true;
+    timing_.loaded = loaded_;
+    timing_.totalNanos = plat_now_ns() - t0;
+    plat_flag_set(&load_done_);
 }
 
-// Buf assumed to be kMaxPath in cch size.
+static bool remap(void);
+
 static bool
-get_portable_lib_path(wchar_t* buf) {
-    wchar_t* rootp;
-    bool ok;
+load(void) {
+    plat_once(&load_once_, load_once);
+    if (!lifetime_ || !loaded_) return loaded_;
+    return remap();
+}
 
-    ok = get_app_root(buf, &rootp);
-    if (!ok) return false;
 
-    return calc_portable_lib_path(buf, rootp);
-}
+// Lifetime +++
 
-// Buf assumed to be kMaxPath in cch size.
-static bool
-calc_app_lib_path(wchar_t* buf, wchar_t* rootp) {
-    const wchar_t* end = buf + kMaxPath;
-    const wchar_t* pp = rootp + sizeof(kLibFile) / sizeof(*kLibFile);
-    if (pp > end) return false;
+enum {
+    kMaxTickMillis = 1000,
+};
 
-    memcpy(rootp, kLibFile, sizeof(kLibFile));
+#define REFS_HELD(v) ((v) & 0xffffffff)
+#define REFS_EPOCH(v) ((v) >> 32)
 
-    return true;
+static void
+lib_pin(void) {
+    // Ordered before reading any PROCPTR, see try_unload().
+    plat_add64(&refs_, 1);
+    plat_fence();
 }
 
-// Buf assumed to be kMaxPath in cch size.
-static bool
-get_itunes_prog_lib_path(wchar_t* buf) {
-    const wchar_t kSubKey[] = L"SOFTWARE\\Apple Computer, Inc.\\iTunes";
-    const wchar_t kValName[] = L"InstallDir";
-
-    DWORD sz = sizeof(wchar_t) * kMaxPath;
-    if (ERROR_SUCCESS != RegGetValueW(HKEY_LOCAL_MACHINE, kSubKey, kValName, RRF_RT_REG_SZ, NULL, buf, &sz)) return false;
-    sz = (sz / sizeof(wchar_t)) - 1;
-    return calc_app_lib_path(buf, buf + sz);
+static void
+lib_unpin(void) {
+    plat_add64(&refs_, ((SInt64)1 << 32) - 1);
 }
 
-#ifdef WAT4FF_USE_APPMODEL
-static wchar_t*
-gen_wapp_full_name(const wchar_t* family_name) {
-    wchar_t* rlt = NULL;
-    UINT32 count = 0;
-    UINT32 buf_len = 0;
-    wchar_t* buf = NULL;
-    wchar_t** full_names = NULL;
-
-    LONG rc = FindPackagesByPackageFamily(
-        family_name, PACKAGE_FILTER_HEAD,
-        &count, NULL, &buf_len, NULL, NULL
-    );
-    // If Not found, rc == 0
-    if (rc != ERROR_INSUFFICIENT_BUFFER) return false;
-
-    buf = HeapAlloc(GetProcessHeap(), 0, sizeof(*buf) * buf_len);
-    if (!buf) goto fin;
-    full_names = HeapAlloc(GetProcessHeap(), 0, sizeof(*full_names) * count);
-    if (!full_names) goto fin;
-
-    rc = FindPackagesByPackageFamily(
-        family_name, PACKAGE_FILTER_HEAD,
-        &count, full_names, &buf_len, buf, NULL
-    );
-    if (rc) goto fin;
-
-    rlt = buf;
-
-fin:
-    if (!rlt && buf) HeapFree(GetProcessHeap(), 0, buf);
-    if (full_names) HeapFree(GetProcessHeap(), 0, full_names);
-    return rlt;
+void
+lib_retain(void) {
+    if (lifetime_) plat_add64(&refs_, 1);
 }
 
-// Buf assumed to be kMaxPath in cch size.
-static bool
-get_wapp_dir_by_full_name(wchar_t* buf, wchar_t** rootp, const wchar_t* full_name) {
-    UINT32 cch = 0;
-    LONG rc = GetPackagePathByFullName(full_name, &cch, NULL);
-    if (rc != ERROR_INSUFFICIENT_BUFFER) return false;
-    if (cch >= kMaxPath - 1) return false; // We'll add trailing backslash, so kMaxPath - 1
-    
-    rc = GetPackagePathByFullName(full_name, &cch, buf);
-    if (rc) return false;
-
-    buf[cch - 1] = L'\\';
-    buf[cch]   = L'\0';
-    *rootp = buf + cch;
-
-    return true;
+void
+lib_release(void) {
+    if (lifetime_) plat_add64(&refs_, -1);
 }
 
-// Buf assumed to be kMaxPath in cch size.
+// Maps the library again if the reaper has unloaded it. Resolvers only
+// run while it is unloaded or about to be, so taking the lock here is rare.
 static bool
-get_wapp_dir_by_family_name(wchar_t* buf, wchar_t** rootp, const wchar_t* family_name) {
-    wchar_t* full_name = gen_wapp_full_name(family_name);
-    if (!full_name) return false;
-
-    bool rlt = get_wapp_dir_by_full_name(buf, rootp, full_name);
-    HeapFree(GetProcessHeap(), 0, full_name);
-    return rlt;
+remap(void) {
+    plat_mutex_lock(&state_lock_);
+    if (!plat_load32(&mapped_)) {
+        Wat4ffLoadTiming timing = { .source = -1 };
+        if (map_lib(&timing)) {
+            plat_store32(&mapped_, 1);
+            plat_counter_add(&loads_, 1);
+        }
+    }
+    bool ok = plat_load32(&mapped_);
+    plat_mutex_unlock(&state_lock_);
+    return ok;
 }
 
-// Buf assumed to be kMaxPath in cch size.
-static bool
-get_itunes_app_lib_path(wchar_t* buf) {
-    const wchar_t kFamilyName[] = L"AppleInc.iTunes_nzyj5cx40ttqa";
-
-    wchar_t* rootp;
-    bool ok = get_wapp_dir_by_family_name(buf, &rootp, kFamilyName);
-    if (!ok) return false;
-
-    return calc_app_lib_path(buf, rootp);
+// A call pins before it reads a PROCPTR, the reaper points them all at the
+// resolvers before it looks at the pins again, with fences in between on
+// both sides. So either the reaper sees the pin and backs off, or the call
+// reads a resolver, which waits on state_lock_ and maps the library again.
+static void
+try_unload(void) {
+    plat_mutex_lock(&state_lock_);
+    if (plat_load32(&mapped_) && !REFS_HELD(plat_add64(&refs_, 0))) {
+        for (int i = 0; i < kProcCount; ++i) plat_publish_ptr(kProcs[i].slot, kProcs[i].resolver);
+        plat_fence();
+        if (!REFS_HELD(plat_add64(&refs_, 0))) {
+            unmap_lib();
+            plat_store32(&mapped_, 0);
+            plat_counter_add(&unloads_, 1);
+        }
+        else {
+            for (int i = 0; i < kProcCount; ++i) plat_publish_ptr(kProcs[i].slot, real_[i]);
+        }
+    }
+    plat_mutex_unlock(&state_lock_);
 }
-#endif //#ifdef WAT4FF_USE_APPMODEL
-
-static HMODULE
-load_lib(void) {
-    enum { kLLFlags = LOAD_LIBRARY_SEARCH_DLL_LOAD_DIR | LOAD_LIBRARY_SEARCH_SYSTEM32 | LOAD_IGNORE_CODE_AUTHZ_LEVEL};
-    wchar_t* path = HeapAlloc(GetProcessHeap(), 0, sizeof(wchar_t) * kMaxPath);
-    if (!path) return NULL;
 
-    HMODULE lib = NULL;
-
-    if (get_portable_lib_path(path)) {
-        if (lib = LoadLibraryExW(path, NULL, kLLFlags)) goto fin;
-    }
-    if (get_itunes_prog_lib_path(path)) {
-        if (lib = LoadLibraryExW(path, NULL, kLLFlags)) goto fin;
-    }
-#ifdef WAT4FF_USE_APPMODEL
-    if (get_itunes_app_lib_path(path)) {
-        if (lib = LoadLibraryExW(path, NULL, kLLFlags)) goto fin;
+// Wakes a few times per idle period. Once no call has finished for a whole
+// period, parked converters go, then the library if nothing else holds it.
+static void
+reaper_main(void* param) {
+    SInt64 seen = -1;
+    SInt64 since = plat_now_ns();
+    for (;;) {
+        SInt64 idle = plat_counter_get(&idle_ns_);
+        SInt64 tick = idle / 4000000;
+        plat_sleep_ms(tick < 1 ? 1 : tick > kMaxTickMillis ? kMaxTickMillis : (UInt32)tick);
+
+        SInt64 refs = plat_add64(&refs_, 0);
+        SInt64 now = plat_now_ns();
+        if (REFS_EPOCH(refs) != seen) {
+            seen = REFS_EPOCH(refs);
+            since = now;
+            continue;
+        }
+        if (!idle || now - since < idle || !plat_load32(&mapped_)) continue;
+        if (REFS_HELD(refs)) wat4ff_pool_trim();
+        try_unload();
     }
-#endif
-
-fin:
-    HeapFree(GetProcessHeap(), 0, path);
-    return lib;
 }
 
-// Shared by dec, enc +++
+// Lifetime ---
 
-DECL_PROC(OSStatus, AudioConverterDispose, AudioConverterRef p1) {
-    LOAD_LIB;
-    return CALL_PROC(AudioConverterDispose, p1);
-}
 
-DECL_PROC(OSStatus, AudioConverterFillComplexBuffer, AudioConverterRef p1, AudioConverterComplexInputDataProc p2, void* p3, UInt32* p4, AudioBufferList* p5, AudioStreamPacketDescription* p6) {
-    LOAD_LIB;
-    return CALL_PROC(AudioConverterFillComplexBuffer, p1, p2, p3, p4, p5, p6);
-}
+// Load +++
 
-DECL_PROC(OSStatus, AudioConverterGetProperty, AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, void* p4) {
-    LOAD_LIB;
-    return CALL_PROC(AudioConverterGetProperty, p1, p2, p3, p4);
+OSStatus
+wat4ff_preload(void) {
+    return load() ? noErr : NSExecutableLoadError;
 }
 
-DECL_PROC(OSStatus, AudioConverterGetPropertyInfo, AudioConverterRef p1, AudioConverterPropertyID p2, UInt32* p3, Boolean* p4) {
-    LOAD_LIB;
-    return CALL_PROC(AudioConverterGetPropertyInfo, p1, p2, p3, p4);
-}
-
-DECL_PROC(OSStatus, AudioConverterNew, const AudioStreamBasicDescription* p1, const AudioStreamBasicDescription* p2, AudioConverterRef* p3) {
-    LOAD_LIB;
-    return CALL_PROC(AudioConverterNew, p1, p2, p3);
+static void
+preload_thread(void* param) {
+    load();
 }
 
-DECL_PROC(OSStatus, AudioConverterReset, AudioConverterRef p1) {
-    LOAD_LIB;
-    return CALL_PROC(AudioConverterReset, p1);
-}
+void
+wat4ff_preload_async(void) {
+    if (!plat_flag_test_and_set(&preloading_)) return;
 
-DECL_PROC(OSStatus, AudioConverterSetProperty, AudioConverterRef p1, AudioConverterPropertyID p2, UInt32 p3, const void* p4) {
-    LOAD_LIB;
-    return CALL_PROC(AudioConverterSetProperty, p1, p2, p3, p4);
+    // If no thread, the first AudioToolbox call simply loads inline.
+    plat_thread_detach(preload_thread, NULL);
 }
 
-// Shared by dec, enc ---
+bool
+wat4ff_get_load_timing(Wat4ffLoadTiming* timing) {
+    if (!plat_flag_get(&load_done_)) return false;
 
-
-// Used only by dec +++
-
-DECL_PROC(OSStatus, AudioFormatGetPropertyInfo, AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4) {
-    LOAD_LIB;
-    return CALL_PROC(AudioFormatGetPropertyInfo, p1, p2, p3, p4);
-}
-
-DECL_PROC(OSStatus, AudioFormatGetProperty, AudioFormatPropertyID p1, UInt32 p2, const void* p3, UInt32* p4, void* p5) {
-    LOAD_LIB;
-    return CALL_PROC(AudioFormatGetProperty, p1, p2, p3, p4, p5);
+    *timing = timing_;
+    return true;
 }
 
-// Used only by dec ---
+// WAT4FF_PRELOAD=1 starts loading in the background before main() runs,
+// so it overlaps with whatever the application does first.
+static void
+preload_from_env(void) {
+    char val[8];
+    if (!plat_getenv("WAT4FF_PRELOAD", val, sizeof(val))) return;
 
+    if (!strcmp(val, "sync")) {
+        load();
+    }
+    else if (strcmp(val, "0")) {
+        wat4ff_preload_async();
+    }
+}
 
+// WAT4FF_UNLOAD_IDLE_MS=ms turns idle unload on, see wat4ff_unload_configure().
+// WAT4FF_HOST=name, or 1 for the default, sends calls to a host, see
+// wat4ff_host_configure().
 static void
-load(void) {
-    if (InterlockedCompareExchange(&loading_, 1, 0) == 1) {
-        while (loading_) SwitchToThread();
-        return;
+configure_from_env(void) {
+    char val[kIpcNameMax];
+    if (plat_getenv("WAT4FF_UNLOAD_IDLE_MS", val, sizeof(val))) {
+        wat4ff_unload_configure((UInt32)strtoul(val, NULL, 10));
     }
-    
-    if (loaded_) goto fin;
-
-    lib_ = load_lib();
-    if (!lib_) goto fin;
-
-    // CAUTION: Assume all procedure names found without further checking.
-    GET_PROC(lib_, AudioConverterDispose);
-    GET_PROC(lib_, AudioConverterFillComplexBuffer);
-    GET_PROC(lib_, AudioConverterGetProperty);
-    GET_PROC(lib_, AudioConverterGetPropertyInfo);
-    GET_PROC(lib_, AudioConverterNew);
-    GET_PROC(lib_, AudioConverterReset);
-    GET_PROC(lib_, AudioConverterSetProperty);
+    if (plat_getenv("WAT4FF_HOST", val, sizeof(val)) && strcmp(val, "0")) {
+        wat4ff_host_configure(strcmp(val, "1") ? val : NULL);
+    }
+    // Before a preload, which would fix the setting.
+    preload_from_env();
+}
 
-    GET_PROC(lib_, AudioFormatGetPropertyInfo);
-    GET_PROC(lib_, AudioFormatGetProperty);
+PLAT_CONSTRUCTOR(configure_from_env)
+
+OSStatus
+wat4ff_unload_configure(UInt32 idleMillis) {
+    OSStatus rc = noErr;
+    plat_mutex_lock(&state_lock_);
+    if (!load_begun_) lifetime_ = idleMillis > 0;
+    if (lifetime_) plat_counter_set(&idle_ns_, (SInt64)idleMillis * 1000000);
+    else if (idleMillis) rc = kAudio_ParamError;
+    plat_mutex_unlock(&state_lock_);
+    return rc;
+}
 
-    loaded_ = 1;
+OSStatus
+wat4ff_host_configure(const char* name) {
+    OSStatus rc = kAudio_ParamError;
+    plat_mutex_lock(&state_lock_);
+    if (!load_begun_ && remote_set_name(name ? name : IPC_DEFAULT_NAME)) rc = noErr;
+    plat_mutex_unlock(&state_lock_);
+    return rc;
+}
 
-fin:
-    InterlockedCompareExchange(&loading_, 0, 1);
+void
+wat4ff_get_lifetime_stats(Wat4ffLifetimeStats* stats) {
+    stats->loads = (UInt64)plat_counter_get(&loads_);
+    stats->unloads = (UInt64)plat_counter_get(&unloads_);
+    stats->references = (UInt32)REFS_HELD(plat_add64(&refs_, 0));
+    stats->loaded = lifetime_ ? plat_load32(&mapped_) != 0 : plat_flag_get(&load_done_) && loaded_;
 }
+
+// Load ---
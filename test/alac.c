@@ -0,0 +1,89 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes PCM to ALAC through one converter, then with wat4ff_alac_encode()
+ * and wat4ff_alac_decode() on 1 to 8 threads, in batches small enough that
+ * the threads steal from each other. Every run must match the single
+ * converter bit for bit, kept or passed to emit, and decode back to the
+ * input.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "fixture.h"
+
+
+enum {
+    kRate       = 44100,
+    kChannels   = 2,
+    kFrames     = 4096 * 150 + 1234,    // A short last packet
+    kMaxThreads = 8,
+    kBatch      = 3,                    // Packets
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAlac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatAppleLossless,
+    .mChannelsPerFrame = kChannels,
+};
+
+static SInt16 pcm_[kFrames * kChannels];
+static SInt16 back_[(kFrames + 4096) * kChannels];
+
+
+int
+main(void) {
+    for (UInt32 i = 0; i < kFrames * kChannels; ++i) pcm_[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    Digest serial = digest_new();
+    PcmSource src = { pcm_, kChannels, kFrames, 0 };
+    if (!encode_plain(&kPcm, &kAlac, NULL, 0, pcm_source_proc, &src, &serial) || !serial.packets) {
+        fprintf(stderr, "serial encode failed\n");
+        return 1;
+    }
+
+    bool ok = true;
+    for (UInt32 threads = 1; threads <= kMaxThreads && ok; threads *= 2) {
+        Wat4ffAlacJob job = {
+            .input = kPcm,
+            .output = kAlac,
+            .threads = threads,
+            .batchPackets = kBatch,
+        };
+        Wat4ffEncodedStream s;
+        if (wat4ff_alac_encode(&job, pcm_, kFrames, &s)) {
+            fprintf(stderr, "encode failed on %u threads\n", threads);
+            return 1;
+        }
+        Digest kept = digest_packets(digest_new(), s.data, s.packets, s.packetCount);
+
+        Digest streamed = digest_new();
+        job.emit = digest_emit;
+        job.emitUser = &streamed;
+        OSStatus rc = wat4ff_alac_encode(&job, pcm_, kFrames, NULL);
+
+        job.input = kAlac;
+        job.output = kPcm;
+        job.emit = NULL;
+        UInt64 decoded = 0;
+        memset(back_, 0, sizeof(back_));
+        rc = rc ? rc : wat4ff_alac_decode(&job, &s, back_, &decoded);
+
+        bool same = digest_same(&kept, &serial) && digest_same(&streamed, &serial);
+        bool lossless = !rc && decoded == kFrames && !memcmp(back_, pcm_, sizeof(pcm_));
+        printf("%u threads:    %u batches, %s, %s\n", threads, s.segments,
+               same ? "identical" : "DIFFERS", lossless ? "lossless" : "LOSSY");
+        ok = same && lossless;
+        wat4ff_free_encoded(&s);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Converters encoding through their arenas with the pool on, one after
+ * another, so each takes the last one's parked converter. Its arena must
+ * come along: past the first converter nothing is allocated, and once the
+ * pool is trimmed the arenas hold no more bytes than before the first.
+ * Every encode must match a plain one.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "fixture.h"
+
+
+enum {
+    kRate      = 44100,
+    kChannels  = 2,
+    kFrames    = kRate * 2,
+    kPackets   = 8,
+    kRounds    = 6,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+static SInt16 pcm_[kFrames * kChannels];
+
+
+// The whole input through a new converter, its output lent by the arena.
+static bool
+encode_arena(Digest* d) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kPcm, &kAac, &conv)) return false;
+    PcmSource src = { pcm_, kChannels, kFrames, 0 };
+    bool ok = true;
+    while (ok) {
+        Wat4ffPacketBuffer buf;
+        wat4ff_arena_recycle(conv);
+        ok = !wat4ff_arena_acquire(conv, kPackets, &buf);
+        if (!ok) break;
+        UInt32 n = kPackets;
+        AudioBufferList list = { 1, { { kChannels, buf.dataSize, buf.data } } };
+        ok = !AudioConverterFillComplexBuffer(conv, pcm_source_proc, &src, &n, &list, buf.packets);
+        if (!n) break;
+        *d = digest_packets(*d, buf.data, buf.packets, n);
+    }
+    AudioConverterDispose(conv);
+    return ok;
+}
+
+int
+main(void) {
+    for (UInt32 i = 0; i < kFrames * kChannels; ++i) pcm_[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    Digest plain = digest_new();
+    PcmSource src = { pcm_, kChannels, kFrames, 0 };
+    if (!encode_plain(&kPcm, &kAac, NULL, 0, pcm_source_proc, &src, &plain) || !plain.packets) {
+        fprintf(stderr, "plain encode failed\n");
+        return 1;
+    }
+
+    wat4ff_pool_configure(4, 0);
+    Wat4ffArenaStats start, first, now;
+    wat4ff_get_arena_stats(&start);
+    bool ok = true;
+    for (UInt32 round = 0; round < kRounds && ok; ++round) {
+        Digest d = digest_new();
+        ok = encode_arena(&d) && digest_same(&d, &plain);
+        wat4ff_get_arena_stats(&now);
+        if (!round) first = now;
+        printf("round %u:      %llu allocations, %llu bytes, %s\n", round,
+               (unsigned long long)(now.allocations - start.allocations),
+               (unsigned long long)(now.bytes - start.bytes), ok ? "ok" : "DIFFERS");
+        ok = ok && now.allocations == first.allocations && now.bytes == first.bytes;
+    }
+    Wat4ffPoolStats pool;
+    wat4ff_get_pool_stats(&pool);
+    wat4ff_pool_trim();
+    wat4ff_get_arena_stats(&now);
+    printf("pool:         %llu hits, %llu misses\n", (unsigned long long)pool.hits, (unsigned long long)pool.misses);
+    printf("trimmed:      %lld bytes held\n", (long long)(now.bytes - start.bytes));
+    ok = ok && pool.hits == kRounds - 1 && now.bytes == start.bytes;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes PCM to AAC, decodes it through one converter, then with
+ * wat4ff_decode_parallel() on 1 to 8 threads, in segments of a few packets
+ * and of the default length. Every run must match the single converter
+ * sample for sample, priming and padding included.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "fixture.h"
+
+
+enum {
+    kRate         = 44100,
+    kChannels     = 2,
+    kFrames       = kRate * 12 + 777,   // Past one default segment
+    kMaxThreads   = 8,
+    kShortPackets = 7,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Packets {
+    const Wat4ffEncodedStream* s;
+    UInt64 next;
+    AudioStreamPacketDescription desc;
+}Packets;
+
+
+static OSStatus
+packet_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    Packets* p = user;
+    if (p->next >= p->s->packetCount) {
+        *packets = 0;
+        return noErr;
+    }
+    p->desc = p->s->packets[p->next++];
+    data->mBuffers[0].mData = p->s->data + p->desc.mStartOffset;
+    data->mBuffers[0].mDataByteSize = p->desc.mDataByteSize;
+    p->desc.mStartOffset = 0;
+    if (descs) *descs = &p->desc;
+    *packets = 1;
+    return noErr;
+}
+
+// Decodes s the way a single ffmpeg process would, into pcm.
+static UInt64
+decode_serial(const Wat4ffEncodedStream* s, SInt16* pcm) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kAac, &kPcm, &conv)) return 0;
+    if (s->magicCookieSize
+        && AudioConverterSetProperty(conv, kAudioConverterDecompressionMagicCookie, s->magicCookieSize, s->magicCookie)) {
+        AudioConverterDispose(conv);
+        return 0;
+    }
+
+    UInt64 cap = s->packetCount * s->framesPerPacket;
+    UInt64 got = 0;
+    Packets p = { s, 0 };
+    while (got < cap) {
+        UInt32 n = cap - got < 4096 ? (UInt32)(cap - got) : 4096;
+        AudioBufferList list = { 1, { { kChannels, n * kPcm.mBytesPerFrame, pcm + got * kChannels } } };
+        if (AudioConverterFillComplexBuffer(conv, packet_proc, &p, &n, &list, NULL) || !n) break;
+        got += n;
+    }
+    AudioConverterDispose(conv);
+    return got;
+}
+
+int
+main(void) {
+    SInt16* pcm = malloc((size_t)kFrames * kPcm.mBytesPerFrame);
+    if (!pcm) return 1;
+    for (UInt32 i = 0; i < kFrames * kChannels; ++i) pcm[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    Wat4ffParallelEncode enc = { .input = kPcm, .output = kAac };
+    Wat4ffEncodedStream s;
+    OSStatus rc = wat4ff_encode_parallel(&enc, pcm, kFrames, &s);
+    free(pcm);
+    if (rc) {
+        fprintf(stderr, "encode failed\n");
+        return 1;
+    }
+
+    size_t size = s.packetCount * s.framesPerPacket * kPcm.mBytesPerFrame;
+    SInt16* serial = malloc(size);
+    SInt16* parallel = malloc(size);
+    UInt64 serial_frames = serial && parallel ? decode_serial(&s, serial) : 0;
+    printf("serial:       %llu packets, %llu frames\n", (unsigned long long)s.packetCount, (unsigned long long)serial_frames);
+
+    bool ok = serial_frames > 0;
+    static const UInt32 kSegments[] = { kShortPackets, 0 };
+    for (UInt32 i = 0; i < 2 && ok; ++i) {
+        for (UInt32 threads = 1; threads <= kMaxThreads && ok; threads *= 2) {
+            Wat4ffParallelDecode job = {
+                .input = kAac,
+                .output = kPcm,
+                .threads = threads,
+                .segmentPackets = kSegments[i],
+            };
+            memset(parallel, 0, size);
+            UInt64 got = 0;
+            rc = wat4ff_decode_parallel(&job, &s, parallel, &got);
+            ok = !rc && got == serial_frames && !memcmp(parallel, serial, got * kPcm.mBytesPerFrame);
+            printf("%u threads:    %s segments, %s\n", threads, kSegments[i] ? "short" : "default",
+                   ok ? "sample exact" : "DIFFERS");
+        }
+    }
+
+    free(parallel);
+    free(serial);
+    wat4ff_free_encoded(&s);
+    return ok ? 0 : 1;
+}
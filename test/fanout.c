@@ -0,0 +1,133 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Three renditions fanned out of a ring much smaller than the input, read
+ * in chunks of uneven size, so the ring wraps at odd places and the reader
+ * keeps waiting on the slowest rendition. Each rendition must come out
+ * byte for byte as a plain encode of the same PCM, both in outs and
+ * through its emit callback.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "fixture.h"
+
+enum {
+    kRate       = 44100,
+    kChannels   = 2,
+    kFrames     = kRate * 10,
+    kRingFrames = 3001,
+    kRenditions = 3,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const struct {
+    AudioFormatID format;
+    UInt32 bitRate;
+} kLadder[kRenditions] = {
+    { kAudioFormatMPEG4AAC,    128000 },
+    { kAudioFormatMPEG4AAC,     64000 },
+    { kAudioFormatMPEG4AAC_HE,  48000 },
+};
+
+static SInt16 pcm_[kFrames * kChannels];
+
+typedef struct Source {
+    UInt32 pos;
+    UInt32 reads;
+}Source;
+
+
+// Up to *frames, but a different amount almost every call.
+static OSStatus
+read_proc(void* user, void* buf, UInt32* frames) {
+    Source* s = user;
+    UInt32 n = kFrames - s->pos;
+    UInt32 uneven = ++s->reads * 379 % 1021 + 1;
+    if (n > uneven) n = uneven;
+    if (n > *frames) n = *frames;
+    memcpy(buf, pcm_ + s->pos * kChannels, (size_t)n * kPcm.mBytesPerFrame);
+    s->pos += n;
+    *frames = n;
+    return noErr;
+}
+
+static AudioStreamBasicDescription
+rendition_format(int i) {
+    AudioStreamBasicDescription fmt = {
+        .mSampleRate       = kRate,
+        .mFormatID         = kLadder[i].format,
+        .mChannelsPerFrame = kChannels,
+    };
+    return fmt;
+}
+
+// The whole input through one converter on this thread.
+static bool
+encode_plain_rendition(int i, Digest* d) {
+    AudioStreamBasicDescription fmt = rendition_format(i);
+    Wat4ffConverterProperty prop = { kAudioConverterEncodeBitRate, sizeof(UInt32), &kLadder[i].bitRate };
+    PcmSource src = { pcm_, kChannels, kFrames, 0 };
+    return encode_plain(&kPcm, &fmt, &prop, 1, pcm_source_proc, &src, d);
+}
+
+int
+main(void) {
+    for (UInt32 i = 0; i < kFrames * kChannels; ++i) pcm_[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    Digest plain[kRenditions];
+    for (int i = 0; i < kRenditions; ++i) {
+        plain[i] = digest_new();
+        if (!encode_plain_rendition(i, &plain[i]) || !plain[i].packets) {
+            fprintf(stderr, "plain encode %d failed\n", i);
+            return 1;
+        }
+    }
+
+    Wat4ffConverterProperty props[kRenditions];
+    Wat4ffRendition renditions[kRenditions];
+    Digest emitted[kRenditions];
+    for (int i = 0; i < kRenditions; ++i) {
+        props[i] = (Wat4ffConverterProperty){ kAudioConverterEncodeBitRate, sizeof(UInt32), &kLadder[i].bitRate };
+        emitted[i] = digest_new();
+        renditions[i] = (Wat4ffRendition){
+            .output = rendition_format(i), .properties = &props[i], .propertyCount = 1,
+            .emit = digest_emit, .emitUser = &emitted[i],
+        };
+    }
+    Source src = { 0, 0 };
+    Wat4ffFanOut job = {
+        .input = kPcm,
+        .renditions = renditions,
+        .renditionCount = kRenditions,
+        .ringFrames = kRingFrames,
+        .read = read_proc,
+        .readUser = &src,
+    };
+    Wat4ffEncodedStream outs[kRenditions];
+    OSStatus rc = wat4ff_encode_fanout(&job, outs);
+    if (rc) {
+        fprintf(stderr, "fan-out failed: %d\n", (int)rc);
+        return 1;
+    }
+
+    bool ok = src.pos == kFrames;
+    printf("read:         %u frames in %u reads\n", src.pos, src.reads);
+    for (int i = 0; i < kRenditions; ++i) {
+        Digest d = digest_packets(digest_new(), outs[i].data, outs[i].packets, outs[i].packetCount);
+        bool same = digest_same(&d, &plain[i]) && digest_same(&emitted[i], &plain[i]);
+        printf("rendition %d:  %llu packets, %llu bytes, %s\n", i, (unsigned long long)d.packets,
+               (unsigned long long)d.bytes, same ? "ok" : "DIFFERS");
+        ok = ok && same;
+        wat4ff_free_encoded(&outs[i]);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * What the tests and benchmarks share to feed converters and check what
+ * comes out: interleaved 16-bit PCM, a source over it, a digest of packets
+ * and a plain encode to compare with.
+*/
+
+#ifndef WAT4FF_FIXTURE_H
+#define WAT4FF_FIXTURE_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+
+enum {
+    kFixtureFill = 16,                  // Packets per call of encode_plain()
+};
+
+// Interleaved signed 16-bit PCM, usable as a static initializer.
+#define PCM16_FORMAT(rate, channels) {                                                      \
+    .mSampleRate       = (rate),                                                            \
+    .mFormatID         = kAudioFormatLinearPCM,                                             \
+    .mFormatFlags      = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked,        \
+    .mBytesPerPacket   = (channels) * 2,                                                    \
+    .mFramesPerPacket  = 1,                                                                 \
+    .mBytesPerFrame    = (channels) * 2,                                                    \
+    .mChannelsPerFrame = (channels),                                                        \
+    .mBitsPerChannel   = 16,                                                                \
+}
+
+
+// Digest +++
+
+// Every packet's bytes and frame count, the way a muxer would see them.
+typedef struct Digest {
+    UInt64 hash;
+    UInt64 packets;
+    UInt64 bytes;
+}Digest;
+
+static inline UInt64
+fnv1a(UInt64 h, const void* data, size_t size) {
+    const UInt8* p = data;
+    for (size_t i = 0; i < size; ++i) h = (h ^ p[i]) * 0x100000001b3ull;
+    return h;
+}
+
+static inline Digest
+digest_new(void) {
+    return (Digest){ 0xcbf29ce484222325ull, 0, 0 };
+}
+
+static inline Digest
+digest_packets(Digest d, const UInt8* data, const AudioStreamPacketDescription* packets, UInt64 count) {
+    for (UInt64 i = 0; i < count; ++i) {
+        d.hash = fnv1a(d.hash, data + packets[i].mStartOffset, packets[i].mDataByteSize);
+        d.hash = fnv1a(d.hash, &packets[i].mVariableFramesInPacket, sizeof(UInt32));
+        d.bytes += packets[i].mDataByteSize;
+    }
+    d.packets += count;
+    return d;
+}
+
+static inline bool
+digest_same(const Digest* a, const Digest* b) {
+    return a->hash == b->hash && a->packets == b->packets && a->bytes == b->bytes;
+}
+
+// A Wat4ffPacketProc adding to the Digest at user.
+static inline void
+digest_emit(void* user, const UInt8* data, const AudioStreamPacketDescription* packets, UInt32 count) {
+    Digest* d = user;
+    *d = digest_packets(*d, data, packets, count);
+}
+
+// Digest ---
+
+
+// Source +++
+
+typedef struct PcmSource {
+    const SInt16* pcm;
+    UInt32 channels;
+    UInt64 frames;
+    UInt64 pos;
+}PcmSource;
+
+// An input proc handing out the PcmSource at user in place.
+static inline OSStatus
+pcm_source_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+                AudioStreamPacketDescription** descs, void* user) {
+    PcmSource* s = user;
+    UInt64 left = s->frames - s->pos;
+    if (*packets > left) *packets = (UInt32)left;
+    data->mBuffers[0].mData = (void*)(s->pcm + s->pos * s->channels);
+    data->mBuffers[0].mDataByteSize = *packets * s->channels * 2;
+    data->mBuffers[0].mNumberChannels = s->channels;
+    s->pos += *packets;
+    return noErr;
+}
+
+// Source ---
+
+
+// Plain encode +++
+
+// Everything proc gives, through one converter on this thread with props
+// set first, added to *d. False if the converter fails.
+static inline bool
+encode_plain(const AudioStreamBasicDescription* in, const AudioStreamBasicDescription* out,
+             const Wat4ffConverterProperty* props, UInt32 propCount,
+             AudioConverterComplexInputDataProc proc, void* user, Digest* d) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(in, out, &conv)) return false;
+    bool ok = true;
+    for (UInt32 i = 0; i < propCount && ok; ++i) {
+        ok = !AudioConverterSetProperty(conv, props[i].id, props[i].size, props[i].data);
+    }
+    UInt32 max_packet = 0;
+    UInt32 size = sizeof(max_packet);
+    ok = ok && !AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &max_packet);
+    UInt8* buf = ok ? malloc((size_t)max_packet * kFixtureFill) : NULL;
+    ok = buf != NULL;
+    while (ok) {
+        UInt32 n = kFixtureFill;
+        AudioStreamPacketDescription descs[kFixtureFill];
+        AudioBufferList list = { 1, { { out->mChannelsPerFrame, max_packet * kFixtureFill, buf } } };
+        ok = !AudioConverterFillComplexBuffer(conv, proc, user, &n, &list, descs);
+        if (!n) break;
+        *d = digest_packets(*d, buf, descs, n);
+    }
+    free(buf);
+    AudioConverterDispose(conv);
+    return ok;
+}
+
+// Plain encode ---
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Encodes the same PCM as one segment and as many segments in parallel,
+ * then decodes both and compares them around every seam. The stand-in
+ * codec's step follows WAT4FF_MOCK_HISTORY packets, so with that many
+ * overlap packets the bitstream must match the serial one and no seam may
+ * deviate by more than -40 dBFS. With one packet fewer every seam shows,
+ * and the check must go over the limit or it cannot tell. ADTS headers
+ * must frame every packet.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "fixture.h"
+
+
+enum {
+    kRate            = 44100,
+    kChannels        = 2,
+    kFramesPerPacket = 1024,            // Of the stand-in AAC
+    kSegmentFrames   = kFramesPerPacket * 64,
+    kFrames          = kSegmentFrames * 6 + 1000,
+    kWindow          = 4096,            // Frames either side of a seam
+    kLimit           = 328,             // -40 dBFS
+    kDefaultHistory  = 2,               // The stand-in's, see mock/
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+typedef struct Packets {
+    const Wat4ffEncodedStream* s;
+    UInt64 next;
+    AudioStreamPacketDescription desc;
+}Packets;
+
+static SInt16 pcm_[kFrames * kChannels];
+
+
+static OSStatus
+packet_proc(AudioConverterRef conv, UInt32* packets, AudioBufferList* data,
+            AudioStreamPacketDescription** descs, void* user) {
+    Packets* p = user;
+    if (p->next >= p->s->packetCount) {
+        *packets = 0;
+        return noErr;
+    }
+    p->desc = p->s->packets[p->next++];
+    data->mBuffers[0].mData = p->s->data + p->desc.mStartOffset;
+    data->mBuffers[0].mDataByteSize = p->desc.mDataByteSize;
+    p->desc.mStartOffset = 0;
+    if (descs) *descs = &p->desc;
+    *packets = 1;
+    return noErr;
+}
+
+// Decodes s into a new buffer of *frames frames, priming and padding removed.
+static SInt16*
+decode(const Wat4ffEncodedStream* s, UInt64* frames) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kAac, &kPcm, &conv)) return NULL;
+    if (s->magicCookieSize) {
+        AudioConverterSetProperty(conv, kAudioConverterDecompressionMagicCookie, s->magicCookieSize, s->magicCookie);
+    }
+
+    UInt64 cap = (s->packetCount + 1) * s->framesPerPacket;
+    SInt16* pcm = malloc(cap * kPcm.mBytesPerFrame);
+    Packets p = { s, 0 };
+    UInt64 got = 0;
+    while (pcm) {
+        UInt32 n = s->framesPerPacket;
+        if (got + n > cap) break;
+        AudioBufferList list = { 1, { { kChannels, n * kPcm.mBytesPerFrame, pcm + got * kChannels } } };
+        if (AudioConverterFillComplexBuffer(conv, packet_proc, &p, &n, &list, NULL) || !n) break;
+        got += n;
+    }
+    AudioConverterDispose(conv);
+    if (!pcm) return NULL;
+
+    UInt64 lead = s->prime.leadingFrames < got ? s->prime.leadingFrames : got;
+    got -= lead;
+    memmove(pcm, pcm + lead * kChannels, got * kPcm.mBytesPerFrame);
+    *frames = s->prime.trailingFrames < got ? got - s->prime.trailingFrames : 0;
+    return pcm;
+}
+
+static int
+max_diff(const SInt16* a, const SInt16* b, UInt64 from, UInt64 to) {
+    int worst = 0;
+    for (UInt64 i = from * kChannels; i < to * kChannels; ++i) {
+        int d = abs(a[i] - b[i]);
+        if (d > worst) worst = d;
+    }
+    return worst;
+}
+
+// Worst deviation from a around the seams of s, decoded. Seam i is where
+// packet i * kSegmentFrames / kFramesPerPacket starts.
+static int
+worst_seam(const SInt16* a, UInt64 n, const Wat4ffEncodedStream* s) {
+    UInt64 m;
+    SInt16* b = decode(s, &m);
+    if (!b || m != n) {
+        free(b);
+        return 32767;
+    }
+    int worst = 0;
+    for (UInt32 i = 1; i < s->segments; ++i) {
+        UInt64 seam = (UInt64)i * kSegmentFrames;
+        seam = seam > s->prime.leadingFrames ? seam - s->prime.leadingFrames : 0;
+        UInt64 from = seam > kWindow ? seam - kWindow : 0;
+        UInt64 to = seam + kWindow < n ? seam + kWindow : n;
+        int d = max_diff(a, b, from, to);
+        if (d > worst) worst = d;
+    }
+    free(b);
+    return worst;
+}
+
+static bool
+same_stream(const Wat4ffEncodedStream* a, const Wat4ffEncodedStream* b) {
+    return a->packetCount == b->packetCount && a->dataSize == b->dataSize
+        && !memcmp(a->data, b->data, a->dataSize);
+}
+
+static bool
+check_adts(const Wat4ffEncodedStream* s) {
+    for (UInt64 i = 0; i < s->packetCount; ++i) {
+        const UInt8* h = s->data + s->packets[i].mStartOffset;
+        UInt32 len = ((h[3] & 3) << 11) | (h[4] << 3) | (h[5] >> 5);
+        if (h[0] != 0xff || (h[1] & 0xf6) != 0xf0 || len != s->packets[i].mDataByteSize) return false;
+    }
+    return true;
+}
+
+int
+main(void) {
+    const char* val = getenv("WAT4FF_MOCK_HISTORY");
+    UInt32 history = val && atoi(val) > 0 ? (UInt32)atoi(val) : kDefaultHistory;
+    if (history < 2) {
+        fprintf(stderr, "one packet of history leaves no overlap short of it\n");
+        return 1;
+    }
+
+    // A sweep plus a little noise, nothing repeats at a segment boundary.
+    double phase = 0;
+    for (UInt32 i = 0; i < kFrames; ++i) {
+        phase += 2 * M_PI * (100 + 4000.0 * i / kFrames) / kRate;
+        SInt16 v = (SInt16)(12000 * sin(phase) + (rand() % 2001 - 1000));
+        pcm_[i * 2] = v;
+        pcm_[i * 2 + 1] = (SInt16)(v / 2);
+    }
+
+    Wat4ffParallelEncode job = {
+        .input = kPcm,
+        .output = kAac,
+        .threads = 1,
+        .segmentFrames = kFrames * 2,   // Room for the priming, one segment
+    };
+    Wat4ffEncodedStream serial;
+    if (wat4ff_encode_parallel(&job, pcm_, kFrames, &serial)) {
+        fprintf(stderr, "serial encode failed\n");
+        return 1;
+    }
+    UInt64 n;
+    SInt16* a = decode(&serial, &n);
+    if (!a) {
+        fprintf(stderr, "decode failed\n");
+        return 1;
+    }
+
+    // Enough overlap, then one packet short of it.
+    job.threads = 0;
+    job.segmentFrames = kSegmentFrames;
+    Wat4ffEncodedStream enough, shy;
+    job.overlapPackets = history;
+    OSStatus rc = wat4ff_encode_parallel(&job, pcm_, kFrames, &enough);
+    job.overlapPackets = history - 1;
+    if (rc || wat4ff_encode_parallel(&job, pcm_, kFrames, &shy)) {
+        fprintf(stderr, "parallel encode failed\n");
+        return 1;
+    }
+    int seam = worst_seam(a, n, &enough);
+    bool same = same_stream(&serial, &enough);
+    int control = worst_seam(a, n, &shy);
+
+    job.overlapPackets = history;
+    job.adts = true;
+    Wat4ffEncodedStream adts;
+    bool adts_ok = !wat4ff_encode_parallel(&job, pcm_, kFrames, &adts)
+                && adts.packetCount == serial.packetCount && check_adts(&adts);
+
+    printf("segments:     %u, %u packets of history\n", enough.segments, history);
+    printf("overlap %u:    bitstream %s, worst seam %d\n", history, same ? "identical" : "DIFFERS", seam);
+    printf("overlap %u:    worst seam %d, must be over %d\n", history - 1, control, kLimit);
+    printf("adts:         %s\n", adts_ok ? "ok" : "BAD");
+
+    bool ok = enough.segments > 1 && same && seam < kLimit && control >= kLimit && adts_ok;
+    wat4ff_free_encoded(&serial);
+    wat4ff_free_encoded(&enough);
+    wat4ff_free_encoded(&shy);
+    wat4ff_free_encoded(&adts);
+    free(a);
+    return ok ? 0 : 1;
+}
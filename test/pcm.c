@@ -0,0 +1,162 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Checks every SIMD level the CPU has against plain C, bit for bit, on
+ * random samples and on the awkward ones: out of range, halfway between
+ * integers, infinities and NaN. Converting, interleaving and
+ * deinterleaving 1 to 8 channels, between every pair of formats, from
+ * aligned buffers and from ones a sample off.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+
+enum {
+    kMaxChannels = 8,
+    kCheckFrames = 4099,              // Not a multiple of any vector width
+    kSamples     = kCheckFrames * kMaxChannels,
+};
+
+static const char* const kSimdNames[] = { "c", "sse2", "avx2", "neon" };
+static const char* const kFormatNames[] = { "s16", "s32", "f32" };
+
+typedef struct Set {
+    UInt8* src[kWat4ffSampleCount];   // Interleaved or one plane after another
+    UInt8* ref;
+    UInt8* out;
+}Set;
+
+
+static UInt32
+sample_size(UInt32 format) {
+    return format == kWat4ffSampleS16 ? 2 : 4;
+}
+
+static UInt32
+next_random(UInt32* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state;
+}
+
+// Fills n samples of each format, with the awkward values every so often.
+static void
+make_samples(void* s16, void* s32, void* f32, size_t n) {
+    static const float special[] = {
+        1.0f, -1.0f, 1.5f, -1.5f, 0.0f, -0.0f, 1e-40f, -1e-40f, 1e30f, -1e30f,
+        0.5f / 32768, 1.5f / 32768, 2.5f / 32768, -0.5f / 32768, -2.5f / 32768,
+        32767.5f / 32768, -32768.5f / 32768, 4194304.5f / 2147483648.0f, -8388607.5f / 2147483648.0f,
+    };
+    UInt32 state = 12345;
+    SInt16* a = s16;
+    SInt32* b = s32;
+    float* c = f32;
+    size_t nspecial = sizeof(special) / sizeof(special[0]);
+    for (size_t i = 0; i < n; ++i) {
+        UInt32 r = next_random(&state);
+        a[i] = (SInt16)(r >> 16);
+        b[i] = (SInt32)r;
+        if (i % 7 == 0) c[i] = special[(i / 7) % nspecial];
+        else c[i] = ((SInt32)r / 2147483648.0f) * 1.25f;
+    }
+    // inf, -inf and NaN, without libm.
+    UInt32 bits[] = { 0x7f800000u, 0xff800000u, 0x7fc00000u, 0xffc00001u };
+    for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]) && i * 11 + 3 < n; ++i) {
+        memcpy(&c[i * 11 + 3], &bits[i], 4);
+    }
+}
+
+// Every kernel at simd against plain C, with source and destination skip
+// samples into their buffers.
+static bool
+check_level(UInt32 simd, const Set* set, UInt32 skip) {
+    size_t n = (size_t)kSamples - skip * kMaxChannels;
+    size_t frames = kCheckFrames - skip;
+    bool ok = true;
+    for (UInt32 from = 0; from < kWat4ffSampleCount; ++from) {
+        const UInt8* src = set->src[from] + skip * sample_size(from);
+        for (UInt32 to = 0; to < kWat4ffSampleCount; ++to) {
+            UInt8* ref = set->ref + skip * sample_size(to);
+            UInt8* out = set->out + skip * sample_size(to);
+            size_t bytes = n * sample_size(to);
+            wat4ff_pcm_use_simd(kWat4ffSimdNone);
+            wat4ff_pcm_convert(ref, to, src, from, n);
+            wat4ff_pcm_use_simd(simd);
+            memset(out, 0xAA, bytes);
+            wat4ff_pcm_convert(out, to, src, from, n);
+            if (memcmp(ref, out, bytes)) {
+                printf("  %s: convert %s to %s DIFFERS\n", kSimdNames[simd], kFormatNames[from], kFormatNames[to]);
+                ok = false;
+            }
+
+            for (UInt32 ch = 1; ch <= kMaxChannels; ++ch) {
+                const void* in[kMaxChannels];
+                void* refs[kMaxChannels];
+                void* outs[kMaxChannels];
+                for (UInt32 c = 0; c < ch; ++c) {
+                    in[c] = src + c * frames * sample_size(from);
+                    refs[c] = ref + c * frames * sample_size(to);
+                    outs[c] = out + c * frames * sample_size(to);
+                }
+                bytes = frames * ch * sample_size(to);
+
+                wat4ff_pcm_use_simd(kWat4ffSimdNone);
+                wat4ff_pcm_interleave(ref, to, in, from, ch, (UInt32)frames);
+                wat4ff_pcm_use_simd(simd);
+                memset(out, 0xAA, bytes);
+                wat4ff_pcm_interleave(out, to, in, from, ch, (UInt32)frames);
+                if (memcmp(ref, out, bytes)) {
+                    printf("  %s: interleave %u channels %s to %s DIFFERS\n",
+                           kSimdNames[simd], ch, kFormatNames[from], kFormatNames[to]);
+                    ok = false;
+                }
+
+                wat4ff_pcm_use_simd(kWat4ffSimdNone);
+                wat4ff_pcm_deinterleave(refs, to, src, from, ch, (UInt32)frames);
+                wat4ff_pcm_use_simd(simd);
+                memset(out, 0xAA, bytes);
+                wat4ff_pcm_deinterleave(outs, to, src, from, ch, (UInt32)frames);
+                if (memcmp(ref, out, bytes)) {
+                    printf("  %s: deinterleave %u channels %s to %s DIFFERS\n",
+                           kSimdNames[simd], ch, kFormatNames[from], kFormatNames[to]);
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+int
+main(void) {
+    Set set;
+    bool ok = true;
+    for (UInt32 f = 0; f < kWat4ffSampleCount; ++f) ok = (set.src[f] = malloc(kSamples * 4)) && ok;
+    ok = (set.ref = malloc(kSamples * 4)) && ok;
+    ok = (set.out = malloc(kSamples * 4)) && ok;
+    if (!ok) return 1;
+    make_samples(set.src[0], set.src[1], set.src[2], kSamples);
+
+    UInt32 best = wat4ff_pcm_simd();
+    UInt32 checked = 0;
+    for (UInt32 simd = kWat4ffSimdSSE2; simd <= kWat4ffSimdNEON; ++simd) {
+        if (wat4ff_pcm_use_simd(simd) != simd) continue;
+        bool same = check_level(simd, &set, 0) && check_level(simd, &set, 1);
+        printf("%-5s bit exact against c: %s\n", kSimdNames[simd], same ? "yes" : "NO");
+        ok = ok && same;
+        ++checked;
+    }
+    wat4ff_pcm_use_simd(best);
+    if (!checked) printf("no SIMD level on this CPU\n");
+
+    for (UInt32 f = 0; f < kWat4ffSampleCount; ++f) free(set.src[f]);
+    free(set.ref);
+    free(set.out);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * A converter taken from the pool that still carries its last owner's bit
+ * rate, which the new owner never set. Whatever the new owner asks before
+ * the first conversion must be answered as by a converter of its own: the
+ * maximum packet size, the magic cookie, the bit rate and the output
+ * format, through both getters.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "fixture.h"
+
+
+enum {
+    kRate       = 44100,
+    kChannels   = 2,
+    kCookieSize = 64,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = kChannels,
+};
+
+static const UInt32 kQuality = 0x7F;        // kAudioConverterQuality_Max
+static const UInt32 kOldBitRate = 64000;
+
+typedef struct Answers {
+    UInt32 maxPacket;
+    UInt32 bitRate;
+    UInt32 cookieInfo;
+    UInt32 cookieSize;
+    UInt8 cookie[kCookieSize];
+    AudioStreamBasicDescription output;
+}Answers;
+
+
+static bool
+ask(AudioConverterRef conv, Answers* a) {
+    memset(a, 0, sizeof(*a));
+    UInt32 size = sizeof(a->maxPacket);
+    bool ok = !AudioConverterGetProperty(conv, kAudioConverterPropertyMaximumOutputPacketSize, &size, &a->maxPacket);
+    size = sizeof(a->bitRate);
+    ok = ok && !AudioConverterGetProperty(conv, kAudioConverterEncodeBitRate, &size, &a->bitRate);
+    ok = ok && !AudioConverterGetPropertyInfo(conv, kAudioConverterCompressionMagicCookie, &a->cookieInfo, NULL);
+    a->cookieSize = kCookieSize;
+    ok = ok && !AudioConverterGetProperty(conv, kAudioConverterCompressionMagicCookie, &a->cookieSize, a->cookie);
+    size = sizeof(a->output);
+    ok = ok && !AudioConverterGetProperty(conv, kAudioConverterCurrentOutputStreamDescription, &size, &a->output);
+    return ok;
+}
+
+// A new converter with only the quality set, asked before converting.
+static bool
+ask_new(Answers* a) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kPcm, &kAac, &conv)) return false;
+    bool ok = !AudioConverterSetProperty(conv, kAudioConverterCodecQuality, sizeof(kQuality), &kQuality)
+           && ask(conv, a);
+    AudioConverterDispose(conv);
+    return ok;
+}
+
+static void
+print(const char* name, const Answers* a) {
+    printf("%-13s %u max packet, %u bps, %u byte cookie\n", name, a->maxPacket, a->bitRate, a->cookieSize);
+}
+
+int
+main(void) {
+    Answers own, pooled;
+    if (!ask_new(&own)) {
+        fprintf(stderr, "unpooled converter failed\n");
+        return 1;
+    }
+    print("own:", &own);
+
+    // Parks a converter with the quality, then a bit rate, applied.
+    wat4ff_pool_configure(4, 0);
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kPcm, &kAac, &conv)
+        || AudioConverterSetProperty(conv, kAudioConverterCodecQuality, sizeof(kQuality), &kQuality)
+        || AudioConverterSetProperty(conv, kAudioConverterEncodeBitRate, sizeof(kOldBitRate), &kOldBitRate)) {
+        fprintf(stderr, "first converter failed\n");
+        return 1;
+    }
+    AudioConverterDispose(conv);
+
+    bool ok = ask_new(&pooled);
+    Wat4ffPoolStats stats;
+    wat4ff_get_pool_stats(&stats);
+    wat4ff_pool_configure(0, 0);
+    if (!ok) {
+        fprintf(stderr, "pooled converter failed\n");
+        return 1;
+    }
+    print("pooled:", &pooled);
+    printf("pool:         %llu hits, %llu stale\n", (unsigned long long)stats.hits, (unsigned long long)stats.stale);
+    ok = stats.hits == 1 && stats.stale == 1 && own.bitRate != kOldBitRate
+      && !memcmp(&own, &pooled, sizeof(own));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,176 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * The AudioQueue ring with every kind of producer at once: three threads
+ * enqueueing buffers of their own, and the output callback re-enqueueing
+ * a set of its own. Each buffer is stamped with its producer and a
+ * sequence number, and a sink that keeps the stamps checks that every
+ * producer's buffers played once each, in the order enqueued.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate       = 48000,
+    kChannels   = 2,
+    kBytes      = 256,
+    kThreads    = 3,
+    kProducers  = kThreads + 1,         // The last is the callback
+    kPerSet     = 4,                    // Buffers per producer
+    kEach       = 2000,                 // Buffers enqueued per producer
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, kChannels);
+
+typedef struct Stamp {
+    UInt32 producer;
+    UInt32 seq;
+}Stamp;
+
+typedef struct Producer {
+    BenchThread thread;
+    AudioQueueRef queue;
+    AudioQueueBufferRef buffers[kPerSet];
+    volatile int free[kPerSet];         // Back from the queue
+    UInt32 id;
+    UInt32 next;                        // Sequence number
+    bool ok;
+}Producer;
+
+// Written on the render thread only, read once the queue is disposed.
+static Stamp played_[kProducers * kEach];
+static UInt32 played_count_;
+static Producer producers_[kProducers];
+static volatile int callback_done_;
+
+
+static OSStatus
+sink_open(void* user, const AudioStreamBasicDescription* format, void** stream) {
+    *stream = user;
+    return noErr;
+}
+
+static OSStatus
+sink_write(void* stream, const void* data, UInt32 bytes) {
+    if (bytes != kBytes || played_count_ == kProducers * kEach) return kAudioQueueErr_InvalidBuffer;
+    memcpy(&played_[played_count_++], data, sizeof(Stamp));
+    return noErr;
+}
+
+static void
+sink_close(void* stream, bool drain) {
+}
+
+static const Wat4ffSink kSink = { "test", "wat4ff test sink", NULL, sink_open, sink_write, sink_close };
+
+static bool
+enqueue(Producer* p, AudioQueueBufferRef b) {
+    Stamp s = { p->id, p->next++ };
+    memset(b->mAudioData, (int)s.seq, kBytes);
+    memcpy(b->mAudioData, &s, sizeof(s));
+    b->mAudioDataByteSize = kBytes;
+    return AudioQueueEnqueueBuffer(p->queue, b, 0, NULL) == noErr;
+}
+
+static int
+index_of(const Producer* p, AudioQueueBufferRef b) {
+    for (int i = 0; i < kPerSet; ++i) {
+        if (p->buffers[i] == b) return i;
+    }
+    return -1;
+}
+
+static void
+output_proc(void* user, AudioQueueRef q, AudioQueueBufferRef b) {
+    Producer* cb = &producers_[kThreads];
+    int i = index_of(cb, b);
+    if (i >= 0) {
+        if (cb->next < kEach && !enqueue(cb, b)) cb->ok = false;
+        if (cb->next == kEach) __atomic_store_n(&callback_done_, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    for (UInt32 t = 0; t < kThreads; ++t) {
+        i = index_of(&producers_[t], b);
+        if (i >= 0) __atomic_store_n(&producers_[t].free[i], 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void
+producer_main(void* param) {
+    Producer* p = param;
+    for (int i = 0; p->ok && p->next < kEach; i = (i + 1) % kPerSet) {
+        while (!__atomic_load_n(&p->free[i], __ATOMIC_ACQUIRE)) bench_sleep_ms(0);
+        __atomic_store_n(&p->free[i], 0, __ATOMIC_RELAXED);
+        p->ok = enqueue(p, p->buffers[i]);
+    }
+}
+
+int
+main(void) {
+    if (wat4ff_sink_register(&kSink) || wat4ff_sink_set_default("test")) {
+        fprintf(stderr, "cannot register the test sink\n");
+        return 1;
+    }
+    AudioQueueRef q;
+    if (AudioQueueNewOutput(&kPcm, output_proc, NULL, NULL, kCFRunLoopCommonModes, 0, &q)) {
+        fprintf(stderr, "cannot open a queue\n");
+        return 1;
+    }
+    bool ok = true;
+    for (UInt32 t = 0; t < kProducers; ++t) {
+        Producer* p = &producers_[t];
+        *p = (Producer){ .queue = q, .id = t, .ok = true };
+        for (int i = 0; i < kPerSet && ok; ++i) {
+            ok = !AudioQueueAllocateBuffer(q, kBytes, &p->buffers[i]);
+            p->free[i] = 1;
+        }
+    }
+    // The callback's set keeps itself going once primed, before the render
+    // thread can call back.
+    Producer* cb = &producers_[kThreads];
+    for (int i = 0; i < kPerSet && ok; ++i) ok = enqueue(cb, cb->buffers[i]);
+    ok = ok && !AudioQueueStart(q, NULL);
+    UInt32 started = 0;
+    for (; ok && started < kThreads; ++started) {
+        ok = bench_thread_start(&producers_[started].thread, producer_main, &producers_[started]);
+    }
+    for (UInt32 t = 0; t < started; ++t) bench_thread_join(&producers_[t].thread);
+    for (UInt32 t = 0; t < started; ++t) ok = ok && producers_[t].ok;
+
+    // Flush only waits for what is enqueued when called, so first let the
+    // callback's set run out.
+    for (int spins = 0; ok && !__atomic_load_n(&callback_done_, __ATOMIC_ACQUIRE) && spins < 10000; ++spins) {
+        bench_sleep_ms(1);
+    }
+    ok = ok && !AudioQueueFlush(q);
+    AudioQueueDispose(q, false);
+    ok = ok && cb->ok;
+    if (!ok) {
+        fprintf(stderr, "queue failed\n");
+        return 1;
+    }
+
+    UInt32 seen[kProducers] = { 0 };
+    for (UInt32 i = 0; i < played_count_ && ok; ++i) {
+        const Stamp* s = &played_[i];
+        ok = s->producer < kProducers && s->seq == seen[s->producer];
+        if (!ok) fprintf(stderr, "buffer %u: producer %u, seq %u out of order\n", i, s->producer, s->seq);
+        else ++seen[s->producer];
+    }
+    for (UInt32 t = 0; t < kProducers; ++t) {
+        printf("producer %u: %u of %u played in order\n", t, seen[t], (UInt32)kEach);
+        ok = ok && seen[t] == kEach;
+    }
+    return ok ? 0 : 1;
+}
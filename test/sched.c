@@ -0,0 +1,106 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Four streams on a scheduler of three workers, two live and two bulk,
+ * with turns of one to three packets. The input is pushed in small chunks,
+ * and one stream is removed halfway through. The others must come out byte
+ * for byte as a plain encode of the same PCM, and the removed one must emit
+ * nothing after wat4ff_sched_remove() returns.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "fixture.h"
+
+
+enum {
+    kRate      = 24000,
+    kFrames    = kRate * 10,
+    kChunk     = 1000,
+    kStreams   = 4,
+    kRemoved   = 3,
+    kWorkers   = 3,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, 1);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = 1,
+};
+
+static SInt16 pcm_[kFrames];
+
+
+int
+main(void) {
+    for (UInt32 i = 0; i < kFrames; ++i) pcm_[i] = (SInt16)(i * 7919);
+
+    Digest plain = digest_new();
+    PcmSource src = { pcm_, 1, kFrames, 0 };
+    if (!encode_plain(&kPcm, &kAac, NULL, 0, pcm_source_proc, &src, &plain) || !plain.packets) {
+        fprintf(stderr, "plain encode failed\n");
+        return 1;
+    }
+
+    Wat4ffScheduler* sched;
+    if (wat4ff_sched_open(kWorkers, &sched)) {
+        fprintf(stderr, "cannot open the scheduler\n");
+        return 1;
+    }
+    Digest digests[kStreams];
+    Wat4ffSchedStream* streams[kStreams] = { NULL };
+    bool ok = true;
+    for (UInt32 i = 0; i < kStreams && ok; ++i) {
+        digests[i] = digest_new();
+        Wat4ffSchedStreamConfig cfg = {
+            .input = kPcm, .output = kAac, .queueFrames = 8192, .quantumPackets = i % 3 + 1,
+            .deadlineMillis = i < 2 ? 20 : 0, .emit = digest_emit, .emitUser = &digests[i],
+        };
+        ok = !wat4ff_sched_add(sched, &cfg, &streams[i]);
+    }
+
+    Digest removed = { 0 };
+    for (UInt32 pos = 0; ok && pos < kFrames; pos += kChunk) {
+        UInt32 n = kFrames - pos < kChunk ? kFrames - pos : kChunk;
+        for (UInt32 i = 0; i < kStreams && ok; ++i) {
+            if (streams[i]) ok = !wat4ff_sched_push(streams[i], true, pcm_ + pos, n);
+        }
+        if (pos >= kFrames / 2 && streams[kRemoved]) {
+            wat4ff_sched_remove(streams[kRemoved]);
+            streams[kRemoved] = NULL;
+            removed = digests[kRemoved];
+        }
+    }
+    for (UInt32 i = 0; i < kStreams && ok; ++i) {
+        if (streams[i]) ok = !wat4ff_sched_push(streams[i], true, NULL, 0) && !wat4ff_sched_wait(streams[i]);
+    }
+    for (UInt32 i = 0; i < kStreams; ++i) {
+        if (streams[i]) wat4ff_sched_remove(streams[i]);
+    }
+    wat4ff_sched_close(sched);
+    if (!ok) {
+        fprintf(stderr, "scheduled encode failed\n");
+        return 1;
+    }
+
+    printf("plain:     %llu packets, %llu bytes\n", (unsigned long long)plain.packets, (unsigned long long)plain.bytes);
+    for (UInt32 i = 0; i < kStreams; ++i) {
+        const Digest* d = &digests[i];
+        bool same = i == kRemoved
+            ? digest_same(d, &removed) && d->packets < plain.packets
+            : digest_same(d, &plain);
+        printf("stream %u:  %llu packets, %llu bytes, %s\n", i, (unsigned long long)d->packets,
+               (unsigned long long)d->bytes, same ? "ok" : "DIFFERS");
+        ok = ok && same;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/*
+ * This file is part of wat4ff.
+ * 2024 github.com/chrdev
+ * Zero-Clause BSD
+ *
+ * Idle unload raced by calls, as bench/unload.c does it, for a couple of
+ * seconds. Four threads encode in short bursts, some holding a converter
+ * across a pause longer than the 5 ms idle period, with the pool on, and
+ * every other half cycle goes quiet but for the odd call. Every burst must
+ * encode as the first did, the library must stay loaded while a converter
+ * that has converted is alive, and it must have gone once all are idle.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <wat4ff.h>
+
+#include "bench.h"
+#include "fixture.h"
+
+
+enum {
+    kRate      = 8000,
+    kFrames    = 4096,
+    kThreads   = 4,
+    kIdleMs    = 5,
+    kCycleMs   = kIdleMs * 8,
+    kMillis    = 2000,
+};
+
+static const AudioStreamBasicDescription kPcm = PCM16_FORMAT(kRate, 1);
+
+static const AudioStreamBasicDescription kAac = {
+    .mSampleRate       = kRate,
+    .mFormatID         = kAudioFormatMPEG4AAC,
+    .mChannelsPerFrame = 1,
+};
+
+typedef struct Worker {
+    BenchThread thread;
+    UInt32 seed;
+    UInt64 expect;
+    UInt64 bursts;
+    UInt64 failures;
+}Worker;
+
+static SInt16 pcm_[kFrames];
+
+
+// Hash of the whole stream, 0 on failure.
+static UInt64
+encode(AudioConverterRef conv) {
+    UInt8 buf[8192];
+    AudioStreamPacketDescription descs[16];
+    PcmSource src = { pcm_, 1, kFrames, 0 };
+    Digest d = digest_new();
+    for (;;) {
+        UInt32 n = 16;
+        AudioBufferList list = { 1, { { 1, sizeof(buf), buf } } };
+        if (AudioConverterFillComplexBuffer(conv, pcm_source_proc, &src, &n, &list, descs)) return 0;
+        if (!n) break;
+        d = digest_packets(d, buf, descs, n);
+    }
+    return d.hash;
+}
+
+static UInt64
+burst(void) {
+    AudioConverterRef conv;
+    if (AudioConverterNew(&kPcm, &kAac, &conv)) return 0;
+    UInt64 h = encode(conv);
+    AudioConverterDispose(conv);
+    return h;
+}
+
+static UInt32
+next_random(UInt32* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static bool
+loaded(void) {
+    Wat4ffLifetimeStats stats;
+    wat4ff_get_lifetime_stats(&stats);
+    return stats.loaded;
+}
+
+static void
+worker_main(void* param) {
+    Worker* w = param;
+    int64_t until = bench_now_ns() + (int64_t)kMillis * 1000000;
+    while (bench_now_ns() < until) {
+        UInt32 r = next_random(&w->seed);
+        UInt32 at = (UInt32)(bench_now_ns() / 1000000 % kCycleMs);
+        if (at >= kCycleMs / 2) {
+            // Quiet half, the odd call lands wherever the reaper happens to be.
+            UInt32 end = kCycleMs - at;
+            UInt32 wake = r & 3 ? end : r % (kCycleMs / 2 + 1);
+            bench_sleep_ms(wake < end ? wake : end);
+            if (wake >= end) continue;
+        }
+        else {
+            bench_sleep_ms(r % (kIdleMs + 1));
+        }
+
+        if (r & 16) {
+            if (burst() != w->expect) ++w->failures;
+        }
+        else {
+            AudioConverterRef conv;
+            if (AudioConverterNew(&kPcm, &kAac, &conv)) {
+                ++w->failures;
+                continue;
+            }
+            if (encode(conv) != w->expect) ++w->failures;
+            bench_sleep_ms(kIdleMs * 2);
+            if (!loaded()) ++w->failures;
+            if (AudioConverterReset(conv) || encode(conv) != w->expect) ++w->failures;
+            AudioConverterDispose(conv);
+        }
+        ++w->bursts;
+    }
+}
+
+int
+main(void) {
+    for (UInt32 i = 0; i < kFrames; ++i) pcm_[i] = (SInt16)((i * 2654435761u) >> 16);
+
+    if (wat4ff_unload_configure(kIdleMs)) {
+        fprintf(stderr, "unload_configure failed\n");
+        return 1;
+    }
+    wat4ff_pool_configure(16, 0);
+    UInt64 expect = burst();
+    if (!expect) {
+        fprintf(stderr, "encode failed\n");
+        return 1;
+    }
+
+    Worker w[kThreads];
+    for (UInt32 i = 0; i < kThreads; ++i) {
+        w[i] = (Worker){ .seed = 7919 * (i + 1), .expect = expect };
+        bench_thread_start(&w[i].thread, worker_main, &w[i]);
+    }
+    UInt64 bursts = 0, failures = 0;
+    for (UInt32 i = 0; i < kThreads; ++i) {
+        bench_thread_join(&w[i].thread);
+        bursts += w[i].bursts;
+        failures += w[i].failures;
+    }
+
+    int64_t t0 = bench_now_ns();
+    while (loaded() && bench_now_ns() - t0 < (int64_t)kIdleMs * 200 * 1000000) bench_sleep_ms(1);
+    bool gone = !loaded();
+    Wat4ffLifetimeStats stats;
+    wat4ff_get_lifetime_stats(&stats);
+
+    printf("bursts:       %llu, %llu failed\n", (unsigned long long)bursts, (unsigned long long)failures);
+    printf("lifetime:     %llu loads, %llu unloads, %s when idle\n",
+           (unsigned long long)stats.loads, (unsigned long long)stats.unloads, gone ? "unloaded" : "STILL LOADED");
+    return !failures && gone && stats.unloads > 0 ? 0 : 1;
+}